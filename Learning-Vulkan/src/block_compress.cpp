@@ -0,0 +1,524 @@
+#include "block_compress.hpp"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+static const uint32_t BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+/*
+ * Principal axis of n-channel texels by power iteration on the covariance
+ * matrix, seeded with the bounding box diagonal. Returns false for a
+ * block of one color.
+ */
+template<uint32_t N>
+static bool principal_axis(const float texels[16][4], float mean[4], float axis[4])
+{
+	float lo[4], hi[4];
+	for (uint32_t c=0u; c<N; ++c) {
+		mean[c] = 0.0f;
+		lo[c] = hi[c] = texels[0][c];
+	}
+	for (uint32_t i=0u; i<16u; ++i) {
+		for (uint32_t c=0u; c<N; ++c) {
+			mean[c] += texels[i][c] / 16.0f;
+			lo[c] = std::min(lo[c], texels[i][c]);
+			hi[c] = std::max(hi[c], texels[i][c]);
+		}
+	}
+
+	float cov[N][N] = {};
+	for (uint32_t i=0u; i<16u; ++i) {
+		for (uint32_t a=0u; a<N; ++a) {
+			for (uint32_t b=0u; b<N; ++b) {
+				cov[a][b] += (texels[i][a] - mean[a]) * (texels[i][b] - mean[b]);
+			}
+		}
+	}
+
+	float len_sq = 0.0f;
+	for (uint32_t c=0u; c<N; ++c) {
+		axis[c] = hi[c] - lo[c];
+		len_sq += axis[c] * axis[c];
+	}
+	if (len_sq == 0.0f) {
+		return false;
+	}
+
+	for (uint32_t iter=0u; iter<8u; ++iter) {
+		float next[N] = {};
+		for (uint32_t a=0u; a<N; ++a) {
+			for (uint32_t b=0u; b<N; ++b) {
+				next[a] += cov[a][b] * axis[b];
+			}
+		}
+		len_sq = 0.0f;
+		for (uint32_t c=0u; c<N; ++c) {
+			len_sq += next[c] * next[c];
+		}
+		if (len_sq == 0.0f) {
+			break;
+		}
+		const float inv = 1.0f / sqrtf(len_sq);
+		for (uint32_t c=0u; c<N; ++c) {
+			axis[c] = next[c] * inv;
+		}
+	}
+
+	len_sq = 0.0f;
+	for (uint32_t c=0u; c<N; ++c) {
+		len_sq += axis[c] * axis[c];
+	}
+	const float inv = 1.0f / sqrtf(len_sq);
+	for (uint32_t c=0u; c<N; ++c) {
+		axis[c] *= inv;
+	}
+	return true;
+}
+
+/* Endpoints at the texels' extremes along the axis */
+template<uint32_t N>
+static void fit_endpoints(const float texels[16][4], const float mean[4], const float axis[4], float e0[4], float e1[4])
+{
+	float t_min = INFINITY, t_max = -INFINITY;
+	for (uint32_t i=0u; i<16u; ++i) {
+		float t = 0.0f;
+		for (uint32_t c=0u; c<N; ++c) {
+			t += (texels[i][c] - mean[c]) * axis[c];
+		}
+		t_min = std::min(t_min, t);
+		t_max = std::max(t_max, t);
+	}
+	for (uint32_t c=0u; c<N; ++c) {
+		e0[c] = std::clamp(mean[c] + axis[c] * t_min, 0.0f, 255.0f);
+		e1[c] = std::clamp(mean[c] + axis[c] * t_max, 0.0f, 255.0f);
+	}
+}
+
+/*
+ * Least squares endpoints for fixed interpolation weights, weights[i] is
+ * how much of e1 texel i gets. False when the weights are degenerate.
+ */
+template<uint32_t N>
+static bool refit_endpoints(const float texels[16][4], const float weights[16], float e0[4], float e1[4])
+{
+	float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+	float ax[4] = {}, bx[4] = {};
+	for (uint32_t i=0u; i<16u; ++i) {
+		const float b = weights[i], a = 1.0f - b;
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+		for (uint32_t c=0u; c<N; ++c) {
+			ax[c] += a * texels[i][c];
+			bx[c] += b * texels[i][c];
+		}
+	}
+
+	const float det = aa * bb - ab * ab;
+	if (fabsf(det) < 1e-6f) {
+		return false;
+	}
+	const float inv = 1.0f / det;
+	for (uint32_t c=0u; c<N; ++c) {
+		e0[c] = std::clamp((ax[c] * bb - bx[c] * ab) * inv, 0.0f, 255.0f);
+		e1[c] = std::clamp((bx[c] * aa - ax[c] * ab) * inv, 0.0f, 255.0f);
+	}
+	return true;
+}
+
+static void load_texels(const uint8_t in[64], float texels[16][4])
+{
+	for (uint32_t i=0u; i<16u; ++i) {
+		for (uint32_t c=0u; c<4u; ++c) {
+			texels[i][c] = in[i * 4 + c];
+		}
+	}
+}
+
+/* BC1 */
+
+static uint16_t pack_565(const float c[4])
+{
+	const uint32_t r = (uint32_t)(c[0] * 31.0f / 255.0f + 0.5f);
+	const uint32_t g = (uint32_t)(c[1] * 63.0f / 255.0f + 0.5f);
+	const uint32_t b = (uint32_t)(c[2] * 31.0f / 255.0f + 0.5f);
+	return (uint16_t)(r << 11 | g << 5 | b);
+}
+
+static void unpack_565(uint16_t v, int32_t c[3])
+{
+	const int32_t r = v >> 11, g = (v >> 5) & 63, b = v & 31;
+	c[0] = r << 3 | r >> 2;
+	c[1] = g << 2 | g >> 4;
+	c[2] = b << 3 | b >> 2;
+}
+
+/* The four colors of a block with c0 > c1 */
+static void bc1_palette(uint16_t c0, uint16_t c1, int32_t palette[4][3])
+{
+	unpack_565(c0, palette[0]);
+	unpack_565(c1, palette[1]);
+	for (uint32_t c=0u; c<3u; ++c) {
+		palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+		palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+	}
+}
+
+/* Picks the nearest palette entry per texel, returns the squared error */
+static uint32_t bc1_indices(const float texels[16][4], uint16_t c0, uint16_t c1, uint32_t &indices)
+{
+	indices = 0;
+	if (c0 == c1) {
+		/* Three color mode, index 0 is still c0 */
+		int32_t c[3];
+		unpack_565(c0, c);
+		uint32_t error = 0;
+		for (uint32_t i=0u; i<16u; ++i) {
+			for (uint32_t k=0u; k<3u; ++k) {
+				const int32_t d = (int32_t)texels[i][k] - c[k];
+				error += d * d;
+			}
+		}
+		return error;
+	}
+
+	int32_t palette[4][3];
+	bc1_palette(c0, c1, palette);
+	uint32_t error = 0;
+	for (uint32_t i=0u; i<16u; ++i) {
+		uint32_t best = UINT32_MAX, best_ix = 0;
+		for (uint32_t p=0u; p<4u; ++p) {
+			uint32_t e = 0;
+			for (uint32_t k=0u; k<3u; ++k) {
+				const int32_t d = (int32_t)texels[i][k] - palette[p][k];
+				e += d * d;
+			}
+			if (e < best) {
+				best = e;
+				best_ix = p;
+			}
+		}
+		indices |= best_ix << (i * 2);
+		error += best;
+	}
+	return error;
+}
+
+void encode_bc1(const uint8_t in[64], uint8_t out[8])
+{
+	float texels[16][4];
+	load_texels(in, texels);
+
+	float mean[4], axis[4], e0[4], e1[4];
+	uint16_t c0, c1;
+	if (principal_axis<3>(texels, mean, axis)) {
+		fit_endpoints<3>(texels, mean, axis, e1, e0);
+		c0 = pack_565(e0);
+		c1 = pack_565(e1);
+	} else {
+		c0 = c1 = pack_565(texels[0]);
+	}
+	if (c0 < c1) {
+		std::swap(c0, c1);
+	}
+
+	uint32_t indices;
+	uint32_t error = bc1_indices(texels, c0, c1, indices);
+
+	/* Palette entries 0..3 put 0, 1, 1/3 and 2/3 of the way towards c1 */
+	static const float WEIGHTS[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+	for (uint32_t iter=0u; iter<2u && error && c0 != c1; ++iter) {
+		float weights[16];
+		for (uint32_t i=0u; i<16u; ++i) {
+			weights[i] = WEIGHTS[(indices >> (i * 2)) & 3];
+		}
+		if (!refit_endpoints<3>(texels, weights, e0, e1)) {
+			break;
+		}
+		uint16_t r0 = pack_565(e0), r1 = pack_565(e1);
+		if (r0 < r1) {
+			std::swap(r0, r1);
+		}
+		uint32_t refit_indices;
+		const uint32_t refit_error = bc1_indices(texels, r0, r1, refit_indices);
+		if (refit_error >= error) {
+			break;
+		}
+		c0 = r0;
+		c1 = r1;
+		indices = refit_indices;
+		error = refit_error;
+	}
+
+	memcpy(out, &c0, 2);
+	memcpy(out + 2, &c1, 2);
+	memcpy(out + 4, &indices, 4);
+}
+
+void decode_bc1(const uint8_t in[8], uint8_t texels[64])
+{
+	uint16_t c0, c1;
+	uint32_t indices;
+	memcpy(&c0, in, 2);
+	memcpy(&c1, in + 2, 2);
+	memcpy(&indices, in + 4, 4);
+
+	int32_t palette[4][3];
+	bc1_palette(c0, c1, palette);
+	if (c0 <= c1) {
+		for (uint32_t c=0u; c<3u; ++c) {
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+			palette[3][c] = 0;
+		}
+	}
+	for (uint32_t i=0u; i<16u; ++i) {
+		const uint32_t ix = (indices >> (i * 2)) & 3;
+		for (uint32_t c=0u; c<3u; ++c) {
+			texels[i * 4 + c] = (uint8_t)palette[ix][c];
+		}
+		texels[i * 4 + 3] = c0 <= c1 && ix == 3 ? 0 : 255;
+	}
+}
+
+/* BC4, one channel, the halves of BC5 */
+
+static void encode_bc4(const uint8_t in[64], uint32_t channel, uint8_t out[8])
+{
+	uint8_t lo = 255, hi = 0;
+	for (uint32_t i=0u; i<16u; ++i) {
+		lo = std::min(lo, in[i * 4 + channel]);
+		hi = std::max(hi, in[i * 4 + channel]);
+	}
+
+	/* hi > lo selects the eight value mode, codes 0 and 1 are the endpoints and 2..7 step from hi to lo */
+	uint64_t bits = 0;
+	if (hi > lo) {
+		const float scale = 7.0f / (float)(hi - lo);
+		for (uint32_t i=0u; i<16u; ++i) {
+			const uint32_t step = (uint32_t)((hi - in[i * 4 + channel]) * scale + 0.5f);
+			const uint64_t code = step == 0 ? 0 : step == 7 ? 1 : step + 1;
+			bits |= code << (i * 3);
+		}
+	}
+
+	out[0] = hi;
+	out[1] = lo;
+	for (uint32_t b=0u; b<6u; ++b) {
+		out[2 + b] = (uint8_t)(bits >> (b * 8));
+	}
+}
+
+static void decode_bc4(const uint8_t in[8], uint32_t channel, uint8_t texels[64])
+{
+	const int32_t e0 = in[0], e1 = in[1];
+	int32_t palette[8] = { e0, e1 };
+	for (int32_t k=2; k<8; ++k) {
+		palette[k] = e0 > e1
+			? ((8 - k) * e0 + (k - 1) * e1) / 7
+			: k < 6 ? ((6 - k) * e0 + (k - 1) * e1) / 5 : k == 6 ? 0 : 255;
+	}
+
+	uint64_t bits = 0;
+	for (uint32_t b=0u; b<6u; ++b) {
+		bits |= (uint64_t)in[2 + b] << (b * 8);
+	}
+	for (uint32_t i=0u; i<16u; ++i) {
+		texels[i * 4 + channel] = (uint8_t)palette[(bits >> (i * 3)) & 7];
+	}
+}
+
+void encode_bc5(const uint8_t in[64], uint8_t out[16])
+{
+	encode_bc4(in, 0, out);
+	encode_bc4(in, 1, out + 8);
+}
+
+void decode_bc5(const uint8_t in[16], uint8_t texels[64])
+{
+	decode_bc4(in, 0, texels);
+	decode_bc4(in + 8, 1, texels);
+	for (uint32_t i=0u; i<16u; ++i) {
+		texels[i * 4 + 2] = 0;
+		texels[i * 4 + 3] = 255;
+	}
+}
+
+/* BC7 mode 6 */
+
+struct bc7_candidate
+{
+	/* 7 bit endpoints and their p-bits */
+	uint8_t q0[4];
+	uint8_t q1[4];
+	uint32_t p0;
+	uint32_t p1;
+	uint8_t indices[16];
+	uint32_t error;
+};
+
+static void bc7_evaluate(const float texels[16][4], bc7_candidate &cand)
+{
+	int32_t e0[4], e1[4], d[4];
+	int32_t len_sq = 0;
+	for (uint32_t c=0u; c<4u; ++c) {
+		e0[c] = cand.q0[c] << 1 | cand.p0;
+		e1[c] = cand.q1[c] << 1 | cand.p1;
+		d[c] = e1[c] - e0[c];
+		len_sq += d[c] * d[c];
+	}
+
+	cand.error = 0;
+	for (uint32_t i=0u; i<16u; ++i) {
+		/* Project for a first guess, then settle between the neighbouring weights */
+		int32_t guess = 0;
+		if (len_sq) {
+			float t = 0.0f;
+			for (uint32_t c=0u; c<4u; ++c) {
+				t += (texels[i][c] - (float)e0[c]) * (float)d[c];
+			}
+			guess = std::clamp((int32_t)(t / (float)len_sq * 15.0f + 0.5f), 0, 15);
+		}
+
+		uint32_t best = UINT32_MAX, best_ix = 0;
+		for (int32_t ix=std::max(guess - 1, 0); ix<=std::min(guess + 1, 15); ++ix) {
+			const int32_t w = BC7_WEIGHTS[ix];
+			uint32_t e = 0;
+			for (uint32_t c=0u; c<4u; ++c) {
+				const int32_t v = ((64 - w) * e0[c] + w * e1[c] + 32) >> 6;
+				const int32_t diff = (int32_t)texels[i][c] - v;
+				e += diff * diff;
+			}
+			if (e < best) {
+				best = e;
+				best_ix = ix;
+			}
+		}
+		cand.indices[i] = (uint8_t)best_ix;
+		cand.error += best;
+	}
+}
+
+/* Tries all four p-bit pairs for float endpoints, keeps the best in best */
+static void bc7_quantize(const float texels[16][4], const float e0[4], const float e1[4], bc7_candidate &best)
+{
+	for (uint32_t p=0u; p<4u; ++p) {
+		bc7_candidate cand;
+		cand.p0 = p & 1;
+		cand.p1 = p >> 1;
+		for (uint32_t c=0u; c<4u; ++c) {
+			cand.q0[c] = (uint8_t)std::clamp((int32_t)((e0[c] - cand.p0) * 0.5f + 0.5f), 0, 127);
+			cand.q1[c] = (uint8_t)std::clamp((int32_t)((e1[c] - cand.p1) * 0.5f + 0.5f), 0, 127);
+		}
+		bc7_evaluate(texels, cand);
+		if (cand.error < best.error) {
+			best = cand;
+		}
+	}
+}
+
+struct bit_writer
+{
+	uint8_t *out;
+	uint32_t pos = 0;
+
+	void put(uint32_t value, uint32_t bits)
+	{
+		for (uint32_t b=0u; b<bits; ++b, ++this->pos) {
+			this->out[this->pos / 8] |= (uint8_t)(((value >> b) & 1u) << (this->pos % 8));
+		}
+	}
+};
+
+void encode_bc7(const uint8_t in[64], uint8_t out[16])
+{
+	float texels[16][4];
+	load_texels(in, texels);
+
+	float mean[4], axis[4], e0[4], e1[4];
+	if (principal_axis<4>(texels, mean, axis)) {
+		fit_endpoints<4>(texels, mean, axis, e0, e1);
+	} else {
+		for (uint32_t c=0u; c<4u; ++c) {
+			e0[c] = e1[c] = texels[0][c];
+		}
+	}
+
+	bc7_candidate best;
+	best.error = UINT32_MAX;
+	bc7_quantize(texels, e0, e1, best);
+
+	for (uint32_t iter=0u; iter<2u && best.error; ++iter) {
+		float weights[16];
+		for (uint32_t i=0u; i<16u; ++i) {
+			weights[i] = BC7_WEIGHTS[best.indices[i]] / 64.0f;
+		}
+		if (!refit_endpoints<4>(texels, weights, e0, e1)) {
+			break;
+		}
+		const uint32_t before = best.error;
+		bc7_quantize(texels, e0, e1, best);
+		if (best.error >= before) {
+			break;
+		}
+	}
+
+	/* The anchor texel's index drops its top bit, so it must be below 8 */
+	if (best.indices[0] & 8) {
+		std::swap(best.q0, best.q1);
+		std::swap(best.p0, best.p1);
+		for (uint32_t i=0u; i<16u; ++i) {
+			best.indices[i] = (uint8_t)(15 - best.indices[i]);
+		}
+	}
+
+	memset(out, 0, 16);
+	bit_writer bw = { out };
+	bw.put(1u << 6, 7);
+	for (uint32_t c=0u; c<4u; ++c) {
+		bw.put(best.q0[c], 7);
+		bw.put(best.q1[c], 7);
+	}
+	bw.put(best.p0, 1);
+	bw.put(best.p1, 1);
+	bw.put(best.indices[0], 3);
+	for (uint32_t i=1u; i<16u; ++i) {
+		bw.put(best.indices[i], 4);
+	}
+}
+
+void decode_bc7(const uint8_t in[16], uint8_t texels[64])
+{
+	uint32_t pos = 0;
+	auto get = [&](uint32_t bits) {
+		uint32_t v = 0;
+		for (uint32_t b=0u; b<bits; ++b, ++pos) {
+			v |= (uint32_t)((in[pos / 8] >> (pos % 8)) & 1u) << b;
+		}
+		return v;
+	};
+
+	if (get(7) != 1u << 6) {
+		for (uint32_t i=0u; i<16u; ++i) {
+			texels[i * 4] = 255;
+			texels[i * 4 + 1] = 0;
+			texels[i * 4 + 2] = 255;
+			texels[i * 4 + 3] = 255;
+		}
+		return;
+	}
+
+	uint32_t q0[4], q1[4];
+	for (uint32_t c=0u; c<4u; ++c) {
+		q0[c] = get(7);
+		q1[c] = get(7);
+	}
+	const uint32_t p0 = get(1), p1 = get(1);
+	for (uint32_t i=0u; i<16u; ++i) {
+		const uint32_t w = BC7_WEIGHTS[get(i ? 4 : 3)];
+		for (uint32_t c=0u; c<4u; ++c) {
+			const uint32_t e0 = q0[c] << 1 | p0, e1 = q1[c] << 1 | p1;
+			texels[i * 4 + c] = (uint8_t)(((64 - w) * e0 + w * e1 + 32) >> 6);
+		}
+	}
+}
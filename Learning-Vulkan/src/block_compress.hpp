@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Block compressors for one 4x4 block of RGBA8 texels, row major. They
+ * are fit once along the principal axis of the block's colors and refined
+ * with a least squares pass, quality close to the usual offline "fast"
+ * settings at a fraction of the search. Callers split a texture into
+ * blocks and spread them across threads, every block is independent.
+ */
+void encode_bc1(const uint8_t texels[64], uint8_t out[8]);
+/* Red and green as two BC4 blocks, blue and alpha are dropped */
+void encode_bc5(const uint8_t texels[64], uint8_t out[16]);
+/* Mode 6 only, one RGBA subset with 4 bit indices, which covers most content well */
+void encode_bc7(const uint8_t texels[64], uint8_t out[16]);
+
+/* For measuring the error, decode_bc7 only understands mode 6 and returns magenta otherwise */
+void decode_bc1(const uint8_t in[8], uint8_t texels[64]);
+void decode_bc5(const uint8_t in[16], uint8_t texels[64]);
+void decode_bc7(const uint8_t in[16], uint8_t texels[64]);
@@ -0,0 +1,159 @@
+#include "cpu_trace.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+
+/* Rings are never freed so a thread can exit with zones still waiting to be drained */
+static std::mutex rings_mutex;
+static std::vector<std::unique_ptr<cpu_trace_ring>> rings;
+
+cpu_trace_ring *cpu_trace_register_thread()
+{
+	std::lock_guard<std::mutex> lock(rings_mutex);
+
+	rings.push_back(std::make_unique<cpu_trace_ring>());
+	cpu_trace_ring *ring = rings.back().get();
+	ring->tid = (uint32_t)(rings.size() - 1);
+	return ring;
+}
+
+void cpu_trace_set_thread_name(const std::string &name)
+{
+	cpu_trace_ring &ring = cpu_trace_thread_ring();
+
+	std::lock_guard<std::mutex> lock(rings_mutex);
+	ring.name = name;
+}
+
+void cpu_trace_drain(const std::function<void(const cpu_trace_ring &, const cpu_zone_record &)> &f)
+{
+	std::lock_guard<std::mutex> lock(rings_mutex);
+
+	for (auto &ring : rings) {
+		uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+		uint64_t head = ring->head.load(std::memory_order_acquire);
+		for (; tail != head; ++tail) {
+			f(*ring, ring->records[tail & (cpu_trace_ring::CAPACITY - 1)]);
+		}
+		ring->tail.store(tail, std::memory_order_release);
+	}
+}
+
+uint64_t cpu_trace_dropped()
+{
+	std::lock_guard<std::mutex> lock(rings_mutex);
+
+	uint64_t dropped = 0;
+	for (auto &ring : rings) {
+		dropped += ring->dropped.load(std::memory_order_relaxed);
+	}
+	return dropped;
+}
+
+void cpu_frame_profiler::init(trace_writer *trace)
+{
+	this->trace = trace;
+}
+
+void cpu_frame_profiler::end_frame(uint64_t beg_ns, uint64_t end_ns)
+{
+#if LV_CPU_TRACE
+	cpu_trace_thread_ring().push({ "frame", beg_ns, end_ns });
+
+	for (auto &s : this->stats) {
+		s.frame_ns = 0;
+	}
+	this->frame_zones.clear();
+
+	cpu_trace_drain([&](const cpu_trace_ring &ring, const cpu_zone_record &r) {
+		auto it = std::find_if(this->stats.begin(), this->stats.end(), [&](const zone_stats &s) {
+			return s.name == r.name;
+		});
+		if (it == this->stats.end()) {
+			this->stats.push_back({ r.name, 0, 0, 0 });
+			it = this->stats.end() - 1;
+		}
+		it->frame_ns += r.end_ns - r.beg_ns;
+
+		this->frame_zones.push_back({ r.name, ring.tid, r.beg_ns, r.end_ns });
+
+		if (this->trace) {
+			if (std::find(this->named_tids.begin(), this->named_tids.end(), ring.tid) == this->named_tids.end()) {
+				this->named_tids.push_back(ring.tid);
+				this->trace->set_thread_name(ring.tid, ring.name.empty() ? "Thread " + std::to_string(ring.tid) : ring.name);
+			}
+			this->trace->add({ r.name, ring.tid, r.beg_ns, r.end_ns - r.beg_ns });
+		}
+	});
+
+	for (auto &s : this->stats) {
+		s.total_ns += s.frame_ns;
+		s.max_ns = std::max(s.max_ns, s.frame_ns);
+	}
+
+	/* The first frame includes one-off setup and would always be the worst */
+	uint64_t frame_ns = end_ns - beg_ns;
+	if (this->frame_count > 0 && frame_ns > this->worst_ns) {
+		this->worst_frame = this->frame_count;
+		this->worst_beg_ns = beg_ns;
+		this->worst_ns = frame_ns;
+		this->worst_zones.swap(this->frame_zones);
+		std::sort(this->worst_zones.begin(), this->worst_zones.end(), [](const worst_zone &a, const worst_zone &b) {
+			return a.beg_ns < b.beg_ns;
+		});
+	}
+
+	++this->frame_count;
+	++this->summary_frames;
+#else
+	(void)beg_ns;
+	(void)end_ns;
+#endif
+}
+
+void cpu_frame_profiler::print_summary()
+{
+	if (this->summary_frames == 0) {
+		return;
+	}
+
+	std::cout << "CPU (" << this->summary_frames << " frames, avg / max ms per frame):\n";
+	std::cout << std::fixed << std::setprecision(3);
+	for (auto &s : this->stats) {
+		std::cout << "  " << s.name
+			<< ": " << s.total_ns / (double)this->summary_frames / 1e6
+			<< " / " << s.max_ns / 1e6 << '\n';
+		s.total_ns = 0;
+		s.max_ns = 0;
+	}
+	std::cout.unsetf(std::ios::floatfield);
+	std::cout << std::setprecision(6);
+
+	/* Drop counters only ever grow, report the ones since the last summary */
+	uint64_t dropped = cpu_trace_dropped();
+	if (dropped > this->dropped) {
+		std::cout << "  " << dropped - this->dropped << " zones dropped, ring full\n";
+		this->dropped = dropped;
+	}
+
+	this->summary_frames = 0;
+}
+
+void cpu_frame_profiler::print_worst_frame() const
+{
+	if (this->worst_zones.empty()) {
+		return;
+	}
+
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << "Worst frame " << this->worst_frame << ": " << this->worst_ns / 1e6 << " ms\n";
+	for (const auto &z : this->worst_zones) {
+		std::cout << "  [" << z.tid << "] +" << (int64_t)(z.beg_ns - this->worst_beg_ns) / 1e6
+			<< " ms " << z.name << ": " << (z.end_ns - z.beg_ns) / 1e6 << " ms\n";
+	}
+	std::cout.unsetf(std::ios::floatfield);
+	std::cout << std::setprecision(6);
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "trace.hpp"
+
+#include <atomic>
+#include <functional>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* Set to 0 to compile every CPU_ZONE out, the CMake option LV_ENABLE_CPU_TRACE controls it */
+#ifndef LV_CPU_TRACE
+#define LV_CPU_TRACE 1
+#endif
+
+struct cpu_zone_record
+{
+	/* Must outlive the trace, zone names are string literals */
+	const char *name;
+	uint64_t beg_ns;
+	uint64_t end_ns;
+};
+
+/*
+ * Single producer, single consumer ring. Only the owning thread pushes and
+ * only cpu_trace_drain() pops, so a push is a relaxed load, a store of the
+ * record and a release store of head. Zones are dropped, not blocked on,
+ * when the drain falls behind.
+ */
+struct cpu_trace_ring
+{
+	static constexpr uint64_t CAPACITY = 1 << 12;
+
+	void push(const cpu_zone_record &record)
+	{
+		uint64_t head = this->head.load(std::memory_order_relaxed);
+		if (head - this->tail.load(std::memory_order_acquire) >= CAPACITY) {
+			this->dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		this->records[head & (CAPACITY - 1)] = record;
+		this->head.store(head + 1, std::memory_order_release);
+	}
+
+	uint32_t tid = 0;
+	std::string name;
+
+	alignas(64) std::atomic<uint64_t> head = 0;
+	alignas(64) std::atomic<uint64_t> tail = 0;
+	std::atomic<uint64_t> dropped = 0;
+	cpu_zone_record records[CAPACITY];
+};
+
+cpu_trace_ring *cpu_trace_register_thread();
+
+/* Ring of the calling thread, registered on first use and kept alive until exit */
+inline cpu_trace_ring &cpu_trace_thread_ring()
+{
+	thread_local cpu_trace_ring *ring = cpu_trace_register_thread();
+	return *ring;
+}
+
+/* Name shown for the calling thread in the trace */
+void cpu_trace_set_thread_name(const std::string &name);
+
+/* Pops every zone pushed since the previous drain, must not be called from two threads at once */
+void cpu_trace_drain(const std::function<void(const cpu_trace_ring &, const cpu_zone_record &)> &f);
+
+/* Zones lost to full rings over the whole run */
+uint64_t cpu_trace_dropped();
+
+struct cpu_zone
+{
+	explicit cpu_zone(const char *name):
+		name(name),
+		beg_ns(trace_now_ns()) {}
+
+	~cpu_zone() { cpu_trace_thread_ring().push({ this->name, this->beg_ns, trace_now_ns() }); }
+
+	const char *name;
+	uint64_t beg_ns;
+};
+
+#define CPU_ZONE_CONCAT2(a, b) a##b
+#define CPU_ZONE_CONCAT(a, b) CPU_ZONE_CONCAT2(a, b)
+
+#if LV_CPU_TRACE
+/* Times the rest of the enclosing scope on the calling thread */
+#define CPU_ZONE(name) cpu_zone CPU_ZONE_CONCAT(cpu_zone_, __LINE__)(name)
+#else
+#define CPU_ZONE(name) ((void)0)
+#endif
+
+/*
+ * Turns the drained zones into a per-frame breakdown: every zone that
+ * ended inside a frame is added to that frame's total for its name, and
+ * the zones of the slowest frame are kept so a spike can be attributed
+ * to whatever was on the CPU at the time.
+ */
+struct cpu_frame_profiler
+{
+	/* trace may be nullptr */
+	void init(trace_writer *trace);
+
+	/* Call once per frame, off the hot path, with the frame's bounds on the trace_now_ns() timeline */
+	void end_frame(uint64_t beg_ns, uint64_t end_ns);
+
+	/* Prints average and max per frame of every zone since the previous call */
+	void print_summary();
+
+	/* Prints the zones of the slowest frame seen so far */
+	void print_worst_frame() const;
+
+private:
+	struct zone_stats
+	{
+		const char *name;
+		uint64_t frame_ns;
+		uint64_t total_ns;
+		uint64_t max_ns;
+	};
+
+	struct worst_zone
+	{
+		const char *name;
+		uint32_t tid;
+		uint64_t beg_ns;
+		uint64_t end_ns;
+	};
+
+	trace_writer *trace = nullptr;
+	std::vector<zone_stats> stats;
+	uint64_t summary_frames = 0;
+	uint64_t frame_count = 0;
+	uint64_t dropped = 0;
+	std::vector<uint32_t> named_tids;
+
+	std::vector<worst_zone> frame_zones;
+	std::vector<worst_zone> worst_zones;
+	uint64_t worst_frame = 0;
+	uint64_t worst_beg_ns = 0;
+	uint64_t worst_ns = 0;
+};
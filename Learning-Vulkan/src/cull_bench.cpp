@@ -0,0 +1,146 @@
+#include "cull_bench.hpp"
+
+#include "culling.hpp"
+
+#include <glm/ext/matrix_clip_space.hpp>
+#include <glm/ext/matrix_transform.hpp>
+#include <glm/geometric.hpp>
+#include <glm/trigonometric.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <math.h>
+#include <random>
+#include <vector>
+
+static constexpr uint32_t REPEATS = 8;
+
+/* What a renderer without the SoA path would keep per object */
+struct bench_object
+{
+	glm::mat4 world;
+	glm::vec3 center;
+	float radius;
+};
+
+/* Per-object reference, the same test cull() does written the obvious way */
+static uint32_t cull_glm(const glm::vec4 *planes, const std::vector<bench_object> &objects, std::vector<uint32_t> &visible)
+{
+	visible.clear();
+	for (uint32_t i=0u; i<objects.size(); ++i) {
+		const bench_object &o = objects[i];
+		const glm::vec4 center = o.world * glm::vec4(o.center, 1.0f);
+		const float scale = std::max({
+			glm::dot(glm::vec3(o.world[0]), glm::vec3(o.world[0])),
+			glm::dot(glm::vec3(o.world[1]), glm::vec3(o.world[1])),
+			glm::dot(glm::vec3(o.world[2]), glm::vec3(o.world[2]))});
+		const float radius = o.radius * sqrtf(scale);
+
+		bool inside = true;
+		for (uint32_t p=0u; p<6u && inside; ++p) {
+			inside = glm::dot(glm::vec3(planes[p]), glm::vec3(center)) + planes[p].w >= -radius;
+		}
+		if (inside) {
+			visible.push_back(i);
+		}
+	}
+	return (uint32_t)visible.size();
+}
+
+/* Returns the nanoseconds of the fastest of REPEATS runs */
+template <typename Fn>
+static uint64_t best_of(Fn &&fn)
+{
+	uint64_t best_ns = UINT64_MAX;
+	for (uint32_t r=0u; r<REPEATS; ++r) {
+		auto beg = std::chrono::steady_clock::now();
+		fn();
+		auto end = std::chrono::steady_clock::now();
+		best_ns = std::min<uint64_t>(best_ns, std::chrono::duration_cast<std::chrono::nanoseconds>(end - beg).count());
+	}
+	return best_ns;
+}
+
+void run_cull_benchmark(uint32_t object_count)
+{
+	/* Objects scattered around a camera at the origin looking down -z, seeded so runs compare */
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> pos(-500.0f, 500.0f);
+	std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+	std::uniform_real_distribution<float> scale(0.5f, 2.0f);
+	std::uniform_real_distribution<float> radius(0.5f, 4.0f);
+
+	std::vector<bench_object> reference(object_count);
+	cull_objects objects;
+	objects.resize(object_count);
+	for (uint32_t i=0u; i<object_count; ++i) {
+		glm::mat4 world = glm::translate(glm::mat4(1.0f), glm::vec3(pos(rng), pos(rng), pos(rng)));
+		world = glm::rotate(world, angle(rng), glm::normalize(glm::vec3(pos(rng), pos(rng), pos(rng))));
+		world = glm::scale(world, glm::vec3(scale(rng), scale(rng), scale(rng)));
+		const glm::vec3 center(radius(rng), radius(rng), radius(rng));
+		const float r = radius(rng);
+
+		reference[i] = { world, center, r };
+		objects.set_world(i, world);
+		objects.set_bounds(i, center, r);
+	}
+
+	const glm::mat4 view_proj = glm::perspectiveRH_ZO(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 1000.0f)
+		* glm::lookAtRH(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	const cull_frustum frustum = make_cull_frustum(view_proj);
+	glm::vec4 planes[6];
+	for (uint32_t p=0u; p<6u; ++p) {
+		planes[p] = glm::vec4(frustum.nx[p], frustum.ny[p], frustum.nz[p], frustum.d[p]);
+	}
+
+	std::cout << "Culling " << object_count << " spheres, best of " << REPEATS << " runs\n";
+	std::cout << std::setw(8) << "kernel"
+		<< std::setw(10) << "ms"
+		<< std::setw(12) << "Mobj/s"
+		<< std::setw(10) << "speedup"
+		<< std::setw(10) << "visible" << '\n';
+
+	std::vector<uint32_t> expected;
+	uint32_t expected_count = 0;
+	const uint64_t glm_ns = best_of([&]() { expected_count = cull_glm(planes, reference, expected); });
+
+	auto print_row = [&](const char *name, uint64_t ns, uint32_t visible_count) {
+		std::cout << std::fixed << std::setprecision(2)
+			<< std::setw(8) << name
+			<< std::setw(10) << ns / 1e6
+			<< std::setw(12) << object_count / (double)ns * 1e3
+			<< std::setw(9) << glm_ns / (double)ns << 'x'
+			<< std::setw(10) << visible_count << '\n';
+		std::cout.unsetf(std::ios::floatfield);
+		std::cout << std::setprecision(6);
+	};
+	print_row("glm", glm_ns, expected_count);
+
+	std::vector<cull_kernel> kernels = { cull_kernel::scalar };
+	if (get_best_cull_kernel() != cull_kernel::scalar) {
+		kernels.push_back(cull_kernel::sse);
+	}
+	if (get_best_cull_kernel() == cull_kernel::avx2) {
+		kernels.push_back(cull_kernel::avx2);
+	}
+
+	std::vector<uint32_t> visible;
+	for (cull_kernel kernel : kernels) {
+		uint32_t visible_count = 0;
+		const uint64_t ns = best_of([&]() { visible_count = cull(frustum, objects, visible, kernel); });
+		print_row(get_cull_kernel_name(kernel), ns, visible_count);
+
+		/* glm's matrix multiply sums in another order, objects touching a plane may come out differently */
+		std::vector<uint32_t> mismatches;
+		std::set_symmetric_difference(
+			expected.begin(), expected.end(),
+			visible.begin(), visible.begin() + visible_count,
+			std::back_inserter(mismatches));
+		if (!mismatches.empty()) {
+			std::cout << "  " << get_cull_kernel_name(kernel) << " differs from glm on " << mismatches.size() << " objects\n";
+		}
+	}
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * CPU only culling throughput test, no Vulkan device is needed. Culls a
+ * random scene of object_count spheres with per-object glm::mat4 math and
+ * with every SoA kernel the CPU supports, and checks they agree.
+ */
+void run_cull_benchmark(uint32_t object_count);
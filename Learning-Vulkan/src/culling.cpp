@@ -0,0 +1,304 @@
+#include "culling.hpp"
+
+#include <algorithm>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define LV_CULL_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+/* MSVC emits AVX2 intrinsics without /arch, the caller checks the CPU first */
+#define LV_TARGET_AVX2
+#else
+#define LV_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#else
+#define LV_CULL_X86 0
+#endif
+
+static constexpr uint32_t BATCH = 8;
+
+cull_frustum make_cull_frustum(const glm::mat4 &view_proj)
+{
+	/* glm is column major, row i of the matrix is m[0][i], m[1][i], m[2][i], m[3][i] */
+	auto row = [&](int i) {
+		return glm::vec4(view_proj[0][i], view_proj[1][i], view_proj[2][i], view_proj[3][i]);
+	};
+
+	/* Clip space is -w <= x, y <= w and 0 <= z <= w */
+	const glm::vec4 planes[6] = {
+		row(3) + row(0),
+		row(3) - row(0),
+		row(3) + row(1),
+		row(3) - row(1),
+		row(2),
+		row(3) - row(2)};
+
+	cull_frustum ret;
+	for (uint32_t i=0u; i<6u; ++i) {
+		float len = sqrtf(planes[i].x * planes[i].x + planes[i].y * planes[i].y + planes[i].z * planes[i].z);
+		ret.nx[i] = planes[i].x / len;
+		ret.ny[i] = planes[i].y / len;
+		ret.nz[i] = planes[i].z / len;
+		ret.d[i] = planes[i].w / len;
+	}
+	return ret;
+}
+
+void cull_objects::resize(uint32_t count)
+{
+	this->count = count;
+
+	const uint32_t padded = (count + BATCH - 1) / BATCH * BATCH;
+	for (auto *v : {
+			&this->local_x, &this->local_y, &this->local_z, &this->local_radius,
+			&this->world_00, &this->world_01, &this->world_02, &this->world_03,
+			&this->world_10, &this->world_11, &this->world_12, &this->world_13,
+			&this->world_20, &this->world_21, &this->world_22, &this->world_23,
+			&this->center_x, &this->center_y, &this->center_z, &this->radius}) {
+		v->resize(padded);
+	}
+}
+
+void cull_objects::set_bounds(uint32_t ix, const glm::vec3 &center, float radius)
+{
+	this->local_x[ix] = center.x;
+	this->local_y[ix] = center.y;
+	this->local_z[ix] = center.z;
+	this->local_radius[ix] = radius;
+}
+
+void cull_objects::set_world(uint32_t ix, const glm::mat4 &world)
+{
+	this->world_00[ix] = world[0][0];
+	this->world_01[ix] = world[1][0];
+	this->world_02[ix] = world[2][0];
+	this->world_03[ix] = world[3][0];
+	this->world_10[ix] = world[0][1];
+	this->world_11[ix] = world[1][1];
+	this->world_12[ix] = world[2][1];
+	this->world_13[ix] = world[3][1];
+	this->world_20[ix] = world[0][2];
+	this->world_21[ix] = world[1][2];
+	this->world_22[ix] = world[2][2];
+	this->world_23[ix] = world[3][2];
+}
+
+/* Lanes past the object count are padding and never visible */
+static uint32_t valid_mask(uint32_t count, uint32_t base)
+{
+	return count - base >= BATCH ? 0xffu : (1u << (count - base)) - 1u;
+}
+
+/*
+ * Writes base + i for every lane and only advances past the visible ones,
+ * which is cheaper than branching on each bit. out must have room for
+ * base + BATCH indices, which holds since n never exceeds base.
+ */
+static uint32_t compact(uint32_t *out, uint32_t n, uint32_t base, uint32_t mask)
+{
+	for (uint32_t i=0u; i<BATCH; ++i) {
+		out[n] = base + i;
+		n += (mask >> i) & 1u;
+	}
+	return n;
+}
+
+static uint32_t cull_scalar(const cull_frustum &f, cull_objects &o, uint32_t *out)
+{
+	uint32_t n = 0;
+	for (uint32_t base=0u; base<o.count; base+=BATCH) {
+		uint32_t mask = 0;
+		for (uint32_t i=base; i<base+BATCH; ++i) {
+			const float lx = o.local_x[i], ly = o.local_y[i], lz = o.local_z[i];
+			const float x = o.world_00[i] * lx + o.world_01[i] * ly + o.world_02[i] * lz + o.world_03[i];
+			const float y = o.world_10[i] * lx + o.world_11[i] * ly + o.world_12[i] * lz + o.world_13[i];
+			const float z = o.world_20[i] * lx + o.world_21[i] * ly + o.world_22[i] * lz + o.world_23[i];
+
+			/* Non-uniform scale grows the sphere by the longest axis */
+			const float sx = o.world_00[i] * o.world_00[i] + o.world_10[i] * o.world_10[i] + o.world_20[i] * o.world_20[i];
+			const float sy = o.world_01[i] * o.world_01[i] + o.world_11[i] * o.world_11[i] + o.world_21[i] * o.world_21[i];
+			const float sz = o.world_02[i] * o.world_02[i] + o.world_12[i] * o.world_12[i] + o.world_22[i] * o.world_22[i];
+			const float r = o.local_radius[i] * sqrtf(std::max(std::max(sx, sy), sz));
+
+			o.center_x[i] = x;
+			o.center_y[i] = y;
+			o.center_z[i] = z;
+			o.radius[i] = r;
+
+			bool inside = true;
+			for (uint32_t p=0u; p<6u; ++p) {
+				inside &= f.nx[p] * x + f.ny[p] * y + f.nz[p] * z + f.d[p] >= -r;
+			}
+			mask |= (uint32_t)inside << (i - base);
+		}
+		n = compact(out, n, base, mask & valid_mask(o.count, base));
+	}
+	return n;
+}
+
+#if LV_CULL_X86
+
+/* Four objects starting at i, the bit of each visible one is set */
+static uint32_t cull_sse4(const __m128 *nx, const __m128 *ny, const __m128 *nz, const __m128 *d, cull_objects &o, uint32_t i)
+{
+	const __m128 lx = _mm_loadu_ps(&o.local_x[i]);
+	const __m128 ly = _mm_loadu_ps(&o.local_y[i]);
+	const __m128 lz = _mm_loadu_ps(&o.local_z[i]);
+	const __m128 m00 = _mm_loadu_ps(&o.world_00[i]), m01 = _mm_loadu_ps(&o.world_01[i]), m02 = _mm_loadu_ps(&o.world_02[i]);
+	const __m128 m10 = _mm_loadu_ps(&o.world_10[i]), m11 = _mm_loadu_ps(&o.world_11[i]), m12 = _mm_loadu_ps(&o.world_12[i]);
+	const __m128 m20 = _mm_loadu_ps(&o.world_20[i]), m21 = _mm_loadu_ps(&o.world_21[i]), m22 = _mm_loadu_ps(&o.world_22[i]);
+
+	const __m128 x = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m00, lx), _mm_mul_ps(m01, ly)),
+		_mm_mul_ps(m02, lz)), _mm_loadu_ps(&o.world_03[i]));
+	const __m128 y = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m10, lx), _mm_mul_ps(m11, ly)),
+		_mm_mul_ps(m12, lz)), _mm_loadu_ps(&o.world_13[i]));
+	const __m128 z = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m20, lx), _mm_mul_ps(m21, ly)),
+		_mm_mul_ps(m22, lz)), _mm_loadu_ps(&o.world_23[i]));
+
+	const __m128 sx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m00, m00), _mm_mul_ps(m10, m10)), _mm_mul_ps(m20, m20));
+	const __m128 sy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m01, m01), _mm_mul_ps(m11, m11)), _mm_mul_ps(m21, m21));
+	const __m128 sz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m02, m02), _mm_mul_ps(m12, m12)), _mm_mul_ps(m22, m22));
+	const __m128 r = _mm_mul_ps(_mm_loadu_ps(&o.local_radius[i]), _mm_sqrt_ps(_mm_max_ps(_mm_max_ps(sx, sy), sz)));
+
+	_mm_storeu_ps(&o.center_x[i], x);
+	_mm_storeu_ps(&o.center_y[i], y);
+	_mm_storeu_ps(&o.center_z[i], z);
+	_mm_storeu_ps(&o.radius[i], r);
+
+	/* Same sums in the same order as the scalar kernel, so both agree on edge cases */
+	const __m128 neg_r = _mm_sub_ps(_mm_setzero_ps(), r);
+	__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+	for (uint32_t p=0u; p<6u; ++p) {
+		__m128 dist = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx[p], x), _mm_mul_ps(ny[p], y)), _mm_mul_ps(nz[p], z)), d[p]);
+		inside = _mm_and_ps(inside, _mm_cmpge_ps(dist, neg_r));
+	}
+	return (uint32_t)_mm_movemask_ps(inside);
+}
+
+static uint32_t cull_sse(const cull_frustum &f, cull_objects &o, uint32_t *out)
+{
+	__m128 nx[6], ny[6], nz[6], d[6];
+	for (uint32_t p=0u; p<6u; ++p) {
+		nx[p] = _mm_set1_ps(f.nx[p]);
+		ny[p] = _mm_set1_ps(f.ny[p]);
+		nz[p] = _mm_set1_ps(f.nz[p]);
+		d[p] = _mm_set1_ps(f.d[p]);
+	}
+
+	uint32_t n = 0;
+	for (uint32_t base=0u; base<o.count; base+=BATCH) {
+		uint32_t mask = cull_sse4(nx, ny, nz, d, o, base) | cull_sse4(nx, ny, nz, d, o, base + 4) << 4;
+		n = compact(out, n, base, mask & valid_mask(o.count, base));
+	}
+	return n;
+}
+
+LV_TARGET_AVX2 static uint32_t cull_avx2(const cull_frustum &f, cull_objects &o, uint32_t *out)
+{
+	__m256 nx[6], ny[6], nz[6], d[6];
+	for (uint32_t p=0u; p<6u; ++p) {
+		nx[p] = _mm256_set1_ps(f.nx[p]);
+		ny[p] = _mm256_set1_ps(f.ny[p]);
+		nz[p] = _mm256_set1_ps(f.nz[p]);
+		d[p] = _mm256_set1_ps(f.d[p]);
+	}
+
+	uint32_t n = 0;
+	for (uint32_t i=0u; i<o.count; i+=BATCH) {
+		const __m256 lx = _mm256_loadu_ps(&o.local_x[i]);
+		const __m256 ly = _mm256_loadu_ps(&o.local_y[i]);
+		const __m256 lz = _mm256_loadu_ps(&o.local_z[i]);
+		const __m256 m00 = _mm256_loadu_ps(&o.world_00[i]), m01 = _mm256_loadu_ps(&o.world_01[i]), m02 = _mm256_loadu_ps(&o.world_02[i]);
+		const __m256 m10 = _mm256_loadu_ps(&o.world_10[i]), m11 = _mm256_loadu_ps(&o.world_11[i]), m12 = _mm256_loadu_ps(&o.world_12[i]);
+		const __m256 m20 = _mm256_loadu_ps(&o.world_20[i]), m21 = _mm256_loadu_ps(&o.world_21[i]), m22 = _mm256_loadu_ps(&o.world_22[i]);
+
+		/* No FMA, it would round differently from the other kernels */
+		const __m256 x = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m00, lx), _mm256_mul_ps(m01, ly)),
+			_mm256_mul_ps(m02, lz)), _mm256_loadu_ps(&o.world_03[i]));
+		const __m256 y = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m10, lx), _mm256_mul_ps(m11, ly)),
+			_mm256_mul_ps(m12, lz)), _mm256_loadu_ps(&o.world_13[i]));
+		const __m256 z = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m20, lx), _mm256_mul_ps(m21, ly)),
+			_mm256_mul_ps(m22, lz)), _mm256_loadu_ps(&o.world_23[i]));
+
+		const __m256 sx = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m00, m00), _mm256_mul_ps(m10, m10)), _mm256_mul_ps(m20, m20));
+		const __m256 sy = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m01, m01), _mm256_mul_ps(m11, m11)), _mm256_mul_ps(m21, m21));
+		const __m256 sz = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m02, m02), _mm256_mul_ps(m12, m12)), _mm256_mul_ps(m22, m22));
+		const __m256 r = _mm256_mul_ps(_mm256_loadu_ps(&o.local_radius[i]), _mm256_sqrt_ps(_mm256_max_ps(_mm256_max_ps(sx, sy), sz)));
+
+		_mm256_storeu_ps(&o.center_x[i], x);
+		_mm256_storeu_ps(&o.center_y[i], y);
+		_mm256_storeu_ps(&o.center_z[i], z);
+		_mm256_storeu_ps(&o.radius[i], r);
+
+		const __m256 neg_r = _mm256_sub_ps(_mm256_setzero_ps(), r);
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (uint32_t p=0u; p<6u; ++p) {
+			__m256 dist = _mm256_add_ps(
+				_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx[p], x), _mm256_mul_ps(ny[p], y)), _mm256_mul_ps(nz[p], z)),
+				d[p]);
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(dist, neg_r, _CMP_GE_OQ));
+		}
+
+		n = compact(out, n, i, (uint32_t)_mm256_movemask_ps(inside) & valid_mask(o.count, i));
+	}
+	return n;
+}
+
+static bool cpu_has_avx2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	/* The OS has to save the YMM registers too, not just the CPU support them */
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	if (!osxsave || (_xgetbv(0) & 6) != 6) {
+		return false;
+	}
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+cull_kernel get_best_cull_kernel()
+{
+#if LV_CULL_X86
+	static const bool avx2 = cpu_has_avx2();
+	return avx2 ? cull_kernel::avx2 : cull_kernel::sse;
+#else
+	return cull_kernel::scalar;
+#endif
+}
+
+const char *get_cull_kernel_name(cull_kernel kernel)
+{
+	switch (kernel) {
+	case cull_kernel::scalar: return "scalar";
+	case cull_kernel::sse: return "sse";
+	case cull_kernel::avx2: return "avx2";
+	}
+	return "unknown";
+}
+
+uint32_t cull(const cull_frustum &frustum, cull_objects &objects, std::vector<uint32_t> &visible, cull_kernel kernel)
+{
+	if (visible.size() < objects.local_x.size()) {
+		visible.resize(objects.local_x.size());
+	}
+
+	switch (kernel) {
+#if LV_CULL_X86
+	case cull_kernel::sse:
+		return cull_sse(frustum, objects, visible.data());
+	case cull_kernel::avx2:
+		return cull_avx2(frustum, objects, visible.data());
+#endif
+	default:
+		return cull_scalar(frustum, objects, visible.data());
+	}
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+
+#include <stdint.h>
+#include <vector>
+
+/* Normalized planes pointing inwards, a point p is inside when dot(xyz, p) + w >= 0 */
+struct cull_frustum
+{
+	float nx[6];
+	float ny[6];
+	float nz[6];
+	float d[6];
+};
+
+/* Extracts the planes of a view projection matrix with Vulkan's 0..1 depth range */
+cull_frustum make_cull_frustum(const glm::mat4 &view_proj);
+
+/*
+ * Culling input and output in structure of arrays layout, so eight objects
+ * are one load per field. Worlds are affine and stored as the top three
+ * rows of the matrix, world_rc being row r and column c. Local bounds are
+ * spheres, the world spheres are written back for later passes to reuse.
+ */
+struct cull_objects
+{
+	uint32_t count = 0;
+
+	std::vector<float> local_x, local_y, local_z, local_radius;
+	std::vector<float> world_00, world_01, world_02, world_03;
+	std::vector<float> world_10, world_11, world_12, world_13;
+	std::vector<float> world_20, world_21, world_22, world_23;
+
+	std::vector<float> center_x, center_y, center_z, radius;
+
+	/* Rounds storage up to a multiple of eight so kernels never need a scalar tail */
+	void resize(uint32_t count);
+	void set_bounds(uint32_t ix, const glm::vec3 &center, float radius);
+	void set_world(uint32_t ix, const glm::mat4 &world);
+};
+
+enum class cull_kernel
+{
+	scalar,
+	sse,
+	avx2,
+};
+
+/* The widest kernel the CPU runs, scalar on anything but x86 */
+cull_kernel get_best_cull_kernel();
+const char *get_cull_kernel_name(cull_kernel kernel);
+
+/*
+ * Transforms every object's bounds and writes the indices of those that
+ * intersect the frustum to the front of visible, in increasing order.
+ * visible is grown to hold every object, the visible count is returned.
+ */
+uint32_t cull(const cull_frustum &frustum, cull_objects &objects, std::vector<uint32_t> &visible, cull_kernel kernel);
@@ -0,0 +1,516 @@
+#include "image_decode.hpp"
+
+#include "mapped_file.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Inflate (RFC 1951) */
+
+struct bit_reader
+{
+	const uint8_t *p;
+	const uint8_t *end;
+	uint64_t bits = 0;
+	uint32_t count = 0;
+	/* Zero bytes fed past the end, a valid stream never consumes them */
+	uint32_t overrun = 0;
+
+	void refill(uint32_t n)
+	{
+		while (this->count < n) {
+			uint64_t byte = 0;
+			if (this->p < this->end) {
+				byte = *this->p++;
+			} else {
+				++this->overrun;
+			}
+			this->bits |= byte << this->count;
+			this->count += 8;
+		}
+	}
+
+	uint32_t get(uint32_t n)
+	{
+		if (!n) {
+			return 0;
+		}
+		refill(n);
+		uint32_t v = (uint32_t)(this->bits & ((1ull << n) - 1));
+		this->bits >>= n;
+		this->count -= n;
+		return v;
+	}
+
+	void align_to_byte()
+	{
+		get(this->count % 8);
+	}
+};
+
+/*
+ * Canonical Huffman code with a table for codes up to FAST_BITS long, the
+ * rare longer ones are decoded a bit at a time from the code counts.
+ */
+struct huffman
+{
+	static constexpr uint32_t FAST_BITS = 9;
+	static constexpr uint32_t MAX_BITS = 15;
+
+	uint16_t counts[MAX_BITS + 1];
+	uint16_t symbols[288];
+	/* Symbol << 4 | length, 0 for codes longer than FAST_BITS */
+	uint16_t fast[1 << FAST_BITS];
+
+	bool build(const uint8_t *lengths, uint32_t n)
+	{
+		memset(this->counts, 0, sizeof(this->counts));
+		memset(this->fast, 0, sizeof(this->fast));
+		for (uint32_t i=0u; i<n; ++i) {
+			++this->counts[lengths[i]];
+		}
+		this->counts[0] = 0;
+
+		/* Over-subscribed sets can't be decoded, incomplete ones are legal for single code trees */
+		int32_t left = 1;
+		uint16_t offsets[MAX_BITS + 2] = {};
+		for (uint32_t len=1u; len<=MAX_BITS; ++len) {
+			left = (left << 1) - this->counts[len];
+			if (left < 0) {
+				return false;
+			}
+			offsets[len + 1] = offsets[len] + this->counts[len];
+		}
+		for (uint32_t i=0u; i<n; ++i) {
+			if (lengths[i]) {
+				this->symbols[offsets[lengths[i]]++] = (uint16_t)i;
+			}
+		}
+
+		/* Codes are assigned in symbol order per length, and stored bit reversed in the stream */
+		uint32_t code = 0, ix = 0;
+		for (uint32_t len=1u; len<=FAST_BITS; ++len) {
+			for (uint32_t k=0u; k<this->counts[len]; ++k, ++ix, ++code) {
+				uint32_t reversed = 0;
+				for (uint32_t b=0u; b<len; ++b) {
+					reversed |= ((code >> b) & 1u) << (len - 1 - b);
+				}
+				for (uint32_t r=reversed; r<(1u << FAST_BITS); r+=1u << len) {
+					this->fast[r] = (uint16_t)(this->symbols[ix] << 4 | len);
+				}
+			}
+			code <<= 1;
+		}
+		return true;
+	}
+
+	int32_t decode(bit_reader &br) const
+	{
+		br.refill(MAX_BITS);
+		const uint16_t entry = this->fast[br.bits & ((1u << FAST_BITS) - 1)];
+		if (entry) {
+			br.get(entry & 15);
+			return entry >> 4;
+		}
+
+		int32_t code = 0, first = 0, index = 0;
+		for (uint32_t len=1u; len<=MAX_BITS; ++len) {
+			code |= (int32_t)br.get(1);
+			const int32_t count = this->counts[len];
+			if (code - count < first) {
+				return this->symbols[index + (code - first)];
+			}
+			index += count;
+			first = (first + count) << 1;
+			code <<= 1;
+		}
+		return -1;
+	}
+};
+
+static const uint16_t LENGTH_BASE[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t LENGTH_EXTRA[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t DIST_BASE[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+	1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t DIST_EXTRA[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+[[noreturn]] static void inflate_fail()
+{
+	throw std::runtime_error("Failed to inflate PNG data");
+}
+
+/* limit is what the caller expects out to hold, anything decoding to more is corrupt or a decompression bomb */
+static void inflate_codes(bit_reader &br, const huffman &lit, const huffman &dist, std::vector<uint8_t> &out, size_t limit)
+{
+	for (;;) {
+		int32_t sym = lit.decode(br);
+		if (sym < 0) {
+			inflate_fail();
+		} else if (sym < 256) {
+			if (out.size() >= limit) {
+				inflate_fail();
+			}
+			out.push_back((uint8_t)sym);
+		} else if (sym == 256) {
+			return;
+		} else {
+			sym -= 257;
+			if (sym >= 29) {
+				inflate_fail();
+			}
+			const uint32_t len = LENGTH_BASE[sym] + br.get(LENGTH_EXTRA[sym]);
+			const int32_t dsym = dist.decode(br);
+			if (dsym < 0 || dsym >= 30) {
+				inflate_fail();
+			}
+			const size_t d = DIST_BASE[dsym] + br.get(DIST_EXTRA[dsym]);
+			if (d > out.size() || len > limit - out.size()) {
+				inflate_fail();
+			}
+			/* Byte by byte, the match may overlap what it is copying */
+			size_t from = out.size() - d;
+			for (uint32_t i=0u; i<len; ++i) {
+				out.push_back(out[from + i]);
+			}
+		}
+		if (br.overrun > 8) {
+			inflate_fail();
+		}
+	}
+}
+
+static void inflate(const uint8_t *data, size_t size, std::vector<uint8_t> &out, size_t limit)
+{
+	bit_reader br = { data, data + size };
+
+	huffman lit, dist;
+	bool last;
+	do {
+		last = br.get(1);
+		const uint32_t type = br.get(2);
+		if (type == 0) {
+			br.align_to_byte();
+			const uint32_t len = br.get(16);
+			const uint32_t nlen = br.get(16);
+			if ((len ^ 0xffffu) != nlen || len > limit - out.size()) {
+				inflate_fail();
+			}
+			/* Whole bytes left in the bit buffer come first */
+			for (uint32_t i=0u; i<len; ++i) {
+				out.push_back((uint8_t)br.get(8));
+			}
+		} else if (type == 1) {
+			uint8_t lengths[288 + 30];
+			memset(lengths, 8, 144);
+			memset(lengths + 144, 9, 112);
+			memset(lengths + 256, 7, 24);
+			memset(lengths + 280, 8, 8);
+			memset(lengths + 288, 5, 30);
+			lit.build(lengths, 288);
+			dist.build(lengths + 288, 30);
+			inflate_codes(br, lit, dist, out, limit);
+		} else if (type == 2) {
+			const uint32_t nlen = br.get(5) + 257;
+			const uint32_t ndist = br.get(5) + 1;
+			const uint32_t ncode = br.get(4) + 4;
+			static const uint8_t ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+			uint8_t code_lengths[19] = {};
+			for (uint32_t i=0u; i<ncode; ++i) {
+				code_lengths[ORDER[i]] = (uint8_t)br.get(3);
+			}
+			huffman code;
+			if (!code.build(code_lengths, 19)) {
+				inflate_fail();
+			}
+
+			uint8_t lengths[288 + 32] = {};
+			for (uint32_t i=0u; i<nlen + ndist; ) {
+				const int32_t sym = code.decode(br);
+				uint32_t repeat = 0;
+				uint8_t value = 0;
+				if (sym < 0) {
+					inflate_fail();
+				} else if (sym < 16) {
+					lengths[i++] = (uint8_t)sym;
+					continue;
+				} else if (sym == 16) {
+					if (!i) {
+						inflate_fail();
+					}
+					value = lengths[i - 1];
+					repeat = 3 + br.get(2);
+				} else if (sym == 17) {
+					repeat = 3 + br.get(3);
+				} else {
+					repeat = 11 + br.get(7);
+				}
+				if (i + repeat > nlen + ndist) {
+					inflate_fail();
+				}
+				memset(lengths + i, value, repeat);
+				i += repeat;
+			}
+
+			if (!lit.build(lengths, nlen) || !dist.build(lengths + nlen, ndist)) {
+				inflate_fail();
+			}
+			inflate_codes(br, lit, dist, out, limit);
+		} else {
+			inflate_fail();
+		}
+	} while (!last);
+}
+
+/* PNG */
+
+/* Per side, well past any device's maxImageDimension2D */
+static constexpr uint32_t MAX_PNG_DIMENSION = 1 << 16;
+
+static uint32_t read_be32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint8_t paeth(uint8_t a, uint8_t b, uint8_t c)
+{
+	const int p = a + b - c;
+	const int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+	return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+void decode_png(const uint8_t *data, size_t size, image_rgba8 &image)
+{
+	static const uint8_t SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	if (size < 8 || memcmp(data, SIGNATURE, 8) != 0) {
+		throw std::runtime_error("Not a PNG file");
+	}
+
+	uint32_t width = 0, height = 0, depth = 0, color_type = 0;
+	uint8_t palette[256][4] = {};
+	std::vector<uint8_t> compressed;
+	for (size_t pos = 8; pos + 12 <= size; ) {
+		const uint32_t len = read_be32(data + pos);
+		const uint8_t *type = data + pos + 4;
+		const uint8_t *body = data + pos + 8;
+		if (len > size - pos - 12) {
+			throw std::runtime_error("Truncated PNG chunk");
+		}
+
+		if (memcmp(type, "IHDR", 4) == 0 && len >= 13) {
+			width = read_be32(body);
+			height = read_be32(body + 4);
+			depth = body[8];
+			color_type = body[9];
+			if (body[12] != 0) {
+				throw std::runtime_error("Interlaced PNGs are not supported");
+			}
+		} else if (memcmp(type, "PLTE", 4) == 0) {
+			for (uint32_t i=0u; i<len / 3 && i<256u; ++i) {
+				palette[i][0] = body[i * 3];
+				palette[i][1] = body[i * 3 + 1];
+				palette[i][2] = body[i * 3 + 2];
+				palette[i][3] = 255;
+			}
+		} else if (memcmp(type, "tRNS", 4) == 0 && color_type == 3) {
+			for (uint32_t i=0u; i<len && i<256u; ++i) {
+				palette[i][3] = body[i];
+			}
+		} else if (memcmp(type, "IDAT", 4) == 0) {
+			compressed.insert(compressed.end(), body, body + len);
+		} else if (memcmp(type, "IEND", 4) == 0) {
+			break;
+		}
+		pos += 12 + len;
+	}
+
+	uint32_t channels = 0;
+	switch (color_type) {
+	case 0: channels = 1; break;
+	case 2: channels = 3; break;
+	case 3: channels = 1; break;
+	case 4: channels = 2; break;
+	case 6: channels = 4; break;
+	}
+	if (!width || !height || !channels || !(depth == 8 || (depth == 16 && color_type != 3))) {
+		throw std::runtime_error("Unsupported PNG, only 8 and 16 bit channels and 8 bit palettes are");
+	}
+	/* Skips the two byte zlib header, the Adler-32 at the end is not checked */
+	if (compressed.size() < 2 || (compressed[0] & 0x0f) != 8 || (compressed[1] & 0x20)) {
+		throw std::runtime_error("Unsupported PNG compression");
+	}
+
+	/* Bounds every size below, nothing that large is uploadable anyway */
+	if (width > MAX_PNG_DIMENSION || height > MAX_PNG_DIMENSION) {
+		throw std::runtime_error("PNG too large");
+	}
+	const size_t bpp = channels * depth / 8;
+	const size_t stride = (size_t)width * bpp;
+	/* Each row carries a filter byte */
+	if (stride + 1 > SIZE_MAX / height) {
+		throw std::runtime_error("PNG too large");
+	}
+	const size_t raw_size = (stride + 1) * height;
+	std::vector<uint8_t> raw;
+	raw.reserve(raw_size);
+	inflate(compressed.data() + 2, compressed.size() - 2, raw, raw_size);
+	if (raw.size() < raw_size) {
+		throw std::runtime_error("Truncated PNG image data");
+	}
+
+	/* Undo the per row filters in place, each row predicts from the unfiltered one above */
+	for (uint32_t y=0u; y<height; ++y) {
+		const uint8_t filter = raw[y * (stride + 1)];
+		uint8_t *row = raw.data() + y * (stride + 1) + 1;
+		const uint8_t *prev = y ? row - (stride + 1) : nullptr;
+		for (size_t x=0u; x<stride; ++x) {
+			const uint8_t a = x >= bpp ? row[x - bpp] : 0;
+			const uint8_t b = prev ? prev[x] : 0;
+			const uint8_t c = prev && x >= bpp ? prev[x - bpp] : 0;
+			switch (filter) {
+			case 0: break;
+			case 1: row[x] += a; break;
+			case 2: row[x] += b; break;
+			case 3: row[x] += (uint8_t)((a + b) / 2); break;
+			case 4: row[x] += paeth(a, b, c); break;
+			default: throw std::runtime_error("Corrupt PNG filter");
+			}
+		}
+	}
+
+	image.width = width;
+	image.height = height;
+	image.pixels.resize((size_t)width * height * 4);
+	const size_t step = depth / 8;
+	for (uint32_t y=0u; y<height; ++y) {
+		const uint8_t *row = raw.data() + y * (stride + 1) + 1;
+		uint8_t *dst = image.pixels.data() + (size_t)y * width * 4;
+		for (uint32_t x=0u; x<width; ++x, dst+=4) {
+			/* 16 bit samples are big endian, the first byte is the high one */
+			const uint8_t *s = row + x * bpp;
+			switch (color_type) {
+			case 0: dst[0] = dst[1] = dst[2] = s[0]; dst[3] = 255; break;
+			case 2: dst[0] = s[0]; dst[1] = s[step]; dst[2] = s[2 * step]; dst[3] = 255; break;
+			case 3: memcpy(dst, palette[s[0]], 4); break;
+			case 4: dst[0] = dst[1] = dst[2] = s[0]; dst[3] = s[step]; break;
+			case 6: dst[0] = s[0]; dst[1] = s[step]; dst[2] = s[2 * step]; dst[3] = s[3 * step]; break;
+			}
+		}
+	}
+}
+
+/* TGA */
+
+void decode_tga(const uint8_t *data, size_t size, image_rgba8 &image)
+{
+	if (size < 18) {
+		throw std::runtime_error("Truncated TGA header");
+	}
+
+	const uint32_t id_length = data[0];
+	const uint32_t colormap_type = data[1];
+	const uint32_t type = data[2];
+	const uint32_t colormap_bytes = (data[5] | data[6] << 8) * ((data[7] + 7) / 8);
+	const uint32_t width = data[12] | data[13] << 8;
+	const uint32_t height = data[14] | data[15] << 8;
+	const uint32_t bpp = data[16] / 8;
+	const bool top_down = data[17] & 0x20;
+
+	const bool gray = type == 3 || type == 11;
+	const bool rle = type == 10 || type == 11;
+	if (colormap_type || !(type == 2 || type == 3 || type == 10 || type == 11)
+			|| !(gray ? bpp == 1 : bpp == 3 || bpp == 4) || !width || !height) {
+		throw std::runtime_error("Unsupported TGA, only 8 bit gray and 24/32 bit color are");
+	}
+
+	const uint8_t *p = data + 18 + id_length + colormap_bytes;
+	const uint8_t *end = data + size;
+	image.width = width;
+	image.height = height;
+	image.pixels.resize((size_t)width * height * 4);
+
+	auto read_pixel = [&](uint8_t *dst) {
+		if (end - p < (ptrdiff_t)bpp) {
+			throw std::runtime_error("Truncated TGA image data");
+		}
+		/* Stored BGR(A) */
+		if (gray) {
+			dst[0] = dst[1] = dst[2] = p[0];
+			dst[3] = 255;
+		} else {
+			dst[0] = p[2];
+			dst[1] = p[1];
+			dst[2] = p[0];
+			dst[3] = bpp == 4 ? p[3] : 255;
+		}
+		p += bpp;
+	};
+
+	const size_t pixel_count = (size_t)width * height;
+	for (size_t i=0u; i<pixel_count; ) {
+		if (!rle) {
+			read_pixel(&image.pixels[i++ * 4]);
+			continue;
+		}
+		if (p >= end) {
+			throw std::runtime_error("Truncated TGA image data");
+		}
+		const uint8_t header = *p++;
+		const size_t count = std::min<size_t>((header & 0x7f) + 1, pixel_count - i);
+		if (header & 0x80) {
+			uint8_t pixel[4];
+			read_pixel(pixel);
+			for (size_t k=0u; k<count; ++k) {
+				memcpy(&image.pixels[(i + k) * 4], pixel, 4);
+			}
+		} else {
+			for (size_t k=0u; k<count; ++k) {
+				read_pixel(&image.pixels[(i + k) * 4]);
+			}
+		}
+		i += count;
+	}
+
+	/* Bottom-up is the TGA default, rows are flipped to top first */
+	if (!top_down) {
+		const size_t stride = (size_t)width * 4;
+		std::vector<uint8_t> tmp(stride);
+		for (uint32_t y=0u; y<height / 2; ++y) {
+			uint8_t *a = image.pixels.data() + y * stride;
+			uint8_t *b = image.pixels.data() + (height - 1 - y) * stride;
+			memcpy(tmp.data(), a, stride);
+			memcpy(a, b, stride);
+			memcpy(b, tmp.data(), stride);
+		}
+	}
+}
+
+void decode_image(const std::string &path, image_rgba8 &image)
+{
+	std::string ext = std::filesystem::path(path).extension().string();
+	for (char &c : ext) {
+		c = (char)tolower((unsigned char)c);
+	}
+
+	mapped_file file;
+	if (!file.open(path) || !file.data()) {
+		throw std::runtime_error("Failed to open " + path);
+	}
+	const uint8_t *data = (const uint8_t *)file.data();
+
+	if (ext == ".png") {
+		decode_png(data, file.size(), image);
+	} else if (ext == ".tga") {
+		decode_tga(data, file.size(), image);
+	} else {
+		throw std::runtime_error("Unknown image format " + ext + ", expected .png or .tga");
+	}
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* Tightly packed RGBA8 rows, top row first */
+struct image_rgba8
+{
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<uint8_t> pixels;
+};
+
+/*
+ * Non-interlaced PNG of any color type at 8 or 16 bits per channel (16 is
+ * truncated to 8), or 8 bit palettized. Carries its own inflate, there is
+ * no zlib to lean on. Throws on anything else or on corrupt data.
+ */
+void decode_png(const uint8_t *data, size_t size, image_rgba8 &image);
+
+/* Uncompressed or RLE TGA, 8 bit gray or 24/32 bit color */
+void decode_tga(const uint8_t *data, size_t size, image_rgba8 &image);
+
+/* Picks the decoder by extension, throws if the file can't be read or decoded */
+void decode_image(const std::string &path, image_rgba8 &image);
@@ -0,0 +1,115 @@
+#include "job_bench.hpp"
+
+#include "job_system.hpp"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static constexpr uint32_t LEAF_COUNT = 1 << 18;
+static constexpr uint32_t REPEATS = 8;
+
+struct bench_node
+{
+	job_system *jobs;
+	job_counter *counter;
+	std::vector<bench_node> *nodes;
+	uint32_t ix;
+	uint32_t beg;
+	uint32_t end;
+	uint32_t work;
+	uint32_t result;
+};
+
+/* Splits its range in two until one leaf is left, nodes are laid out like a binary heap */
+static void bench_job(void *data)
+{
+	bench_node &node = *(bench_node *)data;
+
+	if (node.end - node.beg > 1) {
+		uint32_t mid = node.beg + (node.end - node.beg) / 2;
+		bench_node &left = (*node.nodes)[node.ix * 2 + 1];
+		bench_node &right = (*node.nodes)[node.ix * 2 + 2];
+		left = { node.jobs, node.counter, node.nodes, node.ix * 2 + 1, node.beg, mid, node.work, 0 };
+		right = { node.jobs, node.counter, node.nodes, node.ix * 2 + 2, mid, node.end, node.work, 0 };
+		node.jobs->run(bench_job, &left, node.counter);
+		node.jobs->run(bench_job, &right, node.counter);
+		return;
+	}
+
+	/* Dependent LCG steps the compiler can't fold */
+	uint32_t x = node.beg;
+	for (uint32_t i=0u; i<node.work; ++i) {
+		x = x * 1664525u + 1013904223u;
+	}
+	node.result = x;
+}
+
+/* Returns the nanoseconds of the fastest of REPEATS runs */
+static uint64_t run_tree(job_system &jobs, uint32_t work)
+{
+	std::vector<bench_node> nodes(LEAF_COUNT * 2);
+
+	uint64_t best_ns = UINT64_MAX;
+	for (uint32_t r=0u; r<REPEATS; ++r) {
+		job_counter counter;
+		nodes[0] = { &jobs, &counter, &nodes, 0, 0, LEAF_COUNT, work, 0 };
+
+		auto beg = std::chrono::steady_clock::now();
+		jobs.run(bench_job, &nodes[0], &counter);
+		jobs.wait(counter);
+		auto end = std::chrono::steady_clock::now();
+
+		best_ns = std::min<uint64_t>(best_ns, std::chrono::duration_cast<std::chrono::nanoseconds>(end - beg).count());
+	}
+	return best_ns;
+}
+
+void run_job_benchmark(uint32_t max_workers)
+{
+	const uint32_t hw_threads = std::max(1u, std::thread::hardware_concurrency());
+	if (max_workers == 0) {
+		max_workers = hw_threads;
+	}
+
+	std::vector<uint32_t> worker_counts;
+	for (uint32_t n=1u; n<max_workers; n*=2) {
+		worker_counts.push_back(n);
+	}
+	worker_counts.push_back(max_workers);
+
+	/* A full binary tree with LEAF_COUNT leaves */
+	const uint64_t job_count = LEAF_COUNT * 2ull - 1;
+	/* Roughly 1us of dependent multiply-adds */
+	const uint32_t leaf_work = 1000;
+
+	std::cout << "Hardware threads: " << hw_threads << '\n';
+	std::cout << "Fork-join tree of " << job_count << " jobs, best of " << REPEATS << " runs\n";
+	std::cout << std::setw(8) << "workers"
+		<< std::setw(14) << "empty Mjob/s"
+		<< std::setw(14) << "1us jobs ms"
+		<< std::setw(10) << "speedup" << '\n';
+
+	double single_ns = 0.0;
+	for (uint32_t workers : worker_counts) {
+		job_system jobs;
+		jobs.init(workers);
+		uint64_t empty_ns = run_tree(jobs, 0);
+		uint64_t work_ns = run_tree(jobs, leaf_work);
+		jobs.deinit();
+
+		if (workers == 1) {
+			single_ns = (double)work_ns;
+		}
+
+		std::cout << std::fixed << std::setprecision(2)
+			<< std::setw(8) << workers
+			<< std::setw(14) << job_count / (double)empty_ns * 1e3
+			<< std::setw(14) << work_ns / 1e6
+			<< std::setw(9) << single_ns / work_ns << "x\n";
+		std::cout.unsetf(std::ios::floatfield);
+		std::cout << std::setprecision(6);
+	}
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * CPU only job system throughput test, no Vulkan device is needed. Runs a
+ * fork-join tree of empty jobs and one of ~1us jobs for 1, 2, 4, ... workers
+ * up to max_workers (0 for one per hardware thread).
+ */
+void run_job_benchmark(uint32_t max_workers);
@@ -0,0 +1,206 @@
+#include "job_system.hpp"
+
+#include "cpu_trace.hpp"
+
+#include <assert.h>
+#include <string>
+
+/* Spins before an idle worker goes to sleep, each spin is one pass over every deque */
+static constexpr uint32_t IDLE_SPINS = 64;
+
+static thread_local const job_system *tls_system = nullptr;
+static thread_local uint32_t tls_worker_ix = 0;
+static thread_local uint32_t tls_rng = 0;
+
+static uint32_t next_random()
+{
+	/* xorshift32, only used to pick steal victims */
+	uint32_t x = tls_rng;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	tls_rng = x;
+	return x;
+}
+
+void job_system::init(uint32_t worker_count)
+{
+	if (worker_count == 0) {
+		worker_count = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	this->quit = false;
+	this->queued = 0;
+	this->sleeping = 0;
+
+	this->deques.resize(worker_count);
+	for (auto &deque : this->deques) {
+		deque = std::make_unique<job_deque>();
+	}
+
+	tls_system = this;
+	tls_worker_ix = 0;
+	tls_rng = 0x9e3779b9u;
+
+	for (uint32_t i=1u; i<worker_count; ++i) {
+		this->threads.emplace_back(&job_system::worker_main, this, i);
+	}
+}
+
+void job_system::deinit()
+{
+	{
+		std::lock_guard<std::mutex> lock(this->sleep_mutex);
+		this->quit = true;
+	}
+	this->sleep_cv.notify_all();
+
+	for (auto &thread : this->threads) {
+		thread.join();
+	}
+	this->threads.clear();
+	this->deques.clear();
+
+	if (tls_system == this) {
+		tls_system = nullptr;
+	}
+}
+
+uint32_t job_system::get_worker_index() const
+{
+	assert(tls_system == this);
+	return tls_worker_ix;
+}
+
+void job_system::run(job_fn fn, void *data, job_counter *counter)
+{
+	if (counter) {
+		counter->pending.fetch_add(1, std::memory_order_relaxed);
+	}
+	push({ fn, data, counter });
+}
+
+void job_system::run_after(job_counter &dependency, job_fn fn, void *data, job_counter *counter)
+{
+	if (counter) {
+		counter->pending.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(dependency.mutex);
+		if (dependency.pending.load(std::memory_order_acquire) != 0) {
+			dependency.continuations.push_back({ fn, data, counter });
+			return;
+		}
+	}
+	push({ fn, data, counter });
+}
+
+void job_system::wait(job_counter &counter)
+{
+	uint32_t worker_ix = get_worker_index();
+
+	job j;
+	while (!counter.done()) {
+		if (find_job(worker_ix, j)) {
+			execute(j);
+		} else {
+			std::this_thread::yield();
+		}
+	}
+}
+
+void job_system::push(const job &j)
+{
+	/* Counted before it becomes visible so a thief can't take the count below zero */
+	this->queued.fetch_add(1, std::memory_order_seq_cst);
+
+	uint32_t worker_ix = get_worker_index();
+	if (!this->deques[worker_ix]->push(j)) {
+		this->queued.fetch_sub(1, std::memory_order_relaxed);
+		execute(j);
+		return;
+	}
+
+	/* Pairs with the sleeping/queued check in worker_main, one side always sees the other */
+	if (this->sleeping.load(std::memory_order_seq_cst) != 0) {
+		std::lock_guard<std::mutex> lock(this->sleep_mutex);
+		this->sleep_cv.notify_one();
+	}
+}
+
+bool job_system::find_job(uint32_t worker_ix, job &out)
+{
+	if (this->deques[worker_ix]->pop(out)) {
+		this->queued.fetch_sub(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	uint32_t count = (uint32_t)this->deques.size();
+	uint32_t first = next_random() % count;
+	for (uint32_t i=0u; i<count; ++i) {
+		uint32_t victim = (first + i) % count;
+		if (victim != worker_ix && this->deques[victim]->steal(out)) {
+			this->queued.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+	return false;
+}
+
+void job_system::execute(const job &j)
+{
+	j.fn(j.data);
+	finish(j.counter);
+}
+
+void job_system::finish(job_counter *counter)
+{
+	if (!counter) {
+		return;
+	}
+
+	counter->finishing.fetch_add(1, std::memory_order_acq_rel);
+	if (counter->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		std::vector<job> continuations;
+		{
+			std::lock_guard<std::mutex> lock(counter->mutex);
+			continuations.swap(counter->continuations);
+		}
+		for (const auto &j : continuations) {
+			push(j);
+		}
+	}
+	counter->finishing.fetch_sub(1, std::memory_order_release);
+}
+
+void job_system::worker_main(uint32_t worker_ix)
+{
+	tls_system = this;
+	tls_worker_ix = worker_ix;
+	tls_rng = 0x9e3779b9u * (worker_ix + 1);
+	cpu_trace_set_thread_name("Worker " + std::to_string(worker_ix));
+
+	job j;
+	uint32_t idle = 0;
+	while (!this->quit.load(std::memory_order_relaxed)) {
+		if (find_job(worker_ix, j)) {
+			execute(j);
+			idle = 0;
+			continue;
+		}
+
+		if (++idle < IDLE_SPINS) {
+			std::this_thread::yield();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(this->sleep_mutex);
+		this->sleeping.fetch_add(1, std::memory_order_seq_cst);
+		this->sleep_cv.wait(lock, [this] {
+			return this->quit.load(std::memory_order_relaxed) || this->queued.load(std::memory_order_seq_cst) != 0;
+		});
+		this->sleeping.fetch_sub(1, std::memory_order_relaxed);
+		idle = 0;
+	}
+}
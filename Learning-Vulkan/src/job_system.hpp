@@ -0,0 +1,201 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+using job_fn = void (*)(void *data);
+
+struct job_counter;
+
+struct job
+{
+	job_fn fn = nullptr;
+	void *data = nullptr;
+	job_counter *counter = nullptr;
+};
+
+/*
+ * Counts the unfinished jobs that were started with it. Jobs queued with
+ * run_after() are held here and released by whichever worker finishes the
+ * last job.
+ */
+struct job_counter
+{
+	bool done() const
+	{
+		return this->pending.load(std::memory_order_acquire) == 0
+			&& this->finishing.load(std::memory_order_acquire) == 0;
+	}
+
+private:
+	friend struct job_system;
+
+	std::atomic<uint32_t> pending = 0;
+	/* Workers still touching the counter after their decrement, so a waiter can't free it under them */
+	std::atomic<uint32_t> finishing = 0;
+	std::mutex mutex;
+	std::vector<job> continuations;
+};
+
+/*
+ * Chase-Lev deque with a fixed capacity (Le et al., "Correct and Efficient
+ * Work-Stealing for Weak Memory Models"). The slot fields are atomics so a
+ * thief reading a slot the owner is reusing is a benign race, its CAS on
+ * top fails and the value is thrown away. The fences of the paper are
+ * folded into seq_cst operations on top and bottom.
+ */
+struct job_deque
+{
+	static constexpr uint32_t CAPACITY = 1 << 12;
+
+	bool push(const job &j)
+	{
+		int64_t b = this->bottom.load(std::memory_order_relaxed);
+		int64_t t = this->top.load(std::memory_order_acquire);
+		if (b - t >= (int64_t)CAPACITY) {
+			return false;
+		}
+
+		slot &s = this->slots[b & (CAPACITY - 1)];
+		s.fn.store(j.fn, std::memory_order_relaxed);
+		s.data.store(j.data, std::memory_order_relaxed);
+		s.counter.store(j.counter, std::memory_order_relaxed);
+		this->bottom.store(b + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(job &out)
+	{
+		int64_t b = this->bottom.load(std::memory_order_relaxed) - 1;
+		this->bottom.store(b, std::memory_order_seq_cst);
+		int64_t t = this->top.load(std::memory_order_seq_cst);
+
+		if (t > b) {
+			this->bottom.store(b + 1, std::memory_order_relaxed);
+			return false;
+		}
+
+		read(b, out);
+		if (t == b) {
+			/* Last job, race the thieves for it */
+			bool won = this->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+			this->bottom.store(b + 1, std::memory_order_relaxed);
+			return won;
+		}
+		return true;
+	}
+
+	bool steal(job &out)
+	{
+		int64_t t = this->top.load(std::memory_order_seq_cst);
+		int64_t b = this->bottom.load(std::memory_order_seq_cst);
+		if (t >= b) {
+			return false;
+		}
+
+		read(t, out);
+		return this->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+	}
+
+private:
+	struct slot
+	{
+		std::atomic<job_fn> fn;
+		std::atomic<void *> data;
+		std::atomic<job_counter *> counter;
+	};
+
+	void read(int64_t ix, job &out) const
+	{
+		const slot &s = this->slots[ix & (CAPACITY - 1)];
+		out.fn = s.fn.load(std::memory_order_relaxed);
+		out.data = s.data.load(std::memory_order_relaxed);
+		out.counter = s.counter.load(std::memory_order_relaxed);
+	}
+
+	alignas(64) std::atomic<int64_t> top = 0;
+	alignas(64) std::atomic<int64_t> bottom = 0;
+	alignas(64) slot slots[CAPACITY];
+};
+
+/*
+ * Work-stealing scheduler. Every worker owns a Chase-Lev deque: it pushes
+ * and pops at the bottom without contention, idle workers steal from the
+ * top of a random victim. The thread that calls init() is worker 0 and
+ * only runs jobs while it waits, the others are dedicated threads that
+ * sleep once every deque has been empty for a while. A worker whose deque
+ * holds job_deque::CAPACITY jobs runs further jobs inline.
+ */
+struct job_system
+{
+	/* Joins the workers if deinit() was skipped, a joinable std::thread would terminate the process */
+	~job_system() { deinit(); }
+
+	/* worker_count includes the calling thread, 0 uses one worker per hardware thread */
+	void init(uint32_t worker_count = 0);
+	void deinit();
+
+	uint32_t get_worker_count() const { return (uint32_t)this->deques.size(); }
+
+	/* Index of the calling worker, only valid on worker threads */
+	uint32_t get_worker_index() const;
+
+	/* Must be called from a worker, runs the job inline if the worker's deque is full */
+	void run(job_fn fn, void *data, job_counter *counter = nullptr);
+
+	/* Queues the job once dependency has no unfinished jobs left */
+	void run_after(job_counter &dependency, job_fn fn, void *data, job_counter *counter = nullptr);
+
+	/* Runs other jobs until counter is done instead of blocking */
+	void wait(job_counter &counter);
+
+	/* Calls f(beg, end) over [0, count) in batches of batch_size and waits for all of them */
+	template<typename F>
+	void parallel_for(uint32_t count, uint32_t batch_size, const F &f)
+	{
+		struct batch
+		{
+			const F *f;
+			uint32_t beg;
+			uint32_t end;
+		};
+
+		std::vector<batch> batches;
+		for (uint32_t beg=0u; beg<count; beg+=batch_size) {
+			batches.push_back({ &f, beg, std::min(count, beg + batch_size) });
+		}
+
+		job_counter counter;
+		for (auto &b : batches) {
+			run([](void *data) {
+				batch *b = (batch *)data;
+				(*b->f)(b->beg, b->end);
+			}, &b, &counter);
+		}
+		wait(counter);
+	}
+
+private:
+	void push(const job &j);
+	bool find_job(uint32_t worker_ix, job &out);
+	void execute(const job &j);
+	void finish(job_counter *counter);
+	void worker_main(uint32_t worker_ix);
+
+private:
+	std::vector<std::unique_ptr<job_deque>> deques;
+	std::vector<std::thread> threads;
+
+	/* Jobs sitting in any deque, lets idle workers decide to sleep without scanning */
+	std::atomic<uint32_t> queued = 0;
+	std::atomic<uint32_t> sleeping = 0;
+	std::atomic<bool> quit = false;
+	std::mutex sleep_mutex;
+	std::condition_variable sleep_cv;
+};
@@ -1,11 +1,354 @@
+#include "cull_bench.hpp"
+#include "job_bench.hpp"
+#include "mesh_bench.hpp"
+#include "mesh_format.hpp"
+#include "mesh_import.hpp"
+#include "mesh_optimize.hpp"
+#include "texture_import.hpp"
 #include "vk_app.hpp"
 
+#include <algorithm>
+#include <iomanip>
 #include <iostream>
 #include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
 
-int main()
+static void print_usage(const char *exe)
 {
-	vk_app app;
+	std::cerr << "Usage: " << exe << " [options]\n"
+		<< "  --frames-in-flight <n>  Frames the CPU may record ahead of the GPU (default 2)\n"
+		<< "  --headless              Render offscreen without a window (accepts CPU devices)\n"
+		<< "  --frames <n>            Stop after n frames (headless default 1000)\n"
+		<< "  --pipeline-cache <path> Where to persist the pipeline cache (default pipeline_cache.bin)\n"
+		<< "  --no-pipeline-cache     Start with a cold pipeline cache and don't write it back\n"
+		<< "  --profile               Print GPU zone timings every second\n"
+		<< "  --trace <path>          Write CPU and GPU zones as Chrome trace JSON on exit\n"
+		<< "  --trace-csv <path>      Write CPU and GPU zones as CSV rows with their frame on exit\n"
+		<< "  --cmds <n>              Stand-in commands recorded per frame (default 0)\n"
+		<< "  --workers <n>           Job system workers including the main thread (default one per hardware thread)\n"
+		<< "  --parallel-record       Record the commands as secondaries in one job per worker\n"
+		<< "  --record-bench          Measure recording throughput per worker count (implies --headless)\n"
+		<< "  --upload-kb <n>         Stream n KiB per frame through the transfer queue (default 0)\n"
+		<< "  --uniform-bytes <n>     Per-draw constants written for every stand-in command (default 0)\n"
+		<< "  --timeline              Synchronize with timeline semaphores (Vulkan 1.2)\n"
+		<< "  --bindless              Bind all resources through one descriptor indexing set (Vulkan 1.2)\n"
+		<< "  --gpu-cull <n>          Frustum cull n stand-in objects in a compute pass every frame (default 0)\n"
+		<< "  --shader-dir <path>     Where the build's SPIR-V is loaded from without a compiler (default shaders)\n"
+		<< "  --shader-source <path>  Where shader sources are compiled from (default the source tree)\n"
+		<< "  --shader-cache <path>   Where compiled SPIR-V is cached (default shader_cache)\n"
+		<< "  --hot-reload            Recompile edited shaders in the background and swap their pipelines\n"
+		<< "  --mesh <path>           Memory map a converted mesh file and upload it to the GPU\n"
+		<< "  --sim-hz <n>            Simulation ticks per second, input is applied at this rate (default 120)\n"
+		<< "  --coupled-input         Pump window events once per frame in the frame loop instead of on the main thread\n"
+		<< "  --debug-severity <s>    Least severe validation message shown: verbose, info, warning or error (default warning)\n"
+		<< "  --debug-mute <id>       Never report validation messages with this messageIdNumber, repeatable\n"
+		<< "  --debug-log <path>      Write validation messages as JSON lines\n"
+		<< "  --no-host-tracking      Let the driver allocate host memory itself instead of through tracking callbacks\n"
+		<< "  --texture <path>        Upload a texture file, or a PNG or TGA imported through the texture cache\n"
+		<< "  --texture-cache <path>  Where imported textures are cached (default texture_cache)\n"
+		<< "  --texture-format <f>    rgba8, bc1, bc5 or bc7 for imported textures (default bc7)\n"
+		<< "  --linear                Imported textures hold data rather than sRGB color\n"
+		<< "  --mip-filter <f>        box or kaiser (default kaiser)\n"
+		<< "  --job-bench             Measure job system throughput per worker count and exit, no GPU needed\n"
+		<< "  --cull-bench [n]        Measure frustum culling of n objects (default 1000000) and exit, no GPU needed\n"
+		<< "  --convert-mesh <in> <out> Optimize and convert an .obj, .gltf or .glb to the binary mesh format and exit\n"
+		<< "  --mesh-bench <in>       Compare loading an .obj, .gltf or .glb against its converted file and exit\n"
+		<< "  --convert-texture <in> <out> Build mips for a PNG or TGA, compress it to the texture format and exit\n";
+}
+
+/* Modes that run instead of the renderer */
+struct tool_args
+{
+	bool job_bench = false;
+	uint32_t cull_bench = 0;
+	std::string mesh_bench;
+	std::string convert_src;
+	std::string convert_dst;
+	std::string texture_src;
+	std::string texture_dst;
+};
+
+static bool parse_args(int argc, char **argv, vk_app_config &config, tool_args &tools)
+{
+	for (int i=1; i<argc; ++i) {
+		const char *arg = argv[i];
+		const char *val = i + 1 < argc ? argv[i + 1] : nullptr;
+
+		if (strcmp(arg, "--frames-in-flight") == 0 && val) {
+			int n = atoi(val);
+			if (n < 1) {
+				return false;
+			}
+			config.frames_in_flight = (uint32_t)n;
+			++i;
+		} else if (strcmp(arg, "--headless") == 0) {
+			config.headless = true;
+		} else if (strcmp(arg, "--frames") == 0 && val) {
+			int n = atoi(val);
+			if (n < 1) {
+				return false;
+			}
+			config.frame_count = (uint32_t)n;
+			++i;
+		} else if (strcmp(arg, "--pipeline-cache") == 0 && val) {
+			config.pipeline_cache_path = val;
+			++i;
+		} else if (strcmp(arg, "--no-pipeline-cache") == 0) {
+			config.pipeline_cache_path.clear();
+		} else if (strcmp(arg, "--profile") == 0) {
+			config.profile = true;
+		} else if (strcmp(arg, "--trace") == 0 && val) {
+			config.trace_path = val;
+			++i;
+		} else if (strcmp(arg, "--trace-csv") == 0 && val) {
+			config.trace_csv_path = val;
+			++i;
+		} else if (strcmp(arg, "--cmds") == 0 && val) {
+			int n = atoi(val);
+			if (n < 0) {
+				return false;
+			}
+			config.cmd_count = (uint32_t)n;
+			++i;
+		} else if (strcmp(arg, "--workers") == 0 && val) {
+			int n = atoi(val);
+			if (n < 0) {
+				return false;
+			}
+			config.worker_count = (uint32_t)n;
+			++i;
+		} else if (strcmp(arg, "--parallel-record") == 0) {
+			config.parallel_record = true;
+		} else if (strcmp(arg, "--record-bench") == 0) {
+			config.record_bench = true;
+		} else if (strcmp(arg, "--upload-kb") == 0 && val) {
+			int n = atoi(val);
+			if (n < 0) {
+				return false;
+			}
+			config.upload_kb = (uint32_t)n;
+			++i;
+		} else if (strcmp(arg, "--uniform-bytes") == 0 && val) {
+			int n = atoi(val);
+			if (n < 0) {
+				return false;
+			}
+			config.uniform_bytes = (uint32_t)n;
+			++i;
+		} else if (strcmp(arg, "--timeline") == 0) {
+			config.timeline = true;
+		} else if (strcmp(arg, "--bindless") == 0) {
+			config.bindless = true;
+		} else if (strcmp(arg, "--gpu-cull") == 0 && val) {
+			int n = atoi(val);
+			if (n < 0) {
+				return false;
+			}
+			config.gpu_cull_count = (uint32_t)n;
+			++i;
+		} else if (strcmp(arg, "--shader-dir") == 0 && val) {
+			config.shader_dir = val;
+			++i;
+		} else if (strcmp(arg, "--shader-source") == 0 && val) {
+			config.shader_source_dir = val;
+			++i;
+		} else if (strcmp(arg, "--shader-cache") == 0 && val) {
+			config.shader_cache_dir = val;
+			++i;
+		} else if (strcmp(arg, "--hot-reload") == 0) {
+			config.hot_reload = true;
+		} else if (strcmp(arg, "--mesh") == 0 && val) {
+			config.mesh_path = val;
+			++i;
+		} else if (strcmp(arg, "--sim-hz") == 0 && val) {
+			int n = atoi(val);
+			if (n < 1) {
+				return false;
+			}
+			config.sim_hz = (uint32_t)n;
+			++i;
+		} else if (strcmp(arg, "--coupled-input") == 0) {
+			config.coupled_input = true;
+		} else if (strcmp(arg, "--debug-severity") == 0 && val) {
+			if (strcmp(val, "verbose") == 0) {
+				config.debug_severity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT;
+			} else if (strcmp(val, "info") == 0) {
+				config.debug_severity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT;
+			} else if (strcmp(val, "warning") == 0) {
+				config.debug_severity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT;
+			} else if (strcmp(val, "error") == 0) {
+				config.debug_severity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+			} else {
+				return false;
+			}
+			++i;
+		} else if (strcmp(arg, "--debug-mute") == 0 && val) {
+			/* IDs are printed in hex, accept that as well as the signed decimal */
+			char *end = nullptr;
+			const long long id = strtoll(val, &end, 0);
+			if (*end || !id) {
+				return false;
+			}
+			config.debug_mutes.push_back((int32_t)(uint32_t)id);
+			++i;
+		} else if (strcmp(arg, "--debug-log") == 0 && val) {
+			config.debug_log_path = val;
+			++i;
+		} else if (strcmp(arg, "--no-host-tracking") == 0) {
+			config.track_host_allocations = false;
+		} else if (strcmp(arg, "--texture") == 0 && val) {
+			config.texture_path = val;
+			++i;
+		} else if (strcmp(arg, "--texture-cache") == 0 && val) {
+			config.texture_cache_dir = val;
+			++i;
+		} else if (strcmp(arg, "--texture-format") == 0 && val) {
+			if (strcmp(val, "rgba8") == 0) {
+				config.texture_options.format = texture_format::rgba8;
+			} else if (strcmp(val, "bc1") == 0) {
+				config.texture_options.format = texture_format::bc1;
+			} else if (strcmp(val, "bc5") == 0) {
+				config.texture_options.format = texture_format::bc5;
+			} else if (strcmp(val, "bc7") == 0) {
+				config.texture_options.format = texture_format::bc7;
+			} else {
+				return false;
+			}
+			++i;
+		} else if (strcmp(arg, "--linear") == 0) {
+			config.texture_options.srgb = false;
+		} else if (strcmp(arg, "--mip-filter") == 0 && val) {
+			if (strcmp(val, "box") == 0) {
+				config.texture_options.filter = mip_filter::box;
+			} else if (strcmp(val, "kaiser") == 0) {
+				config.texture_options.filter = mip_filter::kaiser;
+			} else {
+				return false;
+			}
+			++i;
+		} else if (strcmp(arg, "--job-bench") == 0) {
+			tools.job_bench = true;
+		} else if (strcmp(arg, "--cull-bench") == 0) {
+			tools.cull_bench = 1000000;
+			if (val && val[0] != '-') {
+				int n = atoi(val);
+				if (n < 1) {
+					return false;
+				}
+				tools.cull_bench = (uint32_t)n;
+				++i;
+			}
+		} else if (strcmp(arg, "--mesh-bench") == 0 && val) {
+			tools.mesh_bench = val;
+			++i;
+		} else if (strcmp(arg, "--convert-mesh") == 0 && val && i + 2 < argc) {
+			tools.convert_src = val;
+			tools.convert_dst = argv[i + 2];
+			i += 2;
+		} else if (strcmp(arg, "--convert-texture") == 0 && val && i + 2 < argc) {
+			tools.texture_src = val;
+			tools.texture_dst = argv[i + 2];
+			i += 2;
+		} else {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	vk_app_config config;
+	tool_args tools;
+	if (!parse_args(argc, argv, config, tools)) {
+		print_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (tools.job_bench) {
+		run_job_benchmark(config.worker_count);
+		return EXIT_SUCCESS;
+	}
+
+	if (tools.cull_bench) {
+		run_cull_benchmark(tools.cull_bench);
+		return EXIT_SUCCESS;
+	}
+
+	if (!tools.mesh_bench.empty()) {
+		try {
+			run_mesh_benchmark(tools.mesh_bench);
+		} catch (const std::exception &e) {
+			std::cerr << e.what() << std::endl;
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
+	if (!tools.convert_src.empty()) {
+		try {
+			mesh_data mesh;
+			import_mesh(tools.convert_src, mesh);
+			const vertex_cache_stats before = analyze_vertex_cache(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size());
+			optimize_mesh(mesh);
+			const vertex_cache_stats after = analyze_vertex_cache(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size());
+			build_meshlets(mesh);
+			write_mesh_file(tools.convert_dst, mesh);
+
+			uint32_t cone_count = 0;
+			for (const mesh_meshlet &m : mesh.meshlets) {
+				cone_count += m.cone_cutoff < 1.0f;
+			}
+			std::cout << "Wrote " << tools.convert_dst << ": "
+				<< mesh.vertices.size() << " vertices, "
+				<< mesh.indices.size() / 3 << " triangles, "
+				<< mesh.meshlets.size() << " meshlets, "
+				<< cone_count << " with backface cones\n"
+				<< "Vertex cache (" << VERTEX_CACHE_SIZE << " entry FIFO): ACMR "
+				<< before.acmr << " -> " << after.acmr << ", ATVR "
+				<< before.atvr << " -> " << after.atvr << '\n';
+		} catch (const std::exception &e) {
+			std::cerr << e.what() << std::endl;
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
+	if (!tools.texture_src.empty()) {
+		try {
+			job_system jobs;
+			jobs.init(config.worker_count);
+			texture_data texture;
+			texture_import_stats stats;
+			import_texture(tools.texture_src, config.texture_options, jobs, texture, stats);
+			const uint32_t workers = jobs.get_worker_count();
+			jobs.deinit();
+			write_texture_file(tools.texture_dst, texture);
+
+			const double mip_s = stats.mip_ns * 1e-9;
+			const double compress_s = stats.compress_ns * 1e-9;
+			std::cout << std::fixed << std::setprecision(1)
+				<< "Wrote " << tools.texture_dst << ": "
+				<< texture.width << "x" << texture.height << ", "
+				<< texture.levels.size() << " levels, "
+				<< get_texture_format_name(texture.format) << ", PSNR " << stats.psnr << " dB\n"
+				<< "Decode " << stats.decode_ns * 1e-6 << " ms, mips "
+				<< stats.mip_ns * 1e-6 << " ms (" << stats.texels / std::max(mip_s, 1e-9) * 1e-6 << " MP/s), compress "
+				<< stats.compress_ns * 1e-6 << " ms (" << stats.texels / std::max(compress_s, 1e-9) * 1e-6 << " MP/s) on "
+				<< workers << " workers\n"
+				<< "VRAM " << stats.bytes / 1024.0 << " KiB against " << stats.rgba8_bytes / 1024.0
+				<< " KiB as RGBA8, " << 100.0 * (1.0 - (double)stats.bytes / stats.rgba8_bytes) << "% saved\n";
+		} catch (const std::exception &e) {
+			std::cerr << e.what() << std::endl;
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
+	vk_app app(config);
 
 	try {
 		app.run();
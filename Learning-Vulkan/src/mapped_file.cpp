@@ -0,0 +1,119 @@
+#include "mapped_file.hpp"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(_WIN32)
+
+bool mapped_file::open(const std::string &path)
+{
+	close();
+
+	HANDLE file = CreateFileA(
+		path.c_str(),
+		GENERIC_READ,
+		FILE_SHARE_READ,
+		nullptr,
+		OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+		nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size)) {
+		CloseHandle(file);
+		return false;
+	}
+	this->file = file;
+	this->length = (size_t)size.QuadPart;
+	if (!this->length) {
+		return true;
+	}
+
+	this->mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!this->mapping) {
+		close();
+		return false;
+	}
+	this->view = MapViewOfFile(this->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!this->view) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+void mapped_file::close()
+{
+	if (this->view) {
+		UnmapViewOfFile(this->view);
+	}
+	if (this->mapping) {
+		CloseHandle(this->mapping);
+	}
+	if (this->file) {
+		CloseHandle(this->file);
+	}
+	this->view = nullptr;
+	this->mapping = nullptr;
+	this->file = nullptr;
+	this->length = 0;
+}
+
+#else
+
+bool mapped_file::open(const std::string &path)
+{
+	close();
+
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		::close(fd);
+		return false;
+	}
+	this->length = (size_t)st.st_size;
+	if (!this->length) {
+		::close(fd);
+		return true;
+	}
+
+	/* The mapping keeps its own reference to the file, the descriptor isn't needed past here */
+	void *view = mmap(nullptr, this->length, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (view == MAP_FAILED) {
+		this->length = 0;
+		return false;
+	}
+
+	/* Advice values aren't flags, each is a separate call */
+	madvise(view, this->length, MADV_SEQUENTIAL);
+	madvise(view, this->length, MADV_WILLNEED);
+	this->view = view;
+	return true;
+}
+
+void mapped_file::close()
+{
+	if (this->view) {
+		munmap((void *)this->view, this->length);
+	}
+	this->view = nullptr;
+	this->length = 0;
+}
+
+#endif
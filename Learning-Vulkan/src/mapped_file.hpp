@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stddef.h>
+#include <string>
+
+/*
+ * Read-only view of a whole file through the OS's memory mapping, so the
+ * contents come straight from the page cache without a read() copy. The
+ * pages are hinted as sequential, callers are expected to stream through.
+ */
+struct mapped_file
+{
+	mapped_file() = default;
+	mapped_file(const mapped_file &) = delete;
+	mapped_file &operator=(const mapped_file &) = delete;
+	~mapped_file() { close(); }
+
+	/* False if the file can't be opened or mapped, an empty file maps to a null view */
+	bool open(const std::string &path);
+	void close();
+
+	const void *data() const { return this->view; }
+	size_t size() const { return this->length; }
+
+private:
+	const void *view = nullptr;
+	size_t length = 0;
+#if defined(_WIN32)
+	void *file = nullptr;
+	void *mapping = nullptr;
+#endif
+};
@@ -0,0 +1,90 @@
+#include "mesh_bench.hpp"
+
+#include "mapped_file.hpp"
+#include "mesh_format.hpp"
+#include "mesh_import.hpp"
+#include "mesh_optimize.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string.h>
+#include <vector>
+
+static constexpr uint32_t REPEATS = 5;
+
+/* Returns the nanoseconds of the fastest of REPEATS runs */
+template <typename Fn>
+static uint64_t best_of(Fn &&fn)
+{
+	uint64_t best_ns = UINT64_MAX;
+	for (uint32_t r=0u; r<REPEATS; ++r) {
+		auto beg = std::chrono::steady_clock::now();
+		fn();
+		auto end = std::chrono::steady_clock::now();
+		best_ns = std::min<uint64_t>(best_ns, std::chrono::duration_cast<std::chrono::nanoseconds>(end - beg).count());
+	}
+	return best_ns;
+}
+
+void run_mesh_benchmark(const std::string &source_path)
+{
+	mesh_data mesh;
+	import_mesh(source_path, mesh);
+	optimize_mesh(mesh);
+	build_meshlets(mesh);
+
+	const std::string binary_path = (std::filesystem::temp_directory_path() / "mesh_bench.lvmesh").string();
+	write_mesh_file(binary_path, mesh);
+
+	const uint64_t source_bytes = std::filesystem::file_size(source_path);
+	const uint64_t binary_bytes = std::filesystem::file_size(binary_path);
+	const size_t vertex_bytes = mesh.vertices.size() * sizeof(mesh_vertex);
+	const size_t index_bytes = mesh.indices.size() * sizeof(uint32_t);
+
+	std::cout << "Loading " << source_path << ": "
+		<< mesh.vertices.size() << " vertices, "
+		<< mesh.indices.size() / 3 << " triangles, "
+		<< mesh.meshlets.size() << " meshlets, best of " << REPEATS << " runs\n";
+	std::cout << std::setw(8) << "path"
+		<< std::setw(12) << "MiB"
+		<< std::setw(10) << "ms"
+		<< std::setw(10) << "MB/s"
+		<< std::setw(10) << "speedup" << '\n';
+
+	/* The text path stops at an indexed mesh, the meshlets a real import would also build aren't counted */
+	const uint64_t text_ns = best_of([&]() {
+		mesh_data m;
+		import_mesh(source_path, m);
+	});
+
+	/* Stands in for the mapped staging buffer the loader copies the streams into */
+	std::vector<uint8_t> staging(vertex_bytes + index_bytes);
+	const uint64_t binary_ns = best_of([&]() {
+		mapped_file file;
+		mesh_view view;
+		if (!file.open(binary_path) || !parse_mesh_file(file.data(), file.size(), view)) {
+			throw std::runtime_error("Failed to load " + binary_path);
+		}
+		memcpy(staging.data(), view.vertices, vertex_bytes);
+		memcpy(staging.data() + vertex_bytes, view.indices, index_bytes);
+	});
+
+	auto print_row = [&](const char *name, uint64_t bytes, uint64_t ns) {
+		std::cout << std::fixed << std::setprecision(2)
+			<< std::setw(8) << name
+			<< std::setw(12) << bytes / (1024.0 * 1024.0)
+			<< std::setw(10) << ns / 1e6
+			<< std::setw(10) << bytes / (double)ns * 1e3
+			<< std::setw(9) << text_ns / (double)ns << 'x' << '\n';
+		std::cout.unsetf(std::ios::floatfield);
+		std::cout << std::setprecision(6);
+	};
+	print_row("text", source_bytes, text_ns);
+	print_row("binary", binary_bytes, binary_ns);
+
+	std::filesystem::remove(binary_path);
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <string>
+
+/*
+ * CPU only load time test, no Vulkan device is needed. Times importing
+ * source_path with the text importer against mapping the converted binary
+ * file and copying its streams where a staging buffer would be. Both run
+ * from a warm page cache, so this measures parsing rather than the disk.
+ * Throws if the source can't be imported.
+ */
+void run_mesh_benchmark(const std::string &source_path);
@@ -0,0 +1,247 @@
+#include "mesh_format.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <math.h>
+#include <stdexcept>
+
+static_assert(sizeof(mesh_vertex) == 32, "mesh_vertex is part of the file format");
+static_assert(sizeof(mesh_meshlet) == 48, "mesh_meshlet is part of the file format");
+static_assert(sizeof(mesh_file_header) == 120, "mesh_file_header is part of the file format");
+
+static uint64_t align_up(uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+/* Center of the bounding box and the farthest point from it, not minimal but cheap and stable */
+static void bounding_sphere(const mesh_vertex *vertices, const uint32_t *ids, uint32_t count, float center[3], float &radius)
+{
+	float lo[3] = { INFINITY, INFINITY, INFINITY };
+	float hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+	for (uint32_t i=0u; i<count; ++i) {
+		const mesh_vertex &v = vertices[ids ? ids[i] : i];
+		const float p[3] = { v.px, v.py, v.pz };
+		for (uint32_t k=0u; k<3u; ++k) {
+			lo[k] = std::min(lo[k], p[k]);
+			hi[k] = std::max(hi[k], p[k]);
+		}
+	}
+
+	float radius_sq = 0.0f;
+	for (uint32_t k=0u; k<3u; ++k) {
+		center[k] = count ? (lo[k] + hi[k]) * 0.5f : 0.0f;
+	}
+	for (uint32_t i=0u; i<count; ++i) {
+		const mesh_vertex &v = vertices[ids ? ids[i] : i];
+		const float dx = v.px - center[0], dy = v.py - center[1], dz = v.pz - center[2];
+		radius_sq = std::max(radius_sq, dx * dx + dy * dy + dz * dz);
+	}
+	radius = sqrtf(radius_sq);
+}
+
+/* Average of the unit triangle normals, with the sine of the widest angle any of them makes with it */
+static void normal_cone(const mesh_data &mesh, const mesh_meshlet &meshlet, float axis[3], float &cutoff)
+{
+	const uint32_t *ids = mesh.meshlet_vertices.data() + meshlet.vertex_offset;
+	const uint8_t *tris = mesh.meshlet_triangles.data() + meshlet.triangle_offset;
+
+	std::vector<float> normals;
+	normals.reserve(meshlet.triangle_count * 3);
+	float sum[3] = {};
+	for (uint32_t t=0u; t<meshlet.triangle_count; ++t) {
+		const mesh_vertex &a = mesh.vertices[ids[tris[t * 3]]];
+		const mesh_vertex &b = mesh.vertices[ids[tris[t * 3 + 1]]];
+		const mesh_vertex &c = mesh.vertices[ids[tris[t * 3 + 2]]];
+		const float e1[3] = { b.px - a.px, b.py - a.py, b.pz - a.pz };
+		const float e2[3] = { c.px - a.px, c.py - a.py, c.pz - a.pz };
+		float n[3] = {
+			e1[1] * e2[2] - e1[2] * e2[1],
+			e1[2] * e2[0] - e1[0] * e2[2],
+			e1[0] * e2[1] - e1[1] * e2[0]};
+		const float len = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (len == 0.0f) {
+			continue;
+		}
+		for (uint32_t k=0u; k<3u; ++k) {
+			n[k] /= len;
+			sum[k] += n[k];
+			normals.push_back(n[k]);
+		}
+	}
+
+	axis[0] = axis[1] = axis[2] = 0.0f;
+	cutoff = 1.0f;
+	const float len = sqrtf(sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2]);
+	if (len == 0.0f) {
+		return;
+	}
+	for (uint32_t k=0u; k<3u; ++k) {
+		axis[k] = sum[k] / len;
+	}
+
+	float min_dot = 1.0f;
+	for (size_t i=0u; i<normals.size(); i+=3) {
+		min_dot = std::min(min_dot, normals[i] * axis[0] + normals[i + 1] * axis[1] + normals[i + 2] * axis[2]);
+	}
+	/* Past about 84 degrees from the axis the cone would almost never cull anything */
+	if (min_dot > 0.1f) {
+		cutoff = sqrtf(1.0f - min_dot * min_dot);
+	}
+}
+
+void build_meshlets(mesh_data &mesh)
+{
+	static constexpr uint8_t UNUSED = 0xff;
+
+	mesh.meshlets.clear();
+	mesh.meshlet_vertices.clear();
+	mesh.meshlet_triangles.clear();
+
+	/* Local index of every vertex in the meshlet being built */
+	std::vector<uint8_t> local(mesh.vertices.size(), UNUSED);
+	mesh_meshlet current = {};
+
+	auto finish = [&]() {
+		if (!current.triangle_count) {
+			return;
+		}
+		const uint32_t *ids = mesh.meshlet_vertices.data() + current.vertex_offset;
+		bounding_sphere(mesh.vertices.data(), ids, current.vertex_count, current.center, current.radius);
+		normal_cone(mesh, current, current.cone_axis, current.cone_cutoff);
+		for (uint32_t i=0u; i<current.vertex_count; ++i) {
+			local[ids[i]] = UNUSED;
+		}
+		mesh.meshlets.push_back(current);
+
+		current = {};
+		current.vertex_offset = (uint32_t)mesh.meshlet_vertices.size();
+		current.triangle_offset = (uint32_t)mesh.meshlet_triangles.size();
+	};
+
+	for (size_t t=0u; t+2<mesh.indices.size(); t+=3) {
+		const uint32_t *tri = &mesh.indices[t];
+		/* Counts a repeated new vertex twice, which only ever ends a meshlet a little early */
+		const uint32_t new_vertices = (local[tri[0]] == UNUSED) + (local[tri[1]] == UNUSED) + (local[tri[2]] == UNUSED);
+		if (current.vertex_count + new_vertices > MAX_MESHLET_VERTICES || current.triangle_count == MAX_MESHLET_TRIANGLES) {
+			finish();
+		}
+
+		for (uint32_t k=0u; k<3u; ++k) {
+			if (local[tri[k]] == UNUSED) {
+				local[tri[k]] = (uint8_t)current.vertex_count++;
+				mesh.meshlet_vertices.push_back(tri[k]);
+			}
+			mesh.meshlet_triangles.push_back(local[tri[k]]);
+		}
+		++current.triangle_count;
+	}
+	finish();
+}
+
+void write_mesh_file(const std::string &path, const mesh_data &mesh)
+{
+	mesh_file_header header = {};
+	header.magic = MESH_FILE_MAGIC;
+	header.version = MESH_FILE_VERSION;
+	header.vertex_stride = sizeof(mesh_vertex);
+	header.vertex_count = (uint32_t)mesh.vertices.size();
+	header.index_count = (uint32_t)mesh.indices.size();
+	header.meshlet_count = (uint32_t)mesh.meshlets.size();
+	header.meshlet_vertex_count = (uint32_t)mesh.meshlet_vertices.size();
+	header.meshlet_triangle_bytes = (uint32_t)mesh.meshlet_triangles.size();
+
+	struct section
+	{
+		uint64_t *offset;
+		const void *data;
+		uint64_t size;
+	};
+	section sections[] = {
+		{ &header.vertex_offset, mesh.vertices.data(), mesh.vertices.size() * sizeof(mesh_vertex) },
+		{ &header.index_offset, mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t) },
+		{ &header.meshlet_offset, mesh.meshlets.data(), mesh.meshlets.size() * sizeof(mesh_meshlet) },
+		{ &header.meshlet_vertices_offset, mesh.meshlet_vertices.data(), mesh.meshlet_vertices.size() * sizeof(uint32_t) },
+		{ &header.meshlet_triangles_offset, mesh.meshlet_triangles.data(), mesh.meshlet_triangles.size() }};
+
+	uint64_t offset = align_up(sizeof(header), MESH_SECTION_ALIGNMENT);
+	for (section &s : sections) {
+		*s.offset = offset;
+		offset = align_up(offset + s.size, MESH_SECTION_ALIGNMENT);
+	}
+	header.file_size = offset;
+
+	for (uint32_t k=0u; k<3u; ++k) {
+		header.bounds_min[k] = mesh.vertices.empty() ? 0.0f : INFINITY;
+		header.bounds_max[k] = mesh.vertices.empty() ? 0.0f : -INFINITY;
+	}
+	for (const mesh_vertex &v : mesh.vertices) {
+		const float p[3] = { v.px, v.py, v.pz };
+		for (uint32_t k=0u; k<3u; ++k) {
+			header.bounds_min[k] = std::min(header.bounds_min[k], p[k]);
+			header.bounds_max[k] = std::max(header.bounds_max[k], p[k]);
+		}
+	}
+	bounding_sphere(mesh.vertices.data(), nullptr, header.vertex_count, header.center, header.radius);
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file) {
+		throw std::runtime_error("Failed to open " + path + " for writing");
+	}
+
+	static const char padding[MESH_SECTION_ALIGNMENT] = {};
+	file.write((const char *)&header, sizeof(header));
+	uint64_t written = sizeof(header);
+	for (const section &s : sections) {
+		file.write(padding, *s.offset - written);
+		file.write((const char *)s.data, s.size);
+		written = *s.offset + s.size;
+	}
+	file.write(padding, header.file_size - written);
+
+	if (!file.flush()) {
+		throw std::runtime_error("Failed to write " + path);
+	}
+}
+
+/* Overflow safe, a crafted count can't wrap the end of a section back into the file */
+static bool section_fits(uint64_t offset, uint64_t count, uint64_t element_size, uint64_t size)
+{
+	return offset % MESH_SECTION_ALIGNMENT == 0
+		&& offset <= size
+		&& count <= (size - offset) / element_size;
+}
+
+bool parse_mesh_file(const void *data, size_t size, mesh_view &view)
+{
+	if (!data || size < sizeof(mesh_file_header)) {
+		return false;
+	}
+
+	/* Mappings are page aligned, so the header and every aligned section are too */
+	const mesh_file_header *header = (const mesh_file_header *)data;
+	if (header->magic != MESH_FILE_MAGIC
+			|| header->version != MESH_FILE_VERSION
+			|| header->vertex_stride != sizeof(mesh_vertex)
+			|| header->file_size != size) {
+		return false;
+	}
+
+	if (!section_fits(header->vertex_offset, header->vertex_count, sizeof(mesh_vertex), size)
+			|| !section_fits(header->index_offset, header->index_count, sizeof(uint32_t), size)
+			|| !section_fits(header->meshlet_offset, header->meshlet_count, sizeof(mesh_meshlet), size)
+			|| !section_fits(header->meshlet_vertices_offset, header->meshlet_vertex_count, sizeof(uint32_t), size)
+			|| !section_fits(header->meshlet_triangles_offset, header->meshlet_triangle_bytes, 1, size)) {
+		return false;
+	}
+
+	/* Index and meshlet contents are trusted, checking them would mean reading every byte */
+	const uint8_t *base = (const uint8_t *)data;
+	view.header = header;
+	view.vertices = (const mesh_vertex *)(base + header->vertex_offset);
+	view.indices = (const uint32_t *)(base + header->index_offset);
+	view.meshlets = (const mesh_meshlet *)(base + header->meshlet_offset);
+	view.meshlet_vertices = (const uint32_t *)(base + header->meshlet_vertices_offset);
+	view.meshlet_triangles = base + header->meshlet_triangles_offset;
+	return true;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+ * Binary mesh container, written offline by the converter and read back
+ * through a memory mapping without any parsing. The file is a header
+ * followed by sections at MESH_SECTION_ALIGNMENT aligned offsets, each
+ * already in the layout the GPU consumes, so a section is uploaded by
+ * pointing the staging copy at the mapping. Little endian only.
+ */
+static constexpr uint32_t MESH_FILE_MAGIC = 0x534d564c; /* "LVMS" */
+static constexpr uint32_t MESH_FILE_VERSION = 2;
+static constexpr uint64_t MESH_SECTION_ALIGNMENT = 16;
+
+static constexpr uint32_t MAX_MESHLET_VERTICES = 64;
+static constexpr uint32_t MAX_MESHLET_TRIANGLES = 124;
+
+struct mesh_vertex
+{
+	float px, py, pz;
+	float nx, ny, nz;
+	float u, v;
+};
+
+/*
+ * A cluster of triangles small enough for one mesh shader workgroup, with
+ * a sphere to frustum cull it by and a cone of its triangle normals to
+ * backface cull it by: every triangle faces away from a camera at eye when
+ * dot(center - eye, cone_axis) >= cone_cutoff * length(center - eye) + radius.
+ * cone_cutoff is 1 when the normals spread too far for the test to pass.
+ */
+struct mesh_meshlet
+{
+	/* First entry in the meshlet vertex table and first byte in the triangle table */
+	uint32_t vertex_offset;
+	uint32_t triangle_offset;
+	uint32_t vertex_count;
+	uint32_t triangle_count;
+	float center[3];
+	float radius;
+	float cone_axis[3];
+	float cone_cutoff;
+};
+
+struct mesh_file_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t vertex_stride;
+	uint32_t vertex_count;
+	uint32_t index_count;
+	uint32_t meshlet_count;
+	/* Entries of the meshlet vertex table, indices into the vertex stream */
+	uint32_t meshlet_vertex_count;
+	/* Bytes of the meshlet triangle table, three local uint8_t vertex indices per triangle */
+	uint32_t meshlet_triangle_bytes;
+
+	/* Offsets from the start of the file */
+	uint64_t vertex_offset;
+	uint64_t index_offset;
+	uint64_t meshlet_offset;
+	uint64_t meshlet_vertices_offset;
+	uint64_t meshlet_triangles_offset;
+	uint64_t file_size;
+
+	float bounds_min[3];
+	float bounds_max[3];
+	float center[3];
+	float radius;
+};
+
+/* What the importers produce and the converter writes, uint32_t triangle list indices */
+struct mesh_data
+{
+	std::vector<mesh_vertex> vertices;
+	std::vector<uint32_t> indices;
+	std::vector<mesh_meshlet> meshlets;
+	std::vector<uint32_t> meshlet_vertices;
+	std::vector<uint8_t> meshlet_triangles;
+};
+
+/* Sections of a loaded file, pointing into the caller's memory */
+struct mesh_view
+{
+	const mesh_file_header *header = nullptr;
+	const mesh_vertex *vertices = nullptr;
+	const uint32_t *indices = nullptr;
+	const mesh_meshlet *meshlets = nullptr;
+	const uint32_t *meshlet_vertices = nullptr;
+	const uint8_t *meshlet_triangles = nullptr;
+};
+
+/*
+ * Splits the index buffer into meshlets in index order, replacing any there
+ * were. Run it on cache optimized indices, where neighbouring triangles
+ * already sit together.
+ */
+void build_meshlets(mesh_data &mesh);
+
+/* Throws on I/O errors */
+void write_mesh_file(const std::string &path, const mesh_data &mesh);
+
+/*
+ * Checks the header and that every section lies inside size bytes, then
+ * points view at the sections. Nothing is copied, data must stay alive
+ * and unchanged for as long as the view is used. False if the data is not
+ * a mesh file of this version or is truncated.
+ */
+bool parse_mesh_file(const void *data, size_t size, mesh_view &view);
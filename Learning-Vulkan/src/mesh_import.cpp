@@ -0,0 +1,654 @@
+#include "mesh_import.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <math.h>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+static std::vector<char> read_file(const std::string &path)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		throw std::runtime_error("Failed to open " + path);
+	}
+	return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+/* Area weighted face normals summed per vertex, for vertices from first_vertex used by indices from first_index */
+static void generate_normals(mesh_data &mesh, size_t first_vertex, size_t first_index)
+{
+	for (size_t i=first_vertex; i<mesh.vertices.size(); ++i) {
+		mesh.vertices[i].nx = mesh.vertices[i].ny = mesh.vertices[i].nz = 0.0f;
+	}
+
+	for (size_t t=first_index; t+2<mesh.indices.size(); t+=3) {
+		mesh_vertex &a = mesh.vertices[mesh.indices[t]];
+		mesh_vertex &b = mesh.vertices[mesh.indices[t + 1]];
+		mesh_vertex &c = mesh.vertices[mesh.indices[t + 2]];
+		const float e1[3] = { b.px - a.px, b.py - a.py, b.pz - a.pz };
+		const float e2[3] = { c.px - a.px, c.py - a.py, c.pz - a.pz };
+		const float n[3] = {
+			e1[1] * e2[2] - e1[2] * e2[1],
+			e1[2] * e2[0] - e1[0] * e2[2],
+			e1[0] * e2[1] - e1[1] * e2[0]};
+		for (mesh_vertex *v : { &a, &b, &c }) {
+			v->nx += n[0];
+			v->ny += n[1];
+			v->nz += n[2];
+		}
+	}
+
+	for (size_t i=first_vertex; i<mesh.vertices.size(); ++i) {
+		mesh_vertex &v = mesh.vertices[i];
+		const float len = sqrtf(v.nx * v.nx + v.ny * v.ny + v.nz * v.nz);
+		if (len > 0.0f) {
+			v.nx /= len;
+			v.ny /= len;
+			v.nz /= len;
+		} else {
+			v.ny = 1.0f;
+		}
+	}
+}
+
+/* OBJ */
+
+struct obj_key
+{
+	int32_t position, texcoord, normal;
+
+	bool operator==(const obj_key &o) const
+	{
+		return this->position == o.position && this->texcoord == o.texcoord && this->normal == o.normal;
+	}
+};
+
+struct obj_key_hash
+{
+	size_t operator()(const obj_key &k) const
+	{
+		uint64_t h = (uint64_t)(uint32_t)k.position * 0x9E3779B97F4A7C15ull;
+		h ^= ((uint64_t)(uint32_t)k.texcoord + (h << 6) + (h >> 2)) * 0xC2B2AE3D27D4EB4Full;
+		h ^= ((uint64_t)(uint32_t)k.normal + (h << 6) + (h >> 2)) * 0x165667B19E3779F9ull;
+		return (size_t)h;
+	}
+};
+
+static const char *skip_spaces(const char *p)
+{
+	while (*p == ' ' || *p == '\t') {
+		++p;
+	}
+	return p;
+}
+
+static const char *skip_line(const char *p)
+{
+	while (*p && *p != '\n') {
+		++p;
+	}
+	return *p ? p + 1 : p;
+}
+
+/* Turns a 1-based or negative relative OBJ index into a 0-based one, -1 when absent or out of range */
+static int32_t resolve_obj_index(long ix, size_t count)
+{
+	long resolved = ix > 0 ? ix - 1 : (long)count + ix;
+	return ix != 0 && resolved >= 0 && (size_t)resolved < count ? (int32_t)resolved : -1;
+}
+
+void import_obj(const std::string &path, mesh_data &mesh)
+{
+	std::vector<char> text = read_file(path);
+	/* strtof and strtol stop at the terminator, so they can never run off the end */
+	text.push_back('\0');
+
+	std::vector<float> positions, texcoords, normals;
+	std::unordered_map<obj_key, uint32_t, obj_key_hash> welded;
+	std::vector<uint32_t> face;
+
+	const size_t first_vertex = mesh.vertices.size();
+	const size_t first_index = mesh.indices.size();
+
+	const char *p = text.data();
+	while (*p) {
+		p = skip_spaces(p);
+		char *next;
+
+		if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+			p += 2;
+			for (uint32_t k=0u; k<3u; ++k) {
+				positions.push_back(strtof(p, &next));
+				p = next;
+			}
+		} else if (p[0] == 'v' && p[1] == 't' && (p[2] == ' ' || p[2] == '\t')) {
+			p += 3;
+			for (uint32_t k=0u; k<2u; ++k) {
+				texcoords.push_back(strtof(p, &next));
+				p = next;
+			}
+		} else if (p[0] == 'v' && p[1] == 'n' && (p[2] == ' ' || p[2] == '\t')) {
+			p += 3;
+			for (uint32_t k=0u; k<3u; ++k) {
+				normals.push_back(strtof(p, &next));
+				p = next;
+			}
+		} else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+			p += 2;
+			face.clear();
+			for (;;) {
+				p = skip_spaces(p);
+				if (*p == '\0' || *p == '\n' || *p == '\r' || *p == '#') {
+					break;
+				}
+
+				/* v, v/t, v//n or v/t/n */
+				obj_key key = { -1, -1, -1 };
+				key.position = resolve_obj_index(strtol(p, &next, 10), positions.size() / 3);
+				if (next == p || key.position < 0) {
+					throw std::runtime_error("Failed to parse face in " + path);
+				}
+				p = next;
+				if (*p == '/') {
+					++p;
+					if (*p != '/') {
+						key.texcoord = resolve_obj_index(strtol(p, &next, 10), texcoords.size() / 2);
+						p = next;
+					}
+					if (*p == '/') {
+						++p;
+						key.normal = resolve_obj_index(strtol(p, &next, 10), normals.size() / 3);
+						p = next;
+					}
+				}
+
+				auto it = welded.find(key);
+				if (it == welded.end()) {
+					mesh_vertex v = {};
+					v.px = positions[key.position * 3];
+					v.py = positions[key.position * 3 + 1];
+					v.pz = positions[key.position * 3 + 2];
+					if (key.normal >= 0) {
+						v.nx = normals[key.normal * 3];
+						v.ny = normals[key.normal * 3 + 1];
+						v.nz = normals[key.normal * 3 + 2];
+					}
+					if (key.texcoord >= 0) {
+						/* OBJ puts v = 0 at the bottom, Vulkan samples it at the top */
+						v.u = texcoords[key.texcoord * 2];
+						v.v = 1.0f - texcoords[key.texcoord * 2 + 1];
+					}
+					it = welded.emplace(key, (uint32_t)mesh.vertices.size()).first;
+					mesh.vertices.push_back(v);
+				}
+				face.push_back(it->second);
+			}
+
+			/* Polygons are fanned, fine for the convex faces exporters write */
+			for (size_t i=2u; i<face.size(); ++i) {
+				mesh.indices.push_back(face[0]);
+				mesh.indices.push_back(face[i - 1]);
+				mesh.indices.push_back(face[i]);
+			}
+		}
+
+		p = skip_line(p);
+	}
+
+	if (normals.empty()) {
+		generate_normals(mesh, first_vertex, first_index);
+	}
+}
+
+/* glTF */
+
+struct json_value
+{
+	enum class kind { null, boolean, number, string, array, object };
+
+	kind type = kind::null;
+	bool boolean = false;
+	double number = 0.0;
+	std::string string;
+	std::vector<json_value> array;
+	std::vector<std::pair<std::string, json_value>> object;
+
+	const json_value *find(const char *key) const
+	{
+		for (const auto &member : this->object) {
+			if (member.first == key) {
+				return &member.second;
+			}
+		}
+		return nullptr;
+	}
+
+	/* Integer member or fallback when it is missing */
+	int64_t get_int(const char *key, int64_t fallback) const
+	{
+		const json_value *v = find(key);
+		return v && v->type == kind::number ? (int64_t)v->number : fallback;
+	}
+};
+
+/* Just enough JSON for glTF, the files come from exporters so errors only need to be caught, not explained */
+struct json_parser
+{
+	const char *p;
+	const char *end;
+
+	[[noreturn]] void fail()
+	{
+		throw std::runtime_error("Failed to parse glTF JSON");
+	}
+
+	void skip_whitespace()
+	{
+		while (this->p < this->end && (*this->p == ' ' || *this->p == '\t' || *this->p == '\n' || *this->p == '\r')) {
+			++this->p;
+		}
+	}
+
+	void expect(char c)
+	{
+		skip_whitespace();
+		if (this->p >= this->end || *this->p != c) {
+			fail();
+		}
+		++this->p;
+	}
+
+	bool match(const char *literal)
+	{
+		size_t len = strlen(literal);
+		if ((size_t)(this->end - this->p) < len || strncmp(this->p, literal, len) != 0) {
+			return false;
+		}
+		this->p += len;
+		return true;
+	}
+
+	std::string parse_string()
+	{
+		expect('"');
+		std::string s;
+		while (this->p < this->end && *this->p != '"') {
+			char c = *this->p++;
+			if (c != '\\') {
+				s.push_back(c);
+				continue;
+			}
+			if (this->p >= this->end) {
+				fail();
+			}
+			c = *this->p++;
+			switch (c) {
+			case 'b': s.push_back('\b'); break;
+			case 'f': s.push_back('\f'); break;
+			case 'n': s.push_back('\n'); break;
+			case 'r': s.push_back('\r'); break;
+			case 't': s.push_back('\t'); break;
+			case 'u': {
+				if (this->end - this->p < 4) {
+					fail();
+				}
+				uint32_t cp = (uint32_t)strtoul(std::string(this->p, 4).c_str(), nullptr, 16);
+				this->p += 4;
+				/* Surrogate pairs come out as two 3 byte sequences, names and URIs are ASCII in practice */
+				if (cp < 0x80) {
+					s.push_back((char)cp);
+				} else if (cp < 0x800) {
+					s.push_back((char)(0xC0 | (cp >> 6)));
+					s.push_back((char)(0x80 | (cp & 0x3F)));
+				} else {
+					s.push_back((char)(0xE0 | (cp >> 12)));
+					s.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+					s.push_back((char)(0x80 | (cp & 0x3F)));
+				}
+				break;
+			}
+			default: s.push_back(c); break;
+			}
+		}
+		expect('"');
+		return s;
+	}
+
+	json_value parse_value()
+	{
+		skip_whitespace();
+		if (this->p >= this->end) {
+			fail();
+		}
+
+		json_value v;
+		if (*this->p == '{') {
+			++this->p;
+			v.type = json_value::kind::object;
+			skip_whitespace();
+			if (this->p < this->end && *this->p == '}') {
+				++this->p;
+				return v;
+			}
+			do {
+				std::string key = parse_string();
+				expect(':');
+				v.object.emplace_back(std::move(key), parse_value());
+				skip_whitespace();
+			} while (this->p < this->end && *this->p == ',' && ++this->p);
+			expect('}');
+		} else if (*this->p == '[') {
+			++this->p;
+			v.type = json_value::kind::array;
+			skip_whitespace();
+			if (this->p < this->end && *this->p == ']') {
+				++this->p;
+				return v;
+			}
+			do {
+				v.array.push_back(parse_value());
+				skip_whitespace();
+			} while (this->p < this->end && *this->p == ',' && ++this->p);
+			expect(']');
+		} else if (*this->p == '"') {
+			v.type = json_value::kind::string;
+			v.string = parse_string();
+		} else if (match("true")) {
+			v.type = json_value::kind::boolean;
+			v.boolean = true;
+		} else if (match("false")) {
+			v.type = json_value::kind::boolean;
+		} else if (match("null")) {
+			v.type = json_value::kind::null;
+		} else {
+			/* The document is copied into a terminated string, strtod can't read past it */
+			char *next;
+			v.type = json_value::kind::number;
+			v.number = strtod(this->p, &next);
+			if (next == this->p) {
+				fail();
+			}
+			this->p = next;
+		}
+		return v;
+	}
+};
+
+static json_value parse_json(const char *data, size_t size)
+{
+	std::string text(data, size);
+	json_parser parser = { text.data(), text.data() + text.size() };
+	return parser.parse_value();
+}
+
+static std::vector<uint8_t> decode_base64(const char *p, const char *end)
+{
+	auto decode = [](char c) -> int {
+		if (c >= 'A' && c <= 'Z') return c - 'A';
+		if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+		if (c >= '0' && c <= '9') return c - '0' + 52;
+		if (c == '+') return 62;
+		if (c == '/') return 63;
+		return -1;
+	};
+
+	std::vector<uint8_t> out;
+	out.reserve((end - p) / 4 * 3);
+	uint32_t bits = 0, bit_count = 0;
+	for (; p < end; ++p) {
+		int d = decode(*p);
+		if (d < 0) {
+			continue;
+		}
+		bits = (bits << 6) | (uint32_t)d;
+		bit_count += 6;
+		if (bit_count >= 8) {
+			bit_count -= 8;
+			out.push_back((uint8_t)(bits >> bit_count));
+		}
+	}
+	return out;
+}
+
+static constexpr uint32_t GLB_MAGIC = 0x46546C67;
+static constexpr uint32_t GLB_CHUNK_JSON = 0x4E4F534A;
+static constexpr uint32_t GLB_CHUNK_BIN = 0x004E4942;
+
+static constexpr int64_t GLTF_UNSIGNED_BYTE = 5121;
+static constexpr int64_t GLTF_UNSIGNED_SHORT = 5123;
+static constexpr int64_t GLTF_UNSIGNED_INT = 5125;
+static constexpr int64_t GLTF_FLOAT = 5126;
+static constexpr int64_t GLTF_TRIANGLES = 4;
+
+struct gltf_document
+{
+	json_value json;
+	std::vector<std::vector<uint8_t>> buffers;
+};
+
+static const json_value &gltf_element(const json_value &root, const char *array, int64_t ix)
+{
+	const json_value *a = root.find(array);
+	if (!a || ix < 0 || (size_t)ix >= a->array.size()) {
+		throw std::runtime_error(std::string("glTF ") + array + " index out of range");
+	}
+	return a->array[ix];
+}
+
+/* Returns the accessor's first element and its stride, after checking it fits in its buffer */
+static const uint8_t *gltf_accessor(
+	const gltf_document &doc,
+	int64_t accessor_ix,
+	int64_t element_size,
+	size_t &count,
+	size_t &stride)
+{
+	const json_value &accessor = gltf_element(doc.json, "accessors", accessor_ix);
+	if (accessor.find("sparse")) {
+		throw std::runtime_error("Sparse glTF accessors are not supported");
+	}
+	const json_value &view = gltf_element(doc.json, "bufferViews", accessor.get_int("bufferView", -1));
+	const int64_t buffer_ix = view.get_int("buffer", -1);
+	if (buffer_ix < 0 || (size_t)buffer_ix >= doc.buffers.size()) {
+		throw std::runtime_error("glTF buffer index out of range");
+	}
+	const std::vector<uint8_t> &buffer = doc.buffers[buffer_ix];
+
+	/* Untrusted, each is range checked on its own before any arithmetic that could wrap */
+	const int64_t view_offset = view.get_int("byteOffset", 0);
+	const int64_t view_length = view.get_int("byteLength", 0);
+	const int64_t accessor_offset = accessor.get_int("byteOffset", 0);
+	const int64_t accessor_count = accessor.get_int("count", 0);
+	const int64_t view_stride = view.get_int("byteStride", element_size);
+	if (view_offset < 0 || view_length < 0 || accessor_offset < 0 || accessor_count < 0 || view_stride < element_size
+			|| (uint64_t)view_offset > buffer.size()
+			|| (uint64_t)view_length > buffer.size() - (size_t)view_offset
+			|| accessor_offset > view_length) {
+		throw std::runtime_error("glTF accessor out of bounds");
+	}
+
+	count = (size_t)accessor_count;
+	stride = (size_t)view_stride;
+	const size_t offset = (size_t)view_offset + (size_t)accessor_offset;
+	const size_t available = (size_t)(view_length - accessor_offset);
+	/* The last element starts (count - 1) strides in, compared by division so nothing overflows */
+	if (count && (available < (size_t)element_size || count - 1 > (available - (size_t)element_size) / stride)) {
+		throw std::runtime_error("glTF accessor out of bounds");
+	}
+	return buffer.data() + offset;
+}
+
+static void check_float_accessor(const gltf_document &doc, int64_t accessor_ix, const char *type)
+{
+	const json_value &accessor = gltf_element(doc.json, "accessors", accessor_ix);
+	const json_value *t = accessor.find("type");
+	if (accessor.get_int("componentType", 0) != GLTF_FLOAT || !t || t->string != type) {
+		throw std::runtime_error(std::string("glTF attributes must be float ") + type);
+	}
+}
+
+static void import_gltf_primitive(const gltf_document &doc, const json_value &primitive, mesh_data &mesh)
+{
+	const json_value *attributes = primitive.find("attributes");
+	const int64_t position_ix = attributes ? attributes->get_int("POSITION", -1) : -1;
+	if (position_ix < 0) {
+		return;
+	}
+	const int64_t normal_ix = attributes->get_int("NORMAL", -1);
+	const int64_t texcoord_ix = attributes->get_int("TEXCOORD_0", -1);
+
+	const size_t first_vertex = mesh.vertices.size();
+	const size_t first_index = mesh.indices.size();
+
+	size_t count, stride;
+	check_float_accessor(doc, position_ix, "VEC3");
+	const uint8_t *positions = gltf_accessor(doc, position_ix, 12, count, stride);
+	mesh.vertices.resize(first_vertex + count, mesh_vertex{});
+	for (size_t i=0u; i<count; ++i) {
+		memcpy(&mesh.vertices[first_vertex + i].px, positions + i * stride, 12);
+	}
+
+	if (normal_ix >= 0) {
+		size_t normal_count;
+		check_float_accessor(doc, normal_ix, "VEC3");
+		const uint8_t *normals = gltf_accessor(doc, normal_ix, 12, normal_count, stride);
+		for (size_t i=0u; i<std::min(count, normal_count); ++i) {
+			memcpy(&mesh.vertices[first_vertex + i].nx, normals + i * stride, 12);
+		}
+	}
+
+	if (texcoord_ix >= 0) {
+		size_t texcoord_count;
+		check_float_accessor(doc, texcoord_ix, "VEC2");
+		const uint8_t *texcoords = gltf_accessor(doc, texcoord_ix, 8, texcoord_count, stride);
+		for (size_t i=0u; i<std::min(count, texcoord_count); ++i) {
+			memcpy(&mesh.vertices[first_vertex + i].u, texcoords + i * stride, 8);
+		}
+	}
+
+	const int64_t indices_ix = primitive.get_int("indices", -1);
+	if (indices_ix < 0) {
+		for (size_t i=0u; i<count; ++i) {
+			mesh.indices.push_back((uint32_t)(first_vertex + i));
+		}
+	} else {
+		const int64_t type = gltf_element(doc.json, "accessors", indices_ix).get_int("componentType", 0);
+		const int64_t size = type == GLTF_UNSIGNED_INT ? 4 : type == GLTF_UNSIGNED_SHORT ? 2 : type == GLTF_UNSIGNED_BYTE ? 1 : 0;
+		if (!size) {
+			throw std::runtime_error("Unsupported glTF index type");
+		}
+
+		size_t index_count;
+		const uint8_t *indices = gltf_accessor(doc, indices_ix, size, index_count, stride);
+		for (size_t i=0u; i<index_count; ++i) {
+			uint32_t ix = 0;
+			memcpy(&ix, indices + i * stride, size);
+			if (ix >= count) {
+				throw std::runtime_error("glTF index out of range");
+			}
+			mesh.indices.push_back((uint32_t)(first_vertex + ix));
+		}
+	}
+	mesh.indices.resize(first_index + (mesh.indices.size() - first_index) / 3 * 3);
+
+	if (normal_ix < 0) {
+		generate_normals(mesh, first_vertex, first_index);
+	}
+}
+
+void import_gltf(const std::string &path, mesh_data &mesh)
+{
+	std::vector<char> file = read_file(path);
+
+	gltf_document doc;
+	std::vector<uint8_t> glb_bin;
+	uint32_t magic = 0;
+	if (file.size() >= 4) {
+		memcpy(&magic, file.data(), 4);
+	}
+
+	if (magic == GLB_MAGIC) {
+		/* 12 byte header, then chunks of length, type and data, JSON first */
+		size_t offset = 12;
+		bool have_json = false;
+		while (offset + 8 <= file.size()) {
+			uint32_t chunk_length, chunk_type;
+			memcpy(&chunk_length, file.data() + offset, 4);
+			memcpy(&chunk_type, file.data() + offset + 4, 4);
+			offset += 8;
+			if (chunk_length > file.size() - offset) {
+				throw std::runtime_error("Truncated GLB chunk in " + path);
+			}
+			if (chunk_type == GLB_CHUNK_JSON && !have_json) {
+				doc.json = parse_json(file.data() + offset, chunk_length);
+				have_json = true;
+			} else if (chunk_type == GLB_CHUNK_BIN && glb_bin.empty()) {
+				glb_bin.assign(file.data() + offset, file.data() + offset + chunk_length);
+			}
+			offset += chunk_length;
+		}
+		if (!have_json) {
+			throw std::runtime_error("No JSON chunk in " + path);
+		}
+	} else {
+		doc.json = parse_json(file.data(), file.size());
+	}
+
+	const std::filesystem::path dir = std::filesystem::path(path).parent_path();
+	if (const json_value *buffers = doc.json.find("buffers")) {
+		for (const json_value &buffer : buffers->array) {
+			const json_value *uri = buffer.find("uri");
+			if (!uri) {
+				doc.buffers.push_back(std::move(glb_bin));
+			} else if (uri->string.compare(0, 5, "data:") == 0) {
+				size_t comma = uri->string.find(',');
+				if (comma == std::string::npos) {
+					throw std::runtime_error("Malformed glTF data URI");
+				}
+				doc.buffers.push_back(decode_base64(uri->string.data() + comma + 1, uri->string.data() + uri->string.size()));
+			} else {
+				std::vector<char> data = read_file((dir / uri->string).string());
+				doc.buffers.emplace_back(data.begin(), data.end());
+			}
+		}
+	}
+
+	const json_value *meshes = doc.json.find("meshes");
+	if (!meshes) {
+		return;
+	}
+	for (const json_value &m : meshes->array) {
+		const json_value *primitives = m.find("primitives");
+		if (!primitives) {
+			continue;
+		}
+		for (const json_value &primitive : primitives->array) {
+			if (primitive.get_int("mode", GLTF_TRIANGLES) == GLTF_TRIANGLES) {
+				import_gltf_primitive(doc, primitive, mesh);
+			}
+		}
+	}
+}
+
+void import_mesh(const std::string &path, mesh_data &mesh)
+{
+	std::string ext = std::filesystem::path(path).extension().string();
+	for (char &c : ext) {
+		c = (char)tolower((unsigned char)c);
+	}
+
+	if (ext == ".obj") {
+		import_obj(path, mesh);
+	} else if (ext == ".gltf" || ext == ".glb") {
+		import_gltf(path, mesh);
+	} else {
+		throw std::runtime_error("Unknown mesh format " + ext + ", expected .obj, .gltf or .glb");
+	}
+}
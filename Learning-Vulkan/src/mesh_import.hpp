@@ -0,0 +1,24 @@
+#pragma once
+
+#include "mesh_format.hpp"
+
+#include <string>
+
+/*
+ * Text and glTF importers for the offline converter. Everything is merged
+ * into one indexed triangle list with identical vertices welded; missing
+ * normals are generated from the faces. Throw on unreadable or
+ * unsupported input. Meshlets are left for build_meshlets().
+ */
+void import_obj(const std::string &path, mesh_data &mesh);
+
+/*
+ * .gltf with external or base64 buffers, or .glb. Every triangle primitive
+ * of every mesh is taken in mesh space, node transforms are not applied.
+ * Attributes must be floats, which is all the core spec allows for
+ * POSITION and NORMAL anyway.
+ */
+void import_gltf(const std::string &path, mesh_data &mesh);
+
+/* Picks the importer by extension */
+void import_mesh(const std::string &path, mesh_data &mesh);
@@ -0,0 +1,297 @@
+#include "mesh_optimize.hpp"
+
+#include <algorithm>
+#include <math.h>
+#include <vector>
+
+/*
+ * FIFO cache modeled with timestamps: a vertex is cached while fewer than
+ * cache_size misses happened since it was loaded. Advancing the clock by
+ * more than cache_size empties it.
+ */
+struct fifo_cache
+{
+	std::vector<uint32_t> loaded_at;
+	uint32_t clock;
+	uint32_t cache_size;
+
+	fifo_cache(size_t vertex_count, uint32_t cache_size) :
+		loaded_at(vertex_count, 0),
+		clock(cache_size + 1),
+		cache_size(cache_size) {}
+
+	bool is_cached(uint32_t v) const { return this->clock - this->loaded_at[v] <= this->cache_size; }
+
+	/* Returns the misses of one triangle */
+	uint32_t access(const uint32_t *tri)
+	{
+		uint32_t misses = 0;
+		for (uint32_t k=0u; k<3u; ++k) {
+			if (!is_cached(tri[k])) {
+				this->loaded_at[tri[k]] = this->clock++;
+				++misses;
+			}
+		}
+		return misses;
+	}
+
+	void flush() { this->clock += this->cache_size + 1; }
+};
+
+vertex_cache_stats analyze_vertex_cache(const uint32_t *indices, size_t index_count, size_t vertex_count, uint32_t cache_size)
+{
+	vertex_cache_stats stats;
+	const size_t tri_count = index_count / 3;
+	if (!tri_count) {
+		return stats;
+	}
+
+	fifo_cache cache(vertex_count, cache_size);
+	std::vector<bool> referenced(vertex_count, false);
+	size_t misses = 0, unique = 0;
+	for (size_t t=0u; t<tri_count; ++t) {
+		misses += cache.access(indices + t * 3);
+		for (uint32_t k=0u; k<3u; ++k) {
+			if (!referenced[indices[t * 3 + k]]) {
+				referenced[indices[t * 3 + k]] = true;
+				++unique;
+			}
+		}
+	}
+
+	stats.acmr = (float)misses / (float)tri_count;
+	stats.atvr = (float)misses / (float)unique;
+	return stats;
+}
+
+void optimize_vertex_cache(uint32_t *indices, size_t index_count, size_t vertex_count, uint32_t cache_size)
+{
+	const size_t tri_count = index_count / 3;
+	if (tri_count < 2) {
+		return;
+	}
+
+	/* Triangles around every vertex, and how many of them are still to be emitted */
+	std::vector<uint32_t> live(vertex_count, 0);
+	for (size_t i=0u; i<tri_count * 3; ++i) {
+		++live[indices[i]];
+	}
+	std::vector<uint32_t> adjacency_offsets(vertex_count + 1, 0);
+	for (size_t v=0u; v<vertex_count; ++v) {
+		adjacency_offsets[v + 1] = adjacency_offsets[v] + live[v];
+	}
+	std::vector<uint32_t> adjacency(tri_count * 3);
+	{
+		std::vector<uint32_t> fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+		for (size_t i=0u; i<tri_count * 3; ++i) {
+			adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);
+		}
+	}
+
+	fifo_cache cache(vertex_count, cache_size);
+	std::vector<bool> emitted(tri_count, false);
+	std::vector<uint32_t> dead_ends;
+	std::vector<uint32_t> candidates;
+	std::vector<uint32_t> out;
+	out.reserve(tri_count * 3);
+	size_t cursor = 0;
+
+	int64_t fan = indices[0];
+	while (fan >= 0) {
+		candidates.clear();
+		for (uint32_t a=adjacency_offsets[fan]; a<adjacency_offsets[fan + 1]; ++a) {
+			const uint32_t t = adjacency[a];
+			if (emitted[t]) {
+				continue;
+			}
+			emitted[t] = true;
+
+			const uint32_t *tri = indices + t * 3;
+			cache.access(tri);
+			for (uint32_t k=0u; k<3u; ++k) {
+				out.push_back(tri[k]);
+				dead_ends.push_back(tri[k]);
+				candidates.push_back(tri[k]);
+				--live[tri[k]];
+			}
+		}
+
+		/* Next fan: the candidate that stays in the cache longest while its remaining triangles are emitted */
+		fan = -1;
+		int64_t best_priority = -1;
+		for (uint32_t v : candidates) {
+			if (!live[v]) {
+				continue;
+			}
+			int64_t priority = 0;
+			const uint32_t age = cache.clock - cache.loaded_at[v];
+			if (age + 2 * live[v] <= cache_size) {
+				priority = age;
+			}
+			if (priority > best_priority) {
+				best_priority = priority;
+				fan = v;
+			}
+		}
+
+		/* Dead end, restart from the most recent vertex with triangles left, or the next one in order */
+		while (fan < 0 && !dead_ends.empty()) {
+			const uint32_t v = dead_ends.back();
+			dead_ends.pop_back();
+			if (live[v]) {
+				fan = v;
+			}
+		}
+		while (fan < 0 && cursor < vertex_count) {
+			if (live[cursor]) {
+				fan = (int64_t)cursor;
+			}
+			++cursor;
+		}
+	}
+
+	std::copy(out.begin(), out.end(), indices);
+}
+
+void optimize_overdraw(
+	uint32_t *indices,
+	size_t index_count,
+	const mesh_vertex *vertices,
+	size_t vertex_count,
+	float threshold,
+	uint32_t cache_size)
+{
+	const size_t tri_count = index_count / 3;
+	if (tri_count < 2) {
+		return;
+	}
+
+	/* Hard boundaries where the cache optimizer had to restart, every vertex of the triangle missed */
+	std::vector<size_t> hard;
+	{
+		fifo_cache cache(vertex_count, cache_size);
+		for (size_t t=0u; t<tri_count; ++t) {
+			if (cache.access(indices + t * 3) == 3 || t == 0) {
+				hard.push_back(t);
+			}
+		}
+		hard.push_back(tri_count);
+	}
+
+	/* Soft boundaries, as soon as a cluster's running ACMR is within threshold of its whole */
+	std::vector<size_t> clusters;
+	fifo_cache cache(vertex_count, cache_size);
+	for (size_t h=0u; h+1<hard.size(); ++h) {
+		const size_t beg = hard[h], end = hard[h + 1];
+
+		cache.flush();
+		size_t misses = 0;
+		for (size_t t=beg; t<end; ++t) {
+			misses += cache.access(indices + t * 3);
+		}
+		const float target = (float)misses / (float)(end - beg) * threshold;
+
+		cache.flush();
+		clusters.push_back(beg);
+		size_t start = beg;
+		misses = 0;
+		for (size_t t=beg; t<end; ++t) {
+			misses += cache.access(indices + t * 3);
+			if (t + 1 < end && (float)misses <= target * (float)(t + 1 - start)) {
+				clusters.push_back(t + 1);
+				start = t + 1;
+				misses = 0;
+				cache.flush();
+			}
+		}
+	}
+	clusters.push_back(tri_count);
+
+	/* Area weighted centroid and normal per cluster, faces are weighted by their cross product */
+	const size_t cluster_count = clusters.size() - 1;
+	std::vector<float> sort_keys(cluster_count, 0.0f);
+	std::vector<float> centroids(cluster_count * 3, 0.0f);
+	std::vector<float> normals(cluster_count * 3, 0.0f);
+	float mesh_centroid[3] = {};
+	float mesh_area = 0.0f;
+	for (size_t c=0u; c<cluster_count; ++c) {
+		float area = 0.0f;
+		for (size_t t=clusters[c]; t<clusters[c + 1]; ++t) {
+			const mesh_vertex &a = vertices[indices[t * 3]];
+			const mesh_vertex &b = vertices[indices[t * 3 + 1]];
+			const mesh_vertex &d = vertices[indices[t * 3 + 2]];
+			const float e1[3] = { b.px - a.px, b.py - a.py, b.pz - a.pz };
+			const float e2[3] = { d.px - a.px, d.py - a.py, d.pz - a.pz };
+			const float n[3] = {
+				e1[1] * e2[2] - e1[2] * e2[1],
+				e1[2] * e2[0] - e1[0] * e2[2],
+				e1[0] * e2[1] - e1[1] * e2[0]};
+			const float w = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			const float center[3] = { (a.px + b.px + d.px) / 3.0f, (a.py + b.py + d.py) / 3.0f, (a.pz + b.pz + d.pz) / 3.0f };
+			for (uint32_t k=0u; k<3u; ++k) {
+				centroids[c * 3 + k] += center[k] * w;
+				normals[c * 3 + k] += n[k];
+			}
+			area += w;
+		}
+
+		for (uint32_t k=0u; k<3u; ++k) {
+			mesh_centroid[k] += centroids[c * 3 + k];
+			centroids[c * 3 + k] = area > 0.0f ? centroids[c * 3 + k] / area : 0.0f;
+		}
+		mesh_area += area;
+	}
+	for (uint32_t k=0u; k<3u; ++k) {
+		mesh_centroid[k] = mesh_area > 0.0f ? mesh_centroid[k] / mesh_area : 0.0f;
+	}
+
+	/* How far out along its own normal a cluster sits, the further out the likelier it occludes */
+	for (size_t c=0u; c<cluster_count; ++c) {
+		const float *n = &normals[c * 3];
+		const float len = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (len > 0.0f) {
+			for (uint32_t k=0u; k<3u; ++k) {
+				sort_keys[c] += (centroids[c * 3 + k] - mesh_centroid[k]) * n[k] / len;
+			}
+		}
+	}
+
+	std::vector<uint32_t> order(cluster_count);
+	for (uint32_t c=0u; c<cluster_count; ++c) {
+		order[c] = c;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return sort_keys[a] > sort_keys[b]; });
+
+	std::vector<uint32_t> out;
+	out.reserve(tri_count * 3);
+	for (uint32_t c : order) {
+		out.insert(out.end(), indices + clusters[c] * 3, indices + clusters[c + 1] * 3);
+	}
+	std::copy(out.begin(), out.end(), indices);
+}
+
+void optimize_vertex_fetch(mesh_data &mesh)
+{
+	std::vector<uint32_t> remap(mesh.vertices.size(), UINT32_MAX);
+	std::vector<mesh_vertex> vertices;
+	vertices.reserve(mesh.vertices.size());
+	for (uint32_t &ix : mesh.indices) {
+		if (remap[ix] == UINT32_MAX) {
+			remap[ix] = (uint32_t)vertices.size();
+			vertices.push_back(mesh.vertices[ix]);
+		}
+		ix = remap[ix];
+	}
+	mesh.vertices.swap(vertices);
+}
+
+void optimize_mesh(mesh_data &mesh)
+{
+	mesh.meshlets.clear();
+	mesh.meshlet_vertices.clear();
+	mesh.meshlet_triangles.clear();
+
+	optimize_vertex_cache(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size());
+	optimize_overdraw(mesh.indices.data(), mesh.indices.size(), mesh.vertices.data(), mesh.vertices.size());
+	optimize_vertex_fetch(mesh);
+}
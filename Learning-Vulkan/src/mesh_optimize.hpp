@@ -0,0 +1,57 @@
+#pragma once
+
+#include "mesh_format.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Entries of the FIFO post-transform cache the optimizers and the report model */
+static constexpr uint32_t VERTEX_CACHE_SIZE = 16;
+
+struct vertex_cache_stats
+{
+	/* Vertices transformed per triangle, 3 is the worst and about 0.5 the best a closed mesh reaches */
+	float acmr = 0.0f;
+	/* Vertices transformed per vertex referenced, 1 is the best */
+	float atvr = 0.0f;
+};
+
+/* Simulates a FIFO cache of cache_size entries over the triangle list */
+vertex_cache_stats analyze_vertex_cache(
+	const uint32_t *indices,
+	size_t index_count,
+	size_t vertex_count,
+	uint32_t cache_size = VERTEX_CACHE_SIZE);
+
+/*
+ * Reorders triangles for post-transform cache reuse with Tipsify (Sander,
+ * Nehab and Barczak 2007): fans around one vertex at a time and picks the
+ * next fan vertex among those still in the cache. Linear time, vertices
+ * are untouched.
+ */
+void optimize_vertex_cache(
+	uint32_t *indices,
+	size_t index_count,
+	size_t vertex_count,
+	uint32_t cache_size = VERTEX_CACHE_SIZE);
+
+/*
+ * Reorders clusters of a cache optimized triangle list so outward facing
+ * ones on the outside of the mesh come first, which draws occluders before
+ * what they hide from most viewpoints. Clusters are split until each has
+ * an ACMR within threshold of where it started, so the cache reuse lost is
+ * bounded by threshold.
+ */
+void optimize_overdraw(
+	uint32_t *indices,
+	size_t index_count,
+	const mesh_vertex *vertices,
+	size_t vertex_count,
+	float threshold = 1.05f,
+	uint32_t cache_size = VERTEX_CACHE_SIZE);
+
+/* Renumbers vertices in order of first use so fetches walk memory forwards, unused vertices are dropped */
+void optimize_vertex_fetch(mesh_data &mesh);
+
+/* Vertex cache, overdraw then vertex fetch, clearing any meshlets since the indices change */
+void optimize_mesh(mesh_data &mesh);
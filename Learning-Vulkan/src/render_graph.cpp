@@ -0,0 +1,492 @@
+#include "render_graph.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+static constexpr VkAccessFlags WRITE_ACCESS =
+	VK_ACCESS_SHADER_WRITE_BIT
+	| VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+	| VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT
+	| VK_ACCESS_TRANSFER_WRITE_BIT
+	| VK_ACCESS_HOST_WRITE_BIT
+	| VK_ACCESS_MEMORY_WRITE_BIT;
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+static VkImageAspectFlags aspect_from_format(VkFormat format)
+{
+	switch (format) {
+	case VK_FORMAT_D16_UNORM:
+	case VK_FORMAT_X8_D24_UNORM_PACK32:
+	case VK_FORMAT_D32_SFLOAT:
+		return VK_IMAGE_ASPECT_DEPTH_BIT;
+	case VK_FORMAT_S8_UINT:
+		return VK_IMAGE_ASPECT_STENCIL_BIT;
+	case VK_FORMAT_D16_UNORM_S8_UINT:
+	case VK_FORMAT_D24_UNORM_S8_UINT:
+	case VK_FORMAT_D32_SFLOAT_S8_UINT:
+		return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+	default:
+		return VK_IMAGE_ASPECT_COLOR_BIT;
+	}
+}
+
+static VkImageUsageFlags image_usage_from_state(const rg_state &state)
+{
+	VkImageUsageFlags usage = 0;
+	switch (state.layout) {
+	case VK_IMAGE_LAYOUT_GENERAL:
+		usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+		break;
+	case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
+		usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+		break;
+	case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
+	case VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL:
+		usage |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+		break;
+	case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
+		usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+		break;
+	case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
+		usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		break;
+	case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
+		usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+		break;
+	default:
+		break;
+	}
+	if (state.access & VK_ACCESS_INPUT_ATTACHMENT_READ_BIT) {
+		usage |= VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+	}
+	return usage;
+}
+
+static VkBufferUsageFlags buffer_usage_from_state(const rg_state &state)
+{
+	VkBufferUsageFlags usage = 0;
+	if (state.access & VK_ACCESS_TRANSFER_READ_BIT) {
+		usage |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	}
+	if (state.access & VK_ACCESS_TRANSFER_WRITE_BIT) {
+		usage |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	}
+	if (state.access & VK_ACCESS_UNIFORM_READ_BIT) {
+		usage |= VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+	}
+	if (state.access & (VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT)) {
+		usage |= VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	}
+	if (state.access & VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT) {
+		usage |= VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+	}
+	if (state.access & VK_ACCESS_INDEX_READ_BIT) {
+		usage |= VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+	}
+	if (state.access & VK_ACCESS_INDIRECT_COMMAND_READ_BIT) {
+		usage |= VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+	}
+	return usage;
+}
+
+rg_resource render_graph::create_image(const char *name, VkFormat format, VkExtent2D extent)
+{
+	rg_resource_info info;
+	info.name = name;
+	info.image = true;
+	info.format = format;
+	info.extent = { extent.width, extent.height, 1 };
+	info.aspect = aspect_from_format(format);
+	return add_resource(std::move(info));
+}
+
+rg_resource render_graph::create_buffer(const char *name, VkDeviceSize size)
+{
+	rg_resource_info info;
+	info.name = name;
+	info.size = size;
+	return add_resource(std::move(info));
+}
+
+rg_resource render_graph::import_image(
+	const char *name,
+	VkFormat format,
+	VkExtent2D extent,
+	const rg_state &initial,
+	const rg_state &final)
+{
+	rg_resource_info info;
+	info.name = name;
+	info.image = true;
+	info.imported = true;
+	info.format = format;
+	info.extent = { extent.width, extent.height, 1 };
+	info.aspect = aspect_from_format(format);
+	info.initial = initial;
+	info.final = final;
+	return add_resource(std::move(info));
+}
+
+rg_resource render_graph::import_buffer(const char *name, VkDeviceSize size, const rg_state &initial, const rg_state &final)
+{
+	rg_resource_info info;
+	info.name = name;
+	info.imported = true;
+	info.size = size;
+	info.initial = initial;
+	info.final = final;
+	return add_resource(std::move(info));
+}
+
+uint32_t render_graph::add_pass(const char *name, execute_fn fn, bool side_effect)
+{
+	this->passes.push_back({ name, std::move(fn), side_effect, {} });
+	return (uint32_t)this->passes.size() - 1;
+}
+
+void render_graph::read(uint32_t pass, rg_resource resource, VkPipelineStageFlags stages, VkAccessFlags access, VkImageLayout layout)
+{
+	add_access(pass, resource, { stages, access, layout }, false);
+}
+
+void render_graph::write(uint32_t pass, rg_resource resource, VkPipelineStageFlags stages, VkAccessFlags access, VkImageLayout layout)
+{
+	add_access(pass, resource, { stages, access, layout }, true);
+}
+
+void render_graph::compile(VkDeviceSize granularity, const requirements_fn &get_requirements)
+{
+	this->compiled.clear();
+	this->final_barriers = {};
+	this->stats = {};
+
+	std::vector<uint32_t> live = cull();
+	for (uint32_t p : live) {
+		this->compiled.push_back({ p, {} });
+	}
+	this->stats.pass_count = (uint32_t)this->passes.size();
+	this->stats.culled_count = (uint32_t)(this->passes.size() - live.size());
+
+	/* Lifetimes and usage only count live passes, a culled reader neither extends nor shapes a resource */
+	this->lifetimes.assign(this->resources.size(), { UINT32_MAX, 0 });
+	for (auto &res : this->resources) {
+		res.image_usage = 0;
+		res.buffer_usage = 0;
+	}
+	for (uint32_t i=0u; i<this->compiled.size(); ++i) {
+		for (const auto &a : this->passes[this->compiled[i].pass].accesses) {
+			lifetime &life = this->lifetimes[a.resource];
+			life.first = std::min(life.first, i);
+			life.last = std::max(life.last, i);
+
+			rg_resource_info &res = this->resources[a.resource];
+			if (res.image) {
+				res.image_usage |= image_usage_from_state(a.state);
+			} else {
+				res.buffer_usage |= buffer_usage_from_state(a.state);
+			}
+		}
+	}
+
+	place_transients(granularity, get_requirements);
+	build_barriers();
+}
+
+void render_graph::clear()
+{
+	this->resources.clear();
+	this->passes.clear();
+	this->compiled.clear();
+	this->final_barriers = {};
+	this->lifetimes.clear();
+	this->requirements.clear();
+	this->placements.clear();
+	this->heaps.clear();
+	this->stats = {};
+}
+
+rg_resource render_graph::add_resource(rg_resource_info &&info)
+{
+	this->resources.push_back(std::move(info));
+	return (rg_resource)this->resources.size() - 1;
+}
+
+void render_graph::add_access(uint32_t pass, rg_resource resource, const rg_state &state, bool write)
+{
+	/* A pass touching a resource twice gets one merged access, an image has one layout per pass */
+	for (auto &a : this->passes[pass].accesses) {
+		if (a.resource != resource) {
+			continue;
+		}
+		if (this->resources[resource].image && a.state.layout != state.layout) {
+			throw std::runtime_error("Render graph pass uses an image in two layouts");
+		}
+		a.state.stages |= state.stages;
+		a.state.access |= state.access;
+		a.read |= !write;
+		a.write |= write;
+		return;
+	}
+	this->passes[pass].accesses.push_back({ resource, state, !write, write });
+}
+
+/*
+ * Walks the passes backwards keeping only those that have a side effect,
+ * write an imported resource or write something a kept pass reads.
+ * Returns the live passes in submission order.
+ */
+std::vector<uint32_t> render_graph::cull()
+{
+	std::vector<bool> needed(this->resources.size(), false);
+	std::vector<uint32_t> live;
+
+	for (uint32_t p=(uint32_t)this->passes.size(); p-- > 0u;) {
+		const pass &ps = this->passes[p];
+
+		bool keep = ps.side_effect;
+		for (const auto &a : ps.accesses) {
+			if (a.write && (this->resources[a.resource].imported || needed[a.resource])) {
+				keep = true;
+			}
+		}
+		if (!keep) {
+			continue;
+		}
+
+		live.push_back(p);
+		/* A read-modify-write still needs whatever produced the contents */
+		for (const auto &a : ps.accesses) {
+			if (a.read) {
+				needed[a.resource] = true;
+			}
+		}
+	}
+
+	std::reverse(live.begin(), live.end());
+	return live;
+}
+
+/*
+ * Greedy placement, largest first: every live transient goes to the first
+ * heap with a compatible memory type, at the lowest offset that doesn't
+ * overlap a resource already there whose lifetime overlaps its own.
+ */
+void render_graph::place_transients(VkDeviceSize granularity, const requirements_fn &get_requirements)
+{
+	this->requirements.assign(this->resources.size(), {});
+	this->placements.assign(this->resources.size(), {});
+	this->heaps.clear();
+
+	std::vector<rg_resource> order;
+	for (rg_resource r=0u; r<this->resources.size(); ++r) {
+		if (this->resources[r].imported || !is_live(r)) {
+			continue;
+		}
+		this->requirements[r] = get_requirements(r, this->resources[r]);
+		this->stats.transient_bytes += this->requirements[r].size;
+		order.push_back(r);
+	}
+	std::stable_sort(order.begin(), order.end(), [&](rg_resource a, rg_resource b) {
+		return this->requirements[a].size > this->requirements[b].size;
+	});
+
+	std::vector<rg_resource> placed;
+	for (rg_resource r : order) {
+		const VkMemoryRequirements &reqs = this->requirements[r];
+		const VkDeviceSize alignment = std::max(reqs.alignment, granularity);
+
+		uint32_t heap_ix = 0;
+		while (heap_ix < this->heaps.size() && !(this->heaps[heap_ix].memory_type_bits & reqs.memoryTypeBits)) {
+			++heap_ix;
+		}
+		if (heap_ix == this->heaps.size()) {
+			this->heaps.push_back({ reqs.memoryTypeBits, 0, 1 });
+		}
+		rg_heap &heap = this->heaps[heap_ix];
+
+		VkDeviceSize offset = 0;
+		for (bool moved=true; moved;) {
+			moved = false;
+			for (rg_resource other : placed) {
+				const rg_placement &op = this->placements[other];
+				const lifetime &a = this->lifetimes[r];
+				const lifetime &b = this->lifetimes[other];
+				if (op.heap != heap_ix || a.last < b.first || b.last < a.first) {
+					continue;
+				}
+				VkDeviceSize other_end = op.offset + this->requirements[other].size;
+				if (offset < other_end && op.offset < offset + reqs.size) {
+					offset = align_up(other_end, alignment);
+					moved = true;
+				}
+			}
+		}
+
+		this->placements[r] = { heap_ix, offset };
+		heap.memory_type_bits &= reqs.memoryTypeBits;
+		heap.size = std::max(heap.size, offset + reqs.size);
+		heap.alignment = std::max(heap.alignment, alignment);
+		placed.push_back(r);
+	}
+
+	for (const auto &heap : this->heaps) {
+		this->stats.heap_bytes += heap.size;
+	}
+}
+
+void render_graph::build_barriers()
+{
+	/* Where the last write happened, who has seen it since and who read the resource after it */
+	struct resource_state
+	{
+		VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkPipelineStageFlags write_stages = 0;
+		VkAccessFlags write_access = 0;
+		VkPipelineStageFlags read_stages = 0;
+		VkPipelineStageFlags visible_stages = 0;
+		VkAccessFlags visible_access = 0;
+	};
+
+	/* Everything a transient is used for in a frame, a superset of its last use */
+	std::vector<VkPipelineStageFlags> used_stages(this->resources.size(), 0);
+	std::vector<VkAccessFlags> written_access(this->resources.size(), 0);
+	for (const auto &cp : this->compiled) {
+		for (const auto &a : this->passes[cp.pass].accesses) {
+			used_stages[a.resource] |= a.state.stages;
+			written_access[a.resource] |= a.write ? a.state.access & WRITE_ACCESS : 0;
+		}
+	}
+
+	std::vector<resource_state> states(this->resources.size());
+	for (rg_resource r=0u; r<this->resources.size(); ++r) {
+		const rg_resource_info &res = this->resources[r];
+		resource_state &s = states[r];
+
+		if (res.imported) {
+			s.layout = res.initial.layout;
+			if (res.initial.stages != VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT) {
+				s.write_stages = res.initial.stages;
+			}
+			s.write_access = res.initial.access;
+			continue;
+		}
+		if (!is_live(r)) {
+			continue;
+		}
+
+		/*
+		 * The graph runs every frame on the same queue, so the first use of
+		 * a transient must wait for the previous frame's uses of its memory,
+		 * its own and those of every resource aliasing it.
+		 */
+		const rg_placement &p = this->placements[r];
+		for (rg_resource other=0u; other<this->resources.size(); ++other) {
+			if (this->resources[other].imported || !is_live(other)) {
+				continue;
+			}
+			const rg_placement &op = this->placements[other];
+			if (op.heap == p.heap
+					&& op.offset < p.offset + this->requirements[r].size
+					&& p.offset < op.offset + this->requirements[other].size) {
+				s.write_stages |= used_stages[other];
+				s.write_access |= written_access[other];
+			}
+		}
+	}
+
+	auto count = [&](rg_barrier_batch &b) {
+		if (b.empty()) {
+			return;
+		}
+		/* An execution dependency still needs a stage on each side */
+		if (!b.src_stages) {
+			b.src_stages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+		}
+		if (!b.dst_stages) {
+			b.dst_stages = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+		}
+		++this->stats.barrier_batches;
+		this->stats.image_barriers += (uint32_t)b.images.size();
+		if (b.src_access || b.dst_access) {
+			++this->stats.memory_barriers;
+		}
+	};
+
+	for (auto &cp : this->compiled) {
+		rg_barrier_batch &b = cp.barriers;
+
+		for (const auto &a : this->passes[cp.pass].accesses) {
+			resource_state &s = states[a.resource];
+			const rg_state &st = a.state;
+
+			if (this->resources[a.resource].image && st.layout != s.layout) {
+				/* The transition is a write of its own, ordered after every earlier use */
+				b.images.push_back({ a.resource, s.write_access, st.access, s.layout, st.layout });
+				b.src_stages |= s.write_stages | s.read_stages;
+				b.dst_stages |= st.stages;
+				s.layout = st.layout;
+				s.write_stages = st.stages;
+				s.write_access = 0;
+				s.read_stages = 0;
+				s.visible_stages = st.stages;
+				s.visible_access = st.access;
+			} else if (a.write) {
+				/* WAW and WAR, the latter only needs an execution dependency */
+				if (s.write_stages | s.read_stages) {
+					b.src_stages |= s.write_stages | s.read_stages;
+					b.dst_stages |= st.stages;
+					if (s.write_access) {
+						b.src_access |= s.write_access;
+						b.dst_access |= st.access;
+					}
+				}
+			} else if (s.write_stages
+					&& ((st.stages & ~s.visible_stages) || (st.access & ~s.visible_access))) {
+				/* RAW, readers that already saw the write share it without another barrier */
+				b.src_stages |= s.write_stages;
+				b.src_access |= s.write_access;
+				b.dst_stages |= st.stages;
+				b.dst_access |= st.access;
+				s.visible_stages |= st.stages;
+				s.visible_access |= st.access;
+			}
+
+			if (a.write) {
+				s.write_stages = st.stages;
+				s.write_access = st.access & WRITE_ACCESS;
+				s.read_stages = 0;
+				s.visible_stages = 0;
+				s.visible_access = 0;
+			} else {
+				s.read_stages |= st.stages;
+			}
+		}
+		count(b);
+	}
+
+	/* Hand imported resources back in the state their owner expects, used or not */
+	rg_barrier_batch &b = this->final_barriers;
+	for (rg_resource r=0u; r<this->resources.size(); ++r) {
+		const rg_resource_info &res = this->resources[r];
+		const resource_state &s = states[r];
+		if (!res.imported) {
+			continue;
+		}
+
+		if (res.image && res.final.layout != VK_IMAGE_LAYOUT_UNDEFINED && res.final.layout != s.layout) {
+			b.images.push_back({ r, s.write_access, res.final.access, s.layout, res.final.layout });
+			b.src_stages |= s.write_stages | s.read_stages;
+			b.dst_stages |= res.final.stages;
+		} else if (res.final.access && s.write_access) {
+			b.src_stages |= s.write_stages;
+			b.src_access |= s.write_access;
+			b.dst_stages |= res.final.stages;
+			b.dst_access |= res.final.access;
+		}
+	}
+	count(b);
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <vulkan/vulkan_core.h>
+
+#include <functional>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* Index of a resource in its render_graph */
+using rg_resource = uint32_t;
+
+/* How a resource is used at a point in the frame */
+struct rg_state
+{
+	VkPipelineStageFlags stages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+	VkAccessFlags access = 0;
+	/* Ignored for buffers */
+	VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+};
+
+struct rg_resource_info
+{
+	std::string name;
+	bool image = false;
+	/* Owned outside the graph, imported resources are never culled away or aliased */
+	bool imported = false;
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	VkExtent3D extent = {};
+	VkImageAspectFlags aspect = 0;
+	VkDeviceSize size = 0;
+	/* Derived from the declared accesses when the graph is compiled */
+	VkImageUsageFlags image_usage = 0;
+	VkBufferUsageFlags buffer_usage = 0;
+	/* State before the first and after the last pass, only used for imported resources */
+	rg_state initial;
+	rg_state final;
+};
+
+struct rg_image_barrier
+{
+	rg_resource resource;
+	VkAccessFlags src_access;
+	VkAccessFlags dst_access;
+	VkImageLayout old_layout;
+	VkImageLayout new_layout;
+};
+
+/* One vkCmdPipelineBarrier, hazards that need no layout change share a single VkMemoryBarrier */
+struct rg_barrier_batch
+{
+	VkPipelineStageFlags src_stages = 0;
+	VkPipelineStageFlags dst_stages = 0;
+	VkAccessFlags src_access = 0;
+	VkAccessFlags dst_access = 0;
+	std::vector<rg_image_barrier> images;
+
+	bool empty() const { return !this->src_stages && !this->dst_stages && this->images.empty(); }
+};
+
+/* Where a transient resource lives, offset is relative to its heap */
+struct rg_placement
+{
+	uint32_t heap = 0;
+	VkDeviceSize offset = 0;
+};
+
+struct rg_heap
+{
+	uint32_t memory_type_bits = 0;
+	VkDeviceSize size = 0;
+	VkDeviceSize alignment = 1;
+};
+
+struct rg_stats
+{
+	uint32_t pass_count = 0;
+	uint32_t culled_count = 0;
+	/* vkCmdPipelineBarrier calls per execution, and what they contain */
+	uint32_t barrier_batches = 0;
+	uint32_t image_barriers = 0;
+	uint32_t memory_barriers = 0;
+	/* Transient memory if every resource had its own allocation, and after aliasing */
+	VkDeviceSize transient_bytes = 0;
+	VkDeviceSize heap_bytes = 0;
+};
+
+/*
+ * Frame graph compiler. Passes declare what they read and write, compile()
+ * then drops passes whose results are never used, works out the barriers
+ * and layout transitions between the remaining ones and places transient
+ * resources whose lifetimes don't overlap in the same memory. Nothing here
+ * talks to a device, vk_render_graph creates the resources and records the
+ * result, so the compiler can be exercised on the CPU alone.
+ */
+struct render_graph
+{
+	using execute_fn = std::function<void(VkCommandBuffer cmd_buf, uint32_t frame_ix)>;
+	/* Creates the transient resource with the derived usage and returns its requirements */
+	using requirements_fn = std::function<VkMemoryRequirements(rg_resource resource, const rg_resource_info &info)>;
+
+	rg_resource create_image(const char *name, VkFormat format, VkExtent2D extent);
+	rg_resource create_buffer(const char *name, VkDeviceSize size);
+	rg_resource import_image(const char *name, VkFormat format, VkExtent2D extent, const rg_state &initial, const rg_state &final);
+	rg_resource import_buffer(const char *name, VkDeviceSize size, const rg_state &initial, const rg_state &final);
+
+	/* Passes run in the order they are added, side effect passes are never culled */
+	uint32_t add_pass(const char *name, execute_fn fn, bool side_effect = false);
+	void read(uint32_t pass, rg_resource resource, VkPipelineStageFlags stages, VkAccessFlags access, VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED);
+	void write(uint32_t pass, rg_resource resource, VkPipelineStageFlags stages, VkAccessFlags access, VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED);
+
+	/* granularity is bufferImageGranularity, transients sharing a heap are kept that far apart */
+	void compile(VkDeviceSize granularity, const requirements_fn &get_requirements);
+	void clear();
+
+	uint32_t get_resource_count() const { return (uint32_t)this->resources.size(); }
+	const rg_resource_info &get_resource(rg_resource resource) const { return this->resources[resource]; }
+	/* Live transients only, placement of anything else is meaningless */
+	bool is_live(rg_resource resource) const { return this->lifetimes[resource].first <= this->lifetimes[resource].last; }
+	const rg_placement &get_placement(rg_resource resource) const { return this->placements[resource]; }
+	const std::vector<rg_heap> &get_heaps() const { return this->heaps; }
+	const rg_stats &get_stats() const { return this->stats; }
+
+	/* Calls visit(barriers, pass) for every live pass in order, then visit(final barriers, nullptr) */
+	template <typename Fn>
+	void for_each_pass(Fn &&visit) const
+	{
+		for (const auto &cp : this->compiled) {
+			visit(cp.barriers, &this->passes[cp.pass].fn);
+		}
+		visit(this->final_barriers, (const execute_fn *)nullptr);
+	}
+
+private:
+	struct access
+	{
+		rg_resource resource;
+		rg_state state;
+		/* Both set for a pass that reads and writes, e.g. blending into a target */
+		bool read;
+		bool write;
+	};
+
+	struct pass
+	{
+		std::string name;
+		execute_fn fn;
+		bool side_effect;
+		std::vector<access> accesses;
+	};
+
+	struct compiled_pass
+	{
+		uint32_t pass;
+		rg_barrier_batch barriers;
+	};
+
+	/* Live pass indices the resource is used in, first > last when unused */
+	struct lifetime
+	{
+		uint32_t first;
+		uint32_t last;
+	};
+
+	rg_resource add_resource(rg_resource_info &&info);
+	void add_access(uint32_t pass, rg_resource resource, const rg_state &state, bool write);
+	std::vector<uint32_t> cull();
+	void place_transients(VkDeviceSize granularity, const requirements_fn &get_requirements);
+	void build_barriers();
+
+private:
+	std::vector<rg_resource_info> resources;
+	std::vector<pass> passes;
+
+	std::vector<compiled_pass> compiled;
+	rg_barrier_batch final_barriers;
+	std::vector<lifetime> lifetimes;
+	std::vector<VkMemoryRequirements> requirements;
+	std::vector<rg_placement> placements;
+	std::vector<rg_heap> heaps;
+	rg_stats stats;
+};
@@ -0,0 +1,389 @@
+#include "shader_cache.hpp"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unordered_set>
+
+#if defined(_WIN32)
+#define popen _popen
+#define pclose _pclose
+#endif
+
+static constexpr uint32_t SPIRV_MAGIC = 0x07230203;
+/* Bumped when the key or the compiler flags change, so old entries stop matching */
+static constexpr const char *CACHE_VERSION = "lv-spirv-1";
+static constexpr uint32_t MAX_INCLUDE_DEPTH = 32;
+
+static const char *GLSLC_FLAGS = "--target-env=vulkan1.0 -O";
+static const char *DXC_FLAGS = "-spirv -fspv-target-env=vulkan1.0 -O3 -E main";
+
+static bool read_text(const std::filesystem::path &path, std::string &text)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		return false;
+	}
+	text.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	return true;
+}
+
+/* Empty unless the file holds whole words starting with the SPIR-V magic */
+static std::vector<uint32_t> read_spirv(const std::filesystem::path &path)
+{
+	std::string bytes;
+	if (!read_text(path, bytes) || bytes.size() < 20 || bytes.size() % sizeof(uint32_t)) {
+		return {};
+	}
+	std::vector<uint32_t> words(bytes.size() / sizeof(uint32_t));
+	memcpy(words.data(), bytes.data(), bytes.size());
+	if (words[0] != SPIRV_MAGIC) {
+		return {};
+	}
+	return words;
+}
+
+/* FNV-1a, 64 bits are plenty for the handful of shaders a cache directory holds */
+static uint64_t hash_bytes(uint64_t h, const void *data, size_t size)
+{
+	const uint8_t *bytes = (const uint8_t *)data;
+	for (size_t i=0u; i<size; ++i) {
+		h ^= bytes[i];
+		h *= 0x100000001b3ull;
+	}
+	return h;
+}
+
+static uint64_t hash_string(uint64_t h, const std::string &s)
+{
+	/* The terminator keeps "ab" + "c" apart from "a" + "bc" */
+	return hash_bytes(h, s.c_str(), s.size() + 1);
+}
+
+static bool is_hlsl(const std::string &name)
+{
+	return name.size() > 5 && name.compare(name.size() - 5, 5, ".hlsl") == 0;
+}
+
+/* cs_6_0 for foo.comp.hlsl and so on, dxc can't tell the stage from the name */
+static const char *hlsl_profile(const std::string &name)
+{
+	const std::string stage = std::filesystem::path(name).stem().extension().string();
+	if (stage == ".vert") {
+		return "vs_6_0";
+	} else if (stage == ".frag") {
+		return "ps_6_0";
+	} else if (stage == ".comp") {
+		return "cs_6_0";
+	}
+	throw std::runtime_error("Failed to tell the stage of " + name + ", expected .vert.hlsl, .frag.hlsl or .comp.hlsl");
+}
+
+/* Arguments of every #include "x" or #include <x> line, good enough for shaders */
+static void find_includes(const std::string &text, std::vector<std::string> &includes)
+{
+	size_t pos = 0;
+	while (pos < text.size()) {
+		size_t eol = text.find('\n', pos);
+		if (eol == std::string::npos) {
+			eol = text.size();
+		}
+
+		const char *p = text.data() + pos;
+		const char *end = text.data() + eol;
+		while (p < end && (*p == ' ' || *p == '\t')) {
+			++p;
+		}
+		if (p < end && *p == '#') {
+			++p;
+			while (p < end && (*p == ' ' || *p == '\t')) {
+				++p;
+			}
+			if (end - p > 7 && strncmp(p, "include", 7) == 0) {
+				p += 7;
+				while (p < end && (*p == ' ' || *p == '\t')) {
+					++p;
+				}
+				if (p < end && (*p == '"' || *p == '<')) {
+					const char close = *p == '"' ? '"' : '>';
+					const char *beg = ++p;
+					while (p < end && *p != close) {
+						++p;
+					}
+					if (p < end) {
+						includes.emplace_back(beg, p);
+					}
+				}
+			}
+		}
+		pos = eol + 1;
+	}
+}
+
+static std::string find_program(const char *name)
+{
+#if defined(_WIN32)
+	const char separator = ';';
+	const std::string file = std::string(name) + ".exe";
+#else
+	const char separator = ':';
+	const std::string file = name;
+#endif
+
+	std::vector<std::filesystem::path> dirs;
+	if (const char *sdk = getenv("VULKAN_SDK")) {
+		dirs.push_back(std::filesystem::path(sdk) / "bin");
+		dirs.push_back(std::filesystem::path(sdk) / "Bin");
+	}
+	if (const char *path = getenv("PATH")) {
+		const char *p = path;
+		while (*p) {
+			const char *sep = strchr(p, separator);
+			const size_t len = sep ? (size_t)(sep - p) : strlen(p);
+			if (len) {
+				dirs.emplace_back(std::string(p, len));
+			}
+			p += len + (sep ? 1 : 0);
+		}
+	}
+
+	std::error_code ec;
+	for (const auto &dir : dirs) {
+		std::filesystem::path candidate = dir / file;
+		if (std::filesystem::is_regular_file(candidate, ec)) {
+			return candidate.string();
+		}
+	}
+	return {};
+}
+
+static std::string program_identity(const std::string &path)
+{
+	std::error_code ec;
+	const uintmax_t size = std::filesystem::file_size(path, ec);
+	const auto mtime = std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+	return path + '|' + std::to_string(size) + '|' + std::to_string(mtime);
+}
+
+void shader_cache::init(const std::string &source_dir, const std::string &cache_dir, const std::string &prebuilt_dir)
+{
+	this->source_dir = source_dir;
+	this->cache_dir = cache_dir;
+	this->prebuilt_dir = prebuilt_dir;
+
+	/* Only looked up, never run, a warm start doesn't pay for a compiler process */
+	this->glslc.path = find_program("glslc");
+	this->dxc.path = find_program("dxc");
+	if (!this->glslc.path.empty()) {
+		this->glslc.identity = program_identity(this->glslc.path);
+	}
+	if (!this->dxc.path.empty()) {
+		this->dxc.identity = program_identity(this->dxc.path);
+	}
+
+	std::error_code ec;
+	std::filesystem::create_directories(this->cache_dir, ec);
+}
+
+const shader_cache::compiler &shader_cache::get_compiler(const std::string &name) const
+{
+	return is_hlsl(name) ? this->dxc : this->glslc;
+}
+
+bool shader_cache::has_compiler(const std::string &name) const
+{
+	return !get_compiler(name).path.empty();
+}
+
+bool shader_cache::read_sources(const std::string &name, std::vector<std::string> &paths, std::string &contents) const
+{
+	struct pending
+	{
+		std::filesystem::path path;
+		uint32_t depth;
+	};
+
+	std::vector<pending> stack = { { std::filesystem::path(this->source_dir) / name, 0 } };
+	std::unordered_set<std::string> seen;
+	std::string text;
+	std::vector<std::string> includes;
+	bool found_root = false;
+
+	while (!stack.empty()) {
+		pending file = stack.back();
+		stack.pop_back();
+		const std::string path = file.path.lexically_normal().string();
+		if (!seen.insert(path).second) {
+			continue;
+		}
+		if (!read_text(path, text)) {
+			/* A missing include is the compiler's to report, it changes the key all the same */
+			contents += path;
+			contents += '\0';
+			continue;
+		}
+		found_root |= file.depth == 0;
+
+		paths.push_back(path);
+		contents += path;
+		contents += '\0';
+		contents += text;
+		contents += '\0';
+
+		if (file.depth == MAX_INCLUDE_DEPTH) {
+			continue;
+		}
+		includes.clear();
+		find_includes(text, includes);
+		/* Reversed so includes are visited in the order they appear */
+		for (auto it = includes.rbegin(); it != includes.rend(); ++it) {
+			std::filesystem::path local = file.path.parent_path() / *it;
+			std::error_code ec;
+			if (!std::filesystem::exists(local, ec)) {
+				local = std::filesystem::path(this->source_dir) / *it;
+			}
+			stack.push_back({ local, file.depth + 1 });
+		}
+	}
+
+	return found_root;
+}
+
+std::vector<std::string> shader_cache::get_dependencies(const std::string &name) const
+{
+	std::vector<std::string> paths;
+	std::string contents;
+	read_sources(name, paths, contents);
+	return paths;
+}
+
+std::vector<uint32_t> shader_cache::load(const std::string &name, const std::vector<std::string> &defines, bool allow_prebuilt)
+{
+	const compiler &c = get_compiler(name);
+	std::vector<std::string> paths;
+	std::string contents;
+	const bool have_source = read_sources(name, paths, contents);
+
+	if (c.path.empty() || !have_source) {
+		if (!allow_prebuilt) {
+			throw std::runtime_error(have_source
+				? "Failed to compile " + name + ", no " + (is_hlsl(name) ? "dxc" : "glslc") + " found"
+				: "Failed to read " + (std::filesystem::path(this->source_dir) / name).string());
+		}
+
+		/* The build compiles without defines, so only a plain load can use its output */
+		const std::filesystem::path prebuilt = std::filesystem::path(this->prebuilt_dir) / (name + ".spv");
+		std::vector<uint32_t> words = defines.empty() ? read_spirv(prebuilt) : std::vector<uint32_t>();
+		if (words.empty()) {
+			throw std::runtime_error("Failed to load " + name + ", no compiler and no prebuilt " + prebuilt.string());
+		}
+		std::lock_guard<std::mutex> lock(this->mutex);
+		++this->stats.prebuilt;
+		return words;
+	}
+
+	uint64_t key = 0xcbf29ce484222325ull;
+	key = hash_string(key, CACHE_VERSION);
+	key = hash_string(key, c.identity);
+	key = hash_string(key, is_hlsl(name) ? DXC_FLAGS : GLSLC_FLAGS);
+	key = hash_bytes(key, contents.data(), contents.size());
+	for (const std::string &define : defines) {
+		key = hash_string(key, define);
+	}
+
+	char hex[17];
+	snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)key);
+	const std::string cache_path = (std::filesystem::path(this->cache_dir) / (name + '-' + hex + ".spv")).string();
+
+	std::vector<uint32_t> words = read_spirv(cache_path);
+	if (!words.empty()) {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		++this->stats.hits;
+		return words;
+	}
+
+	return compile(name, defines, cache_path);
+}
+
+std::vector<uint32_t> shader_cache::compile(
+	const std::string &name,
+	const std::vector<std::string> &defines,
+	const std::string &cache_path)
+{
+	uint64_t serial;
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		serial = this->compile_serial++;
+	}
+	const std::string tmp_path = cache_path + '.' + std::to_string(serial) + ".tmp";
+	const std::string source = (std::filesystem::path(this->source_dir) / name).string();
+
+	std::string cmd = '"' + get_compiler(name).path + "\" ";
+	if (is_hlsl(name)) {
+		cmd += DXC_FLAGS;
+		cmd += std::string(" -T ") + hlsl_profile(name);
+		cmd += " -I \"" + this->source_dir + '"';
+		for (const std::string &define : defines) {
+			cmd += " -D " + define;
+		}
+		cmd += " -Fo \"" + tmp_path + "\" \"" + source + '"';
+	} else {
+		cmd += GLSLC_FLAGS;
+		cmd += " -I \"" + this->source_dir + '"';
+		for (const std::string &define : defines) {
+			cmd += " -D" + define;
+		}
+		cmd += " -o \"" + tmp_path + "\" \"" + source + '"';
+	}
+	cmd += " 2>&1";
+#if defined(_WIN32)
+	/* cmd.exe strips the outer quotes, which would otherwise be the ones around the compiler */
+	cmd = '"' + cmd + '"';
+#endif
+
+	auto beg = std::chrono::steady_clock::now();
+	std::string output;
+	int status = -1;
+	if (FILE *pipe = popen(cmd.c_str(), "r")) {
+		char buf[512];
+		size_t n;
+		while ((n = fread(buf, 1, sizeof(buf), pipe)) > 0) {
+			output.append(buf, n);
+		}
+		status = pclose(pipe);
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	std::vector<uint32_t> words = status == 0 ? read_spirv(tmp_path) : std::vector<uint32_t>();
+	std::error_code ec;
+	if (words.empty()) {
+		std::filesystem::remove(tmp_path, ec);
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			++this->stats.compile_failures;
+		}
+		throw std::runtime_error("Failed to compile " + name + ":\n" + output);
+	}
+
+	/* Renamed into place so a reader never sees half a file, losing a race to an identical compile is fine */
+	std::filesystem::rename(tmp_path, cache_path, ec);
+	if (ec) {
+		std::filesystem::remove(tmp_path, ec);
+	}
+
+	std::lock_guard<std::mutex> lock(this->mutex);
+	++this->stats.compiles;
+	this->stats.compile_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(end - beg).count();
+	return words;
+}
+
+shader_cache_stats shader_cache::get_stats() const
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->stats;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+struct shader_cache_stats
+{
+	/* Loads answered from the cache directory without running a compiler */
+	uint64_t hits = 0;
+	uint64_t compiles = 0;
+	uint64_t compile_failures = 0;
+	/* Loads that fell back to the SPIR-V the build compiled, no compiler was found */
+	uint64_t prebuilt = 0;
+	uint64_t compile_ns = 0;
+};
+
+/*
+ * Content addressed SPIR-V cache. A shader is named by its source file,
+ * .vert, .frag or .comp for GLSL (compiled with glslc) and
+ * .vert.hlsl, .frag.hlsl or .comp.hlsl for HLSL (compiled with dxc). Its key
+ * hashes the source, every file it includes, the defines and the
+ * compiler binary, so a warm cache is a hash and a file read away and the
+ * compiler is only started when something really changed. Compilers are
+ * found on PATH or under VULKAN_SDK once, at init. Without one, loads fall
+ * back to the SPIR-V the build wrote to prebuilt_dir.
+ *
+ * load() may be called from several threads at once.
+ */
+struct shader_cache
+{
+	void init(const std::string &source_dir, const std::string &cache_dir, const std::string &prebuilt_dir);
+
+	/*
+	 * SPIR-V for name compiled with defines ("NAME" or "NAME=VALUE").
+	 * Throws with the compiler's output if it fails. allow_prebuilt lets a
+	 * load without a compiler use the build's SPIR-V, which is stale once
+	 * the source was edited, so reloads pass false.
+	 */
+	std::vector<uint32_t> load(const std::string &name, const std::vector<std::string> &defines, bool allow_prebuilt = true);
+
+	/* The source of name and everything it includes, for watching */
+	std::vector<std::string> get_dependencies(const std::string &name) const;
+
+	bool has_compiler(const std::string &name) const;
+	shader_cache_stats get_stats() const;
+
+private:
+	struct compiler
+	{
+		std::string path;
+		/* Path, size and modification time of the binary, a new version changes at least one */
+		std::string identity;
+	};
+
+	const compiler &get_compiler(const std::string &name) const;
+	bool read_sources(const std::string &name, std::vector<std::string> &paths, std::string &contents) const;
+	std::vector<uint32_t> compile(
+		const std::string &name,
+		const std::vector<std::string> &defines,
+		const std::string &cache_path);
+
+private:
+	std::string source_dir;
+	std::string cache_dir;
+	std::string prebuilt_dir;
+	compiler glslc;
+	compiler dxc;
+
+	mutable std::mutex mutex;
+	shader_cache_stats stats;
+	/* Distinguishes temporary files of compiles running at the same time */
+	uint64_t compile_serial = 0;
+};
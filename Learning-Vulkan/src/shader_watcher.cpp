@@ -0,0 +1,245 @@
+#include "shader_watcher.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <unordered_map>
+#include <unordered_set>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+/* Editors save in several steps, give them time to finish before compiling */
+static constexpr auto SETTLE_TIME = std::chrono::milliseconds(50);
+
+void shader_watcher::init(shader_cache &cache, uint32_t compile_threads)
+{
+	this->cache = &cache;
+	this->running = true;
+	this->watch_thread = std::thread(&shader_watcher::watch_loop, this);
+	for (uint32_t i=0u; i<std::max(compile_threads, 1u); ++i) {
+		this->compile_threads.emplace_back(&shader_watcher::compile_loop, this);
+	}
+}
+
+void shader_watcher::deinit()
+{
+	if (!this->running) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->running = false;
+	}
+	this->cv.notify_all();
+	this->watch_thread.join();
+	for (auto &thread : this->compile_threads) {
+		thread.join();
+	}
+	this->compile_threads.clear();
+	this->shaders.clear();
+	this->queue.clear();
+}
+
+void shader_watcher::watch(const std::string &name, const std::vector<std::string> &defines, shader_build_fn build)
+{
+	std::vector<std::string> dependencies = this->cache->get_dependencies(name);
+
+	std::lock_guard<std::mutex> lock(this->mutex);
+	watched_shader shader;
+	shader.name = name;
+	shader.defines = defines;
+	shader.dependencies = std::move(dependencies);
+	shader.build = std::move(build);
+	this->shaders.push_back(std::move(shader));
+}
+
+void shader_watcher::poll(std::vector<shader_reload> &reloads)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	for (shader_reload &reload : this->finished) {
+		reloads.push_back(std::move(reload));
+	}
+	this->finished.clear();
+}
+
+void shader_watcher::queue_dependents(const std::string &path)
+{
+	for (uint32_t i=0u; i<this->shaders.size(); ++i) {
+		watched_shader &shader = this->shaders[i];
+		if (std::find(shader.dependencies.begin(), shader.dependencies.end(), path) == shader.dependencies.end()) {
+			continue;
+		}
+		if (shader.compiling) {
+			shader.dirty = true;
+		} else if (!shader.queued) {
+			shader.queued = true;
+			this->queue.push_back(i);
+		}
+	}
+}
+
+#if defined(__linux__)
+
+void shader_watcher::watch_loop()
+{
+	int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0) {
+		return;
+	}
+
+	/* Directories rather than files, saving through a rename replaces the file a watch would be on */
+	std::unordered_map<int, std::string> dirs;
+	std::unordered_set<std::string> watched_dirs;
+	std::vector<std::string> changed;
+	alignas(inotify_event) char buf[4096];
+
+	while (this->running) {
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			for (const watched_shader &shader : this->shaders) {
+				for (const std::string &dependency : shader.dependencies) {
+					std::string dir = std::filesystem::path(dependency).parent_path().string();
+					if (watched_dirs.insert(dir).second) {
+						int wd = inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+						if (wd >= 0) {
+							dirs[wd] = dir;
+						}
+					}
+				}
+			}
+		}
+
+		/* Wakes up regularly to notice deinit() and newly watched shaders */
+		pollfd pfd = { fd, POLLIN, 0 };
+		if (::poll(&pfd, 1, 100) <= 0) {
+			continue;
+		}
+		std::this_thread::sleep_for(SETTLE_TIME);
+
+		changed.clear();
+		ssize_t len;
+		while ((len = read(fd, buf, sizeof(buf))) > 0) {
+			for (char *p = buf; p < buf + len; ) {
+				const inotify_event *event = (const inotify_event *)p;
+				auto it = dirs.find(event->wd);
+				if (event->len && it != dirs.end()) {
+					changed.push_back((std::filesystem::path(it->second) / event->name).lexically_normal().string());
+				}
+				p += sizeof(inotify_event) + event->len;
+			}
+		}
+
+		if (!changed.empty()) {
+			std::lock_guard<std::mutex> lock(this->mutex);
+			for (const std::string &path : changed) {
+				queue_dependents(path);
+			}
+			this->cv.notify_all();
+		}
+	}
+
+	close(fd);
+}
+
+#else
+
+void shader_watcher::watch_loop()
+{
+	std::unordered_map<std::string, std::filesystem::file_time_type> times;
+	std::vector<std::string> paths;
+	std::vector<std::string> changed;
+
+	while (this->running) {
+		paths.clear();
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			for (const watched_shader &shader : this->shaders) {
+				paths.insert(paths.end(), shader.dependencies.begin(), shader.dependencies.end());
+			}
+		}
+
+		changed.clear();
+		for (const std::string &path : paths) {
+			std::error_code ec;
+			auto time = std::filesystem::last_write_time(path, ec);
+			if (ec) {
+				continue;
+			}
+			auto it = times.find(path);
+			if (it == times.end()) {
+				times.emplace(path, time);
+			} else if (it->second != time) {
+				it->second = time;
+				changed.push_back(path);
+			}
+		}
+
+		if (!changed.empty()) {
+			std::this_thread::sleep_for(SETTLE_TIME);
+			std::lock_guard<std::mutex> lock(this->mutex);
+			for (const std::string &path : changed) {
+				queue_dependents(path);
+			}
+			this->cv.notify_all();
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(250));
+	}
+}
+
+#endif
+
+void shader_watcher::compile_loop()
+{
+	std::unique_lock<std::mutex> lock(this->mutex);
+	for (;;) {
+		this->cv.wait(lock, [this]() { return !this->running || !this->queue.empty(); });
+		if (!this->running) {
+			return;
+		}
+
+		const uint32_t ix = this->queue.front();
+		this->queue.pop_front();
+		this->shaders[ix].queued = false;
+		this->shaders[ix].compiling = true;
+
+		shader_reload reload;
+		reload.name = this->shaders[ix].name;
+		reload.defines = this->shaders[ix].defines;
+		/* watch() may grow shaders meanwhile */
+		const shader_build_fn build = this->shaders[ix].build;
+		lock.unlock();
+
+		/* Never the build's SPIR-V, it predates the edit */
+		try {
+			reload.spirv = this->cache->load(reload.name, reload.defines, false);
+		} catch (const std::exception &e) {
+			reload.error = e.what();
+		}
+		if (reload.error.empty() && build) {
+			try {
+				reload.object = build(reload.spirv);
+			} catch (const std::exception &e) {
+				reload.error = "Failed to reload " + reload.name + ": " + e.what();
+			}
+		}
+		/* Includes may have been added or removed */
+		std::vector<std::string> dependencies = this->cache->get_dependencies(reload.name);
+
+		lock.lock();
+		watched_shader &shader = this->shaders[ix];
+		shader.dependencies = std::move(dependencies);
+		shader.compiling = false;
+		if (shader.dirty) {
+			shader.dirty = false;
+			shader.queued = true;
+			this->queue.push_back(ix);
+		}
+		this->finished.push_back(std::move(reload));
+	}
+}
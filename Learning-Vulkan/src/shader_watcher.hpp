@@ -0,0 +1,80 @@
+#pragma once
+
+#include "shader_cache.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* A recompiled shader, spirv is empty and error says why when the compile failed */
+struct shader_reload
+{
+	std::string name;
+	std::vector<std::string> defines;
+	std::vector<uint32_t> spirv;
+	std::string error;
+	/* What the watch's build function made of spirv, e.g. a VkPipeline, 0 without one or on failure */
+	uint64_t object = 0;
+};
+
+/* Turns fresh SPIR-V into what the renderer swaps in, on a compile thread. Throws to fail the reload */
+using shader_build_fn = std::function<uint64_t(const std::vector<uint32_t> &spirv)>;
+
+/*
+ * Hot reload. One thread watches the directories of every watched shader's
+ * source and includes (inotify on Linux, modification times elsewhere) and
+ * queues the shaders a change touches, compile threads turn them into
+ * SPIR-V through the cache, and the main thread picks the results up with
+ * poll() between frames. A watch can pass a build function that the compile
+ * thread runs on the new SPIR-V, so even pipeline creation stays off the
+ * frame and the renderer only swaps handles. The build function must not
+ * touch anything the renderer mutates.
+ */
+struct shader_watcher
+{
+	void init(shader_cache &cache, uint32_t compile_threads);
+	void deinit();
+
+	/* Recompiles name with defines whenever its source or one of its includes changes */
+	void watch(const std::string &name, const std::vector<std::string> &defines, shader_build_fn build = {});
+
+	/* Moves out the reloads finished since the last call, still works after deinit() for the ones nobody took */
+	void poll(std::vector<shader_reload> &reloads);
+
+private:
+	struct watched_shader
+	{
+		std::string name;
+		std::vector<std::string> defines;
+		std::vector<std::string> dependencies;
+		shader_build_fn build;
+		/* Changes while queued are folded in, changes while compiling queue it again afterwards */
+		bool queued = false;
+		bool compiling = false;
+		bool dirty = false;
+	};
+
+	void watch_loop();
+	void compile_loop();
+	/* Queues every shader depending on path, with the mutex held */
+	void queue_dependents(const std::string &path);
+
+private:
+	shader_cache *cache = nullptr;
+	std::atomic<bool> running = false;
+	std::thread watch_thread;
+	std::vector<std::thread> compile_threads;
+
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::vector<watched_shader> shaders;
+	/* Indices into shaders */
+	std::deque<uint32_t> queue;
+	std::vector<shader_reload> finished;
+};
@@ -0,0 +1,123 @@
+#include "simulation.hpp"
+
+#include "cpu_trace.hpp"
+#include "trace.hpp"
+
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <chrono>
+
+/* Radians per second while a turn key is held, and per pixel dragged */
+static constexpr float TURN_SPEED = 1.5f;
+static constexpr float DRAG_SENSITIVITY = 0.005f;
+static constexpr float MAX_PITCH = 1.5f;
+
+void simulation::init(uint32_t tick_hz, uint32_t framebuffer_width, uint32_t framebuffer_height)
+{
+	this->tick_hz = std::max(tick_hz, 1u);
+	this->state = {};
+	this->state.framebuffer_width = framebuffer_width;
+	this->state.framebuffer_height = framebuffer_height;
+	this->states.get_back() = this->state;
+	this->states.publish();
+
+	this->running = true;
+	this->thread = std::thread(&simulation::tick_loop, this);
+}
+
+void simulation::deinit()
+{
+	if (!this->running.exchange(false)) {
+		return;
+	}
+	this->thread.join();
+}
+
+void simulation::push(const input_event &e)
+{
+	if (!this->events.push(e)) {
+		this->dropped.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+sim_stats simulation::get_stats() const
+{
+	sim_stats stats;
+	stats.ticks = this->ticks.load(std::memory_order_relaxed);
+	stats.events = this->applied.load(std::memory_order_relaxed);
+	stats.dropped = this->dropped.load(std::memory_order_relaxed);
+	stats.overruns = this->overruns.load(std::memory_order_relaxed);
+	return stats;
+}
+
+void simulation::tick_loop()
+{
+	cpu_trace_set_thread_name("Simulation");
+
+	using clock = std::chrono::steady_clock;
+	const clock::duration period = std::chrono::nanoseconds(1000000000ull / this->tick_hz);
+	const float dt = 1.0f / (float)this->tick_hz;
+	clock::time_point next = clock::now();
+
+	while (this->running.load(std::memory_order_relaxed)) {
+		{
+			CPU_ZONE("sim_tick");
+			input_event e;
+			while (this->events.pop(e)) {
+				apply(e);
+			}
+
+			this->state.yaw += ((float)this->turn_right - (float)this->turn_left) * TURN_SPEED * dt;
+			++this->state.tick;
+			this->states.get_back() = this->state;
+			this->states.publish();
+		}
+		this->ticks.fetch_add(1, std::memory_order_relaxed);
+
+		/* Fixed steps from where the schedule should be, unless a whole step was missed */
+		next += period;
+		const clock::time_point now = clock::now();
+		if (now - next > period) {
+			this->overruns.fetch_add(1, std::memory_order_relaxed);
+			next = now;
+		}
+		std::this_thread::sleep_until(next);
+	}
+}
+
+void simulation::apply(const input_event &e)
+{
+	switch (e.type) {
+	case input_event_type::key: {
+		const bool down = e.action != GLFW_RELEASE;
+		if (e.code == GLFW_KEY_LEFT || e.code == GLFW_KEY_A) {
+			this->turn_left = down;
+		} else if (e.code == GLFW_KEY_RIGHT || e.code == GLFW_KEY_D) {
+			this->turn_right = down;
+		}
+		break;
+	}
+	case input_event_type::mouse_button:
+		if (e.code == GLFW_MOUSE_BUTTON_LEFT) {
+			this->dragging = e.action == GLFW_PRESS;
+		}
+		break;
+	case input_event_type::cursor:
+		if (this->dragging) {
+			this->state.yaw += (float)(e.x - this->cursor_x) * DRAG_SENSITIVITY;
+			this->state.pitch = std::clamp(this->state.pitch - (float)(e.y - this->cursor_y) * DRAG_SENSITIVITY, -MAX_PITCH, MAX_PITCH);
+		}
+		this->cursor_x = e.x;
+		this->cursor_y = e.y;
+		break;
+	case input_event_type::resize:
+		this->state.framebuffer_width = (uint32_t)e.code;
+		this->state.framebuffer_height = (uint32_t)e.action;
+		break;
+	}
+
+	++this->state.input_serial;
+	this->state.input_time_ns = e.time_ns;
+	this->applied.fetch_add(1, std::memory_order_relaxed);
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <thread>
+
+/*
+ * Single producer, single consumer ring of trivially copyable values. Both
+ * sides keep a private copy of the other's index and only reload it when
+ * the ring looks full or empty, so a push or pop usually touches no cache
+ * line the other thread writes.
+ */
+template<typename T, uint64_t CAPACITY>
+struct spsc_queue
+{
+	static_assert((CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of two");
+
+	/* False when full, the value is not queued */
+	bool push(const T &value)
+	{
+		const uint64_t head = this->head.load(std::memory_order_relaxed);
+		if (head - this->cached_tail >= CAPACITY) {
+			this->cached_tail = this->tail.load(std::memory_order_acquire);
+			if (head - this->cached_tail >= CAPACITY) {
+				return false;
+			}
+		}
+		this->slots[head & (CAPACITY - 1)] = value;
+		this->head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(T &out)
+	{
+		const uint64_t tail = this->tail.load(std::memory_order_relaxed);
+		if (tail == this->cached_head) {
+			this->cached_head = this->head.load(std::memory_order_acquire);
+			if (tail == this->cached_head) {
+				return false;
+			}
+		}
+		out = this->slots[tail & (CAPACITY - 1)];
+		this->tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	/* Producer side */
+	alignas(64) std::atomic<uint64_t> head = 0;
+	uint64_t cached_tail = 0;
+	/* Consumer side */
+	alignas(64) std::atomic<uint64_t> tail = 0;
+	uint64_t cached_head = 0;
+	alignas(64) T slots[CAPACITY];
+};
+
+/*
+ * Latest-value handoff between one writer and one reader. The writer fills
+ * its back buffer and swaps it with the middle one, the reader swaps the
+ * middle one for its front buffer when a new value was published. Neither
+ * side ever waits and the reader always sees a whole value, at worst the
+ * same one twice.
+ */
+template<typename T>
+struct triple_buffer
+{
+	T &get_back() { return this->buffers[this->back]; }
+
+	void publish()
+	{
+		this->back = this->middle.exchange(this->back | FRESH, std::memory_order_acq_rel) & INDEX;
+	}
+
+	/* The newest published value, or the previous one if nothing was published since */
+	const T &read()
+	{
+		if (this->middle.load(std::memory_order_relaxed) & FRESH) {
+			this->front = this->middle.exchange(this->front, std::memory_order_acq_rel) & INDEX;
+		}
+		return this->buffers[this->front];
+	}
+
+private:
+	static constexpr uint32_t INDEX = 3;
+	static constexpr uint32_t FRESH = 4;
+
+	T buffers[3] = {};
+	alignas(64) std::atomic<uint32_t> middle = 1;
+	alignas(64) uint32_t back = 0;
+	alignas(64) uint32_t front = 2;
+};
+
+enum class input_event_type : uint32_t
+{
+	key,
+	mouse_button,
+	cursor,
+	resize,
+};
+
+/* What a window callback saw, in GLFW's codes, stamped with trace_now_ns() when it ran */
+struct input_event
+{
+	input_event_type type;
+	/* Key or button code, or the new width */
+	int32_t code;
+	/* GLFW_PRESS, GLFW_RELEASE or GLFW_REPEAT, or the new height */
+	int32_t action;
+	double x;
+	double y;
+	uint64_t time_ns;
+};
+
+/* Everything the renderer takes from the simulation, copied whole every tick */
+struct sim_state
+{
+	uint64_t tick = 0;
+	/* Camera turned by the arrow keys, A and D, and by dragging with the left button, in radians */
+	float yaw = 0.0f;
+	float pitch = 0.0f;
+	uint32_t framebuffer_width = 0;
+	uint32_t framebuffer_height = 0;
+	/* Counts the input events applied so far and stamps the newest, for latency */
+	uint64_t input_serial = 0;
+	uint64_t input_time_ns = 0;
+};
+
+struct sim_stats
+{
+	uint64_t ticks = 0;
+	uint64_t events = 0;
+	/* Events lost to a full queue */
+	uint64_t dropped = 0;
+	/* Ticks that started more than a whole period late */
+	uint64_t overruns = 0;
+};
+
+/*
+ * Fixed rate simulation on its own thread. Window callbacks push() input
+ * events from the thread pumping events, each tick applies what has
+ * arrived and publishes a sim_state, and the renderer read()s the newest
+ * state whenever it starts recording. None of the three waits on another.
+ */
+struct simulation
+{
+	static constexpr uint64_t QUEUE_CAPACITY = 1024;
+
+	~simulation() { deinit(); }
+
+	void init(uint32_t tick_hz, uint32_t framebuffer_width, uint32_t framebuffer_height);
+	void deinit();
+
+	/* Only from one thread, the one GLFW calls the callbacks on */
+	void push(const input_event &e);
+	/* Only from one thread, the renderer */
+	const sim_state &read() { return this->states.read(); }
+
+	sim_stats get_stats() const;
+	uint32_t get_tick_hz() const { return this->tick_hz; }
+
+private:
+	void tick_loop();
+	void apply(const input_event &e);
+
+private:
+	spsc_queue<input_event, QUEUE_CAPACITY> events;
+	triple_buffer<sim_state> states;
+	std::thread thread;
+	std::atomic<bool> running = false;
+	uint32_t tick_hz = 0;
+
+	/* Owned by the simulation thread */
+	sim_state state;
+	bool turn_left = false;
+	bool turn_right = false;
+	bool dragging = false;
+	double cursor_x = 0.0;
+	double cursor_y = 0.0;
+
+	std::atomic<uint64_t> ticks = 0;
+	std::atomic<uint64_t> applied = 0;
+	std::atomic<uint64_t> dropped = 0;
+	std::atomic<uint64_t> overruns = 0;
+};
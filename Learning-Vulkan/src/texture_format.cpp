@@ -0,0 +1,125 @@
+#include "texture_format.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+static_assert(sizeof(texture_file_header) == 296, "texture_file_header is part of the file format");
+
+static uint64_t align_up(uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+const char *get_texture_format_name(texture_format format)
+{
+	switch (format) {
+	case texture_format::rgba8: return "RGBA8";
+	case texture_format::rgba8_srgb: return "RGBA8 sRGB";
+	case texture_format::bc1: return "BC1";
+	case texture_format::bc1_srgb: return "BC1 sRGB";
+	case texture_format::bc5: return "BC5";
+	case texture_format::bc7: return "BC7";
+	case texture_format::bc7_srgb: return "BC7 sRGB";
+	}
+	return "unknown";
+}
+
+bool is_block_compressed(texture_format format)
+{
+	return format != texture_format::rgba8 && format != texture_format::rgba8_srgb;
+}
+
+uint64_t get_texture_level_size(texture_format format, uint32_t width, uint32_t height)
+{
+	const uint64_t blocks = (uint64_t)((width + 3) / 4) * ((height + 3) / 4);
+	switch (format) {
+	case texture_format::rgba8:
+	case texture_format::rgba8_srgb:
+		return (uint64_t)width * height * 4;
+	case texture_format::bc1:
+	case texture_format::bc1_srgb:
+		return blocks * 8;
+	case texture_format::bc5:
+	case texture_format::bc7:
+	case texture_format::bc7_srgb:
+		return blocks * 16;
+	}
+	return 0;
+}
+
+void write_texture_file(const std::string &path, const texture_data &texture)
+{
+	if (texture.levels.empty() || texture.levels.size() > MAX_TEXTURE_LEVELS) {
+		throw std::runtime_error("Failed to write " + path + ", bad mip level count");
+	}
+
+	texture_file_header header = {};
+	header.magic = TEXTURE_FILE_MAGIC;
+	header.version = TEXTURE_FILE_VERSION;
+	header.format = texture.format;
+	header.width = texture.width;
+	header.height = texture.height;
+	header.level_count = (uint32_t)texture.levels.size();
+
+	uint64_t offset = align_up(sizeof(header), TEXTURE_SECTION_ALIGNMENT);
+	for (uint32_t i=0u; i<header.level_count; ++i) {
+		header.level_offsets[i] = offset;
+		header.level_sizes[i] = texture.levels[i].size();
+		offset = align_up(offset + header.level_sizes[i], TEXTURE_SECTION_ALIGNMENT);
+	}
+	header.file_size = offset;
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file) {
+		throw std::runtime_error("Failed to open " + path + " for writing");
+	}
+
+	static const char padding[TEXTURE_SECTION_ALIGNMENT] = {};
+	file.write((const char *)&header, sizeof(header));
+	uint64_t written = sizeof(header);
+	for (uint32_t i=0u; i<header.level_count; ++i) {
+		file.write(padding, header.level_offsets[i] - written);
+		file.write((const char *)texture.levels[i].data(), header.level_sizes[i]);
+		written = header.level_offsets[i] + header.level_sizes[i];
+	}
+	file.write(padding, header.file_size - written);
+
+	if (!file.flush()) {
+		throw std::runtime_error("Failed to write " + path);
+	}
+}
+
+bool parse_texture_file(const void *data, size_t size, texture_view &view)
+{
+	if (!data || size < sizeof(texture_file_header)) {
+		return false;
+	}
+
+	const texture_file_header *header = (const texture_file_header *)data;
+	if (header->magic != TEXTURE_FILE_MAGIC
+			|| header->version != TEXTURE_FILE_VERSION
+			|| header->format > texture_format::bc7_srgb
+			|| !header->width
+			|| !header->height
+			|| !header->level_count
+			|| header->level_count > MAX_TEXTURE_LEVELS
+			|| header->file_size != size) {
+		return false;
+	}
+
+	for (uint32_t i=0u; i<header->level_count; ++i) {
+		const uint32_t w = std::max(1u, header->width >> i);
+		const uint32_t h = std::max(1u, header->height >> i);
+		if (header->level_sizes[i] != get_texture_level_size(header->format, w, h)
+				|| header->level_offsets[i] % TEXTURE_SECTION_ALIGNMENT
+				|| header->level_offsets[i] > size
+				|| header->level_sizes[i] > size - header->level_offsets[i]) {
+			return false;
+		}
+	}
+
+	view.header = header;
+	view.base = (const uint8_t *)data;
+	return true;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+ * Texture container written by the importer and read back through a
+ * memory mapping, like the mesh file. The header is followed by every mip
+ * level, largest first, at TEXTURE_SECTION_ALIGNMENT aligned offsets and
+ * already in the layout vkCmdCopyBufferToImage takes, so the whole chain
+ * is staged with one copy out of the mapping. Little endian only.
+ */
+static constexpr uint32_t TEXTURE_FILE_MAGIC = 0x5854564c; /* "LVTX" */
+static constexpr uint32_t TEXTURE_FILE_VERSION = 1;
+static constexpr uint64_t TEXTURE_SECTION_ALIGNMENT = 16;
+static constexpr uint32_t MAX_TEXTURE_LEVELS = 16;
+
+enum class texture_format : uint32_t
+{
+	rgba8,
+	rgba8_srgb,
+	/* RGB at 4 bits per texel, no alpha */
+	bc1,
+	bc1_srgb,
+	/* Two channels at 8 bits per texel, for normal maps */
+	bc5,
+	/* RGBA at 8 bits per texel */
+	bc7,
+	bc7_srgb,
+};
+
+struct texture_file_header
+{
+	uint32_t magic;
+	uint32_t version;
+	texture_format format;
+	uint32_t width;
+	uint32_t height;
+	uint32_t level_count;
+	uint32_t reserved;
+	/* Offsets from the start of the file */
+	uint64_t level_offsets[MAX_TEXTURE_LEVELS];
+	uint64_t level_sizes[MAX_TEXTURE_LEVELS];
+	uint64_t file_size;
+};
+
+/* What the importer produces, levels[0] is width x height */
+struct texture_data
+{
+	texture_format format = texture_format::rgba8;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<std::vector<uint8_t>> levels;
+};
+
+struct texture_view
+{
+	const texture_file_header *header = nullptr;
+	/* Start of the file, add level_offsets[i] for level i */
+	const uint8_t *base = nullptr;
+};
+
+const char *get_texture_format_name(texture_format format);
+bool is_block_compressed(texture_format format);
+
+/* Bytes of one width x height level, whole 4x4 blocks for the BC formats */
+uint64_t get_texture_level_size(texture_format format, uint32_t width, uint32_t height);
+
+/* Throws on I/O errors */
+void write_texture_file(const std::string &path, const texture_data &texture);
+
+/*
+ * Checks the header and that every level has the size its format and
+ * extent imply and lies inside size bytes. Nothing is copied. False if the
+ * data is not a texture file of this version or is truncated.
+ */
+bool parse_texture_file(const void *data, size_t size, texture_view &view);
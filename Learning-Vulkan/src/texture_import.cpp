@@ -0,0 +1,443 @@
+#include "texture_import.hpp"
+
+#include "block_compress.hpp"
+#include "image_decode.hpp"
+#include "mapped_file.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <math.h>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LV_TEXTURE_SSE 1
+#include <immintrin.h>
+#else
+#define LV_TEXTURE_SSE 0
+#endif
+
+/* Bumped whenever the output of the same source and options changes */
+static constexpr uint32_t ENCODER_VERSION = 1;
+static constexpr uint32_t MAX_TAPS = 6;
+/* Rows of texels, or of blocks, per job */
+static constexpr uint32_t ROW_BATCH = 4;
+static constexpr uint32_t LINEAR_TO_SRGB_SIZE = 4096;
+
+/* One level in linear float RGBA, 4 floats per texel */
+struct float_image
+{
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<float> texels;
+};
+
+/* Source texel 2 * x + offset + t gets weights[t] */
+struct filter_kernel
+{
+	int32_t offset;
+	uint32_t taps;
+	float weights[MAX_TAPS];
+};
+
+struct srgb_tables
+{
+	float to_linear[256];
+	uint8_t to_srgb[LINEAR_TO_SRGB_SIZE];
+
+	srgb_tables()
+	{
+		for (uint32_t i=0u; i<256u; ++i) {
+			const float c = i / 255.0f;
+			this->to_linear[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+		}
+		for (uint32_t i=0u; i<LINEAR_TO_SRGB_SIZE; ++i) {
+			const float l = i / (float)(LINEAR_TO_SRGB_SIZE - 1);
+			const float c = l <= 0.0031308f ? l * 12.92f : 1.055f * powf(l, 1.0f / 2.4f) - 0.055f;
+			this->to_srgb[i] = (uint8_t)(c * 255.0f + 0.5f);
+		}
+	}
+};
+
+static const srgb_tables &get_srgb_tables()
+{
+	static const srgb_tables tables;
+	return tables;
+}
+
+static uint64_t elapsed_ns(std::chrono::steady_clock::time_point beg)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - beg).count();
+}
+
+static float bessel_i0(float x)
+{
+	float sum = 1.0f, term = 1.0f;
+	for (uint32_t k=1u; k<16u; ++k) {
+		term *= (x * 0.5f / k) * (x * 0.5f / k);
+		sum += term;
+	}
+	return sum;
+}
+
+static filter_kernel make_kernel(mip_filter filter)
+{
+	if (filter == mip_filter::box) {
+		return { 0, 2, { 0.5f, 0.5f } };
+	}
+
+	/* sinc at half the source rate, windowed by a Kaiser window (beta 4) reaching 3 source texels out */
+	static constexpr float PI = 3.14159265358979f;
+	static constexpr float BETA = 4.0f;
+	static constexpr float RADIUS = 3.0f;
+	filter_kernel k = { -2, 6, {} };
+	float sum = 0.0f;
+	for (uint32_t t=0u; t<k.taps; ++t) {
+		/* Distance from the destination texel's center, which sits between source texels 2x and 2x + 1 */
+		const float d = (float)t - 2.5f;
+		const float x = d * 0.5f * PI;
+		const float sinc = x == 0.0f ? 1.0f : sinf(x) / x;
+		const float r = d / RADIUS;
+		const float window = bessel_i0(BETA * sqrtf(std::max(0.0f, 1.0f - r * r))) / bessel_i0(BETA);
+		k.weights[t] = sinc * window;
+		sum += k.weights[t];
+	}
+	for (uint32_t t=0u; t<k.taps; ++t) {
+		k.weights[t] /= sum;
+	}
+	return k;
+}
+
+/* dst += w * src over count texels */
+static void accumulate(float *dst, const float *src, float w, uint32_t count)
+{
+#if LV_TEXTURE_SSE
+	const __m128 wv = _mm_set1_ps(w);
+	for (uint32_t i=0u; i<count; ++i) {
+		_mm_storeu_ps(dst + i * 4, _mm_add_ps(_mm_loadu_ps(dst + i * 4), _mm_mul_ps(wv, _mm_loadu_ps(src + i * 4))));
+	}
+#else
+	for (uint32_t i=0u; i<count * 4; ++i) {
+		dst[i] += w * src[i];
+	}
+#endif
+}
+
+/* Halves one row, edges clamp */
+static void downsample_row(const float *src, uint32_t src_width, float *dst, uint32_t dst_width, const filter_kernel &k)
+{
+	for (uint32_t x=0u; x<dst_width; ++x) {
+#if LV_TEXTURE_SSE
+		__m128 acc = _mm_setzero_ps();
+		for (uint32_t t=0u; t<k.taps; ++t) {
+			const int32_t sx = std::clamp((int32_t)x * 2 + k.offset + (int32_t)t, 0, (int32_t)src_width - 1);
+			acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(k.weights[t]), _mm_loadu_ps(src + sx * 4)));
+		}
+		_mm_storeu_ps(dst + x * 4, acc);
+#else
+		float acc[4] = {};
+		for (uint32_t t=0u; t<k.taps; ++t) {
+			const int32_t sx = std::clamp((int32_t)x * 2 + k.offset + (int32_t)t, 0, (int32_t)src_width - 1);
+			for (uint32_t c=0u; c<4u; ++c) {
+				acc[c] += k.weights[t] * src[sx * 4 + c];
+			}
+		}
+		memcpy(dst + x * 4, acc, sizeof(acc));
+#endif
+	}
+}
+
+/*
+ * Next level of src. Horizontal pass into a half width image, then a
+ * vertical pass that combines whole rows so every read is sequential.
+ * A dimension that is already 1 stays 1, the clamped taps all land on the
+ * same texel and their weights sum to one.
+ */
+static void downsample(const float_image &src, float_image &dst, const filter_kernel &k, job_system &jobs)
+{
+	dst.width = std::max(1u, src.width / 2);
+	dst.height = std::max(1u, src.height / 2);
+	dst.texels.assign((size_t)dst.width * dst.height * 4, 0.0f);
+
+	std::vector<float> half((size_t)dst.width * src.height * 4);
+	jobs.parallel_for(src.height, ROW_BATCH * 4, [&](uint32_t beg, uint32_t end) {
+		for (uint32_t y=beg; y<end; ++y) {
+			downsample_row(&src.texels[(size_t)y * src.width * 4], src.width, &half[(size_t)y * dst.width * 4], dst.width, k);
+		}
+	});
+
+	jobs.parallel_for(dst.height, ROW_BATCH, [&](uint32_t beg, uint32_t end) {
+		for (uint32_t y=beg; y<end; ++y) {
+			float *row = &dst.texels[(size_t)y * dst.width * 4];
+			for (uint32_t t=0u; t<k.taps; ++t) {
+				const int32_t sy = std::clamp((int32_t)y * 2 + k.offset + (int32_t)t, 0, (int32_t)src.height - 1);
+				accumulate(row, &half[(size_t)sy * dst.width * 4], k.weights[t], dst.width);
+			}
+		}
+	});
+}
+
+static void to_float(const image_rgba8 &image, bool srgb, float_image &out, job_system &jobs)
+{
+	const srgb_tables &tables = get_srgb_tables();
+	out.width = image.width;
+	out.height = image.height;
+	out.texels.resize((size_t)image.width * image.height * 4);
+
+	jobs.parallel_for(image.height, ROW_BATCH * 4, [&](uint32_t beg, uint32_t end) {
+		for (size_t i=(size_t)beg * image.width * 4; i<(size_t)end * image.width * 4; i+=4) {
+			for (uint32_t c=0u; c<3u; ++c) {
+				out.texels[i + c] = srgb ? tables.to_linear[image.pixels[i + c]] : image.pixels[i + c] / 255.0f;
+			}
+			out.texels[i + 3] = image.pixels[i + 3] / 255.0f;
+		}
+	});
+}
+
+/* Clamps to [0, 1], the Kaiser filter over- and undershoots at edges */
+static void to_rgba8(const float_image &image, bool srgb, std::vector<uint8_t> &out, job_system &jobs)
+{
+	const srgb_tables &tables = get_srgb_tables();
+	out.resize((size_t)image.width * image.height * 4);
+
+	jobs.parallel_for(image.height, ROW_BATCH * 4, [&](uint32_t beg, uint32_t end) {
+		for (size_t i=(size_t)beg * image.width * 4; i<(size_t)end * image.width * 4; i+=4) {
+			for (uint32_t c=0u; c<4u; ++c) {
+				const float v = std::clamp(image.texels[i + c], 0.0f, 1.0f);
+				out[i + c] = srgb && c < 3
+					? tables.to_srgb[(uint32_t)(v * (LINEAR_TO_SRGB_SIZE - 1) + 0.5f)]
+					: (uint8_t)(v * 255.0f + 0.5f);
+			}
+		}
+	});
+}
+
+/* Copies the 4x4 block at bx, by, repeating the last row and column past the edges */
+static void gather_block(const uint8_t *rgba, uint32_t width, uint32_t height, uint32_t bx, uint32_t by, uint8_t block[64])
+{
+	for (uint32_t y=0u; y<4u; ++y) {
+		const uint32_t sy = std::min(by * 4 + y, height - 1);
+		for (uint32_t x=0u; x<4u; ++x) {
+			const uint32_t sx = std::min(bx * 4 + x, width - 1);
+			memcpy(block + (y * 4 + x) * 4, rgba + ((size_t)sy * width + sx) * 4, 4);
+		}
+	}
+}
+
+static void compress_level(
+	const std::vector<uint8_t> &rgba,
+	uint32_t width,
+	uint32_t height,
+	texture_format format,
+	std::vector<uint8_t> &out,
+	job_system &jobs)
+{
+	out.resize(get_texture_level_size(format, width, height));
+	if (!is_block_compressed(format)) {
+		memcpy(out.data(), rgba.data(), out.size());
+		return;
+	}
+
+	const uint32_t blocks_x = (width + 3) / 4;
+	const uint32_t blocks_y = (height + 3) / 4;
+	const uint32_t block_size = format == texture_format::bc1 || format == texture_format::bc1_srgb ? 8 : 16;
+
+	jobs.parallel_for(blocks_y, 1, [&](uint32_t beg, uint32_t end) {
+		uint8_t block[64];
+		for (uint32_t by=beg; by<end; ++by) {
+			for (uint32_t bx=0u; bx<blocks_x; ++bx) {
+				gather_block(rgba.data(), width, height, bx, by, block);
+				uint8_t *dst = &out[((size_t)by * blocks_x + bx) * block_size];
+				switch (format) {
+				case texture_format::bc1:
+				case texture_format::bc1_srgb:
+					encode_bc1(block, dst);
+					break;
+				case texture_format::bc5:
+					encode_bc5(block, dst);
+					break;
+				default:
+					encode_bc7(block, dst);
+					break;
+				}
+			}
+		}
+	});
+}
+
+static double measure_psnr(const std::vector<uint8_t> &rgba, uint32_t width, uint32_t height, const texture_data &texture)
+{
+	const texture_format format = texture.format;
+	const uint32_t channels = format == texture_format::bc5 ? 2 : format == texture_format::bc1 || format == texture_format::bc1_srgb ? 3 : 4;
+	const uint32_t blocks_x = (width + 3) / 4;
+	const uint32_t blocks_y = (height + 3) / 4;
+	const uint32_t block_size = format == texture_format::bc1 || format == texture_format::bc1_srgb ? 8 : 16;
+	const std::vector<uint8_t> &level = texture.levels[0];
+
+	uint64_t error = 0, count = 0;
+	uint8_t block[64], decoded[64];
+	for (uint32_t by=0u; by<blocks_y; ++by) {
+		for (uint32_t bx=0u; bx<blocks_x; ++bx) {
+			gather_block(rgba.data(), width, height, bx, by, block);
+			if (is_block_compressed(format)) {
+				const uint8_t *src = &level[((size_t)by * blocks_x + bx) * block_size];
+				if (block_size == 8) {
+					decode_bc1(src, decoded);
+				} else if (format == texture_format::bc5) {
+					decode_bc5(src, decoded);
+				} else {
+					decode_bc7(src, decoded);
+				}
+			} else {
+				gather_block(level.data(), width, height, bx, by, decoded);
+			}
+
+			for (uint32_t i=0u; i<16u; ++i) {
+				if (bx * 4 + i % 4 >= width || by * 4 + i / 4 >= height) {
+					continue;
+				}
+				for (uint32_t c=0u; c<channels; ++c) {
+					const int32_t d = (int32_t)block[i * 4 + c] - decoded[i * 4 + c];
+					error += d * d;
+				}
+				count += channels;
+			}
+		}
+	}
+
+	if (!error) {
+		return INFINITY;
+	}
+	const double mse = (double)error / count;
+	return 10.0 * log10(255.0 * 255.0 / mse);
+}
+
+static texture_format get_output_format(const texture_import_options &options)
+{
+	switch (options.format) {
+	case texture_format::rgba8:
+	case texture_format::rgba8_srgb:
+		return options.srgb ? texture_format::rgba8_srgb : texture_format::rgba8;
+	case texture_format::bc1:
+	case texture_format::bc1_srgb:
+		return options.srgb ? texture_format::bc1_srgb : texture_format::bc1;
+	case texture_format::bc5:
+		return texture_format::bc5;
+	case texture_format::bc7:
+	case texture_format::bc7_srgb:
+		return options.srgb ? texture_format::bc7_srgb : texture_format::bc7;
+	}
+	return options.format;
+}
+
+void import_texture(
+	const std::string &path,
+	const texture_import_options &options,
+	job_system &jobs,
+	texture_data &texture,
+	texture_import_stats &stats)
+{
+	stats = {};
+	texture.format = get_output_format(options);
+	const bool srgb = texture.format == texture_format::rgba8_srgb
+		|| texture.format == texture_format::bc1_srgb
+		|| texture.format == texture_format::bc7_srgb;
+
+	auto beg = std::chrono::steady_clock::now();
+	image_rgba8 image;
+	decode_image(path, image);
+	stats.decode_ns = elapsed_ns(beg);
+
+	texture.width = image.width;
+	texture.height = image.height;
+	uint32_t level_count = 1;
+	while (level_count < MAX_TEXTURE_LEVELS && (image.width >> level_count || image.height >> level_count)) {
+		++level_count;
+	}
+	texture.levels.assign(level_count, {});
+
+	/* Level 0 keeps the decoded bytes, every smaller one goes through float and back */
+	beg = std::chrono::steady_clock::now();
+	const filter_kernel kernel = make_kernel(options.filter);
+	std::vector<std::vector<uint8_t>> rgba(level_count);
+	float_image current, next;
+	if (level_count > 1) {
+		to_float(image, srgb, current, jobs);
+	}
+	rgba[0] = std::move(image.pixels);
+	for (uint32_t i=1u; i<level_count; ++i) {
+		downsample(current, next, kernel, jobs);
+		to_rgba8(next, srgb, rgba[i], jobs);
+		std::swap(current, next);
+	}
+	stats.mip_ns = elapsed_ns(beg);
+
+	beg = std::chrono::steady_clock::now();
+	for (uint32_t i=0u; i<level_count; ++i) {
+		const uint32_t w = std::max(1u, texture.width >> i);
+		const uint32_t h = std::max(1u, texture.height >> i);
+		compress_level(rgba[i], w, h, texture.format, texture.levels[i], jobs);
+		stats.texels += (uint64_t)w * h;
+		stats.rgba8_bytes += (uint64_t)w * h * 4;
+		stats.bytes += texture.levels[i].size();
+	}
+	stats.compress_ns = elapsed_ns(beg);
+
+	stats.psnr = measure_psnr(rgba[0], texture.width, texture.height, texture);
+}
+
+static uint64_t hash_bytes(uint64_t h, const void *data, size_t size)
+{
+	const uint8_t *bytes = (const uint8_t *)data;
+	for (size_t i=0u; i<size; ++i) {
+		h = (h ^ bytes[i]) * 1099511628211ull;
+	}
+	return h;
+}
+
+std::string get_cached_texture(
+	const std::string &path,
+	const texture_import_options &options,
+	const std::string &cache_dir,
+	job_system &jobs,
+	bool &imported)
+{
+	mapped_file source;
+	if (!source.open(path)) {
+		throw std::runtime_error("Failed to open texture " + path);
+	}
+
+	uint64_t key = 14695981039346656037ull;
+	const uint32_t params[] = { TEXTURE_FILE_VERSION, ENCODER_VERSION, (uint32_t)get_output_format(options), (uint32_t)options.filter };
+	key = hash_bytes(key, params, sizeof(params));
+	key = hash_bytes(key, source.data(), source.size());
+	source.close();
+
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.lvtex", (unsigned long long)key);
+	const std::filesystem::path cached = std::filesystem::path(cache_dir) / name;
+
+	imported = false;
+	std::error_code ec;
+	if (std::filesystem::exists(cached, ec)) {
+		return cached.string();
+	}
+
+	texture_data texture;
+	texture_import_stats stats;
+	import_texture(path, options, jobs, texture, stats);
+
+	/* Written under a temporary name first so a crash never leaves a truncated file behind */
+	std::filesystem::create_directories(cache_dir, ec);
+	const std::filesystem::path tmp = cached.string() + ".tmp";
+	write_texture_file(tmp.string(), texture);
+	std::filesystem::rename(tmp, cached, ec);
+	if (ec) {
+		throw std::runtime_error("Failed to write " + cached.string() + ": " + ec.message());
+	}
+	imported = true;
+	return cached.string();
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "job_system.hpp"
+#include "texture_format.hpp"
+
+#include <stdint.h>
+#include <string>
+
+enum class mip_filter
+{
+	/* 2x2 average */
+	box,
+	/* 6 tap Kaiser windowed sinc, sharper mips at a little ringing */
+	kaiser,
+};
+
+struct texture_import_options
+{
+	/* rgba8, bc1, bc5 or bc7, the sRGB variant is picked from srgb */
+	texture_format format = texture_format::bc7;
+	/* Color data: mips are filtered in linear space and stored as sRGB. Ignored for BC5 */
+	bool srgb = true;
+	mip_filter filter = mip_filter::kaiser;
+};
+
+struct texture_import_stats
+{
+	uint64_t decode_ns = 0;
+	uint64_t mip_ns = 0;
+	uint64_t compress_ns = 0;
+	/* Texels over every level */
+	uint64_t texels = 0;
+	/* The same chain as RGBA8, against the bytes actually written */
+	uint64_t rgba8_bytes = 0;
+	uint64_t bytes = 0;
+	/* Level 0 after compression against before, over the channels the format keeps */
+	double psnr = 0.0;
+};
+
+/*
+ * Decodes a PNG or TGA, builds the full mip chain in linear float and
+ * compresses every level. Rows of the filter passes and rows of 4x4 blocks
+ * are spread over jobs, so all of it runs on every worker. Throws on
+ * unreadable input.
+ */
+void import_texture(
+	const std::string &path,
+	const texture_import_options &options,
+	job_system &jobs,
+	texture_data &texture,
+	texture_import_stats &stats);
+
+/*
+ * The texture file for path under cache_dir, imported and written first if
+ * it isn't there yet. Files are named by a hash of the source's contents,
+ * the options and the encoder version, so an edited image or a new
+ * encoder never picks up a stale file. imported tells whether it had to.
+ */
+std::string get_cached_texture(
+	const std::string &path,
+	const texture_import_options &options,
+	const std::string &cache_dir,
+	job_system &jobs,
+	bool &imported);
@@ -0,0 +1,252 @@
+#include "tlsf_heap.hpp"
+
+#include <algorithm>
+#include <assert.h>
+#include <bit>
+
+static uint64_t align_up(uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static void mapping(uint64_t size, uint32_t &fl, uint32_t &sl)
+{
+	if (size < tlsf_heap::SL_COUNT) {
+		fl = 0;
+		sl = (uint32_t)size;
+	} else {
+		uint32_t f = (uint32_t)std::bit_width(size) - 1;
+		fl = f - tlsf_heap::SL_BITS + 1;
+		sl = (uint32_t)(size >> (f - tlsf_heap::SL_BITS)) - tlsf_heap::SL_COUNT;
+	}
+}
+
+/* Like mapping(), but rounds up so every block in the resulting list is at least size bytes */
+static void mapping_search(uint64_t size, uint32_t &fl, uint32_t &sl)
+{
+	if (size >= tlsf_heap::SL_COUNT) {
+		uint32_t f = (uint32_t)std::bit_width(size) - 1;
+		size += (1ull << (f - tlsf_heap::SL_BITS)) - 1;
+	}
+	mapping(size, fl, sl);
+}
+
+tlsf_heap::tlsf_heap(uint64_t size):
+	size(size & ~(MIN_ALIGN - 1))
+{
+	for (auto &heads : this->free_heads) {
+		std::fill(std::begin(heads), std::end(heads), INVALID_NODE);
+	}
+
+	if (this->size) {
+		uint32_t n = new_node();
+		this->nodes[n].offset = 0;
+		this->nodes[n].size = this->size;
+		this->first_node = n;
+		insert_free(n);
+	}
+}
+
+bool tlsf_heap::alloc(uint64_t size, uint64_t alignment, allocation &out, uint64_t user_data)
+{
+	assert(alignment == 0 || std::has_single_bit(alignment));
+
+	size = align_up(std::max(size, MIN_ALIGN), MIN_ALIGN);
+	alignment = std::max(alignment, MIN_ALIGN);
+
+	/* Worst case padding to reach the alignment is alignment - MIN_ALIGN */
+	uint64_t search = size + alignment - MIN_ALIGN;
+	if (search > this->size) {
+		return false;
+	}
+
+	uint32_t n = find_free(search);
+	if (n == INVALID_NODE) {
+		return false;
+	}
+	remove_free(n);
+
+	uint64_t pad = align_up(this->nodes[n].offset, alignment) - this->nodes[n].offset;
+	if (pad) {
+		uint32_t rest = split(n, pad);
+		insert_free(n);
+		n = rest;
+	}
+
+	if (this->nodes[n].size - size >= MIN_ALIGN) {
+		uint32_t tail = split(n, size);
+		insert_free(tail);
+	}
+
+	node_t &node = this->nodes[n];
+	node.alignment = alignment;
+	node.user_data = user_data;
+
+	this->used += node.size;
+	++this->allocation_count;
+
+	out = { node.offset, node.size, n };
+	return true;
+}
+
+void tlsf_heap::free(const allocation &a)
+{
+	uint32_t n = a.node;
+	assert(n < this->nodes.size() && !this->nodes[n].free);
+
+	this->used -= this->nodes[n].size;
+	--this->allocation_count;
+
+	uint32_t prev = this->nodes[n].prev_phys;
+	if (prev != INVALID_NODE && this->nodes[prev].free) {
+		remove_free(prev);
+		n = merge(prev, n);
+	}
+
+	uint32_t next = this->nodes[n].next_phys;
+	if (next != INVALID_NODE && this->nodes[next].free) {
+		remove_free(next);
+		n = merge(n, next);
+	}
+
+	insert_free(n);
+}
+
+tlsf_heap::stats tlsf_heap::get_stats() const
+{
+	stats ret;
+	ret.size = this->size;
+	ret.used = this->used;
+	ret.allocation_count = this->allocation_count;
+
+	for (uint32_t n=this->first_node; n!=INVALID_NODE; n=this->nodes[n].next_phys) {
+		if (this->nodes[n].free) {
+			++ret.free_range_count;
+			ret.largest_free = std::max(ret.largest_free, this->nodes[n].size);
+		}
+	}
+
+	return ret;
+}
+
+uint32_t tlsf_heap::new_node()
+{
+	if (!this->unused_nodes.empty()) {
+		uint32_t n = this->unused_nodes.back();
+		this->unused_nodes.pop_back();
+		this->nodes[n] = {};
+		return n;
+	}
+
+	this->nodes.emplace_back();
+	return (uint32_t)this->nodes.size() - 1;
+}
+
+void tlsf_heap::release_node(uint32_t n)
+{
+	this->unused_nodes.push_back(n);
+}
+
+void tlsf_heap::insert_free(uint32_t n)
+{
+	uint32_t fl, sl;
+	mapping(this->nodes[n].size, fl, sl);
+
+	uint32_t head = this->free_heads[fl][sl];
+	node_t &node = this->nodes[n];
+	node.free = true;
+	node.prev_free = INVALID_NODE;
+	node.next_free = head;
+	if (head != INVALID_NODE) {
+		this->nodes[head].prev_free = n;
+	}
+
+	this->free_heads[fl][sl] = n;
+	this->fl_bitmap |= 1ull << fl;
+	this->sl_bitmap[fl] |= 1u << sl;
+}
+
+void tlsf_heap::remove_free(uint32_t n)
+{
+	uint32_t fl, sl;
+	mapping(this->nodes[n].size, fl, sl);
+
+	node_t &node = this->nodes[n];
+	if (node.prev_free != INVALID_NODE) {
+		this->nodes[node.prev_free].next_free = node.next_free;
+	} else {
+		this->free_heads[fl][sl] = node.next_free;
+	}
+	if (node.next_free != INVALID_NODE) {
+		this->nodes[node.next_free].prev_free = node.prev_free;
+	}
+
+	node.free = false;
+	node.prev_free = INVALID_NODE;
+	node.next_free = INVALID_NODE;
+
+	if (this->free_heads[fl][sl] == INVALID_NODE) {
+		this->sl_bitmap[fl] &= ~(1u << sl);
+		if (!this->sl_bitmap[fl]) {
+			this->fl_bitmap &= ~(1ull << fl);
+		}
+	}
+}
+
+uint32_t tlsf_heap::find_free(uint64_t size) const
+{
+	uint32_t fl, sl;
+	mapping_search(size, fl, sl);
+	if (fl >= FL_COUNT) {
+		return INVALID_NODE;
+	}
+
+	uint32_t sl_map = sl < SL_COUNT ? this->sl_bitmap[fl] & (~0u << sl) : 0;
+	if (!sl_map) {
+		uint64_t fl_map = fl + 1 < 64 ? this->fl_bitmap & (~0ull << (fl + 1)) : 0;
+		if (!fl_map) {
+			return INVALID_NODE;
+		}
+		fl = (uint32_t)std::countr_zero(fl_map);
+		sl_map = this->sl_bitmap[fl];
+	}
+
+	sl = (uint32_t)std::countr_zero(sl_map);
+	return this->free_heads[fl][sl];
+}
+
+/* Shrinks n to size bytes and returns a new node for the remainder, neither is put on a free list */
+uint32_t tlsf_heap::split(uint32_t n, uint64_t size)
+{
+	uint32_t m = new_node();
+	node_t &node = this->nodes[n];
+	node_t &rest = this->nodes[m];
+
+	rest.offset = node.offset + size;
+	rest.size = node.size - size;
+	rest.prev_phys = n;
+	rest.next_phys = node.next_phys;
+	if (rest.next_phys != INVALID_NODE) {
+		this->nodes[rest.next_phys].prev_phys = m;
+	}
+
+	node.size = size;
+	node.next_phys = m;
+
+	return m;
+}
+
+uint32_t tlsf_heap::merge(uint32_t left, uint32_t right)
+{
+	node_t &l = this->nodes[left];
+	const node_t &r = this->nodes[right];
+
+	l.size += r.size;
+	l.next_phys = r.next_phys;
+	if (l.next_phys != INVALID_NODE) {
+		this->nodes[l.next_phys].prev_phys = left;
+	}
+
+	release_node(right);
+	return left;
+}
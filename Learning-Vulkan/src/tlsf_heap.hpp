@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+/*
+ * Two-level segregated fit allocator over an abstract address range.
+ * It never touches the memory it manages, only offsets, so it can back
+ * device memory blocks and be exercised on the CPU without a device.
+ */
+struct tlsf_heap
+{
+	static constexpr uint32_t SL_BITS = 5;
+	static constexpr uint32_t SL_COUNT = 1u << SL_BITS;
+	static constexpr uint32_t FL_COUNT = 64 - SL_BITS + 1;
+	/* Every offset and size handed out is a multiple of this */
+	static constexpr uint64_t MIN_ALIGN = 16;
+	static constexpr uint32_t INVALID_NODE = UINT32_MAX;
+
+	struct allocation
+	{
+		uint64_t offset = 0;
+		uint64_t size = 0;
+		uint32_t node = INVALID_NODE;
+	};
+
+	struct stats
+	{
+		uint64_t size = 0;
+		uint64_t used = 0;
+		uint32_t allocation_count = 0;
+		uint32_t free_range_count = 0;
+		uint64_t largest_free = 0;
+
+		/* 0 when all free space is one contiguous range, approaching 1 as it splinters */
+		double fragmentation() const
+		{
+			uint64_t free = this->size - this->used;
+			return free ? 1.0 - (double)this->largest_free / (double)free : 0.0;
+		}
+	};
+
+	explicit tlsf_heap(uint64_t size);
+
+	/* Returns false when no free range can hold size bytes at the requested power of two alignment */
+	bool alloc(uint64_t size, uint64_t alignment, allocation &out, uint64_t user_data = 0);
+	void free(const allocation &a);
+
+	stats get_stats() const;
+	bool empty() const { return this->allocation_count == 0; }
+
+	/* Visits live allocations in address order */
+	template<typename F>
+	void for_each_allocation(F &&f) const
+	{
+		for (uint32_t n=this->first_node; n!=INVALID_NODE; n=this->nodes[n].next_phys) {
+			const node_t &node = this->nodes[n];
+			if (!node.free) {
+				f(allocation{ node.offset, node.size, n }, node.alignment, node.user_data);
+			}
+		}
+	}
+
+private:
+	struct node_t
+	{
+		uint64_t offset = 0;
+		uint64_t size = 0;
+		uint64_t alignment = 0;
+		uint64_t user_data = 0;
+		uint32_t prev_phys = INVALID_NODE;
+		uint32_t next_phys = INVALID_NODE;
+		uint32_t prev_free = INVALID_NODE;
+		uint32_t next_free = INVALID_NODE;
+		bool free = false;
+	};
+
+	uint32_t new_node();
+	void release_node(uint32_t n);
+
+	void insert_free(uint32_t n);
+	void remove_free(uint32_t n);
+	uint32_t find_free(uint64_t size) const;
+	uint32_t split(uint32_t n, uint64_t size);
+	uint32_t merge(uint32_t left, uint32_t right);
+
+private:
+	uint64_t size;
+	uint64_t used = 0;
+	uint32_t allocation_count = 0;
+
+	std::vector<node_t> nodes;
+	std::vector<uint32_t> unused_nodes;
+	uint32_t first_node = INVALID_NODE;
+
+	uint64_t fl_bitmap = 0;
+	uint32_t sl_bitmap[FL_COUNT] = {};
+	uint32_t free_heads[FL_COUNT][SL_COUNT];
+};
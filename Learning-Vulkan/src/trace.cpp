@@ -0,0 +1,129 @@
+#include "trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string.h>
+
+uint64_t trace_now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void trace_writer::add(const trace_event &e)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+
+	if (this->events.size() >= MAX_EVENTS) {
+		this->overflowed = true;
+		return;
+	}
+	this->events.push_back(e);
+}
+
+void trace_writer::set_thread_name(uint32_t tid, const std::string &name)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+
+	for (auto &thread : this->thread_names) {
+		if (thread.first == tid) {
+			thread.second = name;
+			return;
+		}
+	}
+	this->thread_names.emplace_back(tid, name);
+}
+
+bool trace_writer::write_chrome_json(const std::string &path)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+
+	std::ofstream file(path, std::ios::trunc);
+	if (!file) {
+		return false;
+	}
+
+	if (this->overflowed) {
+		std::cerr << "Trace buffer full, only the first " << MAX_EVENTS << " zones were kept\n";
+	}
+
+	/* Timestamps are relative to the earliest zone to keep the numbers small */
+	uint64_t base_ns = UINT64_MAX;
+	for (const auto &e : this->events) {
+		base_ns = std::min(base_ns, e.beg_ns);
+	}
+
+	file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+
+	bool first = true;
+	for (const auto &thread : this->thread_names) {
+		file << (first ? "" : ",\n")
+			<< "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread.first
+			<< ",\"args\":{\"name\":\"" << thread.second << "\"}}";
+		first = false;
+	}
+
+	file.setf(std::ios::fixed);
+	file.precision(3);
+	for (const auto &e : this->events) {
+		file << (first ? "" : ",\n")
+			<< "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.tid
+			<< ",\"ts\":" << (e.beg_ns - base_ns) / 1000.0
+			<< ",\"dur\":" << e.dur_ns / 1000.0 << '}';
+		first = false;
+	}
+
+	file << "\n]}\n";
+	return (bool)file;
+}
+
+bool trace_writer::write_csv(const std::string &path)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+
+	std::ofstream file(path, std::ios::trunc);
+	if (!file) {
+		return false;
+	}
+
+	if (this->overflowed) {
+		std::cerr << "Trace buffer full, only the first " << MAX_EVENTS << " zones were kept\n";
+	}
+
+	std::vector<trace_event> sorted = this->events;
+	std::sort(sorted.begin(), sorted.end(), [](const trace_event &a, const trace_event &b) {
+		return a.beg_ns < b.beg_ns;
+	});
+
+	/* Same base as the JSON, so rows line up with what the trace viewer shows */
+	uint64_t base_ns = sorted.empty() ? 0 : sorted.front().beg_ns;
+	std::vector<uint64_t> frame_starts;
+	for (const auto &e : sorted) {
+		if (strcmp(e.name, "frame") == 0) {
+			frame_starts.push_back(e.beg_ns);
+		}
+	}
+
+	file << "frame,thread,zone,begin_ns,duration_ns\n";
+	for (const auto &e : sorted) {
+		/* The frame whose CPU zone began last at or before this one, GPU zones land in the frame they ran in */
+		const size_t frame = std::upper_bound(frame_starts.begin(), frame_starts.end(), e.beg_ns) - frame_starts.begin();
+		if (frame) {
+			file << frame - 1;
+		}
+
+		auto thread = std::find_if(this->thread_names.begin(), this->thread_names.end(), [&](const auto &t) {
+			return t.first == e.tid;
+		});
+		file << ",\"";
+		if (thread != this->thread_names.end()) {
+			file << thread->second;
+		} else {
+			file << "Thread " << e.tid;
+		}
+		file << "\"," << e.name << ',' << e.beg_ns - base_ns << ',' << e.dur_ns << '\n';
+	}
+	return (bool)file;
+}
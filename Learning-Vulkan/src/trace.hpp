@@ -0,0 +1,44 @@
+#pragma once
+
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* Nanoseconds on the steady clock, the common time base of CPU and GPU zones */
+uint64_t trace_now_ns();
+
+struct trace_event
+{
+	/* Must outlive the trace, zone names are string literals */
+	const char *name;
+	uint32_t tid;
+	uint64_t beg_ns;
+	uint64_t dur_ns;
+};
+
+/*
+ * Collects completed zones from any thread and writes them out as Chrome
+ * trace_event JSON (chrome://tracing, ui.perfetto.dev).
+ */
+struct trace_writer
+{
+	static constexpr size_t MAX_EVENTS = 1 << 22;
+
+	void add(const trace_event &e);
+	void set_thread_name(uint32_t tid, const std::string &name);
+
+	bool write_chrome_json(const std::string &path);
+	/*
+	 * One row per zone, frame,thread,zone,begin_ns,duration_ns, in begin
+	 * order. frame counts the CPU frame zones and is empty before the first
+	 * or when CPU zones are compiled out.
+	 */
+	bool write_csv(const std::string &path);
+
+private:
+	std::mutex mutex;
+	std::vector<trace_event> events;
+	std::vector<std::pair<uint32_t, std::string>> thread_names;
+	bool overflowed = false;
+};
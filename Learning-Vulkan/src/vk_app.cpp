@@ -1,786 +1,2564 @@
-#include "vk_app.hpp"
-
-#define VK_USE_PLATFORM_WIN32_KHR
-#define GLFW_INCLUDE_VULKAN
-#include <GLFW/glfw3.h>
-#define GLFW_EXPOSE_NATIVE_WIN32
-#include <GLFW/glfw3native.h>
-
-#include <array>
-#include <stddef.h>
-#include <stdexcept>
-#include <stdint.h>
-#include <set>
-#include <vector>
-#include <iostream>
-#include <iomanip>
-#include <optional>
-
-#if _DEBUG
-enum {ENABLE_VALIDATION_LAYERS=1};
-#else
-enum {ENABLE_VALIDATION_LAYERS=0};
-#endif
-
-static const std::array<const char *, 1> s_validation_layers = {
-	"VK_LAYER_KHRONOS_validation"
-};
-
-static bool check_validation_layer_support()
-{
-	uint32_t layer_count;
-	vkEnumerateInstanceLayerProperties(&layer_count, nullptr);
-
-	std::vector<VkLayerProperties> available_layers(layer_count);
-	vkEnumerateInstanceLayerProperties(&layer_count, available_layers.data());
-
-	for (const auto layer_name : s_validation_layers) {
-		bool found = false;
-
-		for (const auto &layer_properties : available_layers) {
-			if (strcmp(layer_name, layer_properties.layerName) == 0) {
-				found = true;
-				break;
-			}
-		}
-
-		if (!found) {
-			return false;
-		}
-	}
-
-	return true;
-}
-
-static VkResult create_debug_utils_messenger_ext(
-	VkInstance instance,
-	const VkDebugUtilsMessengerCreateInfoEXT *create_info,
-	const VkAllocationCallbacks *allocator,
-	VkDebugUtilsMessengerEXT *debug_messenger)
-{
-	auto func = (PFN_vkCreateDebugUtilsMessengerEXT)vkGetInstanceProcAddr(instance, "vkCreateDebugUtilsMessengerEXT");
-	return func
-		? func(instance, create_info, allocator, debug_messenger)
-		: VK_ERROR_EXTENSION_NOT_PRESENT;
-}
-
-static void destroy_debug_utils_messenger_ext(
-	VkInstance instance,
-	VkDebugUtilsMessengerEXT debug_messenger,
-	const VkAllocationCallbacks *allocator)
-{
-	auto func = (PFN_vkDestroyDebugUtilsMessengerEXT)vkGetInstanceProcAddr(instance, "vkDestroyDebugUtilsMessengerEXT");
-	if (func) {
-		func(instance, debug_messenger, allocator);
-	}
-}
-
-static std::vector<const char *> get_required_extensions()
-{
-	uint32_t glfw_extension_count = 0;
-	const char **glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_extension_count);
-	std::vector<const char *> extensions(glfw_extensions, glfw_extensions + glfw_extension_count);
-	if (ENABLE_VALIDATION_LAYERS) {
-		extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
-	}
-	return extensions;
-}
-
-static const char *vk_get_debug_severity(VkDebugUtilsMessageSeverityFlagBitsEXT severity)
-{
-	switch (severity) {
-	case VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT: return "Verbose";
-	case VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT: return "Info";
-	case VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT: return "Warning";
-	case VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT: return "Error";
-	default: return "(UNKNOWN SEVERITY)";
-	}
-}
-
-static const char *vk_get_debug_type(VkDebugUtilsMessageTypeFlagsEXT type)
-{
-	switch (type) {
-	case VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT: return "General";
-	case VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT: return "Validation";
-	case VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT: return "Performance";
-	case VK_DEBUG_UTILS_MESSAGE_TYPE_DEVICE_ADDRESS_BINDING_BIT_EXT: return "Device address binding";
-	default: return "(UNKNOWN TYPE)";
-	}
-}
-
-static VKAPI_ATTR VkBool32 VKAPI_CALL debug_callback(
-	VkDebugUtilsMessageSeverityFlagBitsEXT severity,
-	VkDebugUtilsMessageTypeFlagsEXT type,
-	const VkDebugUtilsMessengerCallbackDataEXT *data,
-	void *user_data)
-{
-	std::cerr << "Debug callback: " << data->pMessage << "\n";
-	std::cerr << "  Severity: " << vk_get_debug_severity(severity) << "\n";
-	std::cerr << "  Severity: " << vk_get_debug_type(type) << "\n";
-	std::cerr << "  Objects ";
-	
-	for (uint32_t i=0u; i<data->objectCount; ++i) {
-		std::cerr << std::hex << std::setw(16) << std::setfill('0') << data->pObjects[i].objectHandle << ' ';
-	}
-	
-	std::cout << std::dec << std::setfill(' ') << '\n';
-
-	return VK_FALSE;
-}
-
-static void populate_debug_messenger_create_info(VkDebugUtilsMessengerCreateInfoEXT &create_info)
-{
-	create_info = {};
-	create_info.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
-	create_info.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT
-		| VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT
-		| VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
-	create_info.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT
-		| VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT
-		| VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
-	create_info.pfnUserCallback = debug_callback;
-}
-
-struct queue_family_indices
-{
-	std::optional<uint32_t> graphics_family;
-	std::optional<uint32_t> present_family;
-
-	bool is_complete() const
-	{
-		return this->graphics_family.has_value() && this->present_family.has_value();
-	}
-};
-
-void vk_app::run()
-{
-	window_init();
-	vulkan_init();
-
-	loop();
-
-	vulkan_deinit();
-	window_deinit();
-}
-
-static void begin_cmd_buf(VkCommandBuffer buf, VkCommandBufferUsageFlags flags)
-{
-	VkCommandBufferBeginInfo cmd_buf_beg_info = {
-		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-		.pNext = nullptr,
-		.flags = flags,
-		.pInheritanceInfo = nullptr };
-
-	if (vkBeginCommandBuffer(buf, &cmd_buf_beg_info) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to begin command buffer");
-	}
-}
-
-static VkSemaphore create_semaphore(VkDevice device)
-{
-	VkSemaphoreCreateInfo create_info = {
-		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
-		.pNext = nullptr,
-		.flags = 0};
-
-	VkSemaphore sem;
-	if (vkCreateSemaphore(device, &create_info, nullptr, &sem) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create semaphore");
-	}
-
-	return sem;
-}
-
-static uint32_t aquire_next_image(VkDevice device, VkSwapchainKHR swapchain, VkSemaphore present_complete_sem)
-{
-	uint32_t image_ix = 0;
-	if (vkAcquireNextImageKHR(
-			device,
-			swapchain,
-			UINT64_MAX,
-			present_complete_sem,
-			nullptr,
-			&image_ix) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create semaphore");
-	}
-	return image_ix;
-}
-
-static void submit_queue_sync(VkQueue queue, VkCommandBuffer cmd_buf)
-{
-	VkSubmitInfo submit_info = {
-		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-		.pNext = nullptr,
-		.waitSemaphoreCount = 0,
-		.pWaitSemaphores = VK_NULL_HANDLE,
-		.pWaitDstStageMask = VK_NULL_HANDLE,
-		.commandBufferCount = 1,
-		.pCommandBuffers = &cmd_buf,
-		.signalSemaphoreCount = 0,
-		.pSignalSemaphores = VK_NULL_HANDLE};
-
-	if (vkQueueSubmit(queue, 1, &submit_info, nullptr) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to submit queue");
-	}
-}
-
-static void submit_queue_async(VkQueue queue, VkCommandBuffer cmd_buf, VkSemaphore render_complete_sem, VkSemaphore present_complete_sem)
-{
-	VkPipelineStageFlags wait_flags = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	VkSubmitInfo submit_info = {
-		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-		.pNext = nullptr,
-		.waitSemaphoreCount = 1,
-		.pWaitSemaphores = &present_complete_sem,
-		.pWaitDstStageMask = &wait_flags,
-		.commandBufferCount = 1,
-		.pCommandBuffers = &cmd_buf,
-		.signalSemaphoreCount = 1,
-		.pSignalSemaphores = &render_complete_sem };
-
-	if (vkQueueSubmit(queue, 1, &submit_info, nullptr) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to submit queue");
-	}
-}
-
-static void present_queue(VkQueue queue, VkSwapchainKHR swapchain, uint32_t img_ix, VkSemaphore render_complete_sem)
-{
-	VkPresentInfoKHR present_info = {
-		.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
-		.pNext = nullptr,
-		.waitSemaphoreCount = 1,
-		.pWaitSemaphores = &render_complete_sem,
-		.swapchainCount = 1,
-		.pSwapchains = &swapchain,
-		.pImageIndices = &img_ix,
-		.pResults = nullptr};
-
-	if (vkQueuePresentKHR(queue, &present_info) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to present queue");
-	}
-}
-
-void vk_app::loop()
-{
-	VkSemaphore render_complete_sem = create_semaphore(this->vk_device);
-	VkSemaphore present_complete_sem = create_semaphore(this->vk_device);
-
-	while (this->running) {
-		uint32_t img_ix = aquire_next_image(this->vk_device, this->vk_swapchain, present_complete_sem);
-		VkCommandBuffer cmd_buf = this->vk_cmd_bufs[img_ix];
-		VkImage img = this->vk_swapchain_images[img_ix];
-
-		VkClearColorValue clear_color = { 1.0f, 0.0f, 1.0f, 0.0f };
-		VkImageSubresourceRange image_range = {
-			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-			.baseMipLevel = 0,
-			.levelCount = 1,
-			.baseArrayLayer = 0,
-			.layerCount = 1};
-
-		begin_cmd_buf(cmd_buf, 0);
-		vkCmdClearColorImage(cmd_buf, img, VK_IMAGE_LAYOUT_GENERAL, &clear_color, 1, &image_range);
-		vkEndCommandBuffer(cmd_buf);
-
-		submit_queue_async(this->vk_graphics_queue, cmd_buf, render_complete_sem, present_complete_sem);
-		present_queue(this->vk_graphics_queue, this->vk_swapchain, img_ix, render_complete_sem);
-
-		glfwPollEvents();
-		
-		if (glfwWindowShouldClose(this->window)) {
-			this->running = false;
-		}
-	}
-
-	vkDestroySemaphore(this->vk_device, render_complete_sem, nullptr);
-	vkDestroySemaphore(this->vk_device, present_complete_sem, nullptr);
-}
-
-void vk_app::window_init()
-{
-	if (!glfwInit()) {
-		exit(EXIT_FAILURE);
-	}
-
-	if (!glfwVulkanSupported()) {
-		exit(EXIT_FAILURE);
-	}
-
-	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-	glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
-
-	this->window = glfwCreateWindow(
-		this->window_width,
-		this->window_height,
-		"Vulkan",
-		nullptr,
-		nullptr);
-
-	if (!this->window) {
-		glfwTerminate();
-		exit(EXIT_FAILURE);
-	}
-
-	glfwSetKeyCallback(this->window, [](GLFWwindow *window, int key_code, int scancode, int action, int mods) {
-		/*WindowData *data = (WindowData *)glfwGetWindowUserPointer(window);*/
-
-		switch (action) {
-		case GLFW_PRESS: {
-			/*key_pressed_event e((elm::key)key_code, 0);
-			data->event_callback(e);*/
-			break;
-		}
-		case GLFW_RELEASE: {
-			/*key_released_event e((elm::key)key_code);
-			data->event_callback(e);*/
-			break;
-		}
-		case GLFW_REPEAT: {
-			/*key_pressed_event e((elm::key)key_code, 1);
-			data->event_callback(e);*/
-			break;
-		}
-		}
-	});
-}
-
-void vk_app::window_deinit()
-{
-	glfwDestroyWindow(this->window);
-	this->window = nullptr;
-	glfwTerminate();
-}
-
-static VkInstance create_instance()
-{
-	if (ENABLE_VALIDATION_LAYERS && !check_validation_layer_support()) {
-		throw std::runtime_error("Validation layer requested, but not available");
-	}
-
-	auto extensions = get_required_extensions();
-
-	VkApplicationInfo app_info = {
-		.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
-		.pApplicationName = "Learning Vulkan",
-		.applicationVersion = VK_MAKE_VERSION(1, 0, 0),
-		.pEngineName = "No Engine",
-		.engineVersion = VK_MAKE_VERSION(1, 0, 0),
-		.apiVersion = VK_API_VERSION_1_0};
-
-	VkInstanceCreateInfo create_info = {
-		.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
-		.pApplicationInfo = &app_info,
-		.enabledExtensionCount = static_cast<uint32_t>(extensions.size()),
-		.ppEnabledExtensionNames = extensions.data()};
-
-	VkDebugUtilsMessengerCreateInfoEXT debug_create_info = {};
-	if (ENABLE_VALIDATION_LAYERS) {
-		create_info.enabledLayerCount = static_cast<uint32_t>(s_validation_layers.size());
-		create_info.ppEnabledLayerNames = s_validation_layers.data();
-
-		populate_debug_messenger_create_info(debug_create_info);
-		create_info.pNext = (VkDebugUtilsMessengerCreateInfoEXT *)&debug_create_info;
-	} else {
-		create_info.enabledLayerCount = 0;
-		create_info.pNext = nullptr;
-	}
-
-	VkInstance instance;
-	if (vkCreateInstance(&create_info, nullptr, &instance) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create instance");
-	}
-
-	return instance;
-}
-
-static VkDebugUtilsMessengerEXT setup_debug_messenger(VkInstance instance)
-{
-	if (!ENABLE_VALIDATION_LAYERS) {
-		return VK_NULL_HANDLE;
-	}
-
-	VkDebugUtilsMessengerCreateInfoEXT create_info;
-	populate_debug_messenger_create_info(create_info);
-
-	VkDebugUtilsMessengerEXT messenger;
-	if (create_debug_utils_messenger_ext(
-			instance,
-			&create_info,
-			nullptr,
-			&messenger) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to set up debug messenger");
-	}
-
-	return messenger;
-}
-
-static VkSurfaceKHR create_surface(VkInstance instance, GLFWwindow *window)
-{
-	VkSurfaceKHR surface;
-	if (glfwCreateWindowSurface(
-			instance,
-			window,
-			nullptr,
-			&surface) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create window surface");
-	}
-	return surface;
-}
-
-static queue_family_indices find_queue_families(VkPhysicalDevice device, VkSurfaceKHR surface)
-{
-	queue_family_indices indices;
-
-	uint32_t queueFamilyCount = 0;
-	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
-
-	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
-
-	int i = 0;
-	for (const auto &queueFamily : queueFamilies) {
-		if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-			indices.graphics_family = i;
-		}
-
-		VkBool32 presentSupport = false;
-		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
-
-		if (presentSupport) {
-			indices.present_family = i;
-		}
-
-		if (indices.is_complete()) {
-			break;
-		}
-
-		++i;
-	}
-
-	return indices;
-}
-
-static bool is_device_suitable(VkPhysicalDevice device, VkSurfaceKHR surface)
-{
-	queue_family_indices indices = find_queue_families(device, surface);
-	return indices.is_complete();
-}
-
-static VkPhysicalDevice pick_physical_device(VkInstance instance, VkSurfaceKHR surface)
-{
-	uint32_t device_count = 0;
-	vkEnumeratePhysicalDevices(instance, &device_count, nullptr);
-
-	if (device_count == 0) {
-		throw std::runtime_error("Failed to find GPUs with Vulkan support");
-	}
-
-	std::vector<VkPhysicalDevice> devices(device_count);
-	vkEnumeratePhysicalDevices(instance, &device_count, devices.data());
-
-	VkPhysicalDevice ret = VK_NULL_HANDLE;
-	for (const auto &device : devices) {
-		if (is_device_suitable(device, surface)) {
-			ret = device;
-			break;
-		}
-	}
-
-	if (ret == VK_NULL_HANDLE) {
-		throw std::runtime_error("Failed to find a suitable GPU");
-	}
-
-	return ret;
-}
-
-static VkDevice create_logical_device(
-	VkSurfaceKHR surface,
-	VkPhysicalDevice physical_device,
-	VkQueue *graphics_queue,
-	VkQueue *present_queue,
-	const queue_family_indices &indices)
-{
-	std::vector<VkDeviceQueueCreateInfo> queue_create_infos;
-	std::set<uint32_t> unique_queue_families = { indices.graphics_family.value(), indices.present_family.value() };
-
-	float queue_priority = 1.0f;
-	for (uint32_t queue_family : unique_queue_families) {
-		VkDeviceQueueCreateInfo queue_create_info = {
-			.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-			.queueFamilyIndex = queue_family,
-			.queueCount = 1,
-			.pQueuePriorities = &queue_priority};
-		queue_create_infos.push_back(queue_create_info);
-	}
-
-	std::vector<const char *> dev_exts = {
-		VK_KHR_SWAPCHAIN_EXTENSION_NAME,
-		VK_KHR_SHADER_DRAW_PARAMETERS_EXTENSION_NAME};
-
-	VkPhysicalDeviceFeatures deviceFeatures = {
-		/*.geometryShader = VK_TRUE,
-		.tessellationShader = VK_TRUE*/};
-
-	VkDeviceCreateInfo create_info = {
-		.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-		.pNext = nullptr,
-		.flags = 0,
-		.queueCreateInfoCount = (uint32_t)queue_create_infos.size(),
-		.pQueueCreateInfos = queue_create_infos.data(),
-		.enabledLayerCount = 0, // DEPRECATED
-		.ppEnabledLayerNames = nullptr, // DEPRECATED
-		.enabledExtensionCount = (uint32_t)dev_exts.size(),
-		.ppEnabledExtensionNames = dev_exts.data(),
-		.pEnabledFeatures = &deviceFeatures};
-
-	if (ENABLE_VALIDATION_LAYERS) {
-		create_info.enabledLayerCount = static_cast<uint32_t>(s_validation_layers.size());
-		create_info.ppEnabledLayerNames = s_validation_layers.data();
-	}
-
-	VkDevice device;
-	if (vkCreateDevice(physical_device, &create_info, nullptr, &device) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create logical device");
-	}
-
-	vkGetDeviceQueue(device, indices.graphics_family.value(), 0, graphics_queue);
-	vkGetDeviceQueue(device, indices.present_family.value(), 0, present_queue);
-
-	return device;
-}
-
-static VkImageView create_image_view(
-	VkDevice device,
-	VkImage image,
-	VkFormat format,
-	VkImageAspectFlags aspect_flags,
-	VkImageViewType view_type,
-	uint32_t layer_count,
-	uint32_t mip_levels)
-{
-	VkImageViewCreateInfo create_info = {
-		.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-		.pNext = nullptr,
-		.flags = 0,
-		.image = image,
-		.viewType = view_type,
-		.format = format,
-		.components = {
-			.r = VK_COMPONENT_SWIZZLE_IDENTITY,
-			.g = VK_COMPONENT_SWIZZLE_IDENTITY,
-			.b = VK_COMPONENT_SWIZZLE_IDENTITY,
-			.a = VK_COMPONENT_SWIZZLE_IDENTITY},
-		.subresourceRange = {
-			.aspectMask = aspect_flags,
-			.baseMipLevel = 0,
-			.levelCount = mip_levels,
-			.baseArrayLayer = 0,
-			.layerCount = layer_count}
-	};
-
-	VkImageView view;
-	if (vkCreateImageView(device, &create_info, nullptr, &view) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create image view");
-	}
-	return view;
-}
-
-static VkSwapchainKHR create_swap_chain(
-	VkPhysicalDevice physical_device,
-	VkDevice device,
-	VkSurfaceKHR surface,
-	const queue_family_indices &indices,
-	std::vector<VkImage> &swapchain_images,
-	std::vector<VkImageView> &swapchain_image_views)
-{
-	VkSurfaceCapabilitiesKHR surface_caps;
-	if (vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physical_device, surface, &surface_caps) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to get physical device surface capabilities");
-	}
-	uint32_t num_images = surface_caps.minImageCount + 1;
-	if (num_images > surface_caps.maxImageCount) {
-		--num_images;
-	}
-
-	/* Get desired surface format if supported */
-	uint32_t num_formats;
-	std::vector<VkSurfaceFormatKHR> surface_formats;
-	if (vkGetPhysicalDeviceSurfaceFormatsKHR(physical_device, surface, &num_formats, nullptr) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to get physical device surface formats");
-	}
-	surface_formats.resize(num_formats);
-	if (vkGetPhysicalDeviceSurfaceFormatsKHR(physical_device, surface, &num_formats, surface_formats.data()) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to get physical device surface formats");
-	}
-	VkSurfaceFormatKHR surface_format = surface_formats[0];
-	for (const auto &format : surface_formats) {
-		if (format.format == VK_FORMAT_R8G8B8A8_SRGB
-				&& format.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
-			surface_format = format;
-			break;
-		}
-	}
-
-	/* Get desired present mode if supported */
-	uint32_t num_present_modes;
-	std::vector<VkPresentModeKHR> present_modes;
-	if (vkGetPhysicalDeviceSurfacePresentModesKHR(
-			physical_device,
-			surface,
-			&num_present_modes,
-			nullptr) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to get physical device surface present modes");
-	}
-	present_modes.resize(num_present_modes);
-	if (vkGetPhysicalDeviceSurfacePresentModesKHR(
-			physical_device,
-			surface,
-			&num_present_modes,
-			present_modes.data()) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to get physical device surface present modes");
-	}
-	VkPresentModeKHR present_mode = VK_PRESENT_MODE_FIFO_KHR;
-	for (const auto &pm : present_modes) {
-		if (pm == VK_PRESENT_MODE_MAILBOX_KHR) {
-			present_mode = pm;
-			break;
-		}
-	}
-
-	VkSwapchainCreateInfoKHR create_info = {
-		.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
-		.pNext = nullptr,
-		.flags = 0,
-		.surface = surface,
-		.minImageCount = num_images,
-		.imageFormat = surface_format.format,
-		.imageColorSpace = surface_format.colorSpace,
-		.imageExtent = surface_caps.currentExtent,
-		.imageArrayLayers = 1,
-		.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
-			| VK_IMAGE_USAGE_TRANSFER_DST_BIT,
-		.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
-		.queueFamilyIndexCount = 1,
-		.pQueueFamilyIndices = &indices.graphics_family.value(),
-		.preTransform = surface_caps.currentTransform,
-		.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
-		.presentMode = present_mode,
-		.clipped = VK_TRUE};
-
-	VkSwapchainKHR swapchain;
-	if (vkCreateSwapchainKHR(device, &create_info, nullptr, &swapchain) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create swapchain");
-	}
-
-	uint32_t num_swapchain_images = 0;
-	if (vkGetSwapchainImagesKHR(device, swapchain, &num_swapchain_images, nullptr) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to get swapchain images");
-	}
-	swapchain_images.resize(num_swapchain_images);
-	swapchain_image_views.resize(num_swapchain_images);
-	if (vkGetSwapchainImagesKHR(device, swapchain, &num_swapchain_images, swapchain_images.data()) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to get swapchain images");
-	}
-
-	int layer_count = 1;
-	int mip_levels = 1;
-	for (uint32_t i=0u; i<num_swapchain_images; ++i) {
-		swapchain_image_views[i] = create_image_view(
-			device,
-			swapchain_images[i],
-			surface_format.format,
-			VK_IMAGE_ASPECT_COLOR_BIT,
-			VK_IMAGE_VIEW_TYPE_2D,
-			layer_count,
-			mip_levels);
-	}
-
-	return swapchain;
-}
-
-static VkCommandPool create_cmd_pool(VkDevice device, const queue_family_indices &indices)
-{
-	VkCommandPoolCreateInfo create_info = {
-		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-		.pNext = nullptr,
-		.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
-		.queueFamilyIndex = indices.graphics_family.value()};
-
-	VkCommandPool cmd_pool;
-	if (vkCreateCommandPool(device, &create_info, nullptr, &cmd_pool) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create command pool");
-	}
-
-	return cmd_pool;
-}
-
-static void create_cmd_bufs(VkDevice device, VkCommandPool pool, std::vector<VkCommandBuffer> &bufs, uint32_t count)
-{
-	VkCommandBufferAllocateInfo alloc_info = {
-		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-		.pNext = nullptr,
-		.commandPool = pool,
-		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-		.commandBufferCount = count};
-
-	bufs.resize(count);
-	if (vkAllocateCommandBuffers(device, &alloc_info, bufs.data()) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create command pool");
-	}
-}
-
-void vk_app::vulkan_init()
-{
-	this->vk_instance = create_instance();
-	this->vk_debug_messenger = setup_debug_messenger(this->vk_instance);
-	this->vk_surface = create_surface(this->vk_instance, this->window);
-	this->vk_physical_device = pick_physical_device(this->vk_instance, this->vk_surface);
-	auto indices = find_queue_families(this->vk_physical_device, this->vk_surface);
-	this->vk_device = create_logical_device(
-		this->vk_surface,
-		this->vk_physical_device,
-		&this->vk_graphics_queue,
-		&this->vk_present_queue,
-		indices);
-	this->vk_swapchain = create_swap_chain(
-		this->vk_physical_device,
-		this->vk_device,
-		this->vk_surface,
-		indices,
-		this->vk_swapchain_images,
-		this->vk_swapchain_image_views);
-	this->vk_cmd_pool = create_cmd_pool(this->vk_device, indices);
-	create_cmd_bufs(
-		this->vk_device,
-		this->vk_cmd_pool,
-		this->vk_cmd_bufs,
-		this->vk_swapchain_images.size());
-}
-
-void vk_app::vulkan_deinit()
-{
-	vkDestroyCommandPool(this->vk_device, this->vk_cmd_pool, nullptr);
-	this->vk_cmd_pool = VK_NULL_HANDLE;
-
-	for (auto &image : this->vk_swapchain_image_views) {
-		vkDestroyImageView(this->vk_device, image, nullptr);
-	}
-	this->vk_swapchain_image_views.clear();
-
-	vkDestroySwapchainKHR(this->vk_device, this->vk_swapchain, nullptr);
-	this->vk_swapchain = VK_NULL_HANDLE;
-
-	vkDestroyDevice(this->vk_device, nullptr);
-	this->vk_device = VK_NULL_HANDLE;
-
-	if (ENABLE_VALIDATION_LAYERS) {
-		destroy_debug_utils_messenger_ext(this->vk_instance, this->vk_debug_messenger, nullptr);
-		this->vk_debug_messenger = VK_NULL_HANDLE;
-	}
-
-	vkDestroySurfaceKHR(this->vk_instance, this->vk_surface, nullptr);
-	this->vk_surface = VK_NULL_HANDLE;
-
-	vkDestroyInstance(this->vk_instance, nullptr);
-	this->vk_instance = VK_NULL_HANDLE;
-}
+#include "vk_app.hpp"
+
+#include "mapped_file.hpp"
+#include "mesh_format.hpp"
+#include "texture_format.hpp"
+
+/* GLFW picks the right surface extension (Win32, X11 or Wayland) at runtime */
+#if defined(_WIN32)
+#define VK_USE_PLATFORM_WIN32_KHR
+#endif
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#if defined(_WIN32)
+#define GLFW_EXPOSE_NATIVE_WIN32
+#include <GLFW/glfw3native.h>
+#endif
+
+#include <glm/ext/matrix_clip_space.hpp>
+#include <glm/ext/matrix_transform.hpp>
+#include <glm/trigonometric.hpp>
+
+#include <algorithm>
+#include <assert.h>
+#include <array>
+#include <chrono>
+#include <exception>
+#include <math.h>
+#include <stddef.h>
+#include <stdexcept>
+#include <stdint.h>
+#include <string.h>
+#include <set>
+#include <thread>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <optional>
+#include <random>
+
+#if _DEBUG
+enum {ENABLE_VALIDATION_LAYERS=1};
+#else
+enum {ENABLE_VALIDATION_LAYERS=0};
+#endif
+
+static const std::array<const char *, 1> s_validation_layers = {
+	"VK_LAYER_KHRONOS_validation"
+};
+
+static bool check_validation_layer_support()
+{
+	uint32_t layer_count;
+	vkEnumerateInstanceLayerProperties(&layer_count, nullptr);
+
+	std::vector<VkLayerProperties> available_layers(layer_count);
+	vkEnumerateInstanceLayerProperties(&layer_count, available_layers.data());
+
+	for (const auto layer_name : s_validation_layers) {
+		bool found = false;
+
+		for (const auto &layer_properties : available_layers) {
+			if (strcmp(layer_name, layer_properties.layerName) == 0) {
+				found = true;
+				break;
+			}
+		}
+
+		if (!found) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static VkResult create_debug_utils_messenger_ext(
+	VkInstance instance,
+	const VkDebugUtilsMessengerCreateInfoEXT *create_info,
+	const VkAllocationCallbacks *allocator,
+	VkDebugUtilsMessengerEXT *debug_messenger)
+{
+	auto func = (PFN_vkCreateDebugUtilsMessengerEXT)vkGetInstanceProcAddr(instance, "vkCreateDebugUtilsMessengerEXT");
+	return func
+		? func(instance, create_info, allocator, debug_messenger)
+		: VK_ERROR_EXTENSION_NOT_PRESENT;
+}
+
+static void destroy_debug_utils_messenger_ext(
+	VkInstance instance,
+	VkDebugUtilsMessengerEXT debug_messenger,
+	const VkAllocationCallbacks *allocator)
+{
+	auto func = (PFN_vkDestroyDebugUtilsMessengerEXT)vkGetInstanceProcAddr(instance, "vkDestroyDebugUtilsMessengerEXT");
+	if (func) {
+		func(instance, debug_messenger, allocator);
+	}
+}
+
+static std::vector<const char *> get_required_extensions(bool headless)
+{
+	std::vector<const char *> extensions;
+	if (!headless) {
+		uint32_t glfw_extension_count = 0;
+		const char **glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_extension_count);
+		extensions.assign(glfw_extensions, glfw_extensions + glfw_extension_count);
+	}
+	if (ENABLE_VALIDATION_LAYERS) {
+		extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+	}
+	return extensions;
+}
+
+struct queue_family_indices
+{
+	std::optional<uint32_t> graphics_family;
+	std::optional<uint32_t> present_family;
+	/* Always set once graphics is, falls back to the graphics family */
+	std::optional<uint32_t> transfer_family;
+	/* Same fallback, a non-graphics family here can run compute alongside the graphics queue */
+	std::optional<uint32_t> compute_family;
+
+	bool is_complete() const
+	{
+		return this->graphics_family.has_value() && this->present_family.has_value();
+	}
+};
+
+void vk_app::run()
+{
+	this->run_start = std::chrono::steady_clock::now();
+
+	if (this->config.record_bench) {
+		this->config.headless = true;
+		if (this->config.cmd_count == 0) {
+			this->config.cmd_count = 20000;
+		}
+	}
+
+	if (this->config.headless && this->config.frame_count == 0) {
+		this->config.frame_count = 1000;
+	}
+
+	this->jobs.init(this->config.worker_count);
+	std::cout << "Job system: " << this->jobs.get_worker_count() << " workers, "
+		<< std::thread::hardware_concurrency() << " hardware threads\n";
+
+	if (!this->config.headless) {
+		window_init();
+	}
+	vulkan_init();
+
+	if (this->config.record_bench) {
+		record_benchmark();
+	} else {
+		this->sim.init(this->config.sim_hz, this->framebuffer_width, this->framebuffer_height);
+		if (this->config.headless || this->config.coupled_input) {
+			loop();
+		} else {
+			run_decoupled();
+		}
+		this->sim.deinit();
+
+		print_frame_stats();
+		print_memory_stats();
+		this->cpu_profiler.print_summary();
+		this->cpu_profiler.print_worst_frame();
+		this->gpu_profiler.print_summary();
+	}
+
+	vulkan_deinit();
+	if (!this->config.headless) {
+		window_deinit();
+	}
+	this->jobs.deinit();
+
+	if (!this->config.trace_path.empty()) {
+		if (this->trace.write_chrome_json(this->config.trace_path)) {
+			std::cout << "Wrote trace to " << this->config.trace_path << '\n';
+		} else {
+			std::cerr << "Failed to write trace to " << this->config.trace_path << '\n';
+		}
+	}
+	if (!this->config.trace_csv_path.empty()) {
+		if (this->trace.write_csv(this->config.trace_csv_path)) {
+			std::cout << "Wrote trace CSV to " << this->config.trace_csv_path << '\n';
+		} else {
+			std::cerr << "Failed to write trace CSV to " << this->config.trace_csv_path << '\n';
+		}
+	}
+}
+
+static void begin_cmd_buf(VkCommandBuffer buf, VkCommandBufferUsageFlags flags)
+{
+	CPU_ZONE("begin_cmd_buf");
+
+	VkCommandBufferBeginInfo cmd_buf_beg_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.pNext = nullptr,
+		.flags = flags,
+		.pInheritanceInfo = nullptr };
+
+	if (vkBeginCommandBuffer(buf, &cmd_buf_beg_info) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to begin command buffer");
+	}
+}
+
+static void create_cmd_bufs(VkDevice device, VkCommandPool pool, std::vector<VkCommandBuffer> &bufs, uint32_t count)
+{
+	VkCommandBufferAllocateInfo alloc_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+		.pNext = nullptr,
+		.commandPool = pool,
+		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+		.commandBufferCount = count};
+
+	bufs.resize(count);
+	if (vkAllocateCommandBuffers(device, &alloc_info, bufs.data()) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create command pool");
+	}
+}
+
+static VkSemaphore create_semaphore(VkDevice device)
+{
+	VkSemaphoreCreateInfo create_info = {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+		.pNext = nullptr,
+		.flags = 0};
+
+	VkSemaphore sem;
+	if (vkCreateSemaphore(device, &create_info, vk_allocation_callbacks(), &sem) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create semaphore");
+	}
+
+	return sem;
+}
+
+static VkFence create_fence(VkDevice device, VkFenceCreateFlags flags)
+{
+	VkFenceCreateInfo create_info = {
+		.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+		.pNext = nullptr,
+		.flags = flags};
+
+	VkFence fence;
+	if (vkCreateFence(device, &create_info, vk_allocation_callbacks(), &fence) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create fence");
+	}
+
+	return fence;
+}
+
+/* Returns the number of nanoseconds the CPU was blocked, 0 if the fence was already signaled */
+static uint64_t wait_for_fence(VkDevice device, VkFence fence)
+{
+	CPU_ZONE("wait_for_fence");
+
+	VkResult status = vkGetFenceStatus(device, fence);
+	if (status == VK_SUCCESS) {
+		return 0;
+	} else if (status != VK_NOT_READY) {
+		throw std::runtime_error("Failed to get fence status");
+	}
+
+	auto beg = std::chrono::steady_clock::now();
+	if (vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to wait for fence");
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	return std::max<uint64_t>(1, std::chrono::duration_cast<std::chrono::nanoseconds>(end - beg).count());
+}
+
+/* Returns VK_SUCCESS, VK_SUBOPTIMAL_KHR or VK_ERROR_OUT_OF_DATE_KHR, throws on anything else */
+static VkResult aquire_next_image(
+	VkDevice device,
+	VkSwapchainKHR swapchain,
+	VkSemaphore present_complete_sem,
+	uint32_t &image_ix)
+{
+	CPU_ZONE("aquire_next_image");
+
+	VkResult result = vkAcquireNextImageKHR(
+		device,
+		swapchain,
+		UINT64_MAX,
+		present_complete_sem,
+		nullptr,
+		&image_ix);
+	if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR && result != VK_ERROR_OUT_OF_DATE_KHR) {
+		throw std::runtime_error("Failed to acquire next image");
+	}
+	return result;
+}
+
+static void submit_queue_sync(VkQueue queue, VkCommandBuffer cmd_buf)
+{
+	VkSubmitInfo submit_info = {
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.pNext = nullptr,
+		.waitSemaphoreCount = 0,
+		.pWaitSemaphores = VK_NULL_HANDLE,
+		.pWaitDstStageMask = VK_NULL_HANDLE,
+		.commandBufferCount = 1,
+		.pCommandBuffers = &cmd_buf,
+		.signalSemaphoreCount = 0,
+		.pSignalSemaphores = VK_NULL_HANDLE};
+
+	if (vkQueueSubmit(queue, 1, &submit_info, nullptr) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to submit queue");
+	}
+}
+
+static void submit_queue_async(VkQueue queue, VkCommandBuffer cmd_buf, vk_submit_sync &sync, VkFence fence)
+{
+	CPU_ZONE("submit_queue_async");
+
+	VkSubmitInfo submit_info = {
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.pNext = nullptr,
+		.waitSemaphoreCount = 0,
+		.pWaitSemaphores = nullptr,
+		.pWaitDstStageMask = nullptr,
+		.commandBufferCount = 1,
+		.pCommandBuffers = &cmd_buf,
+		.signalSemaphoreCount = 0,
+		.pSignalSemaphores = nullptr};
+	sync.apply(submit_info);
+
+	if (vkQueueSubmit(queue, 1, &submit_info, fence) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to submit queue");
+	}
+}
+
+/* Returns VK_SUCCESS, VK_SUBOPTIMAL_KHR or VK_ERROR_OUT_OF_DATE_KHR, throws on anything else */
+static VkResult present_queue(VkQueue queue, VkSwapchainKHR swapchain, uint32_t img_ix, VkSemaphore render_complete_sem)
+{
+	CPU_ZONE("present_queue");
+
+	VkPresentInfoKHR present_info = {
+		.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+		.pNext = nullptr,
+		.waitSemaphoreCount = 1,
+		.pWaitSemaphores = &render_complete_sem,
+		.swapchainCount = 1,
+		.pSwapchains = &swapchain,
+		.pImageIndices = &img_ix,
+		.pResults = nullptr};
+
+	VkResult result = vkQueuePresentKHR(queue, &present_info);
+	if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR && result != VK_ERROR_OUT_OF_DATE_KHR) {
+		throw std::runtime_error("Failed to present queue");
+	}
+	return result;
+}
+
+static constexpr size_t FRAME_TIME_SAMPLES = 1 << 16;
+/* Fewest regions of the stream buffer uploads rotate through */
+static constexpr uint32_t UPLOAD_SLOTS = 8;
+
+/*
+ * A transfer only overwrites a region once the frame that last read it has
+ * completed, which needs more regions than frames in flight can be reading
+ */
+static uint32_t get_upload_slots(uint32_t frames_in_flight)
+{
+	return std::max(UPLOAD_SLOTS, frames_in_flight + 1);
+}
+
+void vk_app::loop()
+{
+	uint32_t frame_ix = 0;
+	this->frame_stats.frame_times_ns.reserve(FRAME_TIME_SAMPLES);
+
+	const bool tracing = !this->config.trace_path.empty() || !this->config.trace_csv_path.empty();
+	const bool decoupled = !this->config.headless && !this->config.coupled_input;
+	cpu_trace_set_thread_name(decoupled ? "Render thread" : "Main thread");
+	this->cpu_profiler.init(tracing ? &this->trace : nullptr);
+	if (tracing) {
+		this->trace.set_thread_name(vk_gpu_profiler::GPU_TRACE_TID, "GPU graphics queue");
+	}
+
+	std::vector<uint8_t> upload_data((size_t)this->config.upload_kb * 1024);
+	const uint32_t upload_slots = get_upload_slots(this->config.frames_in_flight);
+	for (size_t i=0u; i<upload_data.size(); ++i) {
+		upload_data[i] = (uint8_t)i;
+	}
+
+	auto loop_beg = std::chrono::steady_clock::now();
+	auto frame_beg = loop_beg;
+	auto last_summary = loop_beg;
+	uint64_t seen_input_serial = 0;
+
+	while (this->running) {
+		vk_frame &frame = this->frames[frame_ix];
+
+		/* Only block on the slot we are about to reuse, the other frames keep running on the GPU */
+		const bool timeline = this->graphics_timeline.is_enabled();
+		uint64_t blocked_ns = timeline
+			? this->graphics_timeline.wait(frame.timeline_value)
+			: wait_for_fence(this->vk_device, frame.in_flight_fence);
+		if (blocked_ns) {
+			++this->frame_stats.blocked_count;
+			this->frame_stats.blocked_ns += blocked_ns;
+			this->frame_stats.blocked_max_ns = std::max(this->frame_stats.blocked_max_ns, blocked_ns);
+		}
+
+		VkImage img;
+		uint32_t img_ix = 0;
+		if (this->config.headless) {
+			img = this->vk_offscreen_images[frame_ix];
+		} else {
+			if (this->swapchain_dirty) {
+				recreate_swapchain();
+			}
+
+			VkResult result = aquire_next_image(this->vk_device, this->vk_swapchain, frame.image_available_sem, img_ix);
+			if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+				/*
+				 * Nothing was acquired and the fence is still signaled, retry
+				 * the slot on the new swapchain. None of the frame's
+				 * bookkeeping below has run yet, it happens once per serial.
+				 */
+				recreate_swapchain();
+				continue;
+			}
+			/* A suboptimal image is still presentable, recreate once this frame is out */
+			if (result == VK_SUBOPTIMAL_KHR) {
+				this->swapchain_dirty = true;
+			}
+			img = this->vk_swapchain_images[img_ix];
+		}
+
+		/* The slot's previous frame is done, and with it every frame before */
+		const uint64_t frame_serial = this->frame_stats.frame_count;
+		if (frame_serial >= this->config.frames_in_flight) {
+			this->deletion_queue.retire(frame_serial - this->config.frames_in_flight);
+		}
+		this->deletion_queue.begin_frame(frame_serial);
+		if (this->config.hot_reload) {
+			apply_shader_reloads();
+		}
+		this->uniforms.begin_frame(frame_ix);
+		if (this->host_allocator.is_enabled()) {
+			this->host_allocator.begin_frame(frame_ix);
+		}
+		const uint64_t host_allocs = this->host_allocator.get_heap_alloc_count();
+		if (this->gpu_culler.is_enabled() && frame_serial >= this->config.frames_in_flight) {
+			++this->frame_stats.gpu_cull_frames;
+			this->frame_stats.gpu_cull_visible += this->gpu_culler.get_visible_count(frame_ix);
+		}
+
+		if (!timeline && vkResetFences(this->vk_device, 1, &frame.in_flight_fence) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to reset fence");
+		}
+
+		/*
+		 * Stand-in for streamed mesh data. Each region is overwritten whole,
+		 * so it is never released back from graphics to the transfer family.
+		 */
+		if (!upload_data.empty()) {
+			uint32_t slot = (uint32_t)(this->frame_stats.frame_count % upload_slots);
+			this->uploader.upload_buffer(
+				this->vk_stream_buffer,
+				(VkDeviceSize)slot * upload_data.size(),
+				upload_data.data(),
+				upload_data.size(),
+				VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+				VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+			this->uploader.flush();
+		}
+
+		if (vkResetCommandPool(this->vk_device, frame.cmd_pool, 0) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to reset command pool");
+		}
+		/* As late as possible, after every wait, so the frame carries the newest input */
+		this->frame_sim = this->sim.read();
+		vk_submit_sync sync;
+		begin_cmd_buf(frame.cmd_buf, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+		this->gpu_profiler.begin_frame(frame.cmd_buf, frame_ix);
+		this->uploader.record_acquires(frame.cmd_buf, sync);
+		{
+			VK_GPU_ZONE(this->gpu_profiler, frame.cmd_buf, "frame");
+			if (this->stream_slot != slot_allocator::INVALID_SLOT) {
+				/* Bound once per frame, draws only push the slots of what they read */
+				this->bindless.bind(frame.cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS);
+				this->bindless.push_indices(frame.cmd_buf, &this->stream_slot, 1);
+			}
+			this->frame_graph.bind_image(this->rg_target, img);
+			this->frame_graph.execute(frame.cmd_buf, frame_ix);
+		}
+		vkEndCommandBuffer(frame.cmd_buf);
+		this->uniforms.flush();
+
+		/* Headless frames have no present engine to synchronize with */
+		if (!this->config.headless) {
+			sync.wait(frame.image_available_sem, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+			sync.signal(this->vk_present_sems[img_ix]);
+		}
+		VkFence fence = frame.in_flight_fence;
+		if (timeline) {
+			frame.timeline_value = this->graphics_timeline.next();
+			sync.signal(this->graphics_timeline.get_semaphore(), frame.timeline_value);
+			fence = VK_NULL_HANDLE;
+		}
+		submit_queue_async(this->vk_graphics_queue, frame.cmd_buf, sync, fence);
+
+		if (this->frame_sim.input_serial != seen_input_serial) {
+			seen_input_serial = this->frame_sim.input_serial;
+			const uint64_t latency_ns = trace_now_ns() - this->frame_sim.input_time_ns;
+			auto &latencies = this->frame_stats.input_latency_ns;
+			if (latencies.size() < FRAME_TIME_SAMPLES) {
+				latencies.push_back(latency_ns);
+			} else {
+				latencies[this->frame_stats.input_frames % FRAME_TIME_SAMPLES] = latency_ns;
+			}
+			++this->frame_stats.input_frames;
+		}
+
+		if (!this->config.headless) {
+			VkResult result = present_queue(this->vk_graphics_queue, this->vk_swapchain, img_ix, this->vk_present_sems[img_ix]);
+			if (result != VK_SUCCESS) {
+				this->swapchain_dirty = true;
+			}
+		}
+
+		/* Swapchain recreation and hot reloads are expected to, anything else is worth chasing */
+		const uint64_t frame_host_allocs = this->host_allocator.get_heap_alloc_count() - host_allocs;
+		if (frame_host_allocs) {
+			++this->frame_stats.host_alloc_frames;
+			this->frame_stats.host_alloc_max = std::max(this->frame_stats.host_alloc_max, frame_host_allocs);
+		}
+
+		auto frame_end = std::chrono::steady_clock::now();
+		uint64_t frame_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(frame_end - frame_beg).count();
+		frame_beg = frame_end;
+
+		uint64_t frame_end_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(frame_end.time_since_epoch()).count();
+		this->cpu_profiler.end_frame(frame_end_ns - frame_ns, frame_end_ns);
+
+		if (this->config.profile && frame_end - last_summary >= std::chrono::seconds(1)) {
+			this->cpu_profiler.print_summary();
+			this->gpu_profiler.print_summary();
+			last_summary = frame_end;
+		}
+
+		if (this->frame_stats.frame_count == 0) {
+			this->frame_stats.first_frame_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+				frame_end - this->run_start).count();
+		}
+
+		auto &frame_times = this->frame_stats.frame_times_ns;
+		if (frame_times.size() < FRAME_TIME_SAMPLES) {
+			frame_times.push_back(frame_ns);
+		} else {
+			frame_times[this->frame_stats.frame_count % FRAME_TIME_SAMPLES] = frame_ns;
+		}
+
+		++this->frame_stats.frame_count;
+		frame_ix = (frame_ix + 1) % this->config.frames_in_flight;
+
+		if (this->config.frame_count && this->frame_stats.frame_count >= this->config.frame_count) {
+			this->running = false;
+		}
+
+		if (!this->config.headless) {
+			if (!decoupled) {
+				CPU_ZONE("glfwPollEvents");
+				glfwPollEvents();
+			}
+			if (wait_while_minimized()) {
+				/* Time spent paused is not frame time */
+				frame_beg = std::chrono::steady_clock::now();
+			}
+
+			if (glfwWindowShouldClose(this->window)) {
+				this->running = false;
+			}
+		}
+	}
+
+	vkDeviceWaitIdle(this->vk_device);
+
+	auto loop_end = std::chrono::steady_clock::now();
+	this->frame_stats.total_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(loop_end - loop_beg).count();
+}
+
+/*
+ * GLFW only pumps events on the main thread, so the frame loop moves to a
+ * thread of its own and the main thread does nothing but wait for events.
+ * Input then reaches the simulation as it happens instead of once per
+ * frame, however long the frame loop is blocked on the GPU.
+ */
+void vk_app::run_decoupled()
+{
+	std::exception_ptr error;
+	std::thread render_thread([&]() {
+		try {
+			loop();
+		} catch (...) {
+			error = std::current_exception();
+		}
+		this->running = false;
+		glfwPostEmptyEvent();
+	});
+
+	while (this->running) {
+		glfwWaitEvents();
+		if (glfwWindowShouldClose(this->window)) {
+			this->running = false;
+			notify_window_state();
+		}
+	}
+	render_thread.join();
+
+	if (error) {
+		std::rethrow_exception(error);
+	}
+}
+
+static void clear_image(VkCommandBuffer cmd_buf, VkImage image, VkClearColorValue color)
+{
+	VkImageSubresourceRange image_range = {
+		.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+		.baseMipLevel = 0,
+		.levelCount = 1,
+		.baseArrayLayer = 0,
+		.layerCount = 1};
+
+	vkCmdClearColorImage(cmd_buf, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &color, 1, &image_range);
+}
+
+/* Same sized formats only, which is all the stand-in passes need */
+static void copy_image(VkCommandBuffer cmd_buf, VkImage src, VkImage dst, VkExtent2D extent)
+{
+	VkImageCopy region = {
+		.srcSubresource = {
+			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+			.mipLevel = 0,
+			.baseArrayLayer = 0,
+			.layerCount = 1},
+		.srcOffset = { 0, 0, 0 },
+		.dstSubresource = {
+			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+			.mipLevel = 0,
+			.baseArrayLayer = 0,
+			.layerCount = 1},
+		.dstOffset = { 0, 0, 0 },
+		.extent = { extent.width, extent.height, 1 }};
+
+	vkCmdCopyImage(
+		cmd_buf,
+		src,
+		VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		dst,
+		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		1,
+		&region);
+}
+
+/* Stand-in for a scene's bounds, seeded spheres around the origin each drawing the same 36 index cube */
+static std::vector<gpu_cull_object> make_gpu_cull_scene(uint32_t object_count)
+{
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> pos(-500.0f, 500.0f);
+	std::uniform_real_distribution<float> radius(0.5f, 4.0f);
+
+	std::vector<gpu_cull_object> objects(object_count);
+	for (auto &o : objects) {
+		o = {
+			.center_x = pos(rng),
+			.center_y = pos(rng),
+			.center_z = pos(rng),
+			.radius = radius(rng),
+			.index_count = 36,
+			.first_index = 0,
+			.vertex_offset = 0,
+			.pad = 0};
+	}
+	return objects;
+}
+
+/* A camera at the origin turning slowly, so the visible set changes every frame, and steered by the simulation */
+static glm::mat4 gpu_cull_view_proj(uint64_t frame, float aspect, const sim_state &sim)
+{
+	const float yaw = (float)(frame % 3600) * glm::radians(0.1f) + sim.yaw;
+	const glm::vec3 forward(sinf(yaw) * cosf(sim.pitch), sinf(sim.pitch), -cosf(yaw) * cosf(sim.pitch));
+	return glm::perspectiveRH_ZO(glm::radians(60.0f), aspect, 0.1f, 1000.0f)
+		* glm::lookAtRH(glm::vec3(0.0f), forward, glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
+/*
+ * Stand-in frame: a cleared scene goes through two copies in place of
+ * post processing before it lands in the target. The overlay is only
+ * drawn when profiling, otherwise the graph culls the pass producing it.
+ */
+void vk_app::build_frame_graph()
+{
+	render_graph &graph = this->frame_graph.get_graph();
+	const bool headless = this->config.headless;
+	const VkFormat format = this->vk_target_format;
+	const VkExtent2D extent = { this->window_width, this->window_height };
+	const VkExtent2D overlay_extent = { std::min(256u, extent.width), std::min(64u, extent.height) };
+
+	/* Swapchain images are acquired by a semaphore wait at COLOR_ATTACHMENT_OUTPUT, the first barrier chains from it */
+	rg_state acquired = {
+		headless ? VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT : VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+		0,
+		VK_IMAGE_LAYOUT_UNDEFINED};
+	rg_state released = {
+		VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+		0,
+		headless ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR};
+	this->rg_target = graph.import_image("target", format, extent, acquired, released);
+
+	rg_resource scene = graph.create_image("scene", format, extent);
+	rg_resource post_a = graph.create_image("post_a", format, extent);
+	rg_resource post_b = graph.create_image("post_b", format, extent);
+	rg_resource overlay = graph.create_image("overlay", format, overlay_extent);
+
+	uint32_t pass = graph.add_pass("clear", [this, scene](VkCommandBuffer cmd_buf, uint32_t frame_ix) {
+		VK_GPU_ZONE(this->gpu_profiler, cmd_buf, "clear");
+		clear_image(cmd_buf, this->frame_graph.get_image(scene), { 1.0f, 0.0f, 1.0f, 0.0f });
+	});
+	graph.write(pass, scene, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+	pass = graph.add_pass("overlay", [this, overlay](VkCommandBuffer cmd_buf, uint32_t frame_ix) {
+		VK_GPU_ZONE(this->gpu_profiler, cmd_buf, "overlay");
+		clear_image(cmd_buf, this->frame_graph.get_image(overlay), { 0.0f, 1.0f, 0.0f, 0.0f });
+	});
+	graph.write(pass, overlay, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+	rg_resource post_chain[] = { scene, post_a, post_b, this->rg_target };
+	for (uint32_t i=0u; i<3u; ++i) {
+		rg_resource src = post_chain[i];
+		rg_resource dst = post_chain[i + 1];
+		const char *name = i < 2u ? "post" : "compose";
+		pass = graph.add_pass(name, [this, src, dst, extent, name](VkCommandBuffer cmd_buf, uint32_t frame_ix) {
+			VK_GPU_ZONE(this->gpu_profiler, cmd_buf, name);
+			copy_image(cmd_buf, this->frame_graph.get_image(src), this->frame_graph.get_image(dst), extent);
+		});
+		graph.read(pass, src, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+		graph.write(pass, dst, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+	}
+
+	if (this->config.profile) {
+		pass = graph.add_pass("draw_overlay", [this, overlay, overlay_extent](VkCommandBuffer cmd_buf, uint32_t frame_ix) {
+			VK_GPU_ZONE(this->gpu_profiler, cmd_buf, "overlay");
+			copy_image(cmd_buf, this->frame_graph.get_image(overlay), this->frame_graph.get_image(this->rg_target), overlay_extent);
+		});
+		graph.read(pass, overlay, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+		graph.write(pass, this->rg_target, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+	}
+
+	rg_resource scratch = 0;
+	if (this->config.cmd_count) {
+		/* Every frame fills its own part of the scratch buffer, so frames never depend on each other through it */
+		scratch = graph.import_buffer(
+			"scratch",
+			(VkDeviceSize)this->config.cmd_count * sizeof(uint32_t) * this->config.frames_in_flight,
+			{},
+			{});
+		pass = graph.add_pass("cmds", [this](VkCommandBuffer cmd_buf, uint32_t frame_ix) {
+			VK_GPU_ZONE(this->gpu_profiler, cmd_buf, "cmds");
+			record_cmds(cmd_buf, frame_ix);
+		});
+		graph.write(pass, scratch, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+	}
+
+	rg_resource cull_objects = 0, cull_draws = 0, cull_count = 0;
+	if (this->gpu_culler.is_enabled()) {
+		const uint32_t max_objects = this->gpu_culler.get_max_objects();
+		/* The previous frame's draws read the commands and count, this frame's cull must wait for them */
+		const rg_state indirect = { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT };
+		const rg_state uploaded = { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT };
+		cull_objects = graph.import_buffer("cull_objects", (VkDeviceSize)max_objects * sizeof(gpu_cull_object), uploaded, uploaded);
+		cull_draws = graph.import_buffer("cull_draws", (VkDeviceSize)max_objects * sizeof(VkDrawIndexedIndirectCommand), indirect, indirect);
+		cull_count = graph.import_buffer("cull_count", sizeof(uint32_t), indirect, indirect);
+
+		/* Recorded on the graphics queue, the draws consuming its output are in the same submit */
+		pass = graph.add_pass("gpu_cull", [this](VkCommandBuffer cmd_buf, uint32_t frame_ix) {
+			VK_GPU_ZONE(this->gpu_profiler, cmd_buf, "gpu_cull");
+			const float aspect = (float)this->window_width / (float)std::max(this->window_height, 1u);
+			const glm::mat4 view_proj = gpu_cull_view_proj(this->frame_stats.frame_count, aspect, this->frame_sim);
+			this->gpu_culler.record_cull(cmd_buf, frame_ix, make_cull_frustum(view_proj), this->config.gpu_cull_count);
+		});
+		graph.read(pass, cull_objects, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+		graph.write(pass, cull_draws, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+		graph.write(
+			pass,
+			cull_count,
+			VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+	}
+
+	this->frame_graph.build();
+	if (this->config.cmd_count) {
+		this->frame_graph.bind_buffer(scratch, this->vk_scratch_buffer);
+	}
+	if (this->gpu_culler.is_enabled()) {
+		this->frame_graph.bind_buffer(cull_objects, this->gpu_culler.get_object_buffer());
+		this->frame_graph.bind_buffer(cull_draws, this->gpu_culler.get_draw_buffer());
+		this->frame_graph.bind_buffer(cull_count, this->gpu_culler.get_count_buffer());
+	}
+}
+
+/* Records the stand-in commands, as secondaries on the job system when parallel recording is enabled */
+void vk_app::record_cmds(VkCommandBuffer cmd_buf, uint32_t frame_ix)
+{
+	CPU_ZONE("record_cmds");
+
+	VkBuffer scratch = this->vk_scratch_buffer;
+	VkDeviceSize frame_offset = (VkDeviceSize)this->config.cmd_count * sizeof(uint32_t) * frame_ix;
+	const uint32_t uniform_bytes = this->config.uniform_bytes;
+	auto record = [&](VkCommandBuffer buf, uint32_t beg, uint32_t end) {
+		for (uint32_t i=beg; i<end; ++i) {
+			/* Stand-in for the draw's transform, a real draw would bind it at the returned dynamic offset */
+			if (uniform_bytes) {
+				vk_linear_allocation constants = this->uniforms.alloc(uniform_bytes);
+				if (constants.data) {
+					memset(constants.data, (int)i, uniform_bytes);
+				}
+			}
+			vkCmdFillBuffer(buf, scratch, frame_offset + i * sizeof(uint32_t), sizeof(uint32_t), i);
+		}
+	};
+
+	if (this->recorder.is_enabled()) {
+		this->recorder.record(cmd_buf, frame_ix, this->config.cmd_count, record);
+	} else {
+		record(cmd_buf, 0, this->config.cmd_count);
+	}
+}
+
+/*
+ * Records the same frame over and over without submitting it, once inline
+ * and then through the recorder with 1, 2, 4, ... workers up to the
+ * configured worker count, so only CPU recording cost is measured.
+ */
+void vk_app::record_benchmark()
+{
+	const uint32_t cmd_count = this->config.cmd_count;
+	const uint32_t frame_count = this->config.frame_count;
+	const uint32_t max_workers = this->jobs.get_worker_count();
+
+	std::vector<uint32_t> worker_counts = { 0 };
+	for (uint32_t n=1u; n<max_workers; n*=2) {
+		worker_counts.push_back(n);
+	}
+	worker_counts.push_back(max_workers);
+
+	std::vector<VkCommandBuffer> primary;
+	create_cmd_bufs(this->vk_device, this->vk_cmd_pool, primary, 1);
+
+	VkBuffer scratch = this->vk_scratch_buffer;
+	auto record = [&](VkCommandBuffer buf, uint32_t beg, uint32_t end) {
+		for (uint32_t i=beg; i<end; ++i) {
+			vkCmdFillBuffer(buf, scratch, i * sizeof(uint32_t), sizeof(uint32_t), i);
+		}
+	};
+
+	std::cout << "Recording " << cmd_count << " commands x " << frame_count << " frames\n";
+	std::cout << std::setw(8) << "workers" << std::setw(12) << "ms/frame"
+		<< std::setw(12) << "Mcmds/s" << std::setw(10) << "speedup" << '\n';
+
+	double single_ns = 0.0;
+	for (uint32_t workers : worker_counts) {
+		vk_parallel_recorder bench;
+		if (workers) {
+			this->jobs.deinit();
+			this->jobs.init(workers);
+			bench.init(this->vk_device, this->graphics_family, this->jobs, 1);
+		}
+
+		auto record_frame = [&]() {
+			/* vk_cmd_pool allows implicit resets, beginning the buffer again discards the last frame */
+			begin_cmd_buf(primary[0], VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+			if (workers) {
+				bench.record(primary[0], 0, cmd_count, record);
+			} else {
+				record(primary[0], 0, cmd_count);
+			}
+			vkEndCommandBuffer(primary[0]);
+		};
+
+		for (uint32_t i=0u; i<10u; ++i) {
+			record_frame();
+		}
+
+		auto beg = std::chrono::steady_clock::now();
+		for (uint32_t i=0u; i<frame_count; ++i) {
+			record_frame();
+		}
+		auto end = std::chrono::steady_clock::now();
+		bench.deinit();
+
+		double frame_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - beg).count() / (double)frame_count;
+		if (workers == 1) {
+			single_ns = frame_ns;
+		}
+
+		std::cout << std::setw(8) << (workers ? std::to_string(workers) : "inline")
+			<< std::fixed << std::setprecision(3)
+			<< std::setw(12) << frame_ns / 1e6
+			<< std::setw(12) << cmd_count / frame_ns * 1e3
+			<< std::setw(9) << (single_ns > 0.0 ? single_ns / frame_ns : 1.0) << "x\n";
+		std::cout.unsetf(std::ios::floatfield);
+		std::cout << std::setprecision(6);
+	}
+
+	vkFreeCommandBuffers(this->vk_device, this->vk_cmd_pool, 1, primary.data());
+
+	this->jobs.deinit();
+	this->jobs.init(max_workers);
+}
+
+static uint64_t percentile(const std::vector<uint64_t> &sorted, double p)
+{
+	assert(!sorted.empty());
+	size_t ix = (size_t)(p * (sorted.size() - 1) + 0.5);
+	return sorted[std::min(ix, sorted.size() - 1)];
+}
+
+void vk_app::print_frame_stats() const
+{
+	const vk_frame_stats &stats = this->frame_stats;
+	std::cout << "Frames: " << stats.frame_count
+		<< ", frames in flight: " << this->config.frames_in_flight
+		<< ", blocked on fence: " << stats.blocked_count
+		<< " (total " << stats.blocked_ns / 1000000.0 << " ms"
+		<< ", max " << stats.blocked_max_ns / 1000000.0 << " ms)\n";
+	std::cout << "Time to first frame: " << stats.first_frame_ns / 1e6 << " ms ("
+		<< (this->pipeline_cache.is_warm() ? "warm" : "cold") << " pipeline cache)\n";
+
+	if (stats.frame_times_ns.empty() || stats.total_ns == 0) {
+		return;
+	}
+
+	std::vector<uint64_t> sorted = stats.frame_times_ns;
+	std::sort(sorted.begin(), sorted.end());
+
+	std::cout << "Throughput: " << stats.frame_count / (stats.total_ns / 1e9) << " frames/s\n"
+		<< "Frame time (ms): p50 " << percentile(sorted, 0.50) / 1e6
+		<< ", p90 " << percentile(sorted, 0.90) / 1e6
+		<< ", p99 " << percentile(sorted, 0.99) / 1e6
+		<< ", max " << sorted.back() / 1e6 << '\n';
+
+	if (stats.recreate_count) {
+		/* A resize hitch stays invisible while recreation fits in a median frame */
+		std::cout << "Swapchain recreated " << stats.recreate_count << " times"
+			<< " (avg " << stats.recreate_ns / stats.recreate_count / 1e6 << " ms"
+			<< ", max " << stats.recreate_max_ns / 1e6 << " ms"
+			<< ", " << (stats.recreate_max_ns <= percentile(sorted, 0.50) ? "within" : "over")
+			<< " one frame)\n";
+	}
+
+	if (!stats.input_latency_ns.empty()) {
+		std::vector<uint64_t> latencies = stats.input_latency_ns;
+		std::sort(latencies.begin(), latencies.end());
+		std::cout << "Input to submit (ms): p50 " << percentile(latencies, 0.50) / 1e6
+			<< ", p99 " << percentile(latencies, 0.99) / 1e6
+			<< ", max " << latencies.back() / 1e6
+			<< " over " << stats.input_frames << " frames with new input"
+			<< " (events pumped " << (this->config.coupled_input ? "once per frame" : "on their own thread") << ")\n";
+	}
+	const sim_stats sim = this->sim.get_stats();
+	if (sim.ticks) {
+		std::cout << "Simulation: " << sim.ticks << " ticks at " << this->config.sim_hz << " Hz, "
+			<< sim.events << " input events, "
+			<< sim.dropped << " dropped, "
+			<< sim.overruns << " late ticks\n";
+	}
+
+	if (stats.gpu_cull_frames) {
+		const double visible = (double)stats.gpu_cull_visible / stats.gpu_cull_frames;
+		std::cout << "GPU culling: " << visible << " of " << this->config.gpu_cull_count << " objects visible on average"
+			<< " (" << visible * 100.0 / this->config.gpu_cull_count << "%)\n";
+	}
+}
+
+void vk_app::print_memory_stats()
+{
+	vk_memory_stats stats = this->allocator.get_stats();
+
+	std::cout << "Device memory objects: " << stats.device_allocation_count
+		<< " / " << stats.max_device_allocation_count << '\n';
+
+	for (size_t i=0u; i<stats.types.size(); ++i) {
+		const vk_memory_type_stats &type = stats.types[i];
+		if (!type.reserved) {
+			continue;
+		}
+
+		std::cout << "  Type " << i
+			<< ": " << type.allocation_count << " allocations"
+			<< ", " << type.block_count << " blocks"
+			<< ", " << type.dedicated_count << " dedicated"
+			<< ", used " << type.used / 1024 << " KiB"
+			<< " of " << type.reserved / 1024 << " KiB"
+			<< ", fragmentation " << type.fragmentation << '\n';
+	}
+
+	const rg_stats &graph = this->frame_graph.get_graph().get_stats();
+	std::cout << "Render graph: " << graph.pass_count - graph.culled_count << " of " << graph.pass_count << " passes"
+		<< ", " << graph.barrier_batches << " barrier batches per frame"
+		<< " (" << graph.image_barriers << " image, " << graph.memory_barriers << " memory)"
+		<< ", transients " << graph.transient_bytes / 1024 << " KiB aliased into " << graph.heap_bytes / 1024 << " KiB"
+		<< " (saved " << (graph.transient_bytes - graph.heap_bytes) / 1024 << " KiB)\n";
+
+	const vk_upload_stats &uploads = this->uploader.get_stats();
+	if (uploads.upload_count) {
+		std::cout << "Uploads: " << uploads.bytes / (1024 * 1024) << " MiB"
+			<< " in " << uploads.upload_count << " copies"
+			<< ", " << uploads.batch_count << " batches"
+			<< ", staging ring full " << uploads.ring_wait_count << " times"
+			<< " (" << uploads.ring_wait_ns / 1e6 << " ms)\n";
+	}
+
+	const vk_linear_stats &uniforms = this->uniforms.get_stats();
+	if (uniforms.alloc_count) {
+		std::cout << "Per-frame constants: " << uniforms.alloc_count << " allocations"
+			<< ", peak " << uniforms.peak_frame_bytes / 1024 << " KiB of " << uniforms.frame_capacity / 1024 << " KiB per frame"
+			<< ", " << uniforms.overflow_count << " overflows"
+			<< ", " << uniforms.flush_count << " flushes\n";
+	}
+
+	if (this->bindless.is_enabled()) {
+		const slot_allocator &textures = this->bindless.get_texture_slots();
+		const slot_allocator &buffers = this->bindless.get_buffer_slots();
+		std::cout << "Bindless slots: textures " << textures.get_used() << " (peak " << textures.get_peak() << ")"
+			<< " of " << textures.get_capacity()
+			<< ", buffers " << buffers.get_used() << " (peak " << buffers.get_peak() << ")"
+			<< " of " << buffers.get_capacity() << '\n';
+	}
+
+	if (this->host_allocator.is_enabled()) {
+		static const char *const scope_names[HOST_SCOPE_COUNT] = {"command", "object", "cache", "device", "instance"};
+		const vk_host_memory_stats host = this->host_allocator.get_stats();
+		const double seconds = host.elapsed_ns / 1e9;
+		std::cout << "Host allocations by scope:\n";
+		for (uint32_t i=0u; i<HOST_SCOPE_COUNT; ++i) {
+			const vk_host_scope_stats &scope = host.scopes[i];
+			if (!scope.alloc_count && !scope.internal_bytes) {
+				continue;
+			}
+			std::cout << "  " << scope_names[i]
+				<< ": live " << scope.live_bytes / 1024 << " KiB"
+				<< " (peak " << scope.peak_bytes / 1024 << " KiB)"
+				<< ", " << scope.alloc_count << " allocations"
+				<< " (" << (seconds > 0.0 ? scope.alloc_count / seconds : 0.0) << "/s)"
+				<< ", " << scope.realloc_count << " reallocations"
+				<< ", " << scope.total_bytes / 1024 << " KiB total";
+			if (scope.internal_bytes) {
+				std::cout << ", internal " << scope.internal_bytes / 1024 << " KiB";
+			}
+			std::cout << '\n';
+		}
+		std::cout << "  Command arena: peak " << host.arena_peak_bytes / 1024 << " KiB"
+			<< " of " << host.arena_capacity / 1024 << " KiB per frame"
+			<< ", " << host.arena_overflow_count << " overflows\n"
+			<< "  Frames allocating outside command scope: " << this->frame_stats.host_alloc_frames
+			<< " of " << this->frame_stats.frame_count
+			<< " (max " << this->frame_stats.host_alloc_max << " in one frame)\n";
+	}
+
+	const vk_deletion_stats &deletions = this->deletion_queue.get_stats();
+	if (deletions.queued_count) {
+		std::cout << "Deferred deletions: " << deletions.retired_count << " of " << deletions.queued_count << " released"
+			<< " in " << deletions.retire_batches << " batches"
+			<< ", depth " << deletions.depth << " (max " << deletions.max_depth << ")"
+			<< ", pending " << deletions.pending_bytes / 1024 << " KiB"
+			<< " (max " << deletions.max_pending_bytes / 1024 << " KiB)\n";
+	}
+}
+
+void vk_app::window_init()
+{
+	if (!glfwInit()) {
+		exit(EXIT_FAILURE);
+	}
+
+	if (!glfwVulkanSupported()) {
+		exit(EXIT_FAILURE);
+	}
+
+	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+	glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
+
+	this->window = glfwCreateWindow(
+		this->window_width,
+		this->window_height,
+		"Vulkan",
+		nullptr,
+		nullptr);
+
+	if (!this->window) {
+		glfwTerminate();
+		exit(EXIT_FAILURE);
+	}
+
+	int width = 0, height = 0;
+	glfwGetFramebufferSize(this->window, &width, &height);
+	this->framebuffer_width = (uint32_t)width;
+	this->framebuffer_height = (uint32_t)height;
+
+	/* Every callback only records, the simulation thread applies the events at its own rate */
+	glfwSetWindowUserPointer(this->window, this);
+	glfwSetFramebufferSizeCallback(this->window, [](GLFWwindow *window, int width, int height) {
+		/* Not every platform reports a resize as out of date, so don't rely on the present result */
+		vk_app *app = (vk_app *)glfwGetWindowUserPointer(window);
+		app->framebuffer_width = (uint32_t)width;
+		app->framebuffer_height = (uint32_t)height;
+		app->swapchain_dirty = true;
+		app->sim.push({ input_event_type::resize, width, height, 0.0, 0.0, trace_now_ns() });
+		app->notify_window_state();
+	});
+	glfwSetWindowIconifyCallback(this->window, [](GLFWwindow *window, int iconified) {
+		vk_app *app = (vk_app *)glfwGetWindowUserPointer(window);
+		app->iconified = iconified == GLFW_TRUE;
+		app->notify_window_state();
+	});
+
+	glfwSetKeyCallback(this->window, [](GLFWwindow *window, int key_code, int scancode, int action, int mods) {
+		vk_app *app = (vk_app *)glfwGetWindowUserPointer(window);
+		app->sim.push({ input_event_type::key, key_code, action, 0.0, 0.0, trace_now_ns() });
+	});
+	glfwSetMouseButtonCallback(this->window, [](GLFWwindow *window, int button, int action, int mods) {
+		vk_app *app = (vk_app *)glfwGetWindowUserPointer(window);
+		app->sim.push({ input_event_type::mouse_button, button, action, 0.0, 0.0, trace_now_ns() });
+	});
+	glfwSetCursorPosCallback(this->window, [](GLFWwindow *window, double x, double y) {
+		vk_app *app = (vk_app *)glfwGetWindowUserPointer(window);
+		app->sim.push({ input_event_type::cursor, 0, 0, x, y, trace_now_ns() });
+	});
+}
+
+void vk_app::window_deinit()
+{
+	glfwDestroyWindow(this->window);
+	this->window = nullptr;
+	glfwTerminate();
+}
+
+/* Highest instance version the loader supports, vkEnumerateInstanceVersion is missing on 1.0 loaders */
+static uint32_t get_instance_version()
+{
+	auto enumerate_instance_version = (PFN_vkEnumerateInstanceVersion)vkGetInstanceProcAddr(
+		nullptr,
+		"vkEnumerateInstanceVersion");
+
+	uint32_t version = VK_API_VERSION_1_0;
+	if (enumerate_instance_version && enumerate_instance_version(&version) != VK_SUCCESS) {
+		version = VK_API_VERSION_1_0;
+	}
+	return version;
+}
+
+static VkInstance create_instance(bool headless, uint32_t api_version, vk_debug_sink &debug_sink)
+{
+	if (ENABLE_VALIDATION_LAYERS && !check_validation_layer_support()) {
+		throw std::runtime_error("Validation layer requested, but not available");
+	}
+
+	auto extensions = get_required_extensions(headless);
+
+	VkApplicationInfo app_info = {
+		.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+		.pApplicationName = "Learning Vulkan",
+		.applicationVersion = VK_MAKE_VERSION(1, 0, 0),
+		.pEngineName = "No Engine",
+		.engineVersion = VK_MAKE_VERSION(1, 0, 0),
+		.apiVersion = api_version};
+
+	VkInstanceCreateInfo create_info = {
+		.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+		.pApplicationInfo = &app_info,
+		.enabledExtensionCount = static_cast<uint32_t>(extensions.size()),
+		.ppEnabledExtensionNames = extensions.data()};
+
+	VkDebugUtilsMessengerCreateInfoEXT debug_create_info = {};
+	if (ENABLE_VALIDATION_LAYERS) {
+		create_info.enabledLayerCount = static_cast<uint32_t>(s_validation_layers.size());
+		create_info.ppEnabledLayerNames = s_validation_layers.data();
+
+		debug_sink.fill_create_info(debug_create_info);
+		create_info.pNext = (VkDebugUtilsMessengerCreateInfoEXT *)&debug_create_info;
+	} else {
+		create_info.enabledLayerCount = 0;
+		create_info.pNext = nullptr;
+	}
+
+	VkInstance instance;
+	if (vkCreateInstance(&create_info, vk_allocation_callbacks(), &instance) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create instance");
+	}
+
+	return instance;
+}
+
+static VkDebugUtilsMessengerEXT setup_debug_messenger(VkInstance instance, vk_debug_sink &debug_sink)
+{
+	if (!ENABLE_VALIDATION_LAYERS) {
+		return VK_NULL_HANDLE;
+	}
+
+	VkDebugUtilsMessengerCreateInfoEXT create_info;
+	debug_sink.fill_create_info(create_info);
+
+	VkDebugUtilsMessengerEXT messenger;
+	if (create_debug_utils_messenger_ext(
+			instance,
+			&create_info,
+			vk_allocation_callbacks(),
+			&messenger) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to set up debug messenger");
+	}
+
+	return messenger;
+}
+
+static VkSurfaceKHR create_surface(VkInstance instance, GLFWwindow *window)
+{
+	VkSurfaceKHR surface;
+	if (glfwCreateWindowSurface(
+			instance,
+			window,
+			vk_allocation_callbacks(),
+			&surface) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create window surface");
+	}
+	return surface;
+}
+
+static queue_family_indices find_queue_families(VkPhysicalDevice device, VkSurfaceKHR surface)
+{
+	queue_family_indices indices;
+
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+
+	int i = 0;
+	for (const auto &queueFamily : queueFamilies) {
+		if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+			indices.graphics_family = i;
+		}
+
+		if (surface) {
+			VkBool32 presentSupport = false;
+			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+
+			if (presentSupport) {
+				indices.present_family = i;
+			}
+		} else if (indices.graphics_family.has_value()) {
+			/* Without a surface nothing is presented, the graphics queue stands in for present */
+			indices.present_family = indices.graphics_family;
+		}
+
+		if (indices.is_complete()) {
+			break;
+		}
+
+		++i;
+	}
+
+	/*
+	 * Prefer a transfer-only family (the copy engines on discrete GPUs),
+	 * then any non-graphics family with transfer support. Graphics
+	 * families support transfers implicitly.
+	 */
+	for (uint32_t f=0u; f<queueFamilyCount; ++f) {
+		VkQueueFlags flags = queueFamilies[f].queueFlags;
+		if (!(flags & VK_QUEUE_TRANSFER_BIT) || (flags & VK_QUEUE_GRAPHICS_BIT)) {
+			continue;
+		}
+		if (!(flags & VK_QUEUE_COMPUTE_BIT)) {
+			indices.transfer_family = f;
+			break;
+		}
+		if (!indices.transfer_family.has_value()) {
+			indices.transfer_family = f;
+		}
+	}
+	if (!indices.transfer_family.has_value()) {
+		indices.transfer_family = indices.graphics_family;
+	}
+
+	/* Async compute is a compute family without graphics, graphics families usually take compute too */
+	for (uint32_t f=0u; f<queueFamilyCount; ++f) {
+		VkQueueFlags flags = queueFamilies[f].queueFlags;
+		if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT)) {
+			indices.compute_family = f;
+			break;
+		}
+	}
+	if (!indices.compute_family.has_value()) {
+		indices.compute_family = indices.graphics_family;
+	}
+
+	return indices;
+}
+
+static bool is_device_suitable(VkPhysicalDevice device, VkSurfaceKHR surface)
+{
+	queue_family_indices indices = find_queue_families(device, surface);
+	return indices.is_complete();
+}
+
+static VkPhysicalDevice pick_physical_device(VkInstance instance, VkSurfaceKHR surface)
+{
+	uint32_t device_count = 0;
+	vkEnumeratePhysicalDevices(instance, &device_count, nullptr);
+
+	if (device_count == 0) {
+		throw std::runtime_error("Failed to find GPUs with Vulkan support");
+	}
+
+	std::vector<VkPhysicalDevice> devices(device_count);
+	vkEnumeratePhysicalDevices(instance, &device_count, devices.data());
+
+	VkPhysicalDevice ret = VK_NULL_HANDLE;
+	for (const auto &device : devices) {
+		if (is_device_suitable(device, surface)) {
+			ret = device;
+			break;
+		}
+	}
+
+	if (ret == VK_NULL_HANDLE) {
+		throw std::runtime_error("Failed to find a suitable GPU");
+	}
+
+	VkPhysicalDeviceProperties props;
+	vkGetPhysicalDeviceProperties(ret, &props);
+	std::cout << "Using device: " << props.deviceName << '\n';
+
+	return ret;
+}
+
+static bool supports_timeline_semaphores(VkPhysicalDevice physical_device)
+{
+	VkPhysicalDeviceProperties props;
+	vkGetPhysicalDeviceProperties(physical_device, &props);
+	if (props.apiVersion < VK_API_VERSION_1_2) {
+		return false;
+	}
+
+	VkPhysicalDeviceTimelineSemaphoreFeatures timeline_features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES,
+		.pNext = nullptr,
+		.timelineSemaphore = VK_FALSE};
+
+	VkPhysicalDeviceFeatures2 features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+		.pNext = &timeline_features,
+		.features = {}};
+
+	vkGetPhysicalDeviceFeatures2(physical_device, &features);
+	return timeline_features.timelineSemaphore == VK_TRUE;
+}
+
+/* Indices are uniform per draw, coming from push constants, so non-uniform indexing isn't needed */
+static bool supports_descriptor_indexing(VkPhysicalDevice physical_device)
+{
+	VkPhysicalDeviceProperties props;
+	vkGetPhysicalDeviceProperties(physical_device, &props);
+	if (props.apiVersion < VK_API_VERSION_1_2) {
+		return false;
+	}
+
+	VkPhysicalDeviceDescriptorIndexingFeatures indexing_features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES,
+		.pNext = nullptr};
+
+	VkPhysicalDeviceFeatures2 features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+		.pNext = &indexing_features,
+		.features = {}};
+
+	vkGetPhysicalDeviceFeatures2(physical_device, &features);
+	return indexing_features.runtimeDescriptorArray
+		&& indexing_features.descriptorBindingPartiallyBound
+		&& indexing_features.descriptorBindingSampledImageUpdateAfterBind
+		&& indexing_features.descriptorBindingStorageBufferUpdateAfterBind
+		&& indexing_features.descriptorBindingUpdateUnusedWhilePending;
+}
+
+/* Everything vkCmdDrawIndexedIndirectCount needs for one draw per visible object, all available on 1.0 */
+static bool supports_draw_indirect_count(VkPhysicalDevice physical_device)
+{
+	VkPhysicalDeviceFeatures features;
+	vkGetPhysicalDeviceFeatures(physical_device, &features);
+	if (!features.multiDrawIndirect || !features.drawIndirectFirstInstance) {
+		return false;
+	}
+
+	uint32_t ext_count = 0;
+	if (vkEnumerateDeviceExtensionProperties(physical_device, nullptr, &ext_count, nullptr) != VK_SUCCESS) {
+		return false;
+	}
+	std::vector<VkExtensionProperties> exts(ext_count);
+	if (vkEnumerateDeviceExtensionProperties(physical_device, nullptr, &ext_count, exts.data()) != VK_SUCCESS) {
+		return false;
+	}
+
+	for (const auto &ext : exts) {
+		if (strcmp(ext.extensionName, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool supports_texture_compression_bc(VkPhysicalDevice physical_device)
+{
+	VkPhysicalDeviceFeatures features;
+	vkGetPhysicalDeviceFeatures(physical_device, &features);
+	return features.textureCompressionBC == VK_TRUE;
+}
+
+/* Optional features, each only set when it was asked for and is supported */
+struct device_features
+{
+	bool timeline_semaphores = false;
+	bool descriptor_indexing = false;
+	bool draw_indirect_count = false;
+	bool texture_compression_bc = false;
+};
+
+static VkDevice create_logical_device(
+	VkSurfaceKHR surface,
+	VkPhysicalDevice physical_device,
+	VkQueue *graphics_queue,
+	VkQueue *present_queue,
+	VkQueue *transfer_queue,
+	VkQueue *compute_queue,
+	const queue_family_indices &indices,
+	const device_features &enabled)
+{
+	std::vector<VkDeviceQueueCreateInfo> queue_create_infos;
+	std::set<uint32_t> unique_queue_families = {
+		indices.graphics_family.value(),
+		indices.present_family.value(),
+		indices.transfer_family.value(),
+		indices.compute_family.value() };
+
+	float queue_priority = 1.0f;
+	for (uint32_t queue_family : unique_queue_families) {
+		VkDeviceQueueCreateInfo queue_create_info = {
+			.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+			.queueFamilyIndex = queue_family,
+			.queueCount = 1,
+			.pQueuePriorities = &queue_priority};
+		queue_create_infos.push_back(queue_create_info);
+	}
+
+	std::vector<const char *> dev_exts = {
+		VK_KHR_SHADER_DRAW_PARAMETERS_EXTENSION_NAME};
+	if (surface) {
+		dev_exts.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+	}
+	if (enabled.draw_indirect_count) {
+		dev_exts.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+	}
+
+	VkPhysicalDeviceFeatures deviceFeatures = {
+		/*.geometryShader = VK_TRUE,
+		.tessellationShader = VK_TRUE*/};
+	if (enabled.draw_indirect_count) {
+		deviceFeatures.multiDrawIndirect = VK_TRUE;
+		deviceFeatures.drawIndirectFirstInstance = VK_TRUE;
+	}
+	if (enabled.texture_compression_bc) {
+		deviceFeatures.textureCompressionBC = VK_TRUE;
+	}
+
+	VkPhysicalDeviceTimelineSemaphoreFeatures timeline_features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES,
+		.pNext = nullptr,
+		.timelineSemaphore = VK_TRUE};
+
+	VkPhysicalDeviceDescriptorIndexingFeatures indexing_features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES,
+		.pNext = nullptr};
+	indexing_features.runtimeDescriptorArray = VK_TRUE;
+	indexing_features.descriptorBindingPartiallyBound = VK_TRUE;
+	indexing_features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+	indexing_features.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+	indexing_features.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+
+	/* Optional 1.2 features are only chained in when they were asked for and are supported */
+	void *features = nullptr;
+	if (enabled.timeline_semaphores) {
+		timeline_features.pNext = features;
+		features = &timeline_features;
+	}
+	if (enabled.descriptor_indexing) {
+		indexing_features.pNext = features;
+		features = &indexing_features;
+	}
+
+	VkDeviceCreateInfo create_info = {
+		.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+		.pNext = features,
+		.flags = 0,
+		.queueCreateInfoCount = (uint32_t)queue_create_infos.size(),
+		.pQueueCreateInfos = queue_create_infos.data(),
+		.enabledLayerCount = 0, // DEPRECATED
+		.ppEnabledLayerNames = nullptr, // DEPRECATED
+		.enabledExtensionCount = (uint32_t)dev_exts.size(),
+		.ppEnabledExtensionNames = dev_exts.data(),
+		.pEnabledFeatures = &deviceFeatures};
+
+	if (ENABLE_VALIDATION_LAYERS) {
+		create_info.enabledLayerCount = static_cast<uint32_t>(s_validation_layers.size());
+		create_info.ppEnabledLayerNames = s_validation_layers.data();
+	}
+
+	VkDevice device;
+	if (vkCreateDevice(physical_device, &create_info, vk_allocation_callbacks(), &device) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create logical device");
+	}
+
+	vkGetDeviceQueue(device, indices.graphics_family.value(), 0, graphics_queue);
+	vkGetDeviceQueue(device, indices.present_family.value(), 0, present_queue);
+	vkGetDeviceQueue(device, indices.transfer_family.value(), 0, transfer_queue);
+	vkGetDeviceQueue(device, indices.compute_family.value(), 0, compute_queue);
+
+	return device;
+}
+
+static VkImageView create_image_view(
+	VkDevice device,
+	VkImage image,
+	VkFormat format,
+	VkImageAspectFlags aspect_flags,
+	VkImageViewType view_type,
+	uint32_t layer_count,
+	uint32_t mip_levels)
+{
+	VkImageViewCreateInfo create_info = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+		.pNext = nullptr,
+		.flags = 0,
+		.image = image,
+		.viewType = view_type,
+		.format = format,
+		.components = {
+			.r = VK_COMPONENT_SWIZZLE_IDENTITY,
+			.g = VK_COMPONENT_SWIZZLE_IDENTITY,
+			.b = VK_COMPONENT_SWIZZLE_IDENTITY,
+			.a = VK_COMPONENT_SWIZZLE_IDENTITY},
+		.subresourceRange = {
+			.aspectMask = aspect_flags,
+			.baseMipLevel = 0,
+			.levelCount = mip_levels,
+			.baseArrayLayer = 0,
+			.layerCount = layer_count}
+	};
+
+	VkImageView view;
+	if (vkCreateImageView(device, &create_info, vk_allocation_callbacks(), &view) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create image view");
+	}
+	return view;
+}
+
+/* extent is the framebuffer size on input and the swapchain's on output */
+static VkSwapchainKHR create_swap_chain(
+	VkPhysicalDevice physical_device,
+	VkDevice device,
+	VkSurfaceKHR surface,
+	uint32_t graphics_family,
+	VkSwapchainKHR old_swapchain,
+	VkExtent2D &extent,
+	VkFormat &image_format,
+	std::vector<VkImage> &swapchain_images,
+	std::vector<VkImageView> &swapchain_image_views)
+{
+	VkSurfaceCapabilitiesKHR surface_caps;
+	if (vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physical_device, surface, &surface_caps) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to get physical device surface capabilities");
+	}
+	uint32_t num_images = surface_caps.minImageCount + 1;
+	if (surface_caps.maxImageCount && num_images > surface_caps.maxImageCount) {
+		--num_images;
+	}
+
+	/* Some platforms leave the extent to the swapchain, signaled by 0xFFFFFFFF */
+	if (surface_caps.currentExtent.width != UINT32_MAX) {
+		extent = surface_caps.currentExtent;
+	} else {
+		extent.width = std::clamp(extent.width, surface_caps.minImageExtent.width, surface_caps.maxImageExtent.width);
+		extent.height = std::clamp(extent.height, surface_caps.minImageExtent.height, surface_caps.maxImageExtent.height);
+	}
+
+	/* Get desired surface format if supported */
+	uint32_t num_formats;
+	std::vector<VkSurfaceFormatKHR> surface_formats;
+	if (vkGetPhysicalDeviceSurfaceFormatsKHR(physical_device, surface, &num_formats, nullptr) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to get physical device surface formats");
+	}
+	surface_formats.resize(num_formats);
+	if (vkGetPhysicalDeviceSurfaceFormatsKHR(physical_device, surface, &num_formats, surface_formats.data()) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to get physical device surface formats");
+	}
+	VkSurfaceFormatKHR surface_format = surface_formats[0];
+	for (const auto &format : surface_formats) {
+		if (format.format == VK_FORMAT_R8G8B8A8_SRGB
+				&& format.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
+			surface_format = format;
+			break;
+		}
+	}
+
+	/* Get desired present mode if supported */
+	uint32_t num_present_modes;
+	std::vector<VkPresentModeKHR> present_modes;
+	if (vkGetPhysicalDeviceSurfacePresentModesKHR(
+			physical_device,
+			surface,
+			&num_present_modes,
+			nullptr) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to get physical device surface present modes");
+	}
+	present_modes.resize(num_present_modes);
+	if (vkGetPhysicalDeviceSurfacePresentModesKHR(
+			physical_device,
+			surface,
+			&num_present_modes,
+			present_modes.data()) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to get physical device surface present modes");
+	}
+	VkPresentModeKHR present_mode = VK_PRESENT_MODE_FIFO_KHR;
+	for (const auto &pm : present_modes) {
+		if (pm == VK_PRESENT_MODE_MAILBOX_KHR) {
+			present_mode = pm;
+			break;
+		}
+	}
+
+	VkSwapchainCreateInfoKHR create_info = {
+		.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
+		.pNext = nullptr,
+		.flags = 0,
+		.surface = surface,
+		.minImageCount = num_images,
+		.imageFormat = surface_format.format,
+		.imageColorSpace = surface_format.colorSpace,
+		.imageExtent = extent,
+		.imageArrayLayers = 1,
+		.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
+			| VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+		.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
+		.queueFamilyIndexCount = 1,
+		.pQueueFamilyIndices = &graphics_family,
+		.preTransform = surface_caps.currentTransform,
+		.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
+		.presentMode = present_mode,
+		.clipped = VK_TRUE,
+		.oldSwapchain = old_swapchain};
+
+	VkSwapchainKHR swapchain;
+	if (vkCreateSwapchainKHR(device, &create_info, vk_allocation_callbacks(), &swapchain) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create swapchain");
+	}
+	image_format = surface_format.format;
+
+	uint32_t num_swapchain_images = 0;
+	if (vkGetSwapchainImagesKHR(device, swapchain, &num_swapchain_images, nullptr) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to get swapchain images");
+	}
+	swapchain_images.resize(num_swapchain_images);
+	swapchain_image_views.resize(num_swapchain_images);
+	if (vkGetSwapchainImagesKHR(device, swapchain, &num_swapchain_images, swapchain_images.data()) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to get swapchain images");
+	}
+
+	int layer_count = 1;
+	int mip_levels = 1;
+	for (uint32_t i=0u; i<num_swapchain_images; ++i) {
+		swapchain_image_views[i] = create_image_view(
+			device,
+			swapchain_images[i],
+			surface_format.format,
+			VK_IMAGE_ASPECT_COLOR_BIT,
+			VK_IMAGE_VIEW_TYPE_2D,
+			layer_count,
+			mip_levels);
+	}
+
+	return swapchain;
+}
+
+static constexpr VkFormat OFFSCREEN_FORMAT = VK_FORMAT_R8G8B8A8_UNORM;
+
+static void create_offscreen_targets(
+	VkDevice device,
+	vk_memory_allocator &allocator,
+	uint32_t width,
+	uint32_t height,
+	uint32_t count,
+	std::vector<VkImage> &images,
+	std::vector<vk_allocation> &memory,
+	std::vector<VkImageView> &image_views)
+{
+	const VkFormat format = OFFSCREEN_FORMAT;
+
+	images.resize(count);
+	memory.resize(count);
+	image_views.resize(count);
+
+	for (uint32_t i=0u; i<count; ++i) {
+		VkImageCreateInfo create_info = {
+			.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+			.pNext = nullptr,
+			.flags = 0,
+			.imageType = VK_IMAGE_TYPE_2D,
+			.format = format,
+			.extent = { width, height, 1 },
+			.mipLevels = 1,
+			.arrayLayers = 1,
+			.samples = VK_SAMPLE_COUNT_1_BIT,
+			.tiling = VK_IMAGE_TILING_OPTIMAL,
+			.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
+				| VK_IMAGE_USAGE_TRANSFER_SRC_BIT
+				| VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+			.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+			.queueFamilyIndexCount = 0,
+			.pQueueFamilyIndices = nullptr,
+			.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED};
+
+		if (vkCreateImage(device, &create_info, vk_allocation_callbacks(), &images[i]) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create offscreen image");
+		}
+
+		memory[i] = allocator.alloc_image(images[i], VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+		image_views[i] = create_image_view(
+			device,
+			images[i],
+			format,
+			VK_IMAGE_ASPECT_COLOR_BIT,
+			VK_IMAGE_VIEW_TYPE_2D,
+			1,
+			1);
+	}
+}
+
+/* Device local target of the stand-in commands and uploads */
+static void create_scratch_buffer(
+	VkDevice device,
+	vk_memory_allocator &allocator,
+	VkDeviceSize size,
+	VkBufferUsageFlags usage,
+	VkBuffer &buffer,
+	vk_allocation &memory)
+{
+	VkBufferCreateInfo create_info = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.pNext = nullptr,
+		.flags = 0,
+		.size = size,
+		.usage = usage,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+		.queueFamilyIndexCount = 0,
+		.pQueueFamilyIndices = nullptr};
+
+	if (vkCreateBuffer(device, &create_info, vk_allocation_callbacks(), &buffer) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create scratch buffer");
+	}
+
+	memory = allocator.alloc_buffer(buffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+}
+
+/* Moves freshly created offscreen images out of UNDEFINED so the frame loop can clear them in GENERAL */
+static void transition_offscreen_targets(VkQueue queue, VkCommandBuffer cmd_buf, const std::vector<VkImage> &images)
+{
+	std::vector<VkImageMemoryBarrier> barriers;
+	for (const auto &image : images) {
+		barriers.push_back({
+			.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+			.pNext = nullptr,
+			.srcAccessMask = 0,
+			.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+			.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+			.newLayout = VK_IMAGE_LAYOUT_GENERAL,
+			.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.image = image,
+			.subresourceRange = {
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.baseMipLevel = 0,
+				.levelCount = 1,
+				.baseArrayLayer = 0,
+				.layerCount = 1}});
+	}
+
+	begin_cmd_buf(cmd_buf, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+	vkCmdPipelineBarrier(
+		cmd_buf,
+		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0,
+		0, nullptr,
+		0, nullptr,
+		(uint32_t)barriers.size(), barriers.data());
+	vkEndCommandBuffer(cmd_buf);
+
+	submit_queue_sync(queue, cmd_buf);
+	vkQueueWaitIdle(queue);
+}
+
+static VkCommandPool create_cmd_pool(VkDevice device, const queue_family_indices &indices)
+{
+	VkCommandPoolCreateInfo create_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+		.pNext = nullptr,
+		.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+		.queueFamilyIndex = indices.graphics_family.value()};
+
+	VkCommandPool cmd_pool;
+	if (vkCreateCommandPool(device, &create_info, vk_allocation_callbacks(), &cmd_pool) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create command pool");
+	}
+
+	return cmd_pool;
+}
+
+static void create_frames(VkDevice device, uint32_t queue_family, std::vector<vk_frame> &frames, uint32_t count)
+{
+	/* A pool per frame, recycled with one vkResetCommandPool once the frame's fence has signaled */
+	VkCommandPoolCreateInfo pool_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+		.pNext = nullptr,
+		.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+		.queueFamilyIndex = queue_family};
+
+	frames.resize(count);
+	for (uint32_t i=0u; i<count; ++i) {
+		if (vkCreateCommandPool(device, &pool_info, vk_allocation_callbacks(), &frames[i].cmd_pool) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create command pool");
+		}
+
+		std::vector<VkCommandBuffer> bufs;
+		create_cmd_bufs(device, frames[i].cmd_pool, bufs, 1);
+		frames[i].cmd_buf = bufs[0];
+		frames[i].image_available_sem = create_semaphore(device);
+		/* Created signaled so the first wait on each slot returns immediately */
+		frames[i].in_flight_fence = create_fence(device, VK_FENCE_CREATE_SIGNALED_BIT);
+	}
+}
+
+static void create_present_semaphores(VkDevice device, std::vector<VkSemaphore> &sems, size_t count)
+{
+	sems.resize(count);
+	for (size_t i=0u; i<count; ++i) {
+		sems[i] = create_semaphore(device);
+	}
+}
+
+static void destroy_present_semaphores(VkDevice device, std::vector<VkSemaphore> &sems)
+{
+	for (VkSemaphore sem : sems) {
+		vkDestroySemaphore(device, sem, vk_allocation_callbacks());
+	}
+	sems.clear();
+}
+
+static void destroy_frames(VkDevice device, std::vector<vk_frame> &frames)
+{
+	for (auto &frame : frames) {
+		vkDestroyFence(device, frame.in_flight_fence, vk_allocation_callbacks());
+		vkDestroySemaphore(device, frame.image_available_sem, vk_allocation_callbacks());
+		vkDestroyCommandPool(device, frame.cmd_pool, vk_allocation_callbacks());
+	}
+	frames.clear();
+}
+
+void vk_app::vulkan_init()
+{
+	const bool headless = this->config.headless;
+
+	/* Timeline semaphores and descriptor indexing are core in 1.2, everything else only needs 1.0 */
+	uint32_t api_version = VK_API_VERSION_1_0;
+	if ((this->config.timeline || this->config.bindless) && get_instance_version() >= VK_API_VERSION_1_2) {
+		api_version = VK_API_VERSION_1_2;
+	}
+
+	if (ENABLE_VALIDATION_LAYERS) {
+		/* Every severity from the configured one up, the sink filters further at runtime */
+		const VkDebugUtilsMessageSeverityFlagsEXT all = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT
+			| VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT
+			| VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT
+			| VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+		this->debug_sink.init(all & ~(this->config.debug_severity - 1), this->config.debug_log_path);
+		for (int32_t id : this->config.debug_mutes) {
+			if (!this->debug_sink.mute(id)) {
+				std::cerr << "Too many muted debug message IDs, ignoring " << id << '\n';
+			}
+		}
+	}
+	if (this->config.track_host_allocations) {
+		this->host_allocator.init(this->config.frames_in_flight);
+	}
+	this->vk_instance = create_instance(headless, api_version, this->debug_sink);
+	this->vk_debug_messenger = setup_debug_messenger(this->vk_instance, this->debug_sink);
+	if (!headless) {
+		this->vk_surface = create_surface(this->vk_instance, this->window);
+	}
+	this->vk_physical_device = pick_physical_device(this->vk_instance, this->vk_surface);
+	auto indices = find_queue_families(this->vk_physical_device, this->vk_surface);
+	this->graphics_family = indices.graphics_family.value();
+	const bool vulkan_1_2 = api_version >= VK_API_VERSION_1_2;
+	const bool timeline = vulkan_1_2 && this->config.timeline && supports_timeline_semaphores(this->vk_physical_device);
+	const bool bindless = vulkan_1_2 && this->config.bindless && supports_descriptor_indexing(this->vk_physical_device);
+	device_features features = {
+		.timeline_semaphores = timeline,
+		.descriptor_indexing = bindless,
+		.draw_indirect_count = this->config.gpu_cull_count && supports_draw_indirect_count(this->vk_physical_device),
+		.texture_compression_bc = !this->config.texture_path.empty() && supports_texture_compression_bc(this->vk_physical_device)};
+	this->vk_device = create_logical_device(
+		this->vk_surface,
+		this->vk_physical_device,
+		&this->vk_graphics_queue,
+		&this->vk_present_queue,
+		&this->vk_transfer_queue,
+		&this->vk_compute_queue,
+		indices,
+		features);
+
+	/* One timeline per queue, the transfer queue may be the graphics queue itself */
+	vk_timeline *transfer_timeline = nullptr;
+	if (timeline) {
+		this->graphics_timeline.init(this->vk_device);
+		transfer_timeline = &this->graphics_timeline;
+		if (this->vk_transfer_queue != this->vk_graphics_queue) {
+			this->transfer_timeline.init(this->vk_device);
+			transfer_timeline = &this->transfer_timeline;
+		}
+	}
+	if (this->config.timeline) {
+		std::cout << "Frame sync: " << (timeline ? "timeline semaphores" : "fences, timeline semaphores unsupported") << '\n';
+	}
+	this->allocator.init(this->vk_physical_device, this->vk_device);
+	this->deletion_queue.init(this->vk_device, this->allocator);
+	if (bindless) {
+		this->bindless.init(this->vk_physical_device, this->vk_device);
+	}
+	if (this->config.bindless) {
+		std::cout << "Bindless descriptors: ";
+		if (bindless) {
+			std::cout << this->bindless.get_texture_slots().get_capacity() << " textures, "
+				<< this->bindless.get_buffer_slots().get_capacity() << " buffers\n";
+		} else {
+			std::cout << "descriptor indexing unsupported\n";
+		}
+	}
+	this->frame_graph.init(this->vk_physical_device, this->vk_device, this->allocator);
+	this->pipeline_cache.init(this->vk_physical_device, this->vk_device, this->config.pipeline_cache_path);
+	this->shaders.init(this->config.shader_source_dir, this->config.shader_cache_dir, this->config.shader_dir);
+	this->uploader.init(
+		this->vk_device,
+		this->allocator,
+		this->vk_transfer_queue,
+		indices.transfer_family.value(),
+		indices.graphics_family.value(),
+		transfer_timeline);
+	std::cout << "Transfer queue family " << indices.transfer_family.value()
+		<< (this->uploader.is_dedicated() ? " (dedicated)" : " (shared with graphics)") << '\n';
+	std::cout << "Compute queue family " << indices.compute_family.value()
+		<< (indices.compute_family != indices.graphics_family ? " (async)" : " (shared with graphics)") << '\n';
+	if (headless) {
+		create_offscreen_targets(
+			this->vk_device,
+			this->allocator,
+			this->window_width,
+			this->window_height,
+			this->config.frames_in_flight,
+			this->vk_offscreen_images,
+			this->vk_offscreen_memory,
+			this->vk_offscreen_image_views);
+		this->vk_target_format = OFFSCREEN_FORMAT;
+	} else {
+		VkExtent2D extent = { this->window_width, this->window_height };
+		this->vk_swapchain = create_swap_chain(
+			this->vk_physical_device,
+			this->vk_device,
+			this->vk_surface,
+			this->graphics_family,
+			VK_NULL_HANDLE,
+			extent,
+			this->vk_target_format,
+			this->vk_swapchain_images,
+			this->vk_swapchain_image_views);
+		this->window_width = extent.width;
+		this->window_height = extent.height;
+		create_present_semaphores(this->vk_device, this->vk_present_sems, this->vk_swapchain_images.size());
+	}
+	this->vk_cmd_pool = create_cmd_pool(this->vk_device, indices);
+	create_frames(
+		this->vk_device,
+		indices.graphics_family.value(),
+		this->frames,
+		this->config.frames_in_flight);
+	if (this->config.parallel_record) {
+		this->recorder.init(
+			this->vk_device,
+			indices.graphics_family.value(),
+			this->jobs,
+			this->config.frames_in_flight);
+	}
+	if (this->config.cmd_count) {
+		create_scratch_buffer(
+			this->vk_device,
+			this->allocator,
+			(VkDeviceSize)this->config.cmd_count * sizeof(uint32_t) * this->config.frames_in_flight,
+			VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			this->vk_scratch_buffer,
+			this->vk_scratch_memory);
+	}
+	if (this->config.cmd_count && this->config.uniform_bytes) {
+		/* 256 is the largest minUniformBufferOffsetAlignment allowed, so every command fits */
+		this->uniforms.init(
+			this->vk_physical_device,
+			this->vk_device,
+			this->allocator,
+			this->config.frames_in_flight,
+			(VkDeviceSize)this->config.cmd_count * ((this->config.uniform_bytes + 255) & ~255u));
+	}
+	if (this->config.upload_kb) {
+		create_scratch_buffer(
+			this->vk_device,
+			this->allocator,
+			(VkDeviceSize)this->config.upload_kb * 1024 * get_upload_slots(this->config.frames_in_flight),
+			VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			this->vk_stream_buffer,
+			this->vk_stream_memory);
+		if (this->bindless.is_enabled()) {
+			this->stream_slot = this->bindless.add_buffer(this->vk_stream_buffer);
+		}
+	}
+	if (this->config.gpu_cull_count) {
+		this->gpu_culler.init(
+			this->vk_physical_device,
+			this->vk_device,
+			this->allocator,
+			this->pipeline_cache.get(),
+			this->shaders.load("gpu_cull.comp", {}),
+			this->config.gpu_cull_count,
+			this->config.frames_in_flight,
+			features.draw_indirect_count);
+		std::cout << "GPU culling: " << this->config.gpu_cull_count << " objects, indirect count draws "
+			<< (this->gpu_culler.can_draw() ? "available" : "unsupported") << '\n';
+
+		/* Acquired by the first frame, before its cull pass reads them */
+		std::vector<gpu_cull_object> objects = make_gpu_cull_scene(this->config.gpu_cull_count);
+		this->uploader.upload_buffer(
+			this->gpu_culler.get_object_buffer(),
+			0,
+			objects.data(),
+			objects.size() * sizeof(gpu_cull_object),
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_SHADER_READ_BIT);
+		this->uploader.flush();
+	}
+	if (!this->config.mesh_path.empty()) {
+		load_mesh();
+	}
+	if (!this->config.texture_path.empty()) {
+		load_texture();
+	}
+
+	const shader_cache_stats shader_stats = this->shaders.get_stats();
+	if (shader_stats.hits + shader_stats.compiles + shader_stats.prebuilt) {
+		std::cout << "Shaders: " << shader_stats.hits << " from cache, "
+			<< shader_stats.compiles << " compiled in " << shader_stats.compile_ns / 1000000 << " ms, "
+			<< shader_stats.prebuilt << " prebuilt\n";
+	}
+	if (this->config.hot_reload) {
+		/* Two, so an edited include recompiling several shaders doesn't serialize them all */
+		this->watcher.init(this->shaders, 2);
+		if (this->gpu_culler.is_enabled()) {
+			/* The pipeline cache is internally synchronized, compile threads can share it with the frame loop */
+			this->watcher.watch("gpu_cull.comp", {}, [this](const std::vector<uint32_t> &spirv) {
+				return (uint64_t)this->gpu_culler.create_pipeline(this->pipeline_cache.get(), spirv);
+			});
+		}
+		if (!this->shaders.has_compiler("gpu_cull.comp")) {
+			std::cout << "Hot reload: no glslc found, edits will fail to compile\n";
+		}
+	}
+	build_frame_graph();
+	this->gpu_profiler.init(
+		this->vk_physical_device,
+		this->vk_device,
+		this->vk_graphics_queue,
+		indices.graphics_family.value(),
+		this->vk_cmd_pool,
+		this->config.frames_in_flight,
+		this->config.trace_path.empty() && this->config.trace_csv_path.empty() ? nullptr : &this->trace);
+
+	if (headless) {
+		transition_offscreen_targets(this->vk_graphics_queue, this->frames[0].cmd_buf, this->vk_offscreen_images);
+	}
+}
+
+void vk_app::load_mesh()
+{
+	auto beg = std::chrono::steady_clock::now();
+
+	mapped_file file;
+	mesh_view view;
+	if (!file.open(this->config.mesh_path)) {
+		throw std::runtime_error("Failed to open " + this->config.mesh_path);
+	}
+	if (!parse_mesh_file(file.data(), file.size(), view)) {
+		throw std::runtime_error("Failed to load " + this->config.mesh_path + ", not a mesh file of this version");
+	}
+	if (!view.header->vertex_count || !view.header->index_count) {
+		throw std::runtime_error("Failed to load " + this->config.mesh_path + ", the mesh is empty");
+	}
+
+	const VkDeviceSize vertex_bytes = (VkDeviceSize)view.header->vertex_count * view.header->vertex_stride;
+	const VkDeviceSize index_bytes = (VkDeviceSize)view.header->index_count * sizeof(uint32_t);
+	create_scratch_buffer(
+		this->vk_device,
+		this->allocator,
+		vertex_bytes,
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+		this->vk_mesh_vertex_buffer,
+		this->vk_mesh_vertex_memory);
+	create_scratch_buffer(
+		this->vk_device,
+		this->allocator,
+		index_bytes,
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+		this->vk_mesh_index_buffer,
+		this->vk_mesh_index_memory);
+
+	/* The staging ring copies out of the page cache, which is the only copy the streams ever take */
+	this->uploader.upload_buffer(
+		this->vk_mesh_vertex_buffer,
+		0,
+		view.vertices,
+		vertex_bytes,
+		VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+		VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+	this->uploader.upload_buffer(
+		this->vk_mesh_index_buffer,
+		0,
+		view.indices,
+		index_bytes,
+		VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+		VK_ACCESS_INDEX_READ_BIT);
+	this->uploader.flush();
+
+	const uint32_t vertex_count = view.header->vertex_count;
+	const uint32_t index_count = view.header->index_count;
+	const uint32_t meshlet_count = view.header->meshlet_count;
+	file.close();
+
+	auto end = std::chrono::steady_clock::now();
+	const double ms = std::chrono::duration<double, std::milli>(end - beg).count();
+	const double mib = (vertex_bytes + index_bytes) / (1024.0 * 1024.0);
+	std::cout << "Mesh: " << vertex_count << " vertices, "
+		<< index_count << " indices, "
+		<< meshlet_count << " meshlets, "
+		<< mib << " MiB staged in " << ms << " ms ("
+		<< (vertex_bytes + index_bytes) / (ms * 1e3) << " MB/s)\n";
+}
+
+static VkFormat get_vk_format(texture_format format)
+{
+	switch (format) {
+	case texture_format::rgba8: return VK_FORMAT_R8G8B8A8_UNORM;
+	case texture_format::rgba8_srgb: return VK_FORMAT_R8G8B8A8_SRGB;
+	case texture_format::bc1: return VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+	case texture_format::bc1_srgb: return VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+	case texture_format::bc5: return VK_FORMAT_BC5_UNORM_BLOCK;
+	case texture_format::bc7: return VK_FORMAT_BC7_UNORM_BLOCK;
+	case texture_format::bc7_srgb: return VK_FORMAT_BC7_SRGB_BLOCK;
+	}
+	return VK_FORMAT_UNDEFINED;
+}
+
+void vk_app::load_texture()
+{
+	auto beg = std::chrono::steady_clock::now();
+
+	/* Anything that isn't already a texture file is imported, or found, in the cache */
+	std::string path = this->config.texture_path;
+	mapped_file file;
+	texture_view view;
+	if (!file.open(path)) {
+		throw std::runtime_error("Failed to open " + path);
+	}
+	bool imported = false;
+	if (!parse_texture_file(file.data(), file.size(), view)) {
+		file.close();
+		path = get_cached_texture(path, this->config.texture_options, this->config.texture_cache_dir, this->jobs, imported);
+		if (!file.open(path) || !parse_texture_file(file.data(), file.size(), view)) {
+			throw std::runtime_error("Failed to load " + path + ", not a texture file of this version");
+		}
+	}
+	auto imported_at = std::chrono::steady_clock::now();
+
+	const texture_file_header &header = *view.header;
+	const VkFormat format = get_vk_format(header.format);
+	VkFormatProperties props;
+	vkGetPhysicalDeviceFormatProperties(this->vk_physical_device, format, &props);
+	if (!(props.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT)) {
+		throw std::runtime_error(std::string("Failed to load ") + path + ", the device can't sample " + get_texture_format_name(header.format));
+	}
+
+	/* Levels are staged in one piece, offsets relative to the first */
+	const uint32_t last = header.level_count - 1;
+	const VkDeviceSize bytes = header.level_offsets[last] + header.level_sizes[last] - header.level_offsets[0];
+	if (bytes > this->uploader.get_ring_size()) {
+		throw std::runtime_error("Failed to load " + path + ", it doesn't fit the staging ring");
+	}
+	VkDeviceSize level_offsets[MAX_TEXTURE_LEVELS];
+	for (uint32_t i=0u; i<header.level_count; ++i) {
+		level_offsets[i] = header.level_offsets[i] - header.level_offsets[0];
+	}
+
+	VkImageCreateInfo create_info = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+		.pNext = nullptr,
+		.flags = 0,
+		.imageType = VK_IMAGE_TYPE_2D,
+		.format = format,
+		.extent = { header.width, header.height, 1 },
+		.mipLevels = header.level_count,
+		.arrayLayers = 1,
+		.samples = VK_SAMPLE_COUNT_1_BIT,
+		.tiling = VK_IMAGE_TILING_OPTIMAL,
+		.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+		.queueFamilyIndexCount = 0,
+		.pQueueFamilyIndices = nullptr,
+		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED};
+	if (vkCreateImage(this->vk_device, &create_info, vk_allocation_callbacks(), &this->vk_texture_image) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create texture image");
+	}
+	this->vk_texture_memory = this->allocator.alloc_image(this->vk_texture_image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	this->vk_texture_view = create_image_view(
+		this->vk_device,
+		this->vk_texture_image,
+		format,
+		VK_IMAGE_ASPECT_COLOR_BIT,
+		VK_IMAGE_VIEW_TYPE_2D,
+		1,
+		header.level_count);
+
+	VkSamplerCreateInfo sampler_info = {
+		.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+		.pNext = nullptr,
+		.flags = 0,
+		.magFilter = VK_FILTER_LINEAR,
+		.minFilter = VK_FILTER_LINEAR,
+		.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
+		.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+		.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+		.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+		.mipLodBias = 0.0f,
+		.anisotropyEnable = VK_FALSE,
+		.maxAnisotropy = 1.0f,
+		.compareEnable = VK_FALSE,
+		.compareOp = VK_COMPARE_OP_ALWAYS,
+		.minLod = 0.0f,
+		.maxLod = (float)header.level_count,
+		.borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK,
+		.unnormalizedCoordinates = VK_FALSE};
+	if (vkCreateSampler(this->vk_device, &sampler_info, vk_allocation_callbacks(), &this->vk_texture_sampler) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create texture sampler");
+	}
+
+	/* Straight from the mapping into the ring, like the mesh streams */
+	this->uploader.upload_image(
+		this->vk_texture_image,
+		VK_IMAGE_ASPECT_COLOR_BIT,
+		create_info.extent,
+		header.level_count,
+		level_offsets,
+		view.base + header.level_offsets[0],
+		bytes,
+		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_ACCESS_SHADER_READ_BIT);
+	this->uploader.flush();
+	if (this->bindless.is_enabled()) {
+		this->texture_slot = this->bindless.add_texture(this->vk_texture_view, this->vk_texture_sampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	}
+
+	uint64_t rgba8_bytes = 0;
+	for (uint32_t i=0u; i<header.level_count; ++i) {
+		rgba8_bytes += get_texture_level_size(texture_format::rgba8, std::max(1u, header.width >> i), std::max(1u, header.height >> i));
+	}
+	const uint32_t width = header.width;
+	const uint32_t height = header.height;
+	const uint32_t level_count = header.level_count;
+	const char *format_name = get_texture_format_name(header.format);
+	file.close();
+
+	auto end = std::chrono::steady_clock::now();
+	const double import_ms = std::chrono::duration<double, std::milli>(imported_at - beg).count();
+	const double upload_ms = std::chrono::duration<double, std::milli>(end - imported_at).count();
+	std::cout << "Texture: " << width << "x" << height << ", "
+		<< level_count << " levels, " << format_name << ", "
+		<< bytes / (1024.0 * 1024.0) << " MiB staged in " << upload_ms << " ms, "
+		<< 100.0 * (1.0 - (double)bytes / rgba8_bytes) << "% less VRAM than RGBA8";
+	if (imported) {
+		std::cout << ", imported in " << import_ms << " ms";
+	}
+	std::cout << '\n';
+}
+
+void vk_app::apply_shader_reloads()
+{
+	std::vector<shader_reload> reloads;
+	this->watcher.poll(reloads);
+	for (const shader_reload &reload : reloads) {
+		if (!reload.error.empty()) {
+			std::cerr << reload.error << '\n';
+			continue;
+		}
+
+		/* Built on the compile thread, only the handle is swapped here. The old one stays bound in the frames still in flight */
+		if (reload.name == "gpu_cull.comp" && reload.object) {
+			this->deletion_queue.destroy_pipeline(this->gpu_culler.swap_pipeline((VkPipeline)reload.object));
+		}
+		std::cout << "Reloaded " << reload.name << '\n';
+	}
+}
+
+void vk_app::vulkan_deinit()
+{
+	this->watcher.deinit();
+	/* Pipelines built after the last frame picked up reloads */
+	std::vector<shader_reload> reloads;
+	this->watcher.poll(reloads);
+	for (const shader_reload &reload : reloads) {
+		if (reload.object) {
+			vkDestroyPipeline(this->vk_device, (VkPipeline)reload.object, vk_allocation_callbacks());
+		}
+	}
+	this->gpu_profiler.deinit();
+	this->frame_graph.deinit();
+	this->recorder.deinit();
+	this->uniforms.deinit();
+	this->gpu_culler.deinit();
+	destroy_frames(this->vk_device, this->frames);
+
+	if (this->vk_scratch_buffer) {
+		vkDestroyBuffer(this->vk_device, this->vk_scratch_buffer, vk_allocation_callbacks());
+		this->allocator.free(this->vk_scratch_memory);
+		this->vk_scratch_buffer = VK_NULL_HANDLE;
+	}
+	if (this->vk_stream_buffer) {
+		vkDestroyBuffer(this->vk_device, this->vk_stream_buffer, vk_allocation_callbacks());
+		this->allocator.free(this->vk_stream_memory);
+		this->vk_stream_buffer = VK_NULL_HANDLE;
+	}
+	if (this->vk_mesh_vertex_buffer) {
+		vkDestroyBuffer(this->vk_device, this->vk_mesh_vertex_buffer, vk_allocation_callbacks());
+		this->allocator.free(this->vk_mesh_vertex_memory);
+		this->vk_mesh_vertex_buffer = VK_NULL_HANDLE;
+	}
+	if (this->vk_mesh_index_buffer) {
+		vkDestroyBuffer(this->vk_device, this->vk_mesh_index_buffer, vk_allocation_callbacks());
+		this->allocator.free(this->vk_mesh_index_memory);
+		this->vk_mesh_index_buffer = VK_NULL_HANDLE;
+	}
+	if (this->vk_texture_image) {
+		vkDestroySampler(this->vk_device, this->vk_texture_sampler, vk_allocation_callbacks());
+		vkDestroyImageView(this->vk_device, this->vk_texture_view, vk_allocation_callbacks());
+		vkDestroyImage(this->vk_device, this->vk_texture_image, vk_allocation_callbacks());
+		this->allocator.free(this->vk_texture_memory);
+		this->vk_texture_sampler = VK_NULL_HANDLE;
+		this->vk_texture_view = VK_NULL_HANDLE;
+		this->vk_texture_image = VK_NULL_HANDLE;
+	}
+
+	vkDestroyCommandPool(this->vk_device, this->vk_cmd_pool, vk_allocation_callbacks());
+	this->vk_cmd_pool = VK_NULL_HANDLE;
+
+	for (auto &image : this->vk_swapchain_image_views) {
+		vkDestroyImageView(this->vk_device, image, vk_allocation_callbacks());
+	}
+	this->vk_swapchain_image_views.clear();
+	destroy_present_semaphores(this->vk_device, this->vk_present_sems);
+
+	for (size_t i=0u; i<this->vk_offscreen_images.size(); ++i) {
+		vkDestroyImageView(this->vk_device, this->vk_offscreen_image_views[i], vk_allocation_callbacks());
+		vkDestroyImage(this->vk_device, this->vk_offscreen_images[i], vk_allocation_callbacks());
+		this->allocator.free(this->vk_offscreen_memory[i]);
+	}
+	this->vk_offscreen_image_views.clear();
+	this->vk_offscreen_images.clear();
+	this->vk_offscreen_memory.clear();
+
+	if (this->vk_swapchain) {
+		vkDestroySwapchainKHR(this->vk_device, this->vk_swapchain, vk_allocation_callbacks());
+		this->vk_swapchain = VK_NULL_HANDLE;
+	}
+
+	this->uploader.deinit();
+	this->transfer_timeline.deinit();
+	this->graphics_timeline.deinit();
+	this->pipeline_cache.deinit();
+	this->deletion_queue.deinit();
+	this->bindless.deinit();
+	this->allocator.deinit();
+
+	vkDestroyDevice(this->vk_device, vk_allocation_callbacks());
+	this->vk_device = VK_NULL_HANDLE;
+
+	if (ENABLE_VALIDATION_LAYERS) {
+		destroy_debug_utils_messenger_ext(this->vk_instance, this->vk_debug_messenger, vk_allocation_callbacks());
+		this->vk_debug_messenger = VK_NULL_HANDLE;
+	}
+
+	if (this->vk_surface) {
+		vkDestroySurfaceKHR(this->vk_instance, this->vk_surface, vk_allocation_callbacks());
+		this->vk_surface = VK_NULL_HANDLE;
+	}
+
+	vkDestroyInstance(this->vk_instance, vk_allocation_callbacks());
+	this->vk_instance = VK_NULL_HANDLE;
+
+	if (ENABLE_VALIDATION_LAYERS) {
+		this->debug_sink.deinit();
+		const vk_debug_sink_stats debug = this->debug_sink.get_stats();
+		std::cout << "Debug messages: " << debug.received << " received, "
+			<< debug.shown << " shown, "
+			<< debug.repeats << " repeats of " << debug.unique_ids << " IDs folded, "
+			<< debug.filtered << " filtered, "
+			<< debug.dropped << " dropped\n";
+	}
+
+	if (this->host_allocator.is_enabled()) {
+		this->host_allocator.deinit();
+		const vk_host_memory_stats host = this->host_allocator.get_stats();
+		uint64_t live_bytes = 0;
+		uint64_t live_count = 0;
+		for (const vk_host_scope_stats &scope : host.scopes) {
+			live_bytes += scope.live_bytes;
+			live_count += scope.alloc_count + scope.realloc_count - scope.free_count;
+		}
+		if (live_count) {
+			std::cout << "Host memory still live after vkDestroyInstance: " << live_bytes << " bytes"
+				<< " in " << live_count << " allocations\n";
+		}
+	}
+}
+
+/* Wakes a render thread blocked in wait_while_minimized() to look at the window again */
+void vk_app::notify_window_state()
+{
+	/* Taking the lock orders this after the waiter's check, so the wake-up can't slip in before its wait */
+	{
+		std::lock_guard<std::mutex> lock(this->window_mutex);
+	}
+	this->window_cv.notify_all();
+}
+
+/*
+ * Blocks while the window has no area to render to, returns true if it had
+ * to wait. In glfwWaitEvents when this thread pumps the events, otherwise
+ * the main thread does and wakes us through window_cv once the size,
+ * iconify state or running change.
+ */
+bool vk_app::wait_while_minimized()
+{
+	auto minimized = [this]() {
+		return (!this->framebuffer_width || !this->framebuffer_height || this->iconified)
+			&& this->running && !glfwWindowShouldClose(this->window);
+	};
+
+	bool waited = false;
+	if (this->config.coupled_input) {
+		while (minimized()) {
+			CPU_ZONE("minimized");
+			glfwWaitEvents();
+			waited = true;
+		}
+	} else {
+		std::unique_lock<std::mutex> lock(this->window_mutex);
+		if (minimized()) {
+			CPU_ZONE("minimized");
+			this->window_cv.wait(lock, [&]() { return !minimized(); });
+			waited = true;
+		}
+	}
+	if (waited) {
+		this->swapchain_dirty = true;
+	}
+	return waited;
+}
+
+/*
+ * Rebuilds the swapchain and its image views in place. Command pools,
+ * sync objects and everything not tied to the window size are kept, and
+ * only the graphics and present queues are drained, uploads keep running.
+ */
+void vk_app::recreate_swapchain()
+{
+	wait_while_minimized();
+	if (glfwWindowShouldClose(this->window)) {
+		this->running = false;
+		return;
+	}
+
+	CPU_ZONE("recreate_swapchain");
+	auto beg = std::chrono::steady_clock::now();
+
+	const uint32_t width = this->framebuffer_width;
+	const uint32_t height = this->framebuffer_height;
+
+	/* Passing the old swapchain lets the driver hand its resources over to the new one */
+	VkSwapchainKHR old_swapchain = this->vk_swapchain;
+	std::vector<VkImageView> old_image_views = std::move(this->vk_swapchain_image_views);
+	VkExtent2D extent = { width, height };
+	this->vk_swapchain = create_swap_chain(
+		this->vk_physical_device,
+		this->vk_device,
+		this->vk_surface,
+		this->graphics_family,
+		old_swapchain,
+		extent,
+		this->vk_target_format,
+		this->vk_swapchain_images,
+		this->vk_swapchain_image_views);
+	this->window_width = extent.width;
+	this->window_height = extent.height;
+
+	/* Frames in flight and pending presents may still use the old images */
+	if (vkQueueWaitIdle(this->vk_graphics_queue) != VK_SUCCESS
+			|| vkQueueWaitIdle(this->vk_present_queue) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to wait for queue idle");
+	}
+	for (auto &view : old_image_views) {
+		vkDestroyImageView(this->vk_device, view, vk_allocation_callbacks());
+	}
+	vkDestroySwapchainKHR(this->vk_device, old_swapchain, vk_allocation_callbacks());
+	/* The image count may have changed, and no present waits on the old set anymore */
+	destroy_present_semaphores(this->vk_device, this->vk_present_sems);
+	create_present_semaphores(this->vk_device, this->vk_present_sems, this->vk_swapchain_images.size());
+
+	/* The transients are sized to the window, nothing else in the graph changes */
+	this->frame_graph.reset();
+	build_frame_graph();
+
+	this->swapchain_dirty = false;
+
+	auto end = std::chrono::steady_clock::now();
+	uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - beg).count();
+	++this->frame_stats.recreate_count;
+	this->frame_stats.recreate_ns += ns;
+	this->frame_stats.recreate_max_ns = std::max(this->frame_stats.recreate_max_ns, ns);
+}
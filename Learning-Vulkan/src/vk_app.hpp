@@ -1,44 +1,271 @@
-#pragma once
-
-#include <vulkan/vulkan_core.h>
-
-#include <stdint.h>
-#include <vector>
-
-struct vk_app
-{
-	vk_app():
-		running(true),
-		window_width(800),
-		window_height(600) {}
-
-	void run();
-
-private:
-	void loop();
-
-	void window_init();
-	void window_deinit();
-
-	void vulkan_init();
-	void vulkan_deinit();
-
-private:
-	bool running;
-
-	uint32_t window_width, window_height;
-	struct GLFWwindow *window = nullptr;
-	
-	VkInstance vk_instance = VK_NULL_HANDLE;
-	VkDebugUtilsMessengerEXT vk_debug_messenger = VK_NULL_HANDLE;
-	VkSurfaceKHR vk_surface = VK_NULL_HANDLE;
-	VkPhysicalDevice vk_physical_device = VK_NULL_HANDLE;
-	VkDevice vk_device = VK_NULL_HANDLE;
-	VkQueue vk_graphics_queue = VK_NULL_HANDLE;
-	VkQueue vk_present_queue = VK_NULL_HANDLE;
-	VkSwapchainKHR vk_swapchain = VK_NULL_HANDLE;
-	std::vector<VkImage> vk_swapchain_images;
-	std::vector<VkImageView> vk_swapchain_image_views;
-	VkCommandPool vk_cmd_pool = VK_NULL_HANDLE;
-	std::vector<VkCommandBuffer> vk_cmd_bufs;
-};
+#pragma once
+
+#include "cpu_trace.hpp"
+#include "job_system.hpp"
+#include "shader_cache.hpp"
+#include "shader_watcher.hpp"
+#include "simulation.hpp"
+#include "texture_import.hpp"
+#include "trace.hpp"
+#include "vk_bindless.hpp"
+#include "vk_debug_sink.hpp"
+#include "vk_deletion_queue.hpp"
+#include "vk_gpu_culler.hpp"
+#include "vk_gpu_profiler.hpp"
+#include "vk_host_allocator.hpp"
+#include "vk_linear_allocator.hpp"
+#include "vk_memory.hpp"
+#include "vk_parallel_recorder.hpp"
+#include "vk_pipeline_cache.hpp"
+#include "vk_render_graph.hpp"
+#include "vk_timeline.hpp"
+#include "vk_uploader.hpp"
+
+#include <vulkan/vulkan_core.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* Where the shader sources are, the build points it at the source tree so edits are picked up */
+#ifndef LV_SHADER_SOURCE_DIR
+#define LV_SHADER_SOURCE_DIR "shaders"
+#endif
+
+struct vk_app_config
+{
+	/* Number of frames the CPU may record ahead of the GPU */
+	uint32_t frames_in_flight = 2;
+	/* Render into offscreen images without a window or surface */
+	bool headless = false;
+	/* Stop after this many frames, 0 runs until the window is closed */
+	uint32_t frame_count = 0;
+	/* Where the VkPipelineCache is persisted, empty disables it */
+	std::string pipeline_cache_path = "pipeline_cache.bin";
+	/* Print a rolling GPU zone summary every second */
+	bool profile = false;
+	/* Write CPU and GPU zones as Chrome trace JSON on exit, empty disables */
+	std::string trace_path;
+	/* The same zones as CSV rows tagged with their frame, empty disables */
+	std::string trace_csv_path;
+	/* Stand-in commands recorded per frame, each a 4 byte vkCmdFillBuffer */
+	uint32_t cmd_count = 0;
+	/* Job system workers including the main thread, 0 uses one per hardware thread */
+	uint32_t worker_count = 0;
+	/* Record the commands as secondaries in one job per worker instead of inline */
+	bool parallel_record = false;
+	/* Measure recording throughput for 1..N workers instead of running the frame loop */
+	bool record_bench = false;
+	/* KiB streamed to the GPU through the transfer queue every frame */
+	uint32_t upload_kb = 0;
+	/* Synchronize with Vulkan 1.2 timeline semaphores instead of fences where supported */
+	bool timeline = false;
+	/* Put every texture and buffer in one descriptor indexing set where supported */
+	bool bindless = false;
+	/* Constant bytes written per stand-in command through the per-frame linear allocator */
+	uint32_t uniform_bytes = 0;
+	/* Stand-in objects frustum culled by a compute pass every frame, 0 disables */
+	uint32_t gpu_cull_count = 0;
+	/* Where the build's SPIR-V is loaded from when no shader compiler is found */
+	std::string shader_dir = "shaders";
+	std::string shader_source_dir = LV_SHADER_SOURCE_DIR;
+	/* Compiled SPIR-V keyed by a hash of everything that went into it */
+	std::string shader_cache_dir = "shader_cache";
+	/* Recompile shaders in the background when their sources change and swap in the new pipelines */
+	bool hot_reload = false;
+	/* Converted mesh file uploaded at startup, empty for none */
+	std::string mesh_path;
+	/* Simulation ticks per second, input is applied and handed to the renderer at this rate */
+	uint32_t sim_hz = 120;
+	/* Pump window events from the frame loop, once per frame, instead of from a thread of their own */
+	bool coupled_input = false;
+	/* Least severe validation message reported in Debug builds */
+	VkDebugUtilsMessageSeverityFlagBitsEXT debug_severity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT;
+	/* messageIdNumbers never reported */
+	std::vector<int32_t> debug_mutes;
+	/* Every reported message as one JSON object per line, empty disables */
+	std::string debug_log_path;
+	/* Route the driver's host allocations through counting callbacks with per-frame arenas for command scope */
+	bool track_host_allocations = true;
+	/* Texture uploaded at startup with all its mips, a texture file or a PNG or TGA imported through the cache */
+	std::string texture_path;
+	std::string texture_cache_dir = "texture_cache";
+	/* How sources are imported, shared with --convert-texture */
+	texture_import_options texture_options;
+};
+
+struct vk_frame
+{
+	VkCommandPool cmd_pool = VK_NULL_HANDLE;
+	VkCommandBuffer cmd_buf = VK_NULL_HANDLE;
+	VkSemaphore image_available_sem = VK_NULL_HANDLE;
+	VkFence in_flight_fence = VK_NULL_HANDLE;
+	/* Graphics timeline value the frame's submit signals, waited on instead of the fence */
+	uint64_t timeline_value = 0;
+};
+
+struct vk_frame_stats
+{
+	uint64_t frame_count = 0;
+	/* Fence waits that actually blocked the CPU, and for how long */
+	uint64_t blocked_count = 0;
+	uint64_t blocked_ns = 0;
+	uint64_t blocked_max_ns = 0;
+
+	/* Ring of recent frame times used for the latency percentiles */
+	std::vector<uint64_t> frame_times_ns;
+	uint64_t total_ns = 0;
+
+	/* From the start of run() until the first frame was submitted */
+	uint64_t first_frame_ns = 0;
+
+	/* Swapchain recreations and their CPU cost, excluding time spent minimized */
+	uint64_t recreate_count = 0;
+	uint64_t recreate_ns = 0;
+	uint64_t recreate_max_ns = 0;
+
+	/* Visible object counts read back from completed GPU culls */
+	uint64_t gpu_cull_frames = 0;
+	uint64_t gpu_cull_visible = 0;
+
+	/* Ring of times from an input event to the submit of the first frame that saw it */
+	std::vector<uint64_t> input_latency_ns;
+	uint64_t input_frames = 0;
+
+	/* Frames whose Vulkan calls allocated host memory outside command scope, none once warmed up */
+	uint64_t host_alloc_frames = 0;
+	uint64_t host_alloc_max = 0;
+};
+
+struct vk_app
+{
+	vk_app(const vk_app_config &config = {}):
+		config(config),
+		running(true),
+		window_width(800),
+		window_height(600) {}
+
+	void run();
+
+private:
+	void loop();
+	void run_decoupled();
+	void record_cmds(VkCommandBuffer cmd_buf, uint32_t frame_ix);
+	void record_benchmark();
+	bool wait_while_minimized();
+	void notify_window_state();
+	void recreate_swapchain();
+	void build_frame_graph();
+	void load_mesh();
+	void load_texture();
+	void apply_shader_reloads();
+
+	void window_init();
+	void window_deinit();
+
+	void vulkan_init();
+	void vulkan_deinit();
+
+	void print_frame_stats() const;
+	void print_memory_stats();
+
+private:
+	vk_app_config config;
+	job_system jobs;
+	vk_frame_stats frame_stats;
+	std::chrono::steady_clock::time_point run_start;
+
+	std::atomic<bool> running;
+	/* Set by resize callbacks and suboptimal results, the swapchain is rebuilt before the next acquire */
+	std::atomic<bool> swapchain_dirty = false;
+
+	/* Swapchain extent */
+	uint32_t window_width, window_height;
+	struct GLFWwindow *window = nullptr;
+	/* Written by the window callbacks, which run on whichever thread pumps events */
+	std::atomic<uint32_t> framebuffer_width = 0;
+	std::atomic<uint32_t> framebuffer_height = 0;
+	std::atomic<bool> iconified = false;
+	/* Signaled whenever the above change or running is cleared, the render thread blocks on it while minimized */
+	std::mutex window_mutex;
+	std::condition_variable window_cv;
+
+	simulation sim;
+	/* What the frame being recorded renders */
+	sim_state frame_sim;
+	
+	/* Outlives the instance, every object is created and destroyed through its callbacks */
+	vk_host_allocator host_allocator;
+	VkInstance vk_instance = VK_NULL_HANDLE;
+	VkDebugUtilsMessengerEXT vk_debug_messenger = VK_NULL_HANDLE;
+	vk_debug_sink debug_sink;
+	VkSurfaceKHR vk_surface = VK_NULL_HANDLE;
+	VkPhysicalDevice vk_physical_device = VK_NULL_HANDLE;
+	VkDevice vk_device = VK_NULL_HANDLE;
+	VkQueue vk_graphics_queue = VK_NULL_HANDLE;
+	uint32_t graphics_family = 0;
+	VkQueue vk_present_queue = VK_NULL_HANDLE;
+	VkQueue vk_transfer_queue = VK_NULL_HANDLE;
+	/* From an async compute family when there is one, nothing is submitted to it yet */
+	VkQueue vk_compute_queue = VK_NULL_HANDLE;
+	vk_timeline graphics_timeline;
+	vk_timeline transfer_timeline;
+	vk_memory_allocator allocator;
+	/* Objects released while frames that may use them are in flight */
+	vk_deletion_queue deletion_queue;
+	vk_bindless bindless;
+	vk_pipeline_cache pipeline_cache;
+	shader_cache shaders;
+	/* Only running with hot reload */
+	shader_watcher watcher;
+	vk_uploader uploader;
+	cpu_frame_profiler cpu_profiler;
+	vk_gpu_profiler gpu_profiler;
+	trace_writer trace;
+	VkSwapchainKHR vk_swapchain = VK_NULL_HANDLE;
+	std::vector<VkImage> vk_swapchain_images;
+	std::vector<VkImageView> vk_swapchain_image_views;
+	/*
+	 * Render complete, one per swapchain image rather than per frame: a
+	 * present may still hold an image's semaphore while the frame slot that
+	 * signaled it comes round again, but not once the image is reacquired.
+	 */
+	std::vector<VkSemaphore> vk_present_sems;
+	/* Headless render targets, one per frame in flight */
+	std::vector<VkImage> vk_offscreen_images;
+	std::vector<vk_allocation> vk_offscreen_memory;
+	std::vector<VkImageView> vk_offscreen_image_views;
+	/* Format of the swapchain or offscreen images frames end up in */
+	VkFormat vk_target_format = VK_FORMAT_UNDEFINED;
+	vk_render_graph frame_graph;
+	rg_resource rg_target = 0;
+	/* One-off setup commands, frames record from their own pools */
+	VkCommandPool vk_cmd_pool = VK_NULL_HANDLE;
+	std::vector<vk_frame> frames;
+	vk_parallel_recorder recorder;
+	/* Per-draw constants, one region per frame in flight */
+	vk_linear_allocator uniforms;
+	vk_gpu_culler gpu_culler;
+	VkBuffer vk_scratch_buffer = VK_NULL_HANDLE;
+	vk_allocation vk_scratch_memory;
+	/* Destination of the per-frame uploads */
+	VkBuffer vk_stream_buffer = VK_NULL_HANDLE;
+	vk_allocation vk_stream_memory;
+	/* Bindless buffer slot of the stream buffer */
+	uint32_t stream_slot = slot_allocator::INVALID_SLOT;
+	/* Streams of the --mesh file, uploaded straight from its mapping */
+	VkBuffer vk_mesh_vertex_buffer = VK_NULL_HANDLE;
+	vk_allocation vk_mesh_vertex_memory;
+	VkBuffer vk_mesh_index_buffer = VK_NULL_HANDLE;
+	vk_allocation vk_mesh_index_memory;
+	/* The --texture image with all its mips, sampled through the bindless set when that is on */
+	VkImage vk_texture_image = VK_NULL_HANDLE;
+	vk_allocation vk_texture_memory;
+	VkImageView vk_texture_view = VK_NULL_HANDLE;
+	VkSampler vk_texture_sampler = VK_NULL_HANDLE;
+	uint32_t texture_slot = slot_allocator::INVALID_SLOT;
+};
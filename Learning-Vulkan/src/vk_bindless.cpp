@@ -0,0 +1,243 @@
+#include "vk_bindless.hpp"
+
+#include "vk_host_allocator.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+void slot_allocator::init(uint32_t capacity)
+{
+	this->free_slots.clear();
+	this->next = 0;
+	this->capacity = capacity;
+	this->used = 0;
+	this->peak = 0;
+}
+
+uint32_t slot_allocator::alloc()
+{
+	uint32_t slot;
+	if (!this->free_slots.empty()) {
+		slot = this->free_slots.back();
+		this->free_slots.pop_back();
+	} else if (this->next < this->capacity) {
+		slot = this->next++;
+	} else {
+		return INVALID_SLOT;
+	}
+
+	++this->used;
+	this->peak = std::max(this->peak, this->used);
+	return slot;
+}
+
+void slot_allocator::free(uint32_t slot)
+{
+	this->free_slots.push_back(slot);
+	--this->used;
+}
+
+void vk_bindless::init(VkPhysicalDevice physical_device, VkDevice device, uint32_t max_textures, uint32_t max_buffers)
+{
+	this->device = device;
+
+	VkPhysicalDeviceDescriptorIndexingProperties indexing_props = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES,
+		.pNext = nullptr};
+
+	VkPhysicalDeviceProperties2 props = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+		.pNext = &indexing_props,
+		.properties = {}};
+
+	vkGetPhysicalDeviceProperties2(physical_device, &props);
+
+	/* Combined image samplers count against both the sampler and the sampled image limits */
+	uint32_t texture_count = std::min({
+		max_textures,
+		indexing_props.maxPerStageDescriptorUpdateAfterBindSamplers,
+		indexing_props.maxPerStageDescriptorUpdateAfterBindSampledImages,
+		indexing_props.maxDescriptorSetUpdateAfterBindSamplers,
+		indexing_props.maxDescriptorSetUpdateAfterBindSampledImages});
+	uint32_t buffer_count = std::min({
+		max_buffers,
+		indexing_props.maxPerStageDescriptorUpdateAfterBindStorageBuffers,
+		indexing_props.maxDescriptorSetUpdateAfterBindStorageBuffers});
+
+	/* Both bindings are visible to every stage, so together they must fit the per stage total */
+	const uint32_t resource_limit = indexing_props.maxPerStageUpdateAfterBindResources;
+	if (texture_count + buffer_count > resource_limit) {
+		texture_count = std::min(texture_count, resource_limit / 2);
+		buffer_count = std::min(buffer_count, resource_limit - texture_count);
+	}
+
+	VkDescriptorSetLayoutBinding bindings[] = {
+		{
+			.binding = TEXTURE_BINDING,
+			.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+			.descriptorCount = texture_count,
+			.stageFlags = VK_SHADER_STAGE_ALL,
+			.pImmutableSamplers = nullptr},
+		{
+			.binding = BUFFER_BINDING,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = buffer_count,
+			.stageFlags = VK_SHADER_STAGE_ALL,
+			.pImmutableSamplers = nullptr}};
+
+	const VkDescriptorBindingFlags flags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT
+		| VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT
+		| VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+	VkDescriptorBindingFlags binding_flags[] = { flags, flags };
+
+	VkDescriptorSetLayoutBindingFlagsCreateInfo flags_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+		.pNext = nullptr,
+		.bindingCount = 2,
+		.pBindingFlags = binding_flags};
+
+	VkDescriptorSetLayoutCreateInfo layout_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+		.pNext = &flags_info,
+		.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT,
+		.bindingCount = 2,
+		.pBindings = bindings};
+
+	if (vkCreateDescriptorSetLayout(device, &layout_info, vk_allocation_callbacks(), &this->set_layout) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create bindless descriptor set layout");
+	}
+
+	VkDescriptorPoolSize pool_sizes[] = {
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, texture_count },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, buffer_count }};
+
+	VkDescriptorPoolCreateInfo pool_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+		.pNext = nullptr,
+		.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
+		.maxSets = 1,
+		.poolSizeCount = 2,
+		.pPoolSizes = pool_sizes};
+
+	if (vkCreateDescriptorPool(device, &pool_info, vk_allocation_callbacks(), &this->pool) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create bindless descriptor pool");
+	}
+
+	VkDescriptorSetAllocateInfo alloc_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+		.pNext = nullptr,
+		.descriptorPool = this->pool,
+		.descriptorSetCount = 1,
+		.pSetLayouts = &this->set_layout};
+
+	if (vkAllocateDescriptorSets(device, &alloc_info, &this->set) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to allocate bindless descriptor set");
+	}
+
+	VkPushConstantRange push_range = {
+		.stageFlags = VK_SHADER_STAGE_ALL,
+		.offset = 0,
+		.size = PUSH_CONSTANT_SIZE};
+
+	VkPipelineLayoutCreateInfo pipeline_layout_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+		.pNext = nullptr,
+		.flags = 0,
+		.setLayoutCount = 1,
+		.pSetLayouts = &this->set_layout,
+		.pushConstantRangeCount = 1,
+		.pPushConstantRanges = &push_range};
+
+	if (vkCreatePipelineLayout(device, &pipeline_layout_info, vk_allocation_callbacks(), &this->pipeline_layout) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create bindless pipeline layout");
+	}
+
+	this->texture_slots.init(texture_count);
+	this->buffer_slots.init(buffer_count);
+}
+
+void vk_bindless::deinit()
+{
+	if (!this->device) {
+		return;
+	}
+
+	/* The set goes away with its pool */
+	vkDestroyPipelineLayout(this->device, this->pipeline_layout, vk_allocation_callbacks());
+	vkDestroyDescriptorPool(this->device, this->pool, vk_allocation_callbacks());
+	vkDestroyDescriptorSetLayout(this->device, this->set_layout, vk_allocation_callbacks());
+	this->pipeline_layout = VK_NULL_HANDLE;
+	this->pool = VK_NULL_HANDLE;
+	this->set = VK_NULL_HANDLE;
+	this->set_layout = VK_NULL_HANDLE;
+	this->device = VK_NULL_HANDLE;
+}
+
+uint32_t vk_bindless::add_texture(VkImageView view, VkSampler sampler, VkImageLayout layout)
+{
+	uint32_t slot = this->texture_slots.alloc();
+	if (slot == slot_allocator::INVALID_SLOT) {
+		return slot;
+	}
+
+	VkDescriptorImageInfo image_info = {
+		.sampler = sampler,
+		.imageView = view,
+		.imageLayout = layout};
+
+	VkWriteDescriptorSet write = {
+		.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+		.pNext = nullptr,
+		.dstSet = this->set,
+		.dstBinding = TEXTURE_BINDING,
+		.dstArrayElement = slot,
+		.descriptorCount = 1,
+		.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+		.pImageInfo = &image_info,
+		.pBufferInfo = nullptr,
+		.pTexelBufferView = nullptr};
+
+	vkUpdateDescriptorSets(this->device, 1, &write, 0, nullptr);
+	return slot;
+}
+
+uint32_t vk_bindless::add_buffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range)
+{
+	uint32_t slot = this->buffer_slots.alloc();
+	if (slot == slot_allocator::INVALID_SLOT) {
+		return slot;
+	}
+
+	VkDescriptorBufferInfo buffer_info = {
+		.buffer = buffer,
+		.offset = offset,
+		.range = range};
+
+	VkWriteDescriptorSet write = {
+		.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+		.pNext = nullptr,
+		.dstSet = this->set,
+		.dstBinding = BUFFER_BINDING,
+		.dstArrayElement = slot,
+		.descriptorCount = 1,
+		.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		.pImageInfo = nullptr,
+		.pBufferInfo = &buffer_info,
+		.pTexelBufferView = nullptr};
+
+	vkUpdateDescriptorSets(this->device, 1, &write, 0, nullptr);
+	return slot;
+}
+
+void vk_bindless::bind(VkCommandBuffer cmd_buf, VkPipelineBindPoint bind_point)
+{
+	vkCmdBindDescriptorSets(cmd_buf, bind_point, this->pipeline_layout, 0, 1, &this->set, 0, nullptr);
+}
+
+void vk_bindless::push_indices(VkCommandBuffer cmd_buf, const uint32_t *indices, uint32_t count)
+{
+	if (count * sizeof(uint32_t) > PUSH_CONSTANT_SIZE) {
+		throw std::runtime_error("Too many bindless indices to push");
+	}
+	vkCmdPushConstants(cmd_buf, this->pipeline_layout, VK_SHADER_STAGE_ALL, 0, count * sizeof(uint32_t), indices);
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <vulkan/vulkan_core.h>
+
+#include <stdint.h>
+#include <vector>
+
+/* Hands out indices into a fixed size array, freed indices are reused first */
+struct slot_allocator
+{
+	static constexpr uint32_t INVALID_SLOT = UINT32_MAX;
+
+	void init(uint32_t capacity);
+
+	/* INVALID_SLOT when every index is taken */
+	uint32_t alloc();
+	void free(uint32_t slot);
+
+	uint32_t get_capacity() const { return this->capacity; }
+	uint32_t get_used() const { return this->used; }
+	uint32_t get_peak() const { return this->peak; }
+
+private:
+	std::vector<uint32_t> free_slots;
+	/* Indices at and above this have never been handed out */
+	uint32_t next = 0;
+	uint32_t capacity = 0;
+	uint32_t used = 0;
+	uint32_t peak = 0;
+};
+
+/*
+ * One descriptor set holding every texture and buffer, indexed by shaders
+ * through push constants instead of binding a set per draw. The bindings
+ * are partially bound and update after bind, so slots can be written while
+ * frames using other slots are in flight and unwritten slots are fine as
+ * long as nothing reads them. Needs descriptor indexing, core in 1.2.
+ */
+struct vk_bindless
+{
+	static constexpr uint32_t TEXTURE_BINDING = 0;
+	static constexpr uint32_t BUFFER_BINDING = 1;
+	static constexpr uint32_t DEFAULT_MAX_TEXTURES = 1u << 16;
+	static constexpr uint32_t DEFAULT_MAX_BUFFERS = 1u << 16;
+	/* The minimum maxPushConstantsSize, every device has at least this much */
+	static constexpr uint32_t PUSH_CONSTANT_SIZE = 128;
+
+	/* Counts are clamped to the device's update after bind limits */
+	void init(
+		VkPhysicalDevice physical_device,
+		VkDevice device,
+		uint32_t max_textures = DEFAULT_MAX_TEXTURES,
+		uint32_t max_buffers = DEFAULT_MAX_BUFFERS);
+	void deinit();
+
+	bool is_enabled() const { return this->set != VK_NULL_HANDLE; }
+
+	/* Return the slot shaders index with, INVALID_SLOT when the binding is full */
+	uint32_t add_texture(VkImageView view, VkSampler sampler, VkImageLayout layout);
+	uint32_t add_buffer(VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE);
+
+	/*
+	 * A slot may only be reused once no frame in flight reads it, so free
+	 * them through the deletion queue unless the GPU is known to be done.
+	 */
+	slot_allocator &get_texture_slots() { return this->texture_slots; }
+	slot_allocator &get_buffer_slots() { return this->buffer_slots; }
+
+	/* Once per command buffer and bind point, pipelines sharing the layout keep it bound */
+	void bind(VkCommandBuffer cmd_buf, VkPipelineBindPoint bind_point);
+	/* Up to PUSH_CONSTANT_SIZE / 4 indices, starting at offset 0 of the push constant block */
+	void push_indices(VkCommandBuffer cmd_buf, const uint32_t *indices, uint32_t count);
+
+	VkDescriptorSetLayout get_set_layout() const { return this->set_layout; }
+	VkPipelineLayout get_pipeline_layout() const { return this->pipeline_layout; }
+
+private:
+	VkDevice device = VK_NULL_HANDLE;
+	VkDescriptorSetLayout set_layout = VK_NULL_HANDLE;
+	VkDescriptorPool pool = VK_NULL_HANDLE;
+	VkDescriptorSet set = VK_NULL_HANDLE;
+	VkPipelineLayout pipeline_layout = VK_NULL_HANDLE;
+	slot_allocator texture_slots;
+	slot_allocator buffer_slots;
+};
@@ -0,0 +1,389 @@
+#include "vk_debug_sink.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+
+/* Repeats of one ID are folded into a line at most this often */
+static constexpr uint64_t REPEAT_INTERVAL_NS = 1000000000;
+/* Upper bound on how late a message is printed if its wake-up was missed */
+static constexpr auto POLL_INTERVAL = std::chrono::milliseconds(20);
+
+static uint64_t now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static const char *get_severity_name(VkDebugUtilsMessageSeverityFlagBitsEXT severity)
+{
+	switch (severity) {
+	case VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT: return "Verbose";
+	case VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT: return "Info";
+	case VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT: return "Warning";
+	case VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT: return "Error";
+	default: return "Unknown";
+	}
+}
+
+static const char *get_type_name(VkDebugUtilsMessageTypeFlagsEXT type)
+{
+	if (type & VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT) {
+		return "Validation";
+	}
+	if (type & VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT) {
+		return "Performance";
+	}
+	return "General";
+}
+
+/* Bounded copy, returns true if src didn't fit */
+static bool copy_text(char *dst, size_t capacity, const char *src)
+{
+	if (!src) {
+		dst[0] = '\0';
+		return false;
+	}
+	size_t len = strlen(src);
+	const bool truncated = len >= capacity;
+	len = std::min(len, capacity - 1);
+	memcpy(dst, src, len);
+	dst[len] = '\0';
+	return truncated;
+}
+
+static void append_json_string(std::string &out, const char *s)
+{
+	out += '"';
+	for (; *s; ++s) {
+		const unsigned char c = (unsigned char)*s;
+		if (c == '"' || c == '\\') {
+			out += '\\';
+			out += (char)c;
+		} else if (c == '\n') {
+			out += "\\n";
+		} else if (c < 0x20) {
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", c);
+			out += buf;
+		} else {
+			out += (char)c;
+		}
+	}
+	out += '"';
+}
+
+void vk_debug_sink::init(VkDebugUtilsMessageSeverityFlagsEXT severity_mask, const std::string &log_path)
+{
+	if (!log_path.empty()) {
+		this->log.open(log_path, std::ios::trunc);
+		if (!this->log) {
+			throw std::runtime_error("Failed to open debug log " + log_path);
+		}
+	}
+
+	this->slots = std::make_unique<slot[]>(QUEUE_CAPACITY);
+	for (uint32_t i=0u; i<QUEUE_CAPACITY; ++i) {
+		this->slots[i].sequence.store(i, std::memory_order_relaxed);
+	}
+	this->enqueue_pos.store(0, std::memory_order_relaxed);
+	this->dequeue_pos = 0;
+	this->severity_mask.store(severity_mask, std::memory_order_relaxed);
+	this->start_ns = now_ns();
+
+	this->running = true;
+	this->thread = std::thread(&vk_debug_sink::consume_loop, this);
+}
+
+void vk_debug_sink::deinit()
+{
+	if (!this->running.exchange(false)) {
+		return;
+	}
+	this->wake_cv.notify_one();
+	this->thread.join();
+
+	/* Whatever arrived after the last pass, then every count still owed */
+	message msg;
+	while (pop(msg)) {
+		process(msg);
+	}
+	report_repeats(now_ns(), true);
+	std::cerr.flush();
+	this->log.close();
+	this->slots.reset();
+}
+
+void vk_debug_sink::fill_create_info(VkDebugUtilsMessengerCreateInfoEXT &create_info)
+{
+	create_info = {};
+	create_info.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+	create_info.messageSeverity = this->severity_mask.load(std::memory_order_relaxed);
+	create_info.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT
+		| VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT
+		| VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
+	create_info.pfnUserCallback = callback;
+	create_info.pUserData = this;
+}
+
+void vk_debug_sink::set_severity_mask(VkDebugUtilsMessageSeverityFlagsEXT mask)
+{
+	this->severity_mask.store(mask, std::memory_order_relaxed);
+}
+
+bool vk_debug_sink::mute(int32_t id)
+{
+	if (!id || is_muted(id)) {
+		return id != 0;
+	}
+	for (auto &m : this->muted) {
+		int32_t expected = 0;
+		if (m.compare_exchange_strong(expected, id, std::memory_order_relaxed)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void vk_debug_sink::unmute(int32_t id)
+{
+	for (auto &m : this->muted) {
+		int32_t expected = id;
+		m.compare_exchange_strong(expected, 0, std::memory_order_relaxed);
+	}
+}
+
+vk_debug_sink_stats vk_debug_sink::get_stats() const
+{
+	vk_debug_sink_stats stats;
+	stats.received = this->received.load(std::memory_order_relaxed);
+	stats.filtered = this->filtered.load(std::memory_order_relaxed);
+	stats.dropped = this->dropped.load(std::memory_order_relaxed);
+
+	std::lock_guard<std::mutex> lock(this->stats_mutex);
+	stats.shown = this->shown;
+	stats.repeats = this->repeats;
+	stats.unique_ids = this->unique_ids;
+	return stats;
+}
+
+VKAPI_ATTR VkBool32 VKAPI_CALL vk_debug_sink::callback(
+	VkDebugUtilsMessageSeverityFlagBitsEXT severity,
+	VkDebugUtilsMessageTypeFlagsEXT type,
+	const VkDebugUtilsMessengerCallbackDataEXT *data,
+	void *user_data)
+{
+	vk_debug_sink *sink = (vk_debug_sink *)user_data;
+	sink->received.fetch_add(1, std::memory_order_relaxed);
+
+	if (!(severity & sink->severity_mask.load(std::memory_order_relaxed)) || sink->is_muted(data->messageIdNumber)) {
+		sink->filtered.fetch_add(1, std::memory_order_relaxed);
+		return VK_FALSE;
+	}
+	if (!sink->push(severity, type, data)) {
+		sink->dropped.fetch_add(1, std::memory_order_relaxed);
+		return VK_FALSE;
+	}
+
+	/* Without the mutex a wake-up can be missed, the consumer polls anyway */
+	sink->wake_cv.notify_one();
+	return VK_FALSE;
+}
+
+bool vk_debug_sink::is_muted(int32_t id) const
+{
+	if (!id) {
+		return false;
+	}
+	for (const auto &m : this->muted) {
+		if (m.load(std::memory_order_relaxed) == id) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool vk_debug_sink::push(
+	VkDebugUtilsMessageSeverityFlagBitsEXT severity,
+	VkDebugUtilsMessageTypeFlagsEXT type,
+	const VkDebugUtilsMessengerCallbackDataEXT *data)
+{
+	if (!this->slots) {
+		return false;
+	}
+
+	uint64_t pos = this->enqueue_pos.load(std::memory_order_relaxed);
+	slot *s;
+	for (;;) {
+		s = &this->slots[pos % QUEUE_CAPACITY];
+		const uint64_t seq = s->sequence.load(std::memory_order_acquire);
+		const int64_t diff = (int64_t)(seq - pos);
+		if (diff == 0) {
+			if (this->enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			return false;
+		} else {
+			pos = this->enqueue_pos.load(std::memory_order_relaxed);
+		}
+	}
+
+	message &msg = s->msg;
+	msg.time_ns = now_ns();
+	msg.thread = std::hash<std::thread::id>()(std::this_thread::get_id());
+	msg.severity = severity;
+	msg.type = type;
+	msg.id = data->messageIdNumber;
+	msg.object_count = std::min(data->objectCount, MAX_OBJECTS);
+	for (uint32_t i=0u; i<msg.object_count; ++i) {
+		msg.objects[i] = data->pObjects[i].objectHandle;
+	}
+	copy_text(msg.name, MAX_NAME, data->pMessageIdName);
+	msg.truncated = copy_text(msg.text, MAX_TEXT, data->pMessage);
+
+	s->sequence.store(pos + 1, std::memory_order_release);
+	return true;
+}
+
+bool vk_debug_sink::pop(message &out)
+{
+	slot &s = this->slots[this->dequeue_pos % QUEUE_CAPACITY];
+	if (s.sequence.load(std::memory_order_acquire) != this->dequeue_pos + 1) {
+		return false;
+	}
+	out = s.msg;
+	s.sequence.store(this->dequeue_pos + QUEUE_CAPACITY, std::memory_order_release);
+	++this->dequeue_pos;
+	return true;
+}
+
+void vk_debug_sink::consume_loop()
+{
+	/* A message is over 2 KiB, keep the copy off the stack of every iteration */
+	std::unique_ptr<message> msg = std::make_unique<message>();
+	while (this->running.load(std::memory_order_relaxed)) {
+		while (pop(*msg)) {
+			process(*msg);
+		}
+		report_repeats(now_ns(), false);
+
+		std::unique_lock<std::mutex> lock(this->wake_mutex);
+		this->wake_cv.wait_for(lock, POLL_INTERVAL);
+	}
+}
+
+void vk_debug_sink::process(const message &msg)
+{
+	uint64_t key = (uint32_t)msg.id;
+	if (!msg.id) {
+		/* Loader and layer messages often carry no ID, tell them apart by their text */
+		uint32_t h = 2166136261u;
+		for (const char *c=msg.text; *c; ++c) {
+			h = (h ^ (uint8_t)*c) * 16777619u;
+		}
+		key = 1ull << 32 | h;
+	}
+
+	auto [it, inserted] = this->ids.try_emplace(key);
+	id_state &state = it->second;
+	++state.count;
+
+	if (this->log.is_open()) {
+		char head[160];
+		snprintf(head, sizeof(head), "{\"time_ms\":%.3f,\"severity\":\"%s\",\"type\":\"%s\",\"id\":%d,\"thread\":%llu,\"repeat\":%llu,\"name\":",
+			(msg.time_ns - this->start_ns) / 1e6,
+			get_severity_name(msg.severity),
+			get_type_name(msg.type),
+			msg.id,
+			(unsigned long long)msg.thread,
+			(unsigned long long)(state.count - 1));
+		std::string line = head;
+		append_json_string(line, msg.name);
+		line += ",\"objects\":[";
+		for (uint32_t i=0u; i<msg.object_count; ++i) {
+			char handle[24];
+			snprintf(handle, sizeof(handle), "%s\"0x%016llx\"", i ? "," : "", (unsigned long long)msg.objects[i]);
+			line += handle;
+		}
+		line += "],\"message\":";
+		append_json_string(line, msg.text);
+		line += msg.truncated ? ",\"truncated\":true}\n" : "}\n";
+		this->log << line;
+	}
+
+	if (!inserted) {
+		++state.pending;
+		std::lock_guard<std::mutex> lock(this->stats_mutex);
+		++this->repeats;
+		return;
+	}
+
+	state.severity = msg.severity;
+	state.name = msg.name;
+	state.reported_ns = msg.time_ns;
+
+	/* One write per message, so lines of other threads' output can't land in the middle */
+	std::string out = std::string(get_severity_name(msg.severity)) + " [" + get_type_name(msg.type) + "]";
+	char id[32];
+	snprintf(id, sizeof(id), " 0x%08x", (uint32_t)msg.id);
+	if (msg.name[0]) {
+		out += ' ';
+		out += msg.name;
+	}
+	out += id;
+	out += ": ";
+	out += msg.text;
+	if (msg.truncated) {
+		out += "...";
+	}
+	out += '\n';
+	if (msg.object_count) {
+		out += "  Objects";
+		for (uint32_t i=0u; i<msg.object_count; ++i) {
+			char handle[24];
+			snprintf(handle, sizeof(handle), " 0x%016llx", (unsigned long long)msg.objects[i]);
+			out += handle;
+		}
+		out += '\n';
+	}
+	std::cerr << out;
+
+	std::lock_guard<std::mutex> lock(this->stats_mutex);
+	++this->shown;
+	this->unique_ids = this->ids.size();
+}
+
+void vk_debug_sink::report_repeats(uint64_t now_ns, bool all)
+{
+	std::string out;
+	for (auto &[key, state] : this->ids) {
+		if (!state.pending || (!all && now_ns - state.reported_ns < REPEAT_INTERVAL_NS)) {
+			continue;
+		}
+		char line[160];
+		snprintf(line, sizeof(line), "%s %s repeated %llu times (%llu total)\n",
+			get_severity_name(state.severity),
+			state.name.empty() ? "message" : state.name.c_str(),
+			(unsigned long long)state.pending,
+			(unsigned long long)state.count);
+		out += line;
+		state.pending = 0;
+		state.reported_ns = now_ns;
+	}
+
+	const uint64_t dropped = this->dropped.load(std::memory_order_relaxed);
+	if (dropped != this->reported_dropped) {
+		out += std::to_string(dropped - this->reported_dropped) + " debug messages dropped, the queue was full\n";
+		this->reported_dropped = dropped;
+	}
+	if (!out.empty()) {
+		std::cerr << out;
+	}
+	if (this->log.is_open()) {
+		this->log.flush();
+	}
+}
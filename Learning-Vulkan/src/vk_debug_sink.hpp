@@ -0,0 +1,142 @@
+#pragma once
+
+#include <vulkan/vulkan_core.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+struct vk_debug_sink_stats
+{
+	/* Every call of the messenger, including what the filters rejected */
+	uint64_t received = 0;
+	uint64_t filtered = 0;
+	/* Lost because the queue was full, the driver thread never waits */
+	uint64_t dropped = 0;
+	uint64_t shown = 0;
+	/* Repeats of an ID that were only counted */
+	uint64_t repeats = 0;
+	uint64_t unique_ids = 0;
+};
+
+/*
+ * Validation and debug messenger target. The callback runs on whatever
+ * thread called into the driver, so all it does is check the filters and
+ * copy the message into a bounded lock-free queue. A background thread
+ * formats it: the first message of every messageIdNumber is printed to
+ * std::cerr, further ones are counted and summarized at most once per
+ * second, and every accepted message goes to the structured log (one JSON
+ * object per line) when there is one.
+ *
+ * The filters may be changed from any thread while messages arrive. The
+ * severity mask can only narrow what the messenger was created with.
+ */
+struct vk_debug_sink
+{
+	static constexpr uint32_t QUEUE_CAPACITY = 256;
+	static constexpr uint32_t MAX_TEXT = 2048;
+	static constexpr uint32_t MAX_NAME = 64;
+	static constexpr uint32_t MAX_OBJECTS = 4;
+	static constexpr uint32_t MAX_MUTED = 32;
+
+	~vk_debug_sink() { deinit(); }
+
+	/* log_path may be empty, throws if it can't be opened */
+	void init(VkDebugUtilsMessageSeverityFlagsEXT severity_mask, const std::string &log_path);
+	/* Prints what is still queued and the pending repeat counts */
+	void deinit();
+
+	/* Points create_info at this sink, severities outside the mask aren't even generated */
+	void fill_create_info(VkDebugUtilsMessengerCreateInfoEXT &create_info);
+
+	void set_severity_mask(VkDebugUtilsMessageSeverityFlagsEXT mask);
+	/* False when MAX_MUTED IDs are muted already */
+	bool mute(int32_t id);
+	void unmute(int32_t id);
+
+	vk_debug_sink_stats get_stats() const;
+
+private:
+	struct message
+	{
+		uint64_t time_ns;
+		uint64_t thread;
+		VkDebugUtilsMessageSeverityFlagBitsEXT severity;
+		VkDebugUtilsMessageTypeFlagsEXT type;
+		int32_t id;
+		uint32_t object_count;
+		uint64_t objects[MAX_OBJECTS];
+		bool truncated;
+		char name[MAX_NAME];
+		char text[MAX_TEXT];
+	};
+
+	/* Vyukov's bounded MPMC queue, used with a single consumer */
+	struct slot
+	{
+		std::atomic<uint64_t> sequence;
+		message msg;
+	};
+
+	struct id_state
+	{
+		uint64_t count = 0;
+		/* Repeats since the last line about this ID */
+		uint64_t pending = 0;
+		uint64_t reported_ns = 0;
+		VkDebugUtilsMessageSeverityFlagBitsEXT severity;
+		std::string name;
+	};
+
+	static VKAPI_ATTR VkBool32 VKAPI_CALL callback(
+		VkDebugUtilsMessageSeverityFlagBitsEXT severity,
+		VkDebugUtilsMessageTypeFlagsEXT type,
+		const VkDebugUtilsMessengerCallbackDataEXT *data,
+		void *user_data);
+
+	bool is_muted(int32_t id) const;
+	bool push(
+		VkDebugUtilsMessageSeverityFlagBitsEXT severity,
+		VkDebugUtilsMessageTypeFlagsEXT type,
+		const VkDebugUtilsMessengerCallbackDataEXT *data);
+	bool pop(message &out);
+
+	void consume_loop();
+	void process(const message &msg);
+	void report_repeats(uint64_t now_ns, bool all);
+
+private:
+	std::unique_ptr<slot[]> slots;
+	alignas(64) std::atomic<uint64_t> enqueue_pos = 0;
+	alignas(64) uint64_t dequeue_pos = 0;
+
+	std::atomic<uint32_t> severity_mask = 0;
+	/* 0 marks a free entry, so ID 0 can't be muted */
+	std::atomic<int32_t> muted[MAX_MUTED] = {};
+
+	std::atomic<uint64_t> received = 0;
+	std::atomic<uint64_t> filtered = 0;
+	std::atomic<uint64_t> dropped = 0;
+
+	std::thread thread;
+	std::atomic<bool> running = false;
+	std::mutex wake_mutex;
+	std::condition_variable wake_cv;
+
+	/* Owned by the consumer thread. Keyed by the ID, or by a hash of the text for messages without one */
+	std::unordered_map<uint64_t, id_state> ids;
+	std::ofstream log;
+	uint64_t start_ns = 0;
+	uint64_t reported_dropped = 0;
+
+	mutable std::mutex stats_mutex;
+	uint64_t shown = 0;
+	uint64_t repeats = 0;
+	uint64_t unique_ids = 0;
+};
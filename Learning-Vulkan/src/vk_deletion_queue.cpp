@@ -0,0 +1,133 @@
+#include "vk_deletion_queue.hpp"
+
+#include "cpu_trace.hpp"
+#include "vk_host_allocator.hpp"
+
+#include <algorithm>
+
+void vk_deletion_queue::init(VkDevice device, vk_memory_allocator &allocator)
+{
+	this->device = device;
+	this->allocator = &allocator;
+	this->frame = 0;
+}
+
+void vk_deletion_queue::deinit()
+{
+	flush();
+	this->allocator = nullptr;
+	this->device = VK_NULL_HANDLE;
+}
+
+void vk_deletion_queue::destroy_buffer(VkBuffer buffer)
+{
+	if (buffer) {
+		push(object_kind::buffer, (uint64_t)buffer, {});
+	}
+}
+
+void vk_deletion_queue::destroy_image(VkImage image)
+{
+	if (image) {
+		push(object_kind::image, (uint64_t)image, {});
+	}
+}
+
+void vk_deletion_queue::destroy_image_view(VkImageView view)
+{
+	if (view) {
+		push(object_kind::image_view, (uint64_t)view, {});
+	}
+}
+
+void vk_deletion_queue::destroy_pipeline(VkPipeline pipeline)
+{
+	if (pipeline) {
+		push(object_kind::pipeline, (uint64_t)pipeline, {});
+	}
+}
+
+void vk_deletion_queue::free_memory(vk_allocation &allocation)
+{
+	if (allocation.memory) {
+		push(object_kind::memory, 0, allocation);
+		this->stats.pending_bytes += allocation.size;
+		this->stats.max_pending_bytes = std::max(this->stats.max_pending_bytes, this->stats.pending_bytes);
+	}
+	allocation = {};
+}
+
+void vk_deletion_queue::free_slot(slot_allocator &slots, uint32_t slot)
+{
+	if (slot != slot_allocator::INVALID_SLOT) {
+		push(object_kind::slot, slot, {}, &slots);
+	}
+}
+
+void vk_deletion_queue::push(object_kind kind, uint64_t handle, const vk_allocation &allocation, slot_allocator *slots)
+{
+	this->entries.push_back({
+		.frame = this->frame,
+		.kind = kind,
+		.handle = handle,
+		.allocation = allocation,
+		.slots = slots});
+
+	++this->stats.queued_count;
+	this->stats.depth = (uint32_t)this->entries.size();
+	this->stats.max_depth = std::max(this->stats.max_depth, this->stats.depth);
+}
+
+void vk_deletion_queue::release(entry &e)
+{
+	switch (e.kind) {
+	case object_kind::buffer:
+		vkDestroyBuffer(this->device, (VkBuffer)e.handle, vk_allocation_callbacks());
+		break;
+	case object_kind::image:
+		vkDestroyImage(this->device, (VkImage)e.handle, vk_allocation_callbacks());
+		break;
+	case object_kind::image_view:
+		vkDestroyImageView(this->device, (VkImageView)e.handle, vk_allocation_callbacks());
+		break;
+	case object_kind::pipeline:
+		vkDestroyPipeline(this->device, (VkPipeline)e.handle, vk_allocation_callbacks());
+		break;
+	case object_kind::memory:
+		this->stats.pending_bytes -= e.allocation.size;
+		this->allocator->free(e.allocation);
+		break;
+	case object_kind::slot:
+		e.slots->free((uint32_t)e.handle);
+		break;
+	}
+	++this->stats.retired_count;
+}
+
+void vk_deletion_queue::retire(uint64_t frame)
+{
+	if (this->entries.empty() || this->entries.front().frame > frame) {
+		return;
+	}
+
+	CPU_ZONE("deletion_queue_retire");
+
+	while (!this->entries.empty() && this->entries.front().frame <= frame) {
+		release(this->entries.front());
+		this->entries.pop_front();
+	}
+	++this->stats.retire_batches;
+	this->stats.depth = (uint32_t)this->entries.size();
+}
+
+void vk_deletion_queue::flush()
+{
+	for (auto &e : this->entries) {
+		release(e);
+	}
+	if (!this->entries.empty()) {
+		++this->stats.retire_batches;
+	}
+	this->entries.clear();
+	this->stats.depth = 0;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "vk_bindless.hpp"
+#include "vk_memory.hpp"
+
+#include <vulkan/vulkan_core.h>
+
+#include <deque>
+#include <stdint.h>
+
+struct vk_deletion_stats
+{
+	uint64_t queued_count = 0;
+	uint64_t retired_count = 0;
+	/* retire() calls that released at least one object */
+	uint64_t retire_batches = 0;
+	/* Objects waiting for their frame, and the most there ever were */
+	uint32_t depth = 0;
+	uint32_t max_depth = 0;
+	/* Device memory held by queued allocations */
+	VkDeviceSize pending_bytes = 0;
+	VkDeviceSize max_pending_bytes = 0;
+};
+
+/*
+ * Holds on to objects the GPU may still be using until the frame that last
+ * used them has finished. Everything destroyed through the queue is tagged
+ * with the frame being recorded, and retire() releases all objects of the
+ * frames the CPU has since waited on. Frames finish in submission order,
+ * so the queue stays sorted and retiring only ever pops from the front.
+ */
+struct vk_deletion_queue
+{
+	void init(VkDevice device, vk_memory_allocator &allocator);
+	/* Releases whatever is left, the device must be idle */
+	void deinit();
+
+	/* Objects destroyed from now on may be used by this frame's commands */
+	void begin_frame(uint64_t frame) { this->frame = frame; }
+
+	void destroy_buffer(VkBuffer buffer);
+	void destroy_image(VkImage image);
+	void destroy_image_view(VkImageView view);
+	void destroy_pipeline(VkPipeline pipeline);
+	/* Takes ownership of the allocation and resets it */
+	void free_memory(vk_allocation &allocation);
+	/* Bindless slots, so shaders of frames in flight never see the slot's next resource */
+	void free_slot(slot_allocator &slots, uint32_t slot);
+
+	/* The GPU is done with frame and everything before it */
+	void retire(uint64_t frame);
+	void flush();
+
+	const vk_deletion_stats &get_stats() const { return this->stats; }
+
+private:
+	enum class object_kind
+	{
+		buffer,
+		image,
+		image_view,
+		pipeline,
+		memory,
+		slot,
+	};
+
+	struct entry
+	{
+		uint64_t frame;
+		object_kind kind;
+		/* Non-dispatchable handle, or the slot index */
+		uint64_t handle;
+		vk_allocation allocation;
+		slot_allocator *slots;
+	};
+
+	void push(object_kind kind, uint64_t handle, const vk_allocation &allocation, slot_allocator *slots = nullptr);
+	void release(entry &e);
+
+private:
+	VkDevice device = VK_NULL_HANDLE;
+	vk_memory_allocator *allocator = nullptr;
+	uint64_t frame = 0;
+	std::deque<entry> entries;
+	vk_deletion_stats stats;
+};
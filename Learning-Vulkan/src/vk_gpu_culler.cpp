@@ -0,0 +1,364 @@
+#include "vk_gpu_culler.hpp"
+
+#include "vk_host_allocator.hpp"
+#include "vk_shader.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string.h>
+#include <utility>
+#include <vector>
+
+/* Matches cull_params in gpu_cull.comp */
+struct gpu_cull_params
+{
+	float planes[6][4];
+	uint32_t object_count;
+};
+
+static_assert(sizeof(gpu_cull_object) == 32, "gpu_cull_object must match the std430 layout of the shader");
+static_assert(sizeof(VkDrawIndexedIndirectCommand) == 20, "Draw commands are written with a 20 byte stride");
+static_assert(sizeof(gpu_cull_params) <= 128, "Push constants must fit the guaranteed minimum");
+
+static VkBuffer create_buffer(
+	VkDevice device,
+	vk_memory_allocator &allocator,
+	VkDeviceSize size,
+	VkBufferUsageFlags usage,
+	VkMemoryPropertyFlags props,
+	vk_allocation &memory)
+{
+	VkBufferCreateInfo create_info = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.pNext = nullptr,
+		.flags = 0,
+		.size = size,
+		.usage = usage,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+		.queueFamilyIndexCount = 0,
+		.pQueueFamilyIndices = nullptr};
+
+	VkBuffer buffer;
+	if (vkCreateBuffer(device, &create_info, vk_allocation_callbacks(), &buffer) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create GPU culling buffer");
+	}
+
+	memory = allocator.alloc_buffer(buffer, props);
+	return buffer;
+}
+
+static void buffer_barrier(
+	VkCommandBuffer cmd_buf,
+	VkBuffer buffer,
+	VkPipelineStageFlags src_stage,
+	VkAccessFlags src_access,
+	VkPipelineStageFlags dst_stage,
+	VkAccessFlags dst_access)
+{
+	VkBufferMemoryBarrier barrier = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = src_access,
+		.dstAccessMask = dst_access,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.buffer = buffer,
+		.offset = 0,
+		.size = VK_WHOLE_SIZE};
+
+	vkCmdPipelineBarrier(cmd_buf, src_stage, dst_stage, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+void vk_gpu_culler::init(
+	VkPhysicalDevice physical_device,
+	VkDevice device,
+	vk_memory_allocator &allocator,
+	VkPipelineCache pipeline_cache,
+	const std::vector<uint32_t> &spirv,
+	uint32_t max_objects,
+	uint32_t frame_count,
+	bool draw_indirect_count)
+{
+	this->device = device;
+	this->allocator = &allocator;
+	this->max_objects = max_objects;
+
+	VkPhysicalDeviceProperties props;
+	vkGetPhysicalDeviceProperties(physical_device, &props);
+	if ((max_objects + GROUP_SIZE - 1) / GROUP_SIZE > props.limits.maxComputeWorkGroupCount[0]) {
+		throw std::runtime_error("Too many objects to cull in one dispatch");
+	}
+
+	create_buffers(frame_count);
+	create_layout();
+	this->pipeline = create_pipeline(pipeline_cache, spirv);
+
+	if (draw_indirect_count) {
+		this->cmd_draw_indexed_indirect_count = (PFN_vkCmdDrawIndexedIndirectCount)vkGetDeviceProcAddr(
+			device,
+			"vkCmdDrawIndexedIndirectCountKHR");
+	}
+}
+
+void vk_gpu_culler::create_buffers(uint32_t frame_count)
+{
+	vk_memory_allocator &allocator = *this->allocator;
+	const VkDeviceSize max_objects = std::max(this->max_objects, 1u);
+
+	this->object_buffer = create_buffer(
+		this->device,
+		allocator,
+		max_objects * sizeof(gpu_cull_object),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		this->object_memory);
+	this->draw_buffer = create_buffer(
+		this->device,
+		allocator,
+		max_objects * sizeof(VkDrawIndexedIndirectCommand),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		this->draw_memory);
+	this->count_buffer = create_buffer(
+		this->device,
+		allocator,
+		sizeof(uint32_t),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+			| VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		this->count_memory);
+	/* Coherent so reading a count needs no invalidate, it is a handful of bytes */
+	this->readback_buffer = create_buffer(
+		this->device,
+		allocator,
+		frame_count * sizeof(uint32_t),
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		this->readback_memory);
+	memset(this->readback_memory.mapped, 0, frame_count * sizeof(uint32_t));
+}
+
+void vk_gpu_culler::create_layout()
+{
+	/* Bindings 0, 1 and 2 are the object, draw and count buffers, as declared in the shader */
+	VkDescriptorSetLayoutBinding bindings[3];
+	for (uint32_t b=0u; b<3u; ++b) {
+		bindings[b] = {
+			.binding = b,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+			.pImmutableSamplers = nullptr};
+	}
+
+	VkDescriptorSetLayoutCreateInfo layout_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+		.pNext = nullptr,
+		.flags = 0,
+		.bindingCount = 3,
+		.pBindings = bindings};
+
+	if (vkCreateDescriptorSetLayout(this->device, &layout_info, vk_allocation_callbacks(), &this->set_layout) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create GPU culling descriptor set layout");
+	}
+
+	VkDescriptorPoolSize pool_size = { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3 };
+
+	VkDescriptorPoolCreateInfo pool_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+		.pNext = nullptr,
+		.flags = 0,
+		.maxSets = 1,
+		.poolSizeCount = 1,
+		.pPoolSizes = &pool_size};
+
+	if (vkCreateDescriptorPool(this->device, &pool_info, vk_allocation_callbacks(), &this->pool) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create GPU culling descriptor pool");
+	}
+
+	VkDescriptorSetAllocateInfo alloc_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+		.pNext = nullptr,
+		.descriptorPool = this->pool,
+		.descriptorSetCount = 1,
+		.pSetLayouts = &this->set_layout};
+
+	if (vkAllocateDescriptorSets(this->device, &alloc_info, &this->set) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to allocate GPU culling descriptor set");
+	}
+
+	/* The buffers never change, so the set is written once */
+	VkDescriptorBufferInfo buffer_infos[] = {
+		{ this->object_buffer, 0, VK_WHOLE_SIZE },
+		{ this->draw_buffer, 0, VK_WHOLE_SIZE },
+		{ this->count_buffer, 0, VK_WHOLE_SIZE }};
+
+	VkWriteDescriptorSet writes[3];
+	for (uint32_t b=0u; b<3u; ++b) {
+		writes[b] = {
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.pNext = nullptr,
+			.dstSet = this->set,
+			.dstBinding = b,
+			.dstArrayElement = 0,
+			.descriptorCount = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.pImageInfo = nullptr,
+			.pBufferInfo = &buffer_infos[b],
+			.pTexelBufferView = nullptr};
+	}
+	vkUpdateDescriptorSets(this->device, 3, writes, 0, nullptr);
+
+	VkPushConstantRange push_range = {
+		.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+		.offset = 0,
+		.size = sizeof(gpu_cull_params)};
+
+	VkPipelineLayoutCreateInfo pipeline_layout_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+		.pNext = nullptr,
+		.flags = 0,
+		.setLayoutCount = 1,
+		.pSetLayouts = &this->set_layout,
+		.pushConstantRangeCount = 1,
+		.pPushConstantRanges = &push_range};
+
+	if (vkCreatePipelineLayout(this->device, &pipeline_layout_info, vk_allocation_callbacks(), &this->pipeline_layout) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create GPU culling pipeline layout");
+	}
+}
+
+VkPipeline vk_gpu_culler::create_pipeline(VkPipelineCache pipeline_cache, const std::vector<uint32_t> &spirv) const
+{
+	VkShaderModule module = create_shader_module(this->device, spirv);
+
+	VkComputePipelineCreateInfo pipeline_info = {
+		.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+		.pNext = nullptr,
+		.flags = 0,
+		.stage = {
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+			.pNext = nullptr,
+			.flags = 0,
+			.stage = VK_SHADER_STAGE_COMPUTE_BIT,
+			.module = module,
+			.pName = "main",
+			.pSpecializationInfo = nullptr},
+		.layout = this->pipeline_layout,
+		.basePipelineHandle = VK_NULL_HANDLE,
+		.basePipelineIndex = -1};
+
+	VkPipeline pipeline;
+	VkResult result = vkCreateComputePipelines(this->device, pipeline_cache, 1, &pipeline_info, vk_allocation_callbacks(), &pipeline);
+	/* The pipeline keeps what it needs, the module can go right away */
+	vkDestroyShaderModule(this->device, module, vk_allocation_callbacks());
+	if (result != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create GPU culling pipeline");
+	}
+	return pipeline;
+}
+
+VkPipeline vk_gpu_culler::swap_pipeline(VkPipeline pipeline)
+{
+	std::swap(pipeline, this->pipeline);
+	return pipeline;
+}
+
+void vk_gpu_culler::deinit()
+{
+	if (!this->device) {
+		return;
+	}
+
+	/* The set goes away with its pool */
+	vkDestroyPipeline(this->device, this->pipeline, vk_allocation_callbacks());
+	vkDestroyPipelineLayout(this->device, this->pipeline_layout, vk_allocation_callbacks());
+	vkDestroyDescriptorPool(this->device, this->pool, vk_allocation_callbacks());
+	vkDestroyDescriptorSetLayout(this->device, this->set_layout, vk_allocation_callbacks());
+	this->pipeline = VK_NULL_HANDLE;
+	this->pipeline_layout = VK_NULL_HANDLE;
+	this->pool = VK_NULL_HANDLE;
+	this->set = VK_NULL_HANDLE;
+	this->set_layout = VK_NULL_HANDLE;
+
+	VkBuffer *buffers[] = { &this->object_buffer, &this->draw_buffer, &this->count_buffer, &this->readback_buffer };
+	vk_allocation *memory[] = { &this->object_memory, &this->draw_memory, &this->count_memory, &this->readback_memory };
+	for (uint32_t i=0u; i<4u; ++i) {
+		if (*buffers[i]) {
+			vkDestroyBuffer(this->device, *buffers[i], vk_allocation_callbacks());
+			this->allocator->free(*memory[i]);
+			*buffers[i] = VK_NULL_HANDLE;
+		}
+	}
+
+	this->cmd_draw_indexed_indirect_count = nullptr;
+	this->allocator = nullptr;
+	this->device = VK_NULL_HANDLE;
+}
+
+void vk_gpu_culler::record_cull(VkCommandBuffer cmd_buf, uint32_t frame_ix, const cull_frustum &frustum, uint32_t object_count)
+{
+	gpu_cull_params params;
+	for (uint32_t p=0u; p<6u; ++p) {
+		params.planes[p][0] = frustum.nx[p];
+		params.planes[p][1] = frustum.ny[p];
+		params.planes[p][2] = frustum.nz[p];
+		params.planes[p][3] = frustum.d[p];
+	}
+	params.object_count = std::min(object_count, this->max_objects);
+
+	vkCmdFillBuffer(cmd_buf, this->count_buffer, 0, sizeof(uint32_t), 0);
+	buffer_barrier(
+		cmd_buf,
+		this->count_buffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_ACCESS_TRANSFER_WRITE_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+	vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, this->pipeline);
+	vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE, this->pipeline_layout, 0, 1, &this->set, 0, nullptr);
+	vkCmdPushConstants(cmd_buf, this->pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(params), &params);
+	vkCmdDispatch(cmd_buf, (params.object_count + GROUP_SIZE - 1) / GROUP_SIZE, 1, 1);
+
+	buffer_barrier(
+		cmd_buf,
+		this->count_buffer,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_ACCESS_SHADER_WRITE_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_ACCESS_TRANSFER_READ_BIT);
+
+	VkBufferCopy region = {
+		.srcOffset = 0,
+		.dstOffset = frame_ix * sizeof(uint32_t),
+		.size = sizeof(uint32_t)};
+	vkCmdCopyBuffer(cmd_buf, this->count_buffer, this->readback_buffer, 1, &region);
+	buffer_barrier(
+		cmd_buf,
+		this->readback_buffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_ACCESS_TRANSFER_WRITE_BIT,
+		VK_PIPELINE_STAGE_HOST_BIT,
+		VK_ACCESS_HOST_READ_BIT);
+}
+
+void vk_gpu_culler::record_draws(VkCommandBuffer cmd_buf)
+{
+	if (!this->cmd_draw_indexed_indirect_count) {
+		throw std::runtime_error("Indirect count draws are not enabled");
+	}
+	this->cmd_draw_indexed_indirect_count(
+		cmd_buf,
+		this->draw_buffer,
+		0,
+		this->count_buffer,
+		0,
+		this->max_objects,
+		sizeof(VkDrawIndexedIndirectCommand));
+}
+
+uint32_t vk_gpu_culler::get_visible_count(uint32_t frame_ix) const
+{
+	return ((const uint32_t *)this->readback_memory.mapped)[frame_ix];
+}
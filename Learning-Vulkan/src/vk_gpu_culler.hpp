@@ -0,0 +1,108 @@
+#pragma once
+
+#include "culling.hpp"
+#include "vk_memory.hpp"
+
+#include <vulkan/vulkan_core.h>
+
+#include <stdint.h>
+#include <vector>
+
+/* One object as gpu_cull.comp reads it, a world space sphere and the draw it turns into */
+struct gpu_cull_object
+{
+	float center_x, center_y, center_z, radius;
+	uint32_t index_count;
+	uint32_t first_index;
+	int32_t vertex_offset;
+	uint32_t pad;
+};
+
+/*
+ * Frustum culling on the GPU. A compute pass tests every object against
+ * the frustum and appends a VkDrawIndexedIndirectCommand per visible one,
+ * and one vkCmdDrawIndexedIndirectCount then draws exactly those, so the
+ * CPU never sees per-object visibility. The visible count is also copied
+ * to a host visible slot per frame in flight for statistics.
+ */
+struct vk_gpu_culler
+{
+	static constexpr uint32_t GROUP_SIZE = 64;
+
+	/*
+	 * spirv is the compiled gpu_cull.comp. draw_indirect_count says
+	 * VK_KHR_draw_indirect_count, multiDrawIndirect and
+	 * drawIndirectFirstInstance were enabled, without them only the cull
+	 * pass is available.
+	 */
+	void init(
+		VkPhysicalDevice physical_device,
+		VkDevice device,
+		vk_memory_allocator &allocator,
+		VkPipelineCache pipeline_cache,
+		const std::vector<uint32_t> &spirv,
+		uint32_t max_objects,
+		uint32_t frame_count,
+		bool draw_indirect_count);
+	void deinit();
+
+	bool is_enabled() const { return this->pipeline != VK_NULL_HANDLE; }
+
+	/*
+	 * A pipeline for new SPIR-V of gpu_cull.comp, throws on failure. Only
+	 * reads what init() created, so it may run on any thread while frames
+	 * are recorded.
+	 */
+	VkPipeline create_pipeline(VkPipelineCache pipeline_cache, const std::vector<uint32_t> &spirv) const;
+	/* Swaps pipeline in, returning the old one for the caller to destroy once no frame in flight uses it */
+	VkPipeline swap_pipeline(VkPipeline pipeline);
+	uint32_t get_max_objects() const { return this->max_objects; }
+
+	/* Upload gpu_cull_objects here, to be read at COMPUTE_SHADER with SHADER_READ */
+	VkBuffer get_object_buffer() const { return this->object_buffer; }
+	VkBuffer get_draw_buffer() const { return this->draw_buffer; }
+	VkBuffer get_count_buffer() const { return this->count_buffer; }
+
+	/*
+	 * Resets the count, culls the first object_count objects and copies the
+	 * count to frame_ix's readback slot. The draw and count buffers are
+	 * left written by COMPUTE_SHADER and TRANSFER, the caller makes them
+	 * visible to DRAW_INDIRECT (the frame graph does this for its pass).
+	 */
+	void record_cull(VkCommandBuffer cmd_buf, uint32_t frame_ix, const cull_frustum &frustum, uint32_t object_count);
+
+	bool can_draw() const { return this->cmd_draw_indexed_indirect_count != nullptr; }
+	/* Inside a render pass with the mesh's pipeline, index and vertex buffers bound */
+	void record_draws(VkCommandBuffer cmd_buf);
+
+	/* What frame_ix's last cull let through, only valid once that frame has completed */
+	uint32_t get_visible_count(uint32_t frame_ix) const;
+
+private:
+	void create_buffers(uint32_t frame_count);
+	void create_layout();
+
+private:
+	VkDevice device = VK_NULL_HANDLE;
+	vk_memory_allocator *allocator = nullptr;
+	uint32_t max_objects = 0;
+
+	VkBuffer object_buffer = VK_NULL_HANDLE;
+	vk_allocation object_memory;
+	VkBuffer draw_buffer = VK_NULL_HANDLE;
+	vk_allocation draw_memory;
+	VkBuffer count_buffer = VK_NULL_HANDLE;
+	vk_allocation count_memory;
+	/* One uint32_t per frame in flight */
+	VkBuffer readback_buffer = VK_NULL_HANDLE;
+	vk_allocation readback_memory;
+
+	VkDescriptorSetLayout set_layout = VK_NULL_HANDLE;
+	VkDescriptorPool pool = VK_NULL_HANDLE;
+	VkDescriptorSet set = VK_NULL_HANDLE;
+	VkPipelineLayout pipeline_layout = VK_NULL_HANDLE;
+	VkPipeline pipeline = VK_NULL_HANDLE;
+
+	/* vkCmdDrawIndexedIndirectCountKHR, nullptr when the extension is not enabled */
+	PFN_vkCmdDrawIndexedIndirectCount cmd_draw_indexed_indirect_count = nullptr;
+};
@@ -0,0 +1,262 @@
+#include "vk_gpu_profiler.hpp"
+
+#include "vk_host_allocator.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+
+static VkQueryPool create_timestamp_pool(VkDevice device, uint32_t count)
+{
+	VkQueryPoolCreateInfo create_info = {
+		.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+		.pNext = nullptr,
+		.flags = 0,
+		.queryType = VK_QUERY_TYPE_TIMESTAMP,
+		.queryCount = count,
+		.pipelineStatistics = 0};
+
+	VkQueryPool pool;
+	if (vkCreateQueryPool(device, &create_info, vk_allocation_callbacks(), &pool) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create query pool");
+	}
+	return pool;
+}
+
+void vk_gpu_profiler::init(
+	VkPhysicalDevice physical_device,
+	VkDevice device,
+	VkQueue queue,
+	uint32_t queue_family,
+	VkCommandPool cmd_pool,
+	uint32_t frames_in_flight,
+	trace_writer *trace)
+{
+	this->device = device;
+	this->trace = trace;
+
+	VkPhysicalDeviceProperties props;
+	vkGetPhysicalDeviceProperties(physical_device, &props);
+
+	uint32_t family_count = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &family_count, nullptr);
+	std::vector<VkQueueFamilyProperties> families(family_count);
+	vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &family_count, families.data());
+
+	uint32_t valid_bits = families[queue_family].timestampValidBits;
+	if (valid_bits == 0 || props.limits.timestampPeriod <= 0.0f) {
+		std::cout << "GPU timestamps not supported on this queue, GPU profiler disabled\n";
+		return;
+	}
+
+	this->period_ns = props.limits.timestampPeriod;
+	this->valid_mask = valid_bits >= 64 ? ~0ull : (1ull << valid_bits) - 1;
+
+	this->frames.resize(frames_in_flight);
+	for (auto &f : this->frames) {
+		f.pool = create_timestamp_pool(device, MAX_ZONES * 2);
+	}
+
+	calibrate(queue, cmd_pool);
+}
+
+void vk_gpu_profiler::deinit()
+{
+	for (auto &f : this->frames) {
+		collect(f);
+		vkDestroyQueryPool(this->device, f.pool, vk_allocation_callbacks());
+	}
+	this->frames.clear();
+	this->stats.clear();
+	this->device = VK_NULL_HANDLE;
+}
+
+void vk_gpu_profiler::begin_frame(VkCommandBuffer cmd_buf, uint32_t frame_ix)
+{
+	if (!is_enabled()) {
+		return;
+	}
+
+	this->current_frame = frame_ix;
+	this->depth = 0;
+
+	frame &f = this->frames[frame_ix];
+	collect(f);
+
+	vkCmdResetQueryPool(cmd_buf, f.pool, 0, MAX_ZONES * 2);
+	++this->summary_frames;
+}
+
+uint32_t vk_gpu_profiler::begin_zone(VkCommandBuffer cmd_buf, const char *name)
+{
+	if (!is_enabled()) {
+		return INVALID_ZONE;
+	}
+
+	frame &f = this->frames[this->current_frame];
+	if (f.zones.size() >= MAX_ZONES) {
+		return INVALID_ZONE;
+	}
+
+	uint32_t zone_ix = (uint32_t)f.zones.size();
+	f.zones.push_back({ name, this->depth++ });
+	vkCmdWriteTimestamp(cmd_buf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, f.pool, zone_ix * 2);
+
+	return zone_ix;
+}
+
+void vk_gpu_profiler::end_zone(VkCommandBuffer cmd_buf, uint32_t zone)
+{
+	if (zone == INVALID_ZONE) {
+		return;
+	}
+
+	frame &f = this->frames[this->current_frame];
+	vkCmdWriteTimestamp(cmd_buf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, f.pool, zone * 2 + 1);
+	--this->depth;
+}
+
+void vk_gpu_profiler::print_summary()
+{
+	if (!is_enabled() || this->stats.empty()) {
+		return;
+	}
+
+	std::cout << "GPU (" << this->summary_frames << " frames, avg / max ms):\n";
+	std::cout << std::fixed << std::setprecision(3);
+	for (auto &s : this->stats) {
+		if (s.count == 0) {
+			continue;
+		}
+
+		std::cout << "  " << std::string(s.depth * 2, ' ') << s.name
+			<< ": " << s.total_ns / (double)s.count / 1e6
+			<< " / " << s.max_ns / 1e6 << '\n';
+		s.count = 0;
+		s.total_ns = 0;
+		s.max_ns = 0;
+	}
+	std::cout.unsetf(std::ios::floatfield);
+	std::cout << std::setprecision(6);
+
+	this->summary_frames = 0;
+}
+
+void vk_gpu_profiler::collect(frame &f)
+{
+	if (f.zones.empty()) {
+		return;
+	}
+
+	/* Pairs of (timestamp, availability), unavailable results are dropped instead of waited on */
+	uint32_t query_count = (uint32_t)f.zones.size() * 2;
+	std::vector<uint64_t> results(query_count * 2);
+	VkResult res = vkGetQueryPoolResults(
+		this->device,
+		f.pool,
+		0,
+		query_count,
+		results.size() * sizeof(uint64_t),
+		results.data(),
+		2 * sizeof(uint64_t),
+		VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+	if (res == VK_SUCCESS || res == VK_NOT_READY) {
+		for (uint32_t i=0u; i<f.zones.size(); ++i) {
+			const uint64_t *beg = &results[i * 4];
+			const uint64_t *end = &results[i * 4 + 2];
+			if (!beg[1] || !end[1]) {
+				continue;
+			}
+
+			uint64_t ticks = (end[0] - beg[0]) & this->valid_mask;
+			uint64_t dur_ns = (uint64_t)(ticks * this->period_ns);
+
+			const zone &z = f.zones[i];
+			auto it = std::find_if(this->stats.begin(), this->stats.end(), [&](const zone_stats &s) {
+				return s.name == z.name && s.depth == z.depth;
+			});
+			if (it == this->stats.end()) {
+				this->stats.push_back({ z.name, z.depth, 0, 0, 0 });
+				it = this->stats.end() - 1;
+			}
+			++it->count;
+			it->total_ns += dur_ns;
+			it->max_ns = std::max(it->max_ns, dur_ns);
+
+			if (this->trace) {
+				int64_t beg_ns = (int64_t)((beg[0] & this->valid_mask) * this->period_ns) + this->gpu_to_cpu_ns;
+				this->trace->add({ z.name, GPU_TRACE_TID, (uint64_t)beg_ns, dur_ns });
+			}
+		}
+	}
+
+	f.zones.clear();
+}
+
+/*
+ * Writes one timestamp and brackets the submission with CPU clock reads,
+ * the midpoint is taken as the CPU time of the GPU timestamp. Good to
+ * within the submit latency, which is plenty to line zones up in a trace.
+ */
+void vk_gpu_profiler::calibrate(VkQueue queue, VkCommandPool cmd_pool)
+{
+	VkCommandBufferAllocateInfo alloc_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+		.pNext = nullptr,
+		.commandPool = cmd_pool,
+		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+		.commandBufferCount = 1};
+
+	VkCommandBuffer cmd_buf;
+	if (vkAllocateCommandBuffers(this->device, &alloc_info, &cmd_buf) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to allocate command buffer");
+	}
+
+	VkCommandBufferBeginInfo begin_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.pNext = nullptr,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+		.pInheritanceInfo = nullptr};
+
+	VkQueryPool pool = this->frames[0].pool;
+	vkBeginCommandBuffer(cmd_buf, &begin_info);
+	vkCmdResetQueryPool(cmd_buf, pool, 0, 1);
+	vkCmdWriteTimestamp(cmd_buf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, pool, 0);
+	vkEndCommandBuffer(cmd_buf);
+
+	VkSubmitInfo submit_info = {
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.pNext = nullptr,
+		.waitSemaphoreCount = 0,
+		.pWaitSemaphores = nullptr,
+		.pWaitDstStageMask = nullptr,
+		.commandBufferCount = 1,
+		.pCommandBuffers = &cmd_buf,
+		.signalSemaphoreCount = 0,
+		.pSignalSemaphores = nullptr};
+
+	uint64_t cpu_beg = trace_now_ns();
+	if (vkQueueSubmit(queue, 1, &submit_info, VK_NULL_HANDLE) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to submit queue");
+	}
+	vkQueueWaitIdle(queue);
+	uint64_t cpu_end = trace_now_ns();
+
+	uint64_t ticks = 0;
+	if (vkGetQueryPoolResults(
+			this->device,
+			pool,
+			0,
+			1,
+			sizeof(ticks),
+			&ticks,
+			sizeof(ticks),
+			VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT) == VK_SUCCESS) {
+		int64_t gpu_ns = (int64_t)((ticks & this->valid_mask) * this->period_ns);
+		this->gpu_to_cpu_ns = (int64_t)(cpu_beg + (cpu_end - cpu_beg) / 2) - gpu_ns;
+	}
+
+	vkFreeCommandBuffers(this->device, cmd_pool, 1, &cmd_buf);
+}
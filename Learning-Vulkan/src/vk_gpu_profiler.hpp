@@ -0,0 +1,108 @@
+#pragma once
+
+#include "trace.hpp"
+
+#include <vulkan/vulkan_core.h>
+
+#include <stdint.h>
+#include <vector>
+
+/*
+ * Timestamp query based GPU zones. Every frame in flight owns a query
+ * pool, its results are read back when the frame slot comes around again,
+ * by which point its fence has signaled and nothing stalls.
+ */
+struct vk_gpu_profiler
+{
+	static constexpr uint32_t MAX_ZONES = 64;
+	static constexpr uint32_t INVALID_ZONE = UINT32_MAX;
+	/* Trace thread id the GPU timeline is shown under */
+	static constexpr uint32_t GPU_TRACE_TID = 1000;
+
+	/* trace may be nullptr, queue and cmd_pool are only used to calibrate against the CPU clock */
+	void init(
+		VkPhysicalDevice physical_device,
+		VkDevice device,
+		VkQueue queue,
+		uint32_t queue_family,
+		VkCommandPool cmd_pool,
+		uint32_t frames_in_flight,
+		trace_writer *trace);
+	void deinit();
+
+	bool is_enabled() const { return !this->frames.empty(); }
+
+	/* Call right after beginning the frame slot's command buffer, once its fence has signaled */
+	void begin_frame(VkCommandBuffer cmd_buf, uint32_t frame_ix);
+
+	/* name must outlive the profiler, typically a string literal */
+	uint32_t begin_zone(VkCommandBuffer cmd_buf, const char *name);
+	void end_zone(VkCommandBuffer cmd_buf, uint32_t zone);
+
+	/* Prints average and max of every zone since the previous call */
+	void print_summary();
+
+private:
+	struct zone
+	{
+		const char *name;
+		uint32_t depth;
+	};
+
+	struct frame
+	{
+		VkQueryPool pool = VK_NULL_HANDLE;
+		std::vector<zone> zones;
+	};
+
+	struct zone_stats
+	{
+		const char *name;
+		uint32_t depth;
+		uint64_t count;
+		uint64_t total_ns;
+		uint64_t max_ns;
+	};
+
+	void collect(frame &f);
+	void calibrate(VkQueue queue, VkCommandPool cmd_pool);
+
+private:
+	VkDevice device = VK_NULL_HANDLE;
+	double period_ns = 1.0;
+	uint64_t valid_mask = ~0ull;
+	/* Added to a GPU timestamp in ns to land on the trace_now_ns() timeline */
+	int64_t gpu_to_cpu_ns = 0;
+
+	std::vector<frame> frames;
+	uint32_t current_frame = 0;
+	uint32_t depth = 0;
+
+	std::vector<zone_stats> stats;
+	uint64_t summary_frames = 0;
+	trace_writer *trace = nullptr;
+};
+
+struct vk_gpu_zone
+{
+	vk_gpu_zone(vk_gpu_profiler &profiler, VkCommandBuffer cmd_buf, const char *name):
+		profiler(profiler),
+		cmd_buf(cmd_buf),
+		zone(profiler.begin_zone(cmd_buf, name)) {}
+
+	~vk_gpu_zone() { this->profiler.end_zone(this->cmd_buf, this->zone); }
+
+	vk_gpu_profiler &profiler;
+	VkCommandBuffer cmd_buf;
+	uint32_t zone;
+};
+
+#define VK_GPU_ZONE_CONCAT2(a, b) a##b
+#define VK_GPU_ZONE_CONCAT(a, b) VK_GPU_ZONE_CONCAT2(a, b)
+
+/* Times the rest of the enclosing scope on the GPU */
+#define VK_GPU_ZONE(profiler, cmd_buf, name) \
+	vk_gpu_zone VK_GPU_ZONE_CONCAT(gpu_zone_, __LINE__)((profiler), (cmd_buf), (name))
+
+#define VK_GPU_ZONE_BEGIN(profiler, cmd_buf, name) uint32_t gpu_zone_##name = (profiler).begin_zone((cmd_buf), #name)
+#define VK_GPU_ZONE_END(profiler, cmd_buf, name) (profiler).end_zone((cmd_buf), gpu_zone_##name)
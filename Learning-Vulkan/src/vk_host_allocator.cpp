@@ -0,0 +1,266 @@
+#include "vk_host_allocator.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string.h>
+
+/* Sits right before every pointer handed out, found again from it on free */
+struct alignas(16) vk_host_allocator::header
+{
+	uint8_t *base;
+	size_t size;
+	uint32_t scope;
+	/* Index of the arena plus one, 0 for the heap */
+	uint32_t from_arena;
+};
+
+static constexpr size_t MIN_ALIGNMENT = 16;
+
+/* One live allocation in the high half of an arena's state */
+static constexpr uint64_t ARENA_LIVE_ONE = 1ull << 32;
+static constexpr uint64_t ARENA_OFFSET_MASK = ARENA_LIVE_ONE - 1;
+
+static vk_host_allocator *installed = nullptr;
+
+static uint8_t *place_header(uint8_t *base, size_t alignment, size_t header_size)
+{
+	uintptr_t p = (uintptr_t)base + header_size;
+	p = (p + alignment - 1) & ~(uintptr_t)(alignment - 1);
+	return (uint8_t *)p;
+}
+
+static void update_max(std::atomic<uint64_t> &max, uint64_t value)
+{
+	uint64_t prev = max.load(std::memory_order_relaxed);
+	while (prev < value && !max.compare_exchange_weak(prev, value, std::memory_order_relaxed)) {
+	}
+}
+
+void vk_host_allocator::init(uint32_t frame_count, size_t arena_size)
+{
+	if (installed) {
+		throw std::runtime_error("Failed to install host allocator, one is already installed");
+	}
+	if (arena_size > MAX_ARENA_SIZE) {
+		throw std::runtime_error("Failed to create host allocator arenas, too large");
+	}
+
+	this->arena_count = std::max(frame_count, 1u);
+	this->arena_size = arena_size;
+	this->arenas = std::make_unique<arena[]>(this->arena_count);
+	for (uint32_t i=0u; i<this->arena_count; ++i) {
+		this->arenas[i].memory = std::make_unique<uint8_t[]>(arena_size);
+	}
+	this->current_arena = 0;
+	this->start_ns = trace_now_ns();
+
+	this->callbacks = VkAllocationCallbacks{
+		.pUserData = this,
+		.pfnAllocation = allocation,
+		.pfnReallocation = reallocation,
+		.pfnFree = free,
+		.pfnInternalAllocation = internal_allocation,
+		.pfnInternalFree = internal_free,
+	};
+	installed = this;
+}
+
+void vk_host_allocator::deinit()
+{
+	if (installed == this) {
+		installed = nullptr;
+	}
+	this->arenas.reset();
+	this->arena_count = 0;
+}
+
+void vk_host_allocator::begin_frame(uint32_t frame_ix)
+{
+	const uint32_t ix = frame_ix % this->arena_count;
+	arena &a = this->arenas[ix];
+
+	/* Fails if anything is live, or became live since the load, and the arena is simply left as it is */
+	uint64_t state = a.state.load(std::memory_order_acquire);
+	if ((state & ~ARENA_OFFSET_MASK) == 0) {
+		a.state.compare_exchange_strong(state, 0, std::memory_order_acq_rel);
+	}
+	this->current_arena.store(ix, std::memory_order_release);
+}
+
+uint64_t vk_host_allocator::get_heap_alloc_count() const
+{
+	uint64_t count = 0;
+	for (uint32_t i=0u; i<HOST_SCOPE_COUNT; ++i) {
+		if (i == VK_SYSTEM_ALLOCATION_SCOPE_COMMAND) {
+			continue;
+		}
+		count += this->scopes[i].alloc_count.load(std::memory_order_relaxed);
+		count += this->scopes[i].realloc_count.load(std::memory_order_relaxed);
+	}
+	return count;
+}
+
+vk_host_memory_stats vk_host_allocator::get_stats() const
+{
+	vk_host_memory_stats stats;
+	for (uint32_t i=0u; i<HOST_SCOPE_COUNT; ++i) {
+		const scope_counters &c = this->scopes[i];
+		stats.scopes[i] = vk_host_scope_stats{
+			.live_bytes = c.live_bytes.load(std::memory_order_relaxed),
+			.peak_bytes = c.peak_bytes.load(std::memory_order_relaxed),
+			.alloc_count = c.alloc_count.load(std::memory_order_relaxed),
+			.realloc_count = c.realloc_count.load(std::memory_order_relaxed),
+			.free_count = c.free_count.load(std::memory_order_relaxed),
+			.total_bytes = c.total_bytes.load(std::memory_order_relaxed),
+			.internal_bytes = c.internal_bytes.load(std::memory_order_relaxed),
+		};
+	}
+	stats.arena_overflow_count = this->arena_overflow_count.load(std::memory_order_relaxed);
+	stats.arena_peak_bytes = this->arena_peak_bytes.load(std::memory_order_relaxed);
+	stats.arena_capacity = this->arena_size;
+	stats.elapsed_ns = trace_now_ns() - this->start_ns;
+	return stats;
+}
+
+void vk_host_allocator::count_alloc(VkSystemAllocationScope scope, size_t size)
+{
+	scope_counters &c = this->scopes[scope];
+	uint64_t live = c.live_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+	update_max(c.peak_bytes, live);
+	c.total_bytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+void *vk_host_allocator::alloc_from_arena(size_t size, size_t alignment)
+{
+	const uint32_t ix = this->current_arena.load(std::memory_order_acquire);
+	arena &a = this->arenas[ix];
+	const uint64_t reserve = sizeof(header) + alignment + size;
+
+	/* The bump and the live count move together, so begin_frame() can't rewind under us */
+	uint64_t state = a.state.load(std::memory_order_relaxed);
+	uint64_t offset;
+	do {
+		offset = state & ARENA_OFFSET_MASK;
+		if (offset + reserve > this->arena_size) {
+			this->arena_overflow_count.fetch_add(1, std::memory_order_relaxed);
+			return nullptr;
+		}
+	} while (!a.state.compare_exchange_weak(state, state + ARENA_LIVE_ONE + reserve, std::memory_order_acq_rel));
+	update_max(this->arena_peak_bytes, offset + reserve);
+
+	uint8_t *base = a.memory.get() + offset;
+	uint8_t *p = place_header(base, alignment, sizeof(header));
+	new (p - sizeof(header)) header{base, size, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND, ix + 1u};
+	return p;
+}
+
+void *vk_host_allocator::alloc(size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+	if (size == 0) {
+		return nullptr;
+	}
+	alignment = std::max(alignment, MIN_ALIGNMENT);
+	if ((uint32_t)scope >= HOST_SCOPE_COUNT) {
+		scope = VK_SYSTEM_ALLOCATION_SCOPE_OBJECT;
+	}
+
+	void *p = nullptr;
+	if (scope == VK_SYSTEM_ALLOCATION_SCOPE_COMMAND) {
+		p = this->alloc_from_arena(size, alignment);
+	}
+
+	if (!p) {
+		uint8_t *base = (uint8_t *)malloc(sizeof(header) + alignment + size);
+		/* Vulkan wants nullptr on failure, the caller turns it into VK_ERROR_OUT_OF_HOST_MEMORY */
+		if (!base) {
+			return nullptr;
+		}
+		uint8_t *q = place_header(base, alignment, sizeof(header));
+		new (q - sizeof(header)) header{base, size, (uint32_t)scope, 0u};
+		p = q;
+	}
+
+	this->count_alloc(scope, size);
+	return p;
+}
+
+void vk_host_allocator::release(void *memory)
+{
+	if (!memory) {
+		return;
+	}
+	header *h = (header *)((uint8_t *)memory - sizeof(header));
+
+	scope_counters &c = this->scopes[h->scope];
+	c.live_bytes.fetch_sub(h->size, std::memory_order_relaxed);
+	c.free_count.fetch_add(1, std::memory_order_relaxed);
+
+	/* Arena memory comes back all at once with begin_frame() */
+	if (h->from_arena) {
+		this->arenas[h->from_arena - 1].state.fetch_sub(ARENA_LIVE_ONE, std::memory_order_acq_rel);
+	} else {
+		::free(h->base);
+	}
+}
+
+VKAPI_ATTR void *VKAPI_CALL vk_host_allocator::allocation(void *user_data, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+	vk_host_allocator *self = (vk_host_allocator *)user_data;
+	void *p = self->alloc(size, alignment, scope);
+	if (p) {
+		self->scopes[((header *)p)[-1].scope].alloc_count.fetch_add(1, std::memory_order_relaxed);
+	}
+	return p;
+}
+
+VKAPI_ATTR void *VKAPI_CALL vk_host_allocator::reallocation(void *user_data, void *original, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+	vk_host_allocator *self = (vk_host_allocator *)user_data;
+	if (!original) {
+		return allocation(user_data, size, alignment, scope);
+	}
+	if (size == 0) {
+		self->release(original);
+		return nullptr;
+	}
+
+	/* The original's contents stay untouched when this fails, as the spec wants */
+	void *p = self->alloc(size, alignment, scope);
+	if (!p) {
+		return nullptr;
+	}
+	const header &old = ((header *)original)[-1];
+	memcpy(p, original, std::min(old.size, size));
+	self->scopes[((header *)p)[-1].scope].realloc_count.fetch_add(1, std::memory_order_relaxed);
+	self->release(original);
+	return p;
+}
+
+VKAPI_ATTR void VKAPI_CALL vk_host_allocator::free(void *user_data, void *memory)
+{
+	((vk_host_allocator *)user_data)->release(memory);
+}
+
+VKAPI_ATTR void VKAPI_CALL vk_host_allocator::internal_allocation(void *user_data, size_t size, VkInternalAllocationType, VkSystemAllocationScope scope)
+{
+	vk_host_allocator *self = (vk_host_allocator *)user_data;
+	if ((uint32_t)scope < HOST_SCOPE_COUNT) {
+		self->scopes[scope].internal_bytes.fetch_add(size, std::memory_order_relaxed);
+	}
+}
+
+VKAPI_ATTR void VKAPI_CALL vk_host_allocator::internal_free(void *user_data, size_t size, VkInternalAllocationType, VkSystemAllocationScope scope)
+{
+	vk_host_allocator *self = (vk_host_allocator *)user_data;
+	if ((uint32_t)scope < HOST_SCOPE_COUNT) {
+		self->scopes[scope].internal_bytes.fetch_sub(size, std::memory_order_relaxed);
+	}
+}
+
+const VkAllocationCallbacks *vk_allocation_callbacks()
+{
+	return installed ? installed->get_callbacks() : nullptr;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <vulkan/vulkan_core.h>
+
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+
+/* One per VkSystemAllocationScope, indexed by it */
+static constexpr uint32_t HOST_SCOPE_COUNT = 5;
+
+struct vk_host_scope_stats
+{
+	uint64_t live_bytes = 0;
+	uint64_t peak_bytes = 0;
+	uint64_t alloc_count = 0;
+	uint64_t realloc_count = 0;
+	uint64_t free_count = 0;
+	/* Everything ever handed out, realloc growth included */
+	uint64_t total_bytes = 0;
+	/* Live memory the driver got elsewhere and only reported, e.g. executable code */
+	uint64_t internal_bytes = 0;
+};
+
+struct vk_host_memory_stats
+{
+	vk_host_scope_stats scopes[HOST_SCOPE_COUNT];
+	/* Command scope allocations that didn't fit their frame's arena and went to the heap */
+	uint64_t arena_overflow_count = 0;
+	/* Most bytes one frame's arena held, headers and padding included */
+	uint64_t arena_peak_bytes = 0;
+	uint64_t arena_capacity = 0;
+	/* Since init(), for rates */
+	uint64_t elapsed_ns = 0;
+};
+
+/*
+ * VkAllocationCallbacks that count every host allocation the loader,
+ * layers and driver make through us, by VkSystemAllocationScope. Command
+ * scope allocations only live for the duration of one Vulkan call, so
+ * they are bumped out of a linear arena per frame in flight, which
+ * begin_frame() resets, instead of going through the heap. Every other
+ * scope is an aligned malloc with a small header in front.
+ *
+ * init() installs the callbacks for vk_allocation_callbacks(), which every
+ * vkCreate*, vkAllocateMemory, vkDestroy* and vkFreeMemory call passes, so
+ * it must run before the instance is created and deinit() after it is
+ * destroyed. All callbacks are thread safe and lock free.
+ */
+struct vk_host_allocator
+{
+	static constexpr size_t DEFAULT_ARENA_SIZE = 1 << 20;
+	/* Offsets share a word with the live count */
+	static constexpr size_t MAX_ARENA_SIZE = UINT32_MAX;
+
+	void init(uint32_t frame_count, size_t arena_size = DEFAULT_ARENA_SIZE);
+	void deinit();
+
+	bool is_enabled() const { return this->arenas != nullptr; }
+	const VkAllocationCallbacks *get_callbacks() const { return &this->callbacks; }
+
+	/*
+	 * Command scope allocations go to the frame's arena from now on. It is
+	 * rewound if none of its allocations are live, a call still running on
+	 * another thread keeps it as it is until the slot comes round again.
+	 */
+	void begin_frame(uint32_t frame_ix);
+
+	/* Allocations of every scope but command, cheap enough to sample each frame */
+	uint64_t get_heap_alloc_count() const;
+	vk_host_memory_stats get_stats() const;
+
+private:
+	struct header;
+
+	struct arena
+	{
+		std::unique_ptr<uint8_t[]> memory;
+		/*
+		 * Live allocation count in the high half, bump offset in the low
+		 * half. One word so a reset can only happen while nothing is live,
+		 * a bump and its count can't be split by one.
+		 */
+		std::atomic<uint64_t> state = 0;
+	};
+
+	struct scope_counters
+	{
+		alignas(64) std::atomic<uint64_t> live_bytes = 0;
+		std::atomic<uint64_t> peak_bytes = 0;
+		std::atomic<uint64_t> alloc_count = 0;
+		std::atomic<uint64_t> realloc_count = 0;
+		std::atomic<uint64_t> free_count = 0;
+		std::atomic<uint64_t> total_bytes = 0;
+		std::atomic<uint64_t> internal_bytes = 0;
+	};
+
+	static VKAPI_ATTR void *VKAPI_CALL allocation(void *user_data, size_t size, size_t alignment, VkSystemAllocationScope scope);
+	static VKAPI_ATTR void *VKAPI_CALL reallocation(void *user_data, void *original, size_t size, size_t alignment, VkSystemAllocationScope scope);
+	static VKAPI_ATTR void VKAPI_CALL free(void *user_data, void *memory);
+	static VKAPI_ATTR void VKAPI_CALL internal_allocation(void *user_data, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope);
+	static VKAPI_ATTR void VKAPI_CALL internal_free(void *user_data, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope);
+
+	void *alloc(size_t size, size_t alignment, VkSystemAllocationScope scope);
+	void *alloc_from_arena(size_t size, size_t alignment);
+	void release(void *memory);
+	void count_alloc(VkSystemAllocationScope scope, size_t size);
+
+private:
+	VkAllocationCallbacks callbacks = {};
+	std::unique_ptr<arena[]> arenas;
+	uint32_t arena_count = 0;
+	size_t arena_size = 0;
+	std::atomic<uint32_t> current_arena = 0;
+	std::atomic<uint64_t> arena_overflow_count = 0;
+	std::atomic<uint64_t> arena_peak_bytes = 0;
+	uint64_t start_ns = 0;
+
+	scope_counters scopes[HOST_SCOPE_COUNT];
+};
+
+/* What every allocating or freeing Vulkan call passes, nullptr while no vk_host_allocator is installed */
+const VkAllocationCallbacks *vk_allocation_callbacks();
@@ -0,0 +1,127 @@
+#include "vk_linear_allocator.hpp"
+
+#include "vk_host_allocator.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+void vk_linear_allocator::init(
+	VkPhysicalDevice physical_device,
+	VkDevice device,
+	vk_memory_allocator &allocator,
+	uint32_t frame_count,
+	VkDeviceSize frame_size,
+	VkBufferUsageFlags usage)
+{
+	this->device = device;
+	this->allocator = &allocator;
+
+	VkPhysicalDeviceProperties props;
+	vkGetPhysicalDeviceProperties(physical_device, &props);
+	this->alignment = std::max<VkDeviceSize>(1, props.limits.minUniformBufferOffsetAlignment);
+	this->atom_size = std::max<VkDeviceSize>(1, props.limits.nonCoherentAtomSize);
+
+	/* Regions start on an atom so each frame flushes without touching its neighbours */
+	this->frame_size = align_up(frame_size, std::max(this->alignment, this->atom_size));
+	if (this->frame_size * frame_count > UINT32_MAX) {
+		throw std::runtime_error("Linear allocator too large for dynamic offsets");
+	}
+
+	VkBufferCreateInfo buffer_info = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.pNext = nullptr,
+		.flags = 0,
+		.size = this->frame_size * frame_count,
+		.usage = usage,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+		.queueFamilyIndexCount = 0,
+		.pQueueFamilyIndices = nullptr};
+
+	if (vkCreateBuffer(device, &buffer_info, vk_allocation_callbacks(), &this->buffer) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create linear allocator buffer");
+	}
+
+	/* Flushed ranges are relative to the VkDeviceMemory, so the buffer has to start on an atom too */
+	VkMemoryRequirements reqs;
+	vkGetBufferMemoryRequirements(device, this->buffer, &reqs);
+	reqs.alignment = std::max(reqs.alignment, this->atom_size);
+
+	this->memory = allocator.alloc(reqs, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, true);
+	if (vkBindBufferMemory(device, this->buffer, this->memory.memory, this->memory.offset) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to bind linear allocator memory");
+	}
+
+	VkPhysicalDeviceMemoryProperties mem_props;
+	vkGetPhysicalDeviceMemoryProperties(physical_device, &mem_props);
+	this->coherent = mem_props.memoryTypes[this->memory.memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+	this->frame_base = 0;
+	this->head = 0;
+	this->stats = {};
+	this->stats.frame_capacity = this->frame_size;
+}
+
+void vk_linear_allocator::deinit()
+{
+	if (!this->device) {
+		return;
+	}
+
+	vkDestroyBuffer(this->device, this->buffer, vk_allocation_callbacks());
+	this->allocator->free(this->memory);
+	this->buffer = VK_NULL_HANDLE;
+	this->allocator = nullptr;
+	this->device = VK_NULL_HANDLE;
+}
+
+void vk_linear_allocator::begin_frame(uint32_t frame_ix)
+{
+	this->frame_base = this->frame_size * frame_ix;
+	this->head = 0;
+}
+
+vk_linear_allocation vk_linear_allocator::alloc(VkDeviceSize size)
+{
+	/* Rounding the size keeps every offset aligned without a compare and swap loop */
+	const VkDeviceSize aligned_size = align_up(size, this->alignment);
+	const VkDeviceSize offset = this->head.fetch_add(aligned_size, std::memory_order_relaxed);
+	this->alloc_count.fetch_add(1, std::memory_order_relaxed);
+
+	if (offset + aligned_size > this->frame_size) {
+		this->overflow_count.fetch_add(1, std::memory_order_relaxed);
+		return {};
+	}
+
+	return {
+		.data = (char *)this->memory.mapped + this->frame_base + offset,
+		.offset = (uint32_t)(this->frame_base + offset)};
+}
+
+void vk_linear_allocator::flush()
+{
+	const VkDeviceSize used = std::min(this->head.load(std::memory_order_relaxed), this->frame_size);
+	this->stats.peak_frame_bytes = std::max(this->stats.peak_frame_bytes, used);
+	this->stats.alloc_count = this->alloc_count.load(std::memory_order_relaxed);
+	this->stats.overflow_count = this->overflow_count.load(std::memory_order_relaxed);
+
+	if (this->coherent || !used) {
+		return;
+	}
+
+	VkMappedMemoryRange range = {
+		.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+		.pNext = nullptr,
+		.memory = this->memory.memory,
+		.offset = this->memory.offset + this->frame_base,
+		.size = align_up(used, this->atom_size)};
+
+	if (vkFlushMappedMemoryRanges(this->device, 1, &range) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to flush linear allocator memory");
+	}
+	++this->stats.flush_count;
+}
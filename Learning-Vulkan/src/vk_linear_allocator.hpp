@@ -0,0 +1,75 @@
+#pragma once
+
+#include "vk_memory.hpp"
+
+#include <vulkan/vulkan_core.h>
+
+#include <atomic>
+#include <stdint.h>
+
+struct vk_linear_allocation
+{
+	/* Write the data here, nullptr when the frame's region is full */
+	void *data = nullptr;
+	/* From the start of the buffer, pass it as the dynamic offset */
+	uint32_t offset = 0;
+};
+
+struct vk_linear_stats
+{
+	uint64_t alloc_count = 0;
+	/* Allocations that didn't fit in their frame's region */
+	uint64_t overflow_count = 0;
+	uint64_t flush_count = 0;
+	/* Most bytes any single frame used, alignment padding included */
+	VkDeviceSize peak_frame_bytes = 0;
+	VkDeviceSize frame_capacity = 0;
+};
+
+/*
+ * Bump allocator for per-draw constants over one persistently mapped host
+ * visible buffer, split into a region per frame in flight. Allocations are
+ * aligned to minUniformBufferOffsetAlignment so their offsets can be used
+ * as dynamic offsets, and a region is reset in bulk by begin_frame() once
+ * the frame that used it is done. alloc() is lock free and may be called
+ * from the recording workers. Non-coherent memory is flushed once per frame.
+ */
+struct vk_linear_allocator
+{
+	void init(
+		VkPhysicalDevice physical_device,
+		VkDevice device,
+		vk_memory_allocator &allocator,
+		uint32_t frame_count,
+		VkDeviceSize frame_size,
+		VkBufferUsageFlags usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+	void deinit();
+
+	VkBuffer get_buffer() const { return this->buffer; }
+	/* Every allocation starts at a multiple of this */
+	VkDeviceSize get_alignment() const { return this->alignment; }
+
+	/* The frame's previous contents must no longer be in use by the GPU */
+	void begin_frame(uint32_t frame_ix);
+	vk_linear_allocation alloc(VkDeviceSize size);
+	/* Makes this frame's writes visible to the device in one range, call before submitting */
+	void flush();
+
+	const vk_linear_stats &get_stats() const { return this->stats; }
+
+private:
+	VkDevice device = VK_NULL_HANDLE;
+	vk_memory_allocator *allocator = nullptr;
+	VkBuffer buffer = VK_NULL_HANDLE;
+	vk_allocation memory;
+	bool coherent = true;
+	VkDeviceSize alignment = 1;
+	VkDeviceSize atom_size = 1;
+	VkDeviceSize frame_size = 0;
+
+	VkDeviceSize frame_base = 0;
+	std::atomic<VkDeviceSize> head = 0;
+	std::atomic<uint64_t> alloc_count = 0;
+	std::atomic<uint64_t> overflow_count = 0;
+	vk_linear_stats stats;
+};
@@ -0,0 +1,401 @@
+#include "vk_memory.hpp"
+
+#include "vk_host_allocator.hpp"
+
+#include <algorithm>
+#include <assert.h>
+#include <bit>
+#include <stdexcept>
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static void *offset_ptr(void *base, VkDeviceSize offset)
+{
+	return base ? (char *)base + offset : nullptr;
+}
+
+void vk_memory_allocator::init(VkPhysicalDevice physical_device, VkDevice device, VkDeviceSize block_size)
+{
+	this->device = device;
+
+	VkPhysicalDeviceProperties props;
+	vkGetPhysicalDeviceProperties(physical_device, &props);
+	this->buffer_image_granularity = std::max<VkDeviceSize>(1, props.limits.bufferImageGranularity);
+	this->max_device_allocation_count = props.limits.maxMemoryAllocationCount;
+
+	VkPhysicalDeviceMemoryProperties mem_props;
+	vkGetPhysicalDeviceMemoryProperties(physical_device, &mem_props);
+
+	this->types.resize(mem_props.memoryTypeCount);
+	for (uint32_t i=0u; i<mem_props.memoryTypeCount; ++i) {
+		const VkMemoryHeap &heap = mem_props.memoryHeaps[mem_props.memoryTypes[i].heapIndex];
+
+		/* Small heaps (e.g. the 256 MiB BAR window) get smaller blocks so one block can't hog them */
+		this->types[i].props = mem_props.memoryTypes[i].propertyFlags;
+		this->types[i].block_size = std::max<VkDeviceSize>(
+			std::min(block_size, std::bit_floor(heap.size / 8)),
+			tlsf_heap::MIN_ALIGN);
+	}
+}
+
+void vk_memory_allocator::deinit()
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+
+	for (uint32_t t=0u; t<this->types.size(); ++t) {
+		assert(this->types[t].dedicated_count == 0);
+		for (uint32_t b=0u; b<this->types[t].blocks.size(); ++b) {
+			if (this->types[t].blocks[b].memory) {
+				release_block(t, b);
+			}
+		}
+	}
+
+	this->types.clear();
+	this->device = VK_NULL_HANDLE;
+}
+
+vk_allocation vk_memory_allocator::alloc(
+	const VkMemoryRequirements &reqs,
+	VkMemoryPropertyFlags props,
+	bool linear,
+	uint64_t user_data)
+{
+	VkDeviceSize size = reqs.size;
+	VkDeviceSize alignment = reqs.alignment;
+
+	/*
+	 * Optimal images take whole bufferImageGranularity pages, that way no
+	 * linear resource can ever end up on the same page as one.
+	 */
+	if (!linear) {
+		alignment = std::max(alignment, this->buffer_image_granularity);
+		size = align_up(size, this->buffer_image_granularity);
+	}
+
+	std::lock_guard<std::mutex> lock(this->mutex);
+
+	for (uint32_t t=0u; t<this->types.size(); ++t) {
+		memory_type &type = this->types[t];
+		if (!(reqs.memoryTypeBits & (1u << t)) || (type.props & props) != props) {
+			continue;
+		}
+
+		vk_allocation ret;
+		ret.memory_type = t;
+
+		if (size > type.block_size / 2) {
+			ret.memory = allocate_device_memory(t, size, &ret.mapped);
+			if (!ret.memory) {
+				continue;
+			}
+			ret.size = size;
+			ret.block = DEDICATED_BLOCK;
+			++type.dedicated_count;
+			type.dedicated_bytes += size;
+			return ret;
+		}
+
+		if (try_alloc_from_blocks(t, size, alignment, user_data, ret)) {
+			return ret;
+		}
+
+		uint32_t block_ix;
+		if (!alloc_block(t, type.block_size, block_ix)) {
+			continue;
+		}
+
+		const block &blk = type.blocks[block_ix];
+		if (blk.heap->alloc(size, alignment, ret.sub, user_data)) {
+			ret.memory = blk.memory;
+			ret.offset = ret.sub.offset;
+			ret.size = ret.sub.size;
+			ret.mapped = offset_ptr(blk.mapped, ret.offset);
+			ret.block = block_ix;
+			return ret;
+		}
+	}
+
+	throw std::runtime_error("Failed to allocate device memory");
+}
+
+void vk_memory_allocator::free(vk_allocation &a)
+{
+	if (!a.memory) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(this->mutex);
+	free_locked(a);
+}
+
+vk_allocation vk_memory_allocator::alloc_image(VkImage image, VkMemoryPropertyFlags props, uint64_t user_data)
+{
+	VkMemoryRequirements reqs;
+	vkGetImageMemoryRequirements(this->device, image, &reqs);
+
+	vk_allocation ret = alloc(reqs, props, false, user_data);
+	if (vkBindImageMemory(this->device, image, ret.memory, ret.offset) != VK_SUCCESS) {
+		free(ret);
+		throw std::runtime_error("Failed to bind image memory");
+	}
+	return ret;
+}
+
+vk_allocation vk_memory_allocator::alloc_buffer(VkBuffer buffer, VkMemoryPropertyFlags props, uint64_t user_data)
+{
+	VkMemoryRequirements reqs;
+	vkGetBufferMemoryRequirements(this->device, buffer, &reqs);
+
+	vk_allocation ret = alloc(reqs, props, true, user_data);
+	if (vkBindBufferMemory(this->device, buffer, ret.memory, ret.offset) != VK_SUCCESS) {
+		free(ret);
+		throw std::runtime_error("Failed to bind buffer memory");
+	}
+	return ret;
+}
+
+std::vector<vk_defrag_move> vk_memory_allocator::begin_defragment(VkDeviceSize max_bytes)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+
+	std::vector<vk_defrag_move> moves;
+	VkDeviceSize moved = 0;
+
+	for (uint32_t t=0u; t<this->types.size(); ++t) {
+		memory_type &type = this->types[t];
+
+		std::vector<uint32_t> order;
+		for (uint32_t b=0u; b<type.blocks.size(); ++b) {
+			if (type.blocks[b].memory && !type.blocks[b].heap->empty()) {
+				order.push_back(b);
+			}
+		}
+		if (order.size() < 2) {
+			continue;
+		}
+
+		/* Evacuate the emptiest blocks into the fullest ones */
+		std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+			return type.blocks[a].heap->get_stats().used < type.blocks[b].heap->get_stats().used;
+		});
+
+		std::vector<bool> is_dst(type.blocks.size(), false);
+		for (size_t i=0u; i+1<order.size(); ++i) {
+			uint32_t src_ix = order[i];
+			if (is_dst[src_ix]) {
+				break;
+			}
+
+			const block &src = type.blocks[src_ix];
+			src.heap->for_each_allocation([&](const tlsf_heap::allocation &a, uint64_t alignment, uint64_t user_data) {
+				if (moved + a.size > max_bytes) {
+					return;
+				}
+
+				for (size_t j=order.size()-1; j>i; --j) {
+					uint32_t dst_ix = order[j];
+					block &dst = type.blocks[dst_ix];
+
+					vk_defrag_move move;
+					if (!dst.heap->alloc(a.size, alignment, move.dst.sub, user_data)) {
+						continue;
+					}
+
+					move.src = {
+						.memory = src.memory,
+						.offset = a.offset,
+						.size = a.size,
+						.mapped = offset_ptr(src.mapped, a.offset),
+						.memory_type = t,
+						.block = src_ix,
+						.sub = a};
+					move.dst.memory = dst.memory;
+					move.dst.offset = move.dst.sub.offset;
+					move.dst.size = move.dst.sub.size;
+					move.dst.mapped = offset_ptr(dst.mapped, move.dst.offset);
+					move.dst.memory_type = t;
+					move.dst.block = dst_ix;
+					move.user_data = user_data;
+
+					moves.push_back(move);
+					moved += a.size;
+					is_dst[dst_ix] = true;
+					break;
+				}
+			});
+		}
+	}
+
+	return moves;
+}
+
+void vk_memory_allocator::end_defragment(const std::vector<vk_defrag_move> &moves)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+
+	for (auto move : moves) {
+		free_locked(move.src);
+	}
+}
+
+vk_memory_stats vk_memory_allocator::get_stats()
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+
+	vk_memory_stats ret;
+	ret.types.resize(this->types.size());
+	ret.device_allocation_count = this->device_allocation_count;
+	ret.max_device_allocation_count = this->max_device_allocation_count;
+
+	for (size_t t=0u; t<this->types.size(); ++t) {
+		const memory_type &type = this->types[t];
+		vk_memory_type_stats &stats = ret.types[t];
+
+		stats.dedicated_count = type.dedicated_count;
+		stats.allocation_count = type.dedicated_count;
+		stats.reserved = type.dedicated_bytes;
+		stats.used = type.dedicated_bytes;
+
+		for (const auto &blk : type.blocks) {
+			if (!blk.memory) {
+				continue;
+			}
+
+			tlsf_heap::stats heap_stats = blk.heap->get_stats();
+			++stats.block_count;
+			stats.allocation_count += heap_stats.allocation_count;
+			stats.reserved += heap_stats.size;
+			stats.used += heap_stats.used;
+			stats.fragmentation = std::max(stats.fragmentation, heap_stats.fragmentation());
+		}
+	}
+
+	return ret;
+}
+
+bool vk_memory_allocator::try_alloc_from_blocks(
+	uint32_t type_ix,
+	VkDeviceSize size,
+	VkDeviceSize alignment,
+	uint64_t user_data,
+	vk_allocation &out)
+{
+	memory_type &type = this->types[type_ix];
+
+	for (uint32_t b=0u; b<type.blocks.size(); ++b) {
+		const block &blk = type.blocks[b];
+		if (blk.memory && blk.heap->alloc(size, alignment, out.sub, user_data)) {
+			out.memory = blk.memory;
+			out.offset = out.sub.offset;
+			out.size = out.sub.size;
+			out.mapped = offset_ptr(blk.mapped, out.offset);
+			out.block = b;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool vk_memory_allocator::alloc_block(uint32_t type_ix, VkDeviceSize size, uint32_t &block_ix)
+{
+	memory_type &type = this->types[type_ix];
+
+	block blk;
+	blk.memory = allocate_device_memory(type_ix, size, &blk.mapped);
+	if (!blk.memory) {
+		return false;
+	}
+	blk.heap = std::make_unique<tlsf_heap>(size);
+
+	for (uint32_t b=0u; b<type.blocks.size(); ++b) {
+		if (!type.blocks[b].memory) {
+			type.blocks[b] = std::move(blk);
+			block_ix = b;
+			return true;
+		}
+	}
+
+	type.blocks.push_back(std::move(blk));
+	block_ix = (uint32_t)type.blocks.size() - 1;
+	return true;
+}
+
+void vk_memory_allocator::release_block(uint32_t type_ix, uint32_t block_ix)
+{
+	block &blk = this->types[type_ix].blocks[block_ix];
+
+	if (blk.mapped) {
+		vkUnmapMemory(this->device, blk.memory);
+	}
+	vkFreeMemory(this->device, blk.memory, vk_allocation_callbacks());
+	--this->device_allocation_count;
+
+	blk = {};
+}
+
+void vk_memory_allocator::free_locked(vk_allocation &a)
+{
+	memory_type &type = this->types[a.memory_type];
+
+	if (a.block == DEDICATED_BLOCK) {
+		if (a.mapped) {
+			vkUnmapMemory(this->device, a.memory);
+		}
+		vkFreeMemory(this->device, a.memory, vk_allocation_callbacks());
+		--this->device_allocation_count;
+		--type.dedicated_count;
+		type.dedicated_bytes -= a.size;
+		a = {};
+		return;
+	}
+
+	block &blk = type.blocks[a.block];
+	blk.heap->free(a.sub);
+
+	/* Keep one empty block per memory type around so alloc/free patterns don't thrash vkAllocateMemory */
+	if (blk.heap->empty()) {
+		for (uint32_t b=0u; b<type.blocks.size(); ++b) {
+			if (b != a.block && type.blocks[b].memory && type.blocks[b].heap->empty()) {
+				release_block(a.memory_type, a.block);
+				break;
+			}
+		}
+	}
+
+	a = {};
+}
+
+VkDeviceMemory vk_memory_allocator::allocate_device_memory(uint32_t type_ix, VkDeviceSize size, void **mapped)
+{
+	*mapped = nullptr;
+
+	if (this->device_allocation_count >= this->max_device_allocation_count) {
+		return VK_NULL_HANDLE;
+	}
+
+	VkMemoryAllocateInfo alloc_info = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+		.pNext = nullptr,
+		.allocationSize = size,
+		.memoryTypeIndex = type_ix};
+
+	VkDeviceMemory memory;
+	if (vkAllocateMemory(this->device, &alloc_info, vk_allocation_callbacks(), &memory) != VK_SUCCESS) {
+		return VK_NULL_HANDLE;
+	}
+
+	if (this->types[type_ix].props & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+		if (vkMapMemory(this->device, memory, 0, VK_WHOLE_SIZE, 0, mapped) != VK_SUCCESS) {
+			vkFreeMemory(this->device, memory, vk_allocation_callbacks());
+			return VK_NULL_HANDLE;
+		}
+	}
+
+	++this->device_allocation_count;
+	return memory;
+}
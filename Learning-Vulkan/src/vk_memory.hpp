@@ -0,0 +1,120 @@
+#pragma once
+
+#include "tlsf_heap.hpp"
+
+#include <vulkan/vulkan_core.h>
+
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+struct vk_allocation
+{
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+	/* Host pointer to offset for host visible memory, nullptr otherwise */
+	void *mapped = nullptr;
+	uint32_t memory_type = 0;
+	/* Index into the memory type's blocks, or vk_memory_allocator::DEDICATED_BLOCK */
+	uint32_t block = 0;
+	tlsf_heap::allocation sub;
+};
+
+struct vk_memory_type_stats
+{
+	uint32_t block_count = 0;
+	uint32_t dedicated_count = 0;
+	uint32_t allocation_count = 0;
+	VkDeviceSize reserved = 0;
+	VkDeviceSize used = 0;
+	/* Worst block, see tlsf_heap::stats::fragmentation() */
+	double fragmentation = 0.0;
+};
+
+struct vk_memory_stats
+{
+	/* Indexed by memory type */
+	std::vector<vk_memory_type_stats> types;
+	/* Live VkDeviceMemory objects, compare against maxMemoryAllocationCount */
+	uint32_t device_allocation_count = 0;
+	uint32_t max_device_allocation_count = 0;
+};
+
+struct vk_defrag_move
+{
+	vk_allocation src;
+	vk_allocation dst;
+	/* Whatever the caller passed to alloc(), used to find the resource to rebind */
+	uint64_t user_data;
+};
+
+/*
+ * Reserves large VkDeviceMemory blocks per memory type and sub-allocates
+ * them with a tlsf_heap. Requests larger than half a block get their own
+ * dedicated allocation. Host visible blocks stay persistently mapped.
+ */
+struct vk_memory_allocator
+{
+	static constexpr uint32_t DEDICATED_BLOCK = UINT32_MAX;
+	static constexpr VkDeviceSize DEFAULT_BLOCK_SIZE = 64ull << 20;
+
+	void init(VkPhysicalDevice physical_device, VkDevice device, VkDeviceSize block_size = DEFAULT_BLOCK_SIZE);
+	void deinit();
+
+	/* linear is true for buffers and linear images, false for optimally tiled images */
+	vk_allocation alloc(
+		const VkMemoryRequirements &reqs,
+		VkMemoryPropertyFlags props,
+		bool linear,
+		uint64_t user_data = 0);
+	void free(vk_allocation &a);
+
+	/* Allocates and binds memory for an optimally tiled image or a buffer */
+	vk_allocation alloc_image(VkImage image, VkMemoryPropertyFlags props, uint64_t user_data = 0);
+	vk_allocation alloc_buffer(VkBuffer buffer, VkMemoryPropertyFlags props, uint64_t user_data = 0);
+
+	/*
+	 * Plans up to max_bytes of moves out of the least used blocks of each
+	 * memory type. The destinations are already reserved; the caller copies
+	 * the contents, rebinds its resources and then calls end_defragment() to
+	 * release the sources and any blocks left empty.
+	 */
+	std::vector<vk_defrag_move> begin_defragment(VkDeviceSize max_bytes);
+	void end_defragment(const std::vector<vk_defrag_move> &moves);
+
+	vk_memory_stats get_stats();
+
+private:
+	struct block
+	{
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		void *mapped = nullptr;
+		std::unique_ptr<tlsf_heap> heap;
+	};
+
+	struct memory_type
+	{
+		VkMemoryPropertyFlags props = 0;
+		VkDeviceSize block_size = 0;
+		/* Released blocks keep their slot so block indices stay stable */
+		std::vector<block> blocks;
+		uint32_t dedicated_count = 0;
+		VkDeviceSize dedicated_bytes = 0;
+	};
+
+	bool try_alloc_from_blocks(uint32_t type_ix, VkDeviceSize size, VkDeviceSize alignment, uint64_t user_data, vk_allocation &out);
+	bool alloc_block(uint32_t type_ix, VkDeviceSize size, uint32_t &block_ix);
+	void release_block(uint32_t type_ix, uint32_t block_ix);
+	void free_locked(vk_allocation &a);
+	VkDeviceMemory allocate_device_memory(uint32_t type_ix, VkDeviceSize size, void **mapped);
+
+private:
+	VkDevice device = VK_NULL_HANDLE;
+	VkDeviceSize buffer_image_granularity = 1;
+	uint32_t max_device_allocation_count = 0;
+	uint32_t device_allocation_count = 0;
+	std::vector<memory_type> types;
+	std::mutex mutex;
+};
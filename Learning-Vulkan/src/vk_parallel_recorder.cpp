@@ -0,0 +1,155 @@
+#include "vk_parallel_recorder.hpp"
+
+#include "cpu_trace.hpp"
+#include "vk_host_allocator.hpp"
+
+#include <stdexcept>
+
+static VkCommandPool create_transient_pool(VkDevice device, uint32_t queue_family)
+{
+	/* No RESET_COMMAND_BUFFER_BIT, buffers are only ever recycled by resetting the whole pool */
+	VkCommandPoolCreateInfo create_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+		.pNext = nullptr,
+		.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+		.queueFamilyIndex = queue_family};
+
+	VkCommandPool pool;
+	if (vkCreateCommandPool(device, &create_info, vk_allocation_callbacks(), &pool) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create command pool");
+	}
+	return pool;
+}
+
+void vk_parallel_recorder::init(VkDevice device, uint32_t queue_family, job_system &jobs, uint32_t frames_in_flight)
+{
+	this->device = device;
+	this->jobs = &jobs;
+	this->worker_count = jobs.get_worker_count();
+
+	this->pools.resize(frames_in_flight * this->worker_count);
+	for (auto &p : this->pools) {
+		p.pool = create_transient_pool(device, queue_family);
+	}
+}
+
+void vk_parallel_recorder::deinit()
+{
+	/* Destroying a pool frees its command buffers */
+	for (auto &p : this->pools) {
+		vkDestroyCommandPool(this->device, p.pool, vk_allocation_callbacks());
+	}
+	this->pools.clear();
+	this->slices.clear();
+	this->secondaries.clear();
+	this->worker_count = 0;
+	this->jobs = nullptr;
+	this->device = VK_NULL_HANDLE;
+}
+
+void vk_parallel_recorder::record(VkCommandBuffer primary, uint32_t frame_ix, uint32_t item_count, const record_fn &fn)
+{
+	for (uint32_t i=0u; i<this->worker_count; ++i) {
+		worker_pool &p = this->pools[frame_ix * this->worker_count + i];
+		if (vkResetCommandPool(this->device, p.pool, 0) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to reset command pool");
+		}
+		p.used = 0;
+	}
+
+	uint32_t slice_count = this->worker_count;
+	this->slices.resize(slice_count);
+	for (uint32_t i=0u; i<slice_count; ++i) {
+		this->slices[i] = {
+			this,
+			&fn,
+			frame_ix,
+			(uint32_t)((uint64_t)item_count * i / slice_count),
+			(uint32_t)((uint64_t)item_count * (i + 1) / slice_count),
+			VK_NULL_HANDLE,
+			nullptr};
+	}
+
+	job_counter counter;
+	for (auto &s : this->slices) {
+		this->jobs->run(record_slice, &s, &counter);
+	}
+	{
+		CPU_ZONE("wait_for_recording");
+		this->jobs->wait(counter);
+	}
+
+	this->secondaries.clear();
+	for (auto &s : this->slices) {
+		if (s.error) {
+			std::rethrow_exception(s.error);
+		}
+		this->secondaries.push_back(s.cmd_buf);
+	}
+	vkCmdExecuteCommands(primary, (uint32_t)this->secondaries.size(), this->secondaries.data());
+}
+
+void vk_parallel_recorder::record_slice(void *data)
+{
+	CPU_ZONE("record_secondary");
+
+	slice &s = *(slice *)data;
+	try {
+		s.cmd_buf = s.recorder->next_cmd_buf(s.frame_ix);
+
+		/* Recorded outside a render pass, so there is nothing to inherit */
+		VkCommandBufferInheritanceInfo inheritance_info = {
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+			.pNext = nullptr,
+			.renderPass = VK_NULL_HANDLE,
+			.subpass = 0,
+			.framebuffer = VK_NULL_HANDLE,
+			.occlusionQueryEnable = VK_FALSE,
+			.queryFlags = 0,
+			.pipelineStatistics = 0};
+
+		VkCommandBufferBeginInfo begin_info = {
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+			.pNext = nullptr,
+			.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+			.pInheritanceInfo = &inheritance_info};
+
+		if (vkBeginCommandBuffer(s.cmd_buf, &begin_info) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to begin command buffer");
+		}
+
+		if (s.beg != s.end) {
+			(*s.fn)(s.cmd_buf, s.beg, s.end);
+		}
+
+		if (vkEndCommandBuffer(s.cmd_buf) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to end command buffer");
+		}
+	} catch (...) {
+		/* Jobs can't throw across the scheduler, record() rethrows on the calling thread */
+		s.error = std::current_exception();
+	}
+}
+
+/* Called on the worker running the slice, so only that worker ever touches its pool */
+VkCommandBuffer vk_parallel_recorder::next_cmd_buf(uint32_t frame_ix)
+{
+	worker_pool &p = this->pools[frame_ix * this->worker_count + this->jobs->get_worker_index()];
+
+	if (p.used == p.cmd_bufs.size()) {
+		VkCommandBufferAllocateInfo alloc_info = {
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+			.pNext = nullptr,
+			.commandPool = p.pool,
+			.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+			.commandBufferCount = 1};
+
+		VkCommandBuffer cmd_buf;
+		if (vkAllocateCommandBuffers(this->device, &alloc_info, &cmd_buf) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to allocate command buffer");
+		}
+		p.cmd_bufs.push_back(cmd_buf);
+	}
+
+	return p.cmd_bufs[p.used++];
+}
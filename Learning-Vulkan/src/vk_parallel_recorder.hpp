@@ -0,0 +1,67 @@
+#pragma once
+
+#include "job_system.hpp"
+
+#include <vulkan/vulkan_core.h>
+
+#include <exception>
+#include <functional>
+#include <stdint.h>
+#include <vector>
+
+/*
+ * Splits a frame's commands into jobs that each record a secondary
+ * command buffer, which the primary then executes in order. Every job
+ * system worker owns one VkCommandPool per frame in flight, so recording
+ * never touches a pool another thread uses and a frame slot is recycled
+ * with one vkResetCommandPool per worker instead of per-buffer resets.
+ */
+struct vk_parallel_recorder
+{
+	/* Records the commands for items [beg, end) into a secondary command buffer */
+	using record_fn = std::function<void(VkCommandBuffer cmd_buf, uint32_t beg, uint32_t end)>;
+
+	void init(VkDevice device, uint32_t queue_family, job_system &jobs, uint32_t frames_in_flight);
+	void deinit();
+
+	bool is_enabled() const { return this->jobs != nullptr; }
+
+	/*
+	 * Resets the frame slot's pools, records item_count items in one job per
+	 * worker and executes the secondaries into primary. Only call from worker
+	 * 0 once the frame slot's fence has signaled.
+	 */
+	void record(VkCommandBuffer primary, uint32_t frame_ix, uint32_t item_count, const record_fn &fn);
+
+private:
+	struct worker_pool
+	{
+		VkCommandPool pool = VK_NULL_HANDLE;
+		/* Secondaries are kept across resets and handed out again from the start */
+		std::vector<VkCommandBuffer> cmd_bufs;
+		uint32_t used = 0;
+	};
+
+	struct slice
+	{
+		vk_parallel_recorder *recorder;
+		const record_fn *fn;
+		uint32_t frame_ix;
+		uint32_t beg;
+		uint32_t end;
+		VkCommandBuffer cmd_buf;
+		std::exception_ptr error;
+	};
+
+	static void record_slice(void *data);
+	VkCommandBuffer next_cmd_buf(uint32_t frame_ix);
+
+private:
+	VkDevice device = VK_NULL_HANDLE;
+	job_system *jobs = nullptr;
+	uint32_t worker_count = 0;
+	/* Indexed by frame_ix * worker_count + worker index */
+	std::vector<worker_pool> pools;
+	std::vector<slice> slices;
+	std::vector<VkCommandBuffer> secondaries;
+};
@@ -0,0 +1,125 @@
+#include "vk_pipeline_cache.hpp"
+
+#include "vk_host_allocator.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+/* Layout of the VK_PIPELINE_CACHE_HEADER_VERSION_ONE header every driver puts in front of its data */
+struct pipeline_cache_header
+{
+	uint32_t header_size;
+	uint32_t header_version;
+	uint32_t vendor_id;
+	uint32_t device_id;
+	uint8_t uuid[VK_UUID_SIZE];
+};
+
+static bool is_cache_compatible(const std::vector<char> &data, const VkPhysicalDeviceProperties &props)
+{
+	pipeline_cache_header header;
+	if (data.size() < sizeof(header)) {
+		return false;
+	}
+	memcpy(&header, data.data(), sizeof(header));
+
+	return header.header_size >= sizeof(header)
+		&& header.header_size <= data.size()
+		&& header.header_version == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+		&& header.vendor_id == props.vendorID
+		&& header.device_id == props.deviceID
+		&& memcmp(header.uuid, props.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+static std::vector<char> read_file(const std::string &path)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		return {};
+	}
+	return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static bool write_file_atomic(const std::string &path, const std::vector<char> &data)
+{
+	std::string tmp_path = path + ".tmp";
+	{
+		std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+		if (!file.write(data.data(), data.size()) || !file.flush()) {
+			return false;
+		}
+	}
+
+	std::error_code ec;
+	std::filesystem::rename(tmp_path, path, ec);
+	if (ec) {
+		std::filesystem::remove(tmp_path, ec);
+		return false;
+	}
+	return true;
+}
+
+void vk_pipeline_cache::init(VkPhysicalDevice physical_device, VkDevice device, const std::string &path)
+{
+	this->device = device;
+	this->path = path;
+
+	VkPhysicalDeviceProperties props;
+	vkGetPhysicalDeviceProperties(physical_device, &props);
+
+	std::vector<char> data;
+	if (!path.empty()) {
+		data = read_file(path);
+		if (!data.empty() && !is_cache_compatible(data, props)) {
+			std::cout << "Discarding pipeline cache " << path << ", it was written by another device or driver\n";
+			data.clear();
+		}
+	}
+
+	VkPipelineCacheCreateInfo create_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+		.pNext = nullptr,
+		.flags = 0,
+		.initialDataSize = data.size(),
+		.pInitialData = data.empty() ? nullptr : data.data()};
+
+	if (vkCreatePipelineCache(device, &create_info, vk_allocation_callbacks(), &this->cache) != VK_SUCCESS) {
+		/* Some drivers reject blobs even after the header check, an empty cache still works */
+		create_info.initialDataSize = 0;
+		create_info.pInitialData = nullptr;
+		data.clear();
+		if (vkCreatePipelineCache(device, &create_info, vk_allocation_callbacks(), &this->cache) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create pipeline cache");
+		}
+	}
+
+	this->warm = !data.empty();
+}
+
+void vk_pipeline_cache::deinit()
+{
+	if (!this->path.empty()) {
+		size_t size = 0;
+		std::vector<char> data;
+		if (vkGetPipelineCacheData(this->device, this->cache, &size, nullptr) == VK_SUCCESS && size) {
+			data.resize(size);
+			if (vkGetPipelineCacheData(this->device, this->cache, &size, data.data()) == VK_SUCCESS) {
+				data.resize(size);
+				if (!write_file_atomic(this->path, data)) {
+					std::cerr << "Failed to write pipeline cache " << this->path << '\n';
+				}
+			}
+		}
+	}
+
+	vkDestroyPipelineCache(this->device, this->cache, vk_allocation_callbacks());
+	this->cache = VK_NULL_HANDLE;
+	this->device = VK_NULL_HANDLE;
+	this->warm = false;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <vulkan/vulkan_core.h>
+
+#include <string>
+
+/*
+ * VkPipelineCache persisted to disk between runs. The blob is only fed to
+ * the driver when its header matches the current device, and it is
+ * written back through a temporary file so a crash mid-write can't leave
+ * a truncated cache behind.
+ */
+struct vk_pipeline_cache
+{
+	void init(VkPhysicalDevice physical_device, VkDevice device, const std::string &path);
+	void deinit();
+
+	VkPipelineCache get() const { return this->cache; }
+
+	/* True when a valid blob from a previous run seeded the cache */
+	bool is_warm() const { return this->warm; }
+
+private:
+	VkDevice device = VK_NULL_HANDLE;
+	VkPipelineCache cache = VK_NULL_HANDLE;
+	std::string path;
+	bool warm = false;
+};
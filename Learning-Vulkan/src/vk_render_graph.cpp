@@ -0,0 +1,176 @@
+#include "vk_render_graph.hpp"
+
+#include "cpu_trace.hpp"
+#include "vk_host_allocator.hpp"
+
+#include <stdexcept>
+
+void vk_render_graph::init(VkPhysicalDevice physical_device, VkDevice device, vk_memory_allocator &allocator)
+{
+	this->device = device;
+	this->allocator = &allocator;
+
+	VkPhysicalDeviceProperties props;
+	vkGetPhysicalDeviceProperties(physical_device, &props);
+	this->granularity = props.limits.bufferImageGranularity;
+}
+
+void vk_render_graph::deinit()
+{
+	reset();
+	this->allocator = nullptr;
+	this->device = VK_NULL_HANDLE;
+}
+
+void vk_render_graph::build()
+{
+	CPU_ZONE("render_graph_build");
+
+	const uint32_t count = this->graph.get_resource_count();
+	this->images.assign(count, VK_NULL_HANDLE);
+	this->buffers.assign(count, VK_NULL_HANDLE);
+
+	this->graph.compile(this->granularity, [&](rg_resource resource, const rg_resource_info &info) {
+		VkMemoryRequirements reqs;
+		if (info.image) {
+			VkImageCreateInfo create_info = {
+				.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+				.pNext = nullptr,
+				.flags = 0,
+				.imageType = VK_IMAGE_TYPE_2D,
+				.format = info.format,
+				.extent = info.extent,
+				.mipLevels = 1,
+				.arrayLayers = 1,
+				.samples = VK_SAMPLE_COUNT_1_BIT,
+				.tiling = VK_IMAGE_TILING_OPTIMAL,
+				.usage = info.image_usage,
+				.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+				.queueFamilyIndexCount = 0,
+				.pQueueFamilyIndices = nullptr,
+				.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED};
+
+			if (vkCreateImage(this->device, &create_info, vk_allocation_callbacks(), &this->images[resource]) != VK_SUCCESS) {
+				throw std::runtime_error("Failed to create render graph image");
+			}
+			vkGetImageMemoryRequirements(this->device, this->images[resource], &reqs);
+		} else {
+			VkBufferCreateInfo create_info = {
+				.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+				.pNext = nullptr,
+				.flags = 0,
+				.size = info.size,
+				.usage = info.buffer_usage,
+				.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+				.queueFamilyIndexCount = 0,
+				.pQueueFamilyIndices = nullptr};
+
+			if (vkCreateBuffer(this->device, &create_info, vk_allocation_callbacks(), &this->buffers[resource]) != VK_SUCCESS) {
+				throw std::runtime_error("Failed to create render graph buffer");
+			}
+			vkGetBufferMemoryRequirements(this->device, this->buffers[resource], &reqs);
+		}
+		return reqs;
+	});
+
+	for (const auto &heap : this->graph.get_heaps()) {
+		VkMemoryRequirements reqs = {
+			.size = heap.size,
+			.alignment = heap.alignment,
+			.memoryTypeBits = heap.memory_type_bits};
+		this->heap_memory.push_back(this->allocator->alloc(reqs, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false));
+	}
+
+	for (rg_resource r=0u; r<count; ++r) {
+		const rg_resource_info &info = this->graph.get_resource(r);
+		if (info.imported || !this->graph.is_live(r)) {
+			continue;
+		}
+
+		const rg_placement &p = this->graph.get_placement(r);
+		const vk_allocation &heap = this->heap_memory[p.heap];
+		VkResult result = info.image
+			? vkBindImageMemory(this->device, this->images[r], heap.memory, heap.offset + p.offset)
+			: vkBindBufferMemory(this->device, this->buffers[r], heap.memory, heap.offset + p.offset);
+		if (result != VK_SUCCESS) {
+			throw std::runtime_error("Failed to bind render graph memory");
+		}
+	}
+}
+
+void vk_render_graph::reset()
+{
+	for (rg_resource r=0u; r<this->images.size(); ++r) {
+		if (this->graph.get_resource(r).imported) {
+			continue;
+		}
+		if (this->images[r]) {
+			vkDestroyImage(this->device, this->images[r], vk_allocation_callbacks());
+		}
+		if (this->buffers[r]) {
+			vkDestroyBuffer(this->device, this->buffers[r], vk_allocation_callbacks());
+		}
+	}
+	for (auto &memory : this->heap_memory) {
+		this->allocator->free(memory);
+	}
+	this->heap_memory.clear();
+	this->images.clear();
+	this->buffers.clear();
+	this->graph.clear();
+}
+
+void vk_render_graph::execute(VkCommandBuffer cmd_buf, uint32_t frame_ix)
+{
+	CPU_ZONE("render_graph_execute");
+
+	this->graph.for_each_pass([&](const rg_barrier_batch &batch, const render_graph::execute_fn *fn) {
+		record_barriers(cmd_buf, batch);
+		if (fn) {
+			(*fn)(cmd_buf, frame_ix);
+		}
+	});
+}
+
+void vk_render_graph::record_barriers(VkCommandBuffer cmd_buf, const rg_barrier_batch &batch)
+{
+	if (batch.empty()) {
+		return;
+	}
+
+	this->image_barriers.clear();
+	for (const auto &ib : batch.images) {
+		this->image_barriers.push_back({
+			.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+			.pNext = nullptr,
+			.srcAccessMask = ib.src_access,
+			.dstAccessMask = ib.dst_access,
+			.oldLayout = ib.old_layout,
+			.newLayout = ib.new_layout,
+			.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.image = this->images[ib.resource],
+			.subresourceRange = {
+				.aspectMask = this->graph.get_resource(ib.resource).aspect,
+				.baseMipLevel = 0,
+				.levelCount = VK_REMAINING_MIP_LEVELS,
+				.baseArrayLayer = 0,
+				.layerCount = VK_REMAINING_ARRAY_LAYERS}});
+	}
+
+	VkMemoryBarrier memory_barrier = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = batch.src_access,
+		.dstAccessMask = batch.dst_access};
+	const bool has_memory_barrier = batch.src_access || batch.dst_access;
+
+	vkCmdPipelineBarrier(
+		cmd_buf,
+		batch.src_stages,
+		batch.dst_stages,
+		0,
+		has_memory_barrier ? 1u : 0u, &memory_barrier,
+		0, nullptr,
+		(uint32_t)this->image_barriers.size(), this->image_barriers.data());
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "render_graph.hpp"
+#include "vk_memory.hpp"
+
+#include <vulkan/vulkan_core.h>
+
+#include <vector>
+
+/*
+ * Runs a compiled render_graph on a device. build() creates the transient
+ * images and buffers, binds them into one allocation per aliasing heap and
+ * execute() records each live pass behind its barrier batch. Imported
+ * resources are bound per frame since the swapchain image changes.
+ */
+struct vk_render_graph
+{
+	void init(VkPhysicalDevice physical_device, VkDevice device, vk_memory_allocator &allocator);
+	void deinit();
+
+	/* Declare passes and resources here, then build() */
+	render_graph &get_graph() { return this->graph; }
+
+	void build();
+	/* Destroys the transients and clears the graph for a rebuild, the GPU must be done with them */
+	void reset();
+
+	void bind_image(rg_resource resource, VkImage image) { this->images[resource] = image; }
+	void bind_buffer(rg_resource resource, VkBuffer buffer) { this->buffers[resource] = buffer; }
+	VkImage get_image(rg_resource resource) const { return this->images[resource]; }
+	VkBuffer get_buffer(rg_resource resource) const { return this->buffers[resource]; }
+
+	void execute(VkCommandBuffer cmd_buf, uint32_t frame_ix);
+
+private:
+	void record_barriers(VkCommandBuffer cmd_buf, const rg_barrier_batch &batch);
+
+private:
+	VkDevice device = VK_NULL_HANDLE;
+	vk_memory_allocator *allocator = nullptr;
+	VkDeviceSize granularity = 1;
+
+	render_graph graph;
+	/* Indexed by rg_resource, VK_NULL_HANDLE for the other kind */
+	std::vector<VkImage> images;
+	std::vector<VkBuffer> buffers;
+	std::vector<vk_allocation> heap_memory;
+	std::vector<VkImageMemoryBarrier> image_barriers;
+};
@@ -0,0 +1,22 @@
+#include "vk_shader.hpp"
+
+#include "vk_host_allocator.hpp"
+
+#include <stdexcept>
+
+VkShaderModule create_shader_module(VkDevice device, const std::vector<uint32_t> &spirv)
+{
+	VkShaderModuleCreateInfo create_info = {
+		.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+		.pNext = nullptr,
+		.flags = 0,
+		.codeSize = spirv.size() * sizeof(uint32_t),
+		.pCode = spirv.data()};
+
+	VkShaderModule module;
+	if (spirv.empty() || vkCreateShaderModule(device, &create_info, vk_allocation_callbacks(), &module) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create shader module");
+	}
+
+	return module;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <vulkan/vulkan_core.h>
+
+#include <stdint.h>
+#include <vector>
+
+/* Throws if the driver rejects the code, the caller destroys the module once its pipelines exist */
+VkShaderModule create_shader_module(VkDevice device, const std::vector<uint32_t> &spirv);
@@ -0,0 +1,119 @@
+#include "vk_timeline.hpp"
+
+#include "cpu_trace.hpp"
+#include "vk_host_allocator.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+void vk_timeline::init(VkDevice device)
+{
+	this->device = device;
+
+	VkSemaphoreTypeCreateInfo type_info = {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+		.pNext = nullptr,
+		.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+		.initialValue = 0};
+
+	VkSemaphoreCreateInfo create_info = {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+		.pNext = &type_info,
+		.flags = 0};
+
+	if (vkCreateSemaphore(device, &create_info, vk_allocation_callbacks(), &this->semaphore) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create timeline semaphore");
+	}
+	this->submitted = 0;
+	this->completed = 0;
+}
+
+void vk_timeline::deinit()
+{
+	if (this->semaphore) {
+		vkDestroySemaphore(this->device, this->semaphore, vk_allocation_callbacks());
+		this->semaphore = VK_NULL_HANDLE;
+	}
+	this->device = VK_NULL_HANDLE;
+}
+
+uint64_t vk_timeline::get_completed()
+{
+	uint64_t value = 0;
+	if (vkGetSemaphoreCounterValue(this->device, this->semaphore, &value) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to get semaphore counter value");
+	}
+	this->completed = std::max(this->completed, value);
+	return this->completed;
+}
+
+uint64_t vk_timeline::wait(uint64_t value)
+{
+	if (is_complete(value)) {
+		return 0;
+	}
+
+	CPU_ZONE("wait_for_timeline");
+
+	auto beg = std::chrono::steady_clock::now();
+	VkSemaphoreWaitInfo wait_info = {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+		.pNext = nullptr,
+		.flags = 0,
+		.semaphoreCount = 1,
+		.pSemaphores = &this->semaphore,
+		.pValues = &value};
+
+	if (vkWaitSemaphores(this->device, &wait_info, UINT64_MAX) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to wait for timeline semaphore");
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	this->completed = std::max(this->completed, value);
+	return std::max<uint64_t>(1, std::chrono::duration_cast<std::chrono::nanoseconds>(end - beg).count());
+}
+
+void vk_submit_sync::wait(VkSemaphore semaphore, VkPipelineStageFlags stages, uint64_t value)
+{
+	if (this->wait_count == MAX_SEMAPHORES) {
+		throw std::runtime_error("Too many semaphores to wait on");
+	}
+	this->wait_semaphores[this->wait_count] = semaphore;
+	this->wait_stages[this->wait_count] = stages;
+	this->wait_values[this->wait_count] = value;
+	++this->wait_count;
+	this->has_timeline |= value != 0;
+}
+
+void vk_submit_sync::signal(VkSemaphore semaphore, uint64_t value)
+{
+	if (this->signal_count == MAX_SEMAPHORES) {
+		throw std::runtime_error("Too many semaphores to signal");
+	}
+	this->signal_semaphores[this->signal_count] = semaphore;
+	this->signal_values[this->signal_count] = value;
+	++this->signal_count;
+	this->has_timeline |= value != 0;
+}
+
+void vk_submit_sync::apply(VkSubmitInfo &submit_info)
+{
+	submit_info.waitSemaphoreCount = this->wait_count;
+	submit_info.pWaitSemaphores = this->wait_semaphores;
+	submit_info.pWaitDstStageMask = this->wait_stages;
+	submit_info.signalSemaphoreCount = this->signal_count;
+	submit_info.pSignalSemaphores = this->signal_semaphores;
+
+	/* Binary semaphores in the same submit just ignore their values */
+	if (this->has_timeline) {
+		this->timeline_info = {
+			.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+			.pNext = submit_info.pNext,
+			.waitSemaphoreValueCount = this->wait_count,
+			.pWaitSemaphoreValues = this->wait_values,
+			.signalSemaphoreValueCount = this->signal_count,
+			.pSignalSemaphoreValues = this->signal_values};
+		submit_info.pNext = &this->timeline_info;
+	}
+}
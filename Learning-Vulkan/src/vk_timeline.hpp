@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vulkan/vulkan_core.h>
+
+#include <stdint.h>
+
+/*
+ * Timeline semaphore owned by one queue. Each tracked submit signals the
+ * next value, and since a queue completes in order, reaching a value means
+ * every tracked submit up to it is done. Needs Vulkan 1.2.
+ */
+struct vk_timeline
+{
+	void init(VkDevice device);
+	void deinit();
+
+	bool is_enabled() const { return this->semaphore != VK_NULL_HANDLE; }
+	VkSemaphore get_semaphore() const { return this->semaphore; }
+
+	/* Reserves the value the next submit signals */
+	uint64_t next() { return ++this->submitted; }
+	uint64_t get_submitted() const { return this->submitted; }
+
+	/* Asks the device only when the cached value isn't far enough yet */
+	uint64_t get_completed();
+	bool is_complete(uint64_t value) { return value <= this->completed || value <= get_completed(); }
+
+	/* Returns the nanoseconds spent blocked, 0 if value had already been reached */
+	uint64_t wait(uint64_t value);
+
+private:
+	VkDevice device = VK_NULL_HANDLE;
+	VkSemaphore semaphore = VK_NULL_HANDLE;
+	uint64_t submitted = 0;
+	uint64_t completed = 0;
+};
+
+/* The semaphore waits and signals of one vkQueueSubmit, binary and timeline alike */
+struct vk_submit_sync
+{
+	static constexpr uint32_t MAX_SEMAPHORES = 4;
+
+	/* value is ignored for binary semaphores */
+	void wait(VkSemaphore semaphore, VkPipelineStageFlags stages, uint64_t value = 0);
+	void signal(VkSemaphore semaphore, uint64_t value = 0);
+
+	/* Fills the semaphore fields of submit_info, which must not outlive this */
+	void apply(VkSubmitInfo &submit_info);
+
+private:
+	VkSemaphore wait_semaphores[MAX_SEMAPHORES];
+	VkPipelineStageFlags wait_stages[MAX_SEMAPHORES];
+	uint64_t wait_values[MAX_SEMAPHORES];
+	uint32_t wait_count = 0;
+	VkSemaphore signal_semaphores[MAX_SEMAPHORES];
+	uint64_t signal_values[MAX_SEMAPHORES];
+	uint32_t signal_count = 0;
+	bool has_timeline = false;
+	VkTimelineSemaphoreSubmitInfo timeline_info;
+};
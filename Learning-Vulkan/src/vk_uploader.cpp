@@ -0,0 +1,530 @@
+#include "vk_uploader.hpp"
+
+#include "cpu_trace.hpp"
+#include "vk_host_allocator.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <string.h>
+
+/* Covers every texel block size and the 4 byte copy offset rule */
+static constexpr VkDeviceSize STAGING_ALIGNMENT = 16;
+
+static uint64_t align_up(uint64_t v, uint64_t a)
+{
+	return (v + a - 1) / a * a;
+}
+
+void vk_uploader::init(
+	VkDevice device,
+	vk_memory_allocator &allocator,
+	VkQueue transfer_queue,
+	uint32_t transfer_family,
+	uint32_t graphics_family,
+	vk_timeline *timeline,
+	VkDeviceSize ring_size)
+{
+	this->device = device;
+	this->allocator = &allocator;
+	this->queue = transfer_queue;
+	this->transfer_family = transfer_family;
+	this->graphics_family = graphics_family;
+	this->timeline = timeline;
+	this->ring_size = ring_size;
+
+	VkCommandPoolCreateInfo pool_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+		.pNext = nullptr,
+		.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+		.queueFamilyIndex = transfer_family};
+
+	if (vkCreateCommandPool(device, &pool_info, vk_allocation_callbacks(), &this->cmd_pool) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create command pool");
+	}
+
+	VkBufferCreateInfo buffer_info = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.pNext = nullptr,
+		.flags = 0,
+		.size = ring_size,
+		.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+		.queueFamilyIndexCount = 0,
+		.pQueueFamilyIndices = nullptr};
+
+	if (vkCreateBuffer(device, &buffer_info, vk_allocation_callbacks(), &this->ring) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create staging buffer");
+	}
+
+	/* Coherent, so writes through the persistent mapping need no flush */
+	this->ring_memory = allocator.alloc_buffer(
+		this->ring,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+}
+
+void vk_uploader::deinit()
+{
+	if (!this->device) {
+		return;
+	}
+
+	if (this->recording) {
+		vkEndCommandBuffer(this->current.cmd_buf);
+		this->free_batches.push_back(this->current);
+		this->recording = false;
+	}
+	for (auto &b : this->in_flight) {
+		wait_batch(b);
+		this->free_batches.push_back(b);
+	}
+	this->in_flight.clear();
+
+	for (auto &b : this->free_batches) {
+		if (b.fence) {
+			vkDestroyFence(this->device, b.fence, vk_allocation_callbacks());
+		}
+	}
+	this->free_batches.clear();
+
+	vkDestroyCommandPool(this->device, this->cmd_pool, vk_allocation_callbacks());
+	vkDestroyBuffer(this->device, this->ring, vk_allocation_callbacks());
+	this->allocator->free(this->ring_memory);
+
+	this->ready_buffer_acquires.clear();
+	this->ready_image_acquires.clear();
+	this->timeline = nullptr;
+	this->cmd_pool = VK_NULL_HANDLE;
+	this->ring = VK_NULL_HANDLE;
+	this->device = VK_NULL_HANDLE;
+}
+
+void vk_uploader::upload_buffer(
+	VkBuffer dst,
+	VkDeviceSize dst_offset,
+	const void *data,
+	VkDeviceSize size,
+	VkPipelineStageFlags dst_stage,
+	VkAccessFlags dst_access)
+{
+	/* Chunks of a quarter ring keep several batches in flight for large buffers */
+	const VkDeviceSize max_chunk = std::max<VkDeviceSize>(STAGING_ALIGNMENT, this->ring_size / 4);
+	const uint8_t *src = (const uint8_t *)data;
+
+	while (size) {
+		VkDeviceSize n = std::min(size, max_chunk);
+		VkDeviceSize src_offset = stage(src, n);
+
+		batch &b = open_batch();
+		VkBufferCopy region = {
+			.srcOffset = src_offset,
+			.dstOffset = dst_offset,
+			.size = n};
+		vkCmdCopyBuffer(b.cmd_buf, this->ring, dst, 1, &region);
+
+		b.buffer_acquires.push_back({
+			.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+			.pNext = nullptr,
+			.srcAccessMask = 0,
+			.dstAccessMask = dst_access,
+			.srcQueueFamilyIndex = is_dedicated() ? this->transfer_family : VK_QUEUE_FAMILY_IGNORED,
+			.dstQueueFamilyIndex = is_dedicated() ? this->graphics_family : VK_QUEUE_FAMILY_IGNORED,
+			.buffer = dst,
+			.offset = dst_offset,
+			.size = n});
+		b.dst_stages |= dst_stage;
+		b.dst_access |= dst_access;
+
+		src += n;
+		dst_offset += n;
+		size -= n;
+		++this->stats.upload_count;
+	}
+}
+
+void vk_uploader::upload_image(
+	VkImage dst,
+	VkImageAspectFlags aspect,
+	VkExtent3D extent,
+	uint32_t mip_levels,
+	const VkDeviceSize *level_offsets,
+	const void *data,
+	VkDeviceSize size,
+	VkImageLayout final_layout,
+	VkPipelineStageFlags dst_stage,
+	VkAccessFlags dst_access)
+{
+	VkDeviceSize src_offset = stage(data, size);
+	batch &b = open_batch();
+
+	VkImageSubresourceRange range = {
+		.aspectMask = aspect,
+		.baseMipLevel = 0,
+		.levelCount = mip_levels,
+		.baseArrayLayer = 0,
+		.layerCount = 1};
+
+	VkImageMemoryBarrier to_transfer = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = 0,
+		.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+		.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.image = dst,
+		.subresourceRange = range};
+
+	vkCmdPipelineBarrier(
+		b.cmd_buf,
+		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0,
+		0, nullptr,
+		0, nullptr,
+		1, &to_transfer);
+
+	std::vector<VkBufferImageCopy> regions(mip_levels);
+	for (uint32_t i=0u; i<mip_levels; ++i) {
+		regions[i] = {
+			.bufferOffset = src_offset + level_offsets[i],
+			.bufferRowLength = 0,
+			.bufferImageHeight = 0,
+			.imageSubresource = {
+				.aspectMask = aspect,
+				.mipLevel = i,
+				.baseArrayLayer = 0,
+				.layerCount = 1},
+			.imageOffset = { 0, 0, 0 },
+			.imageExtent = {
+				std::max(1u, extent.width >> i),
+				std::max(1u, extent.height >> i),
+				std::max(1u, extent.depth >> i)}};
+	}
+	vkCmdCopyBufferToImage(
+		b.cmd_buf,
+		this->ring,
+		dst,
+		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		(uint32_t)regions.size(),
+		regions.data());
+
+	/* Release and acquire must name the same layouts, the transition happens once across both */
+	b.image_acquires.push_back({
+		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+		.pNext = nullptr,
+		.srcAccessMask = 0,
+		.dstAccessMask = dst_access,
+		.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		.newLayout = final_layout,
+		.srcQueueFamilyIndex = is_dedicated() ? this->transfer_family : VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = is_dedicated() ? this->graphics_family : VK_QUEUE_FAMILY_IGNORED,
+		.image = dst,
+		.subresourceRange = range});
+	b.dst_stages |= dst_stage;
+	b.dst_access |= dst_access;
+
+	++this->stats.upload_count;
+}
+
+uint64_t vk_uploader::flush()
+{
+	if (!this->recording) {
+		return 0;
+	}
+
+	CPU_ZONE("upload_flush");
+
+	batch &b = this->current;
+
+	/*
+	 * Release side: make the copies available and, on a dedicated family,
+	 * hand the resources over to graphics. Without an ownership transfer
+	 * the layout transition happens here and graphics only needs a
+	 * memory barrier.
+	 */
+	std::vector<VkBufferMemoryBarrier> buffer_releases = b.buffer_acquires;
+	for (auto &barrier : buffer_releases) {
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = 0;
+	}
+	std::vector<VkImageMemoryBarrier> image_releases = b.image_acquires;
+	for (auto &barrier : image_releases) {
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = 0;
+	}
+	vkCmdPipelineBarrier(
+		b.cmd_buf,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+		0,
+		0, nullptr,
+		(uint32_t)buffer_releases.size(), buffer_releases.data(),
+		(uint32_t)image_releases.size(), image_releases.data());
+
+	if (vkEndCommandBuffer(b.cmd_buf) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to end command buffer");
+	}
+
+	VkSubmitInfo submit_info = {
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.pNext = nullptr,
+		.waitSemaphoreCount = 0,
+		.pWaitSemaphores = nullptr,
+		.pWaitDstStageMask = nullptr,
+		.commandBufferCount = 1,
+		.pCommandBuffers = &b.cmd_buf,
+		.signalSemaphoreCount = 0,
+		.pSignalSemaphores = nullptr};
+
+	vk_submit_sync sync;
+	if (this->timeline) {
+		b.timeline_value = this->timeline->next();
+		sync.signal(this->timeline->get_semaphore(), b.timeline_value);
+		sync.apply(submit_info);
+	}
+
+	if (vkQueueSubmit(this->queue, 1, &submit_info, b.fence) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to submit upload batch");
+	}
+
+	/* The consuming submit waits for the value on the GPU, no need to see the batch finish first */
+	if (this->timeline) {
+		this->ready_buffer_acquires.insert(this->ready_buffer_acquires.end(), b.buffer_acquires.begin(), b.buffer_acquires.end());
+		this->ready_image_acquires.insert(this->ready_image_acquires.end(), b.image_acquires.begin(), b.image_acquires.end());
+		this->ready_stages |= b.dst_stages;
+		this->ready_access |= b.dst_access;
+		this->ready_value = b.timeline_value;
+	}
+
+	b.ring_end = this->ring_head;
+	uint64_t id = b.id;
+	this->in_flight.push_back(std::move(b));
+	this->current = {};
+	this->recording = false;
+	++this->stats.batch_count;
+
+	return id;
+}
+
+bool vk_uploader::is_complete(uint64_t batch_id)
+{
+	retire_completed();
+	return batch_id <= this->completed_id;
+}
+
+void vk_uploader::wait(uint64_t batch_id)
+{
+	for (auto &b : this->in_flight) {
+		if (b.id > batch_id) {
+			break;
+		}
+		wait_batch(b);
+	}
+	retire_completed();
+}
+
+void vk_uploader::record_acquires(VkCommandBuffer cmd_buf, vk_submit_sync &sync)
+{
+	retire_completed();
+	if (this->ready_buffer_acquires.empty() && this->ready_image_acquires.empty()) {
+		return;
+	}
+
+	VkPipelineStageFlags dst_stages = this->ready_stages;
+	if (!dst_stages) {
+		dst_stages = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+	}
+	if (is_dedicated()) {
+		/* A semaphore wait only covers the stages it names, the acquire has to chain from those */
+		VkPipelineStageFlags src_stages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+		if (this->timeline) {
+			sync.wait(this->timeline->get_semaphore(), dst_stages, this->ready_value);
+			src_stages = dst_stages;
+		}
+		vkCmdPipelineBarrier(
+			cmd_buf,
+			src_stages,
+			dst_stages,
+			0,
+			0, nullptr,
+			(uint32_t)this->ready_buffer_acquires.size(), this->ready_buffer_acquires.data(),
+			(uint32_t)this->ready_image_acquires.size(), this->ready_image_acquires.data());
+	} else {
+		/* Same queue, the copies were submitted earlier so one barrier orders every consumer after them */
+		VkMemoryBarrier barrier = {
+			.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+			.pNext = nullptr,
+			.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+			.dstAccessMask = this->ready_access};
+
+		vkCmdPipelineBarrier(
+			cmd_buf,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			dst_stages,
+			0,
+			1, &barrier,
+			0, nullptr,
+			0, nullptr);
+	}
+
+	this->ready_buffer_acquires.clear();
+	this->ready_image_acquires.clear();
+	this->ready_stages = 0;
+	this->ready_access = 0;
+}
+
+/* Returns the ring offset of size bytes of data, waiting for old batches if the ring is full */
+VkDeviceSize vk_uploader::stage(const void *data, VkDeviceSize size)
+{
+	for (;;) {
+		uint64_t pos = align_up(this->ring_head, STAGING_ALIGNMENT);
+		if (pos % this->ring_size + size > this->ring_size) {
+			/* Never straddle the end, skip to the start of the next lap */
+			pos = align_up(pos, this->ring_size);
+		}
+
+		if (pos + size - this->ring_tail <= this->ring_size) {
+			this->ring_head = pos + size;
+			if (this->recording) {
+				this->current.ring_end = this->ring_head;
+			}
+
+			VkDeviceSize offset = pos % this->ring_size;
+			memcpy((uint8_t *)this->ring_memory.mapped + offset, data, size);
+			this->stats.bytes += size;
+			return offset;
+		}
+
+		size_t in_flight_count = this->in_flight.size();
+		retire_completed();
+		if (this->in_flight.size() != in_flight_count) {
+			continue;
+		}
+
+		if (!this->in_flight.empty()) {
+			CPU_ZONE("upload_ring_wait");
+			auto beg = std::chrono::steady_clock::now();
+			wait_batch(this->in_flight.front());
+			auto end = std::chrono::steady_clock::now();
+			++this->stats.ring_wait_count;
+			this->stats.ring_wait_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(end - beg).count();
+			continue;
+		}
+
+		if (this->recording) {
+			flush();
+			continue;
+		}
+
+		/* Nothing is using the ring, restart it from the top of a fresh lap */
+		if (size > this->ring_size) {
+			throw std::runtime_error("Upload larger than the staging ring");
+		}
+		this->ring_head = this->ring_tail = align_up(this->ring_head, this->ring_size);
+	}
+}
+
+vk_uploader::batch &vk_uploader::open_batch()
+{
+	if (this->recording) {
+		return this->current;
+	}
+
+	batch b;
+	if (!this->free_batches.empty()) {
+		b = std::move(this->free_batches.back());
+		this->free_batches.pop_back();
+		b.buffer_acquires.clear();
+		b.image_acquires.clear();
+		b.dst_stages = 0;
+		b.dst_access = 0;
+		if (b.fence && vkResetFences(this->device, 1, &b.fence) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to reset fence");
+		}
+	} else {
+		VkCommandBufferAllocateInfo alloc_info = {
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+			.pNext = nullptr,
+			.commandPool = this->cmd_pool,
+			.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+			.commandBufferCount = 1};
+
+		if (vkAllocateCommandBuffers(this->device, &alloc_info, &b.cmd_buf) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to allocate command buffer");
+		}
+
+		VkFenceCreateInfo fence_info = {
+			.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+			.pNext = nullptr,
+			.flags = 0};
+
+		if (!this->timeline && vkCreateFence(this->device, &fence_info, vk_allocation_callbacks(), &b.fence) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create fence");
+		}
+	}
+
+	VkCommandBufferBeginInfo begin_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.pNext = nullptr,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+		.pInheritanceInfo = nullptr};
+
+	if (vkBeginCommandBuffer(b.cmd_buf, &begin_info) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to begin command buffer");
+	}
+
+	b.id = this->next_batch_id++;
+	b.ring_end = this->ring_head;
+	this->current = std::move(b);
+	this->recording = true;
+	return this->current;
+}
+
+bool vk_uploader::is_batch_complete(const batch &b)
+{
+	if (this->timeline) {
+		return this->timeline->is_complete(b.timeline_value);
+	}
+
+	VkResult status = vkGetFenceStatus(this->device, b.fence);
+	if (status != VK_SUCCESS && status != VK_NOT_READY) {
+		throw std::runtime_error("Failed to get fence status");
+	}
+	return status == VK_SUCCESS;
+}
+
+void vk_uploader::wait_batch(const batch &b)
+{
+	if (this->timeline) {
+		this->timeline->wait(b.timeline_value);
+	} else if (vkWaitForFences(this->device, 1, &b.fence, VK_TRUE, UINT64_MAX) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to wait for fence");
+	}
+}
+
+/* Batches finish in submission order on the one queue, so only the front needs polling */
+void vk_uploader::retire_completed()
+{
+	while (!this->in_flight.empty()) {
+		batch &b = this->in_flight.front();
+		if (!is_batch_complete(b)) {
+			break;
+		}
+
+		this->ring_tail = b.ring_end;
+		this->completed_id = b.id;
+
+		/* Without a timeline the consumer can't wait on the GPU, so its acquires wait for the batch */
+		if (!this->timeline) {
+			this->ready_buffer_acquires.insert(this->ready_buffer_acquires.end(), b.buffer_acquires.begin(), b.buffer_acquires.end());
+			this->ready_image_acquires.insert(this->ready_image_acquires.end(), b.image_acquires.begin(), b.image_acquires.end());
+			this->ready_stages |= b.dst_stages;
+			this->ready_access |= b.dst_access;
+		}
+
+		this->free_batches.push_back(std::move(b));
+		this->in_flight.pop_front();
+	}
+}
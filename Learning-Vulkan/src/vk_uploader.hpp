@@ -0,0 +1,149 @@
+#pragma once
+
+#include "vk_memory.hpp"
+#include "vk_timeline.hpp"
+
+#include <vulkan/vulkan_core.h>
+
+#include <deque>
+#include <stdint.h>
+#include <vector>
+
+struct vk_upload_stats
+{
+	uint64_t bytes = 0;
+	uint64_t upload_count = 0;
+	uint64_t batch_count = 0;
+	/* Times the staging ring was full and the CPU waited for the transfer queue */
+	uint64_t ring_wait_count = 0;
+	uint64_t ring_wait_ns = 0;
+};
+
+/*
+ * Streams buffer and image data to the GPU through a persistently mapped
+ * staging ring. Uploads are batched into one command buffer that flush()
+ * submits to the transfer queue with a fence, so the graphics queue never
+ * waits on them. The transfer queue is a dedicated transfer-only family
+ * when the device has one, in which case every upload is released to the
+ * graphics family and acquired again by record_acquires() once its batch
+ * has completed. With a timeline the batches signal the transfer queue's
+ * values instead of fences, and acquires are recorded right away behind a
+ * GPU side wait on the value, so consumers don't lag a frame behind.
+ */
+struct vk_uploader
+{
+	static constexpr VkDeviceSize DEFAULT_RING_SIZE = 32ull << 20;
+
+	void init(
+		VkDevice device,
+		vk_memory_allocator &allocator,
+		VkQueue transfer_queue,
+		uint32_t transfer_family,
+		uint32_t graphics_family,
+		vk_timeline *timeline = nullptr,
+		VkDeviceSize ring_size = DEFAULT_RING_SIZE);
+	void deinit();
+
+	/* True when uploads run on their own queue family and need ownership transfers */
+	bool is_dedicated() const { return this->transfer_family != this->graphics_family; }
+
+	/* upload_image() stages the whole chain at once, so it must fit */
+	VkDeviceSize get_ring_size() const { return this->ring_size; }
+
+	/* Buffers larger than the ring are split over several batches */
+	void upload_buffer(
+		VkBuffer dst,
+		VkDeviceSize dst_offset,
+		const void *data,
+		VkDeviceSize size,
+		VkPipelineStageFlags dst_stage,
+		VkAccessFlags dst_access);
+
+	/*
+	 * data holds all mip levels back to back, level i starting at
+	 * level_offsets[i], each offset a multiple of the texel block size.
+	 * The image goes from UNDEFINED to final_layout.
+	 */
+	void upload_image(
+		VkImage dst,
+		VkImageAspectFlags aspect,
+		VkExtent3D extent,
+		uint32_t mip_levels,
+		const VkDeviceSize *level_offsets,
+		const void *data,
+		VkDeviceSize size,
+		VkImageLayout final_layout,
+		VkPipelineStageFlags dst_stage,
+		VkAccessFlags dst_access);
+
+	/* Submits the uploads recorded so far, returns the batch id to poll or 0 if there was nothing to submit */
+	uint64_t flush();
+
+	/* Non-blocking, retires finished batches and frees their part of the ring */
+	bool is_complete(uint64_t batch_id);
+	void wait(uint64_t batch_id);
+
+	/*
+	 * Records the graphics side barriers of every upload that is ready, call
+	 * at the start of a frame. Adds the transfer timeline wait those barriers
+	 * depend on to the sync of the submit cmd_buf goes into.
+	 */
+	void record_acquires(VkCommandBuffer cmd_buf, vk_submit_sync &sync);
+
+	const vk_upload_stats &get_stats() const { return this->stats; }
+
+private:
+	struct batch
+	{
+		uint64_t id = 0;
+		VkCommandBuffer cmd_buf = VK_NULL_HANDLE;
+		/* One or the other, depending on whether there is a timeline */
+		VkFence fence = VK_NULL_HANDLE;
+		uint64_t timeline_value = 0;
+		/* Ring position just past this batch's data */
+		uint64_t ring_end = 0;
+		std::vector<VkBufferMemoryBarrier> buffer_acquires;
+		std::vector<VkImageMemoryBarrier> image_acquires;
+		VkPipelineStageFlags dst_stages = 0;
+		VkAccessFlags dst_access = 0;
+	};
+
+	VkDeviceSize stage(const void *data, VkDeviceSize size);
+	batch &open_batch();
+	bool is_batch_complete(const batch &b);
+	void wait_batch(const batch &b);
+	void retire_completed();
+
+private:
+	VkDevice device = VK_NULL_HANDLE;
+	vk_memory_allocator *allocator = nullptr;
+	VkQueue queue = VK_NULL_HANDLE;
+	uint32_t transfer_family = 0;
+	uint32_t graphics_family = 0;
+	VkCommandPool cmd_pool = VK_NULL_HANDLE;
+	vk_timeline *timeline = nullptr;
+
+	VkBuffer ring = VK_NULL_HANDLE;
+	vk_allocation ring_memory;
+	VkDeviceSize ring_size = 0;
+	/* Monotonic byte positions, the ring offset is position % ring_size */
+	uint64_t ring_head = 0;
+	uint64_t ring_tail = 0;
+
+	bool recording = false;
+	batch current;
+	std::deque<batch> in_flight;
+	std::vector<batch> free_batches;
+	uint64_t next_batch_id = 1;
+	uint64_t completed_id = 0;
+
+	/* Barriers of completed batches not yet recorded on the graphics queue */
+	std::vector<VkBufferMemoryBarrier> ready_buffer_acquires;
+	std::vector<VkImageMemoryBarrier> ready_image_acquires;
+	VkPipelineStageFlags ready_stages = 0;
+	VkAccessFlags ready_access = 0;
+	/* Transfer timeline value the ready barriers wait for */
+	uint64_t ready_value = 0;
+
+	vk_upload_stats stats;
+};